@@ -0,0 +1,67 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include "MeshObject.h"
+#include "Headless.h"
+
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>  // glm::vec2
+#include <glm/vec3.hpp> // glm::vec3
+
+// Command line of the bench executable. The scene only depends on Objects
+// and Seed, so two runs with the same options draw the same frames.
+struct BenchOptions{
+    int Objects;
+    unsigned int Seed;
+    int Frames;             // measured frames
+    int Warmup;             // frames rendered before measuring
+    int Width, Height;
+    float Orbit;            // distance of the camera to the scene center
+    std::string DataDir;    // folder of cube.off, bumpy_cube.off and bunny.off
+    std::string OutputPath; // results as JSON, not written if empty
+    std::string Label;      // stored with the results, e.g. the commit
+    std::string TracePath;  // profiler trace, see Profiler.h
+    bool Lod;               // draw the levels of detail, on by default
+    bool OptimizeMeshes;    // reorder the meshes for the vertex cache, on by default
+    bool BakeAo;            // bake the ambient occlusion of the meshes, on by default
+    bool FeatureEdges;      // draw only the feature edges of the wireframes
+    bool Meshlets;          // cull the meshlets of the full meshes, on by default
+    bool Occlusion;         // cull the objects hidden by others on the CPU, on by default
+    bool Queries;           // GPU occlusion queries on the expensive objects, off by default
+    std::string Renderer;   // "gl", or "cpu" for the software renderer
+    bool Bvh;               // only time the hierarchy builds, see run_bvh_bench()
+    std::string ScenePath;  // only time saving and opening the scene there, see run_scene_bench()
+    double Autosave;        // seconds between autosaves during the frames, 0 (off) by default
+
+    BenchOptions();
+};
+
+// Read the options, false (with a message) on a bad command line
+bool parse_bench_options(int argc, char* argv[], BenchOptions& options);
+
+// Append the seeded objects: cubes, bumpy cubes and bunnies with random
+// transformations and rendering modes, spread over [-2,2] x [-0.5,0.5] x [-2,2]
+void generate_bench_scene(std::vector<MeshObject>& objects, const BenchOptions& options);
+
+// Camera position of a measured frame: one orbit of the given radius around the scene
+glm::vec3 bench_camera(int frame, int frames, float radius);
+
+// Value below which a fraction p of the values lie (nearest rank)
+double percentile(std::vector<double> values, double p);
+
+// Print the summary and write the JSON results if OutputPath is set
+bool write_bench_results(const BenchOptions& options, const std::vector<FrameTiming>& timings, const std::string& renderer);
+
+// Time the hierarchy build over all the triangles of the scene with 1, 2,
+// 4, ... threads up to the hardware ones, then the scene hierarchy build
+// and its refit after moving every object. Prints them and writes the JSON
+// results if OutputPath is set, without opening a window.
+bool run_bvh_bench(const BenchOptions& options);
+
+// Time saving the scene to ScenePath and opening it again (see
+// SceneFile.h), checking that every object comes back unchanged. Prints
+// them and writes the JSON results if OutputPath is set.
+bool run_scene_bench(const BenchOptions& options);
+
+#endif
@@ -0,0 +1,107 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include "ThreadPool.h"
+
+#include <vector>
+#include <glm/glm.hpp>  // glm::vec2
+#include <glm/vec3.hpp> // glm::vec3
+#include <glm/mat4x4.hpp> // glm::mat4
+
+// A node of a bounding volume hierarchy, 32 bytes. A leaf (Count > 0)
+// holds the Count primitives from First, an inner node (Count == 0) its
+// two children at First and First + 1.
+struct BvhNode{
+    glm::vec3 Min;
+    unsigned int First;
+    glm::vec3 Max;
+    unsigned int Count;
+};
+
+// Most primitives in a leaf of a mesh hierarchy
+const int BVH_LEAF_SIZE = 4;
+
+// Split candidates per axis of the binned SAH builder
+const int BVH_BINS = 16;
+
+// Surface area heuristic: a node costs the traversal step plus the
+// intersections of its primitives, weighted by the chance that a ray
+// through its parent enters it
+const float BVH_TRAVERSAL_COST = 1.0f;
+const float BVH_INTERSECTION_COST = 1.0f;
+
+// Nodes with more primitives are binned by all the threads, smaller ones
+// are built as whole subtrees, one per thread
+const unsigned int BVH_PARALLEL_PRIMITIVES = 4096;
+
+// The hierarchy over a set of boxes: Nodes[0] is the root and Order the
+// box of each leaf entry. Every node is split where the SAH cost over
+// BVH_BINS bins of the box centers is lowest, unless a leaf costs less.
+// The result does not depend on the number of threads.
+void build_bvh(const std::vector<glm::vec3>& mins, const std::vector<glm::vec3>& maxs, unsigned int leaf_size,
+               std::vector<BvhNode>& nodes, std::vector<unsigned int>& order, ThreadPool* pool);
+
+// SAH cost of a hierarchy, relative to the area of its root
+float bvh_cost(const std::vector<BvhNode>& nodes);
+
+// Bottom level hierarchy of a mesh, over its triangles in object space.
+// The triangles are stored again in leaf order as one vertex and two
+// edges, the data of the ray-triangle test.
+class MeshBvh{
+    public:
+        std::vector<BvhNode> Nodes; // root first
+        std::vector<unsigned int> Triangles; // face of F of each leaf entry
+        std::vector<glm::vec3> Vertex0, Edge1, Edge2;
+
+        // The hierarchy over the faces, then their triangles
+        void build(const std::vector<glm::vec3>& positions, const std::vector<unsigned int>& faces, ThreadPool* pool);
+
+        // Only the triangles, for Nodes and Triangles read from a file
+        void init_triangles(const std::vector<glm::vec3>& positions, const std::vector<unsigned int>& faces);
+
+        // False if the nodes and triangles do not describe a hierarchy over that many faces
+        bool valid(unsigned int faces) const;
+
+        bool empty() const { return Nodes.empty(); }
+};
+
+// A mesh placed in the scene
+struct BvhInstance{
+    const MeshBvh* Bvh;
+    glm::mat4 ObjectToWorld;
+    glm::mat4 WorldToObject;
+    glm::vec3 Min, Max; // world bounds
+    unsigned int Object; // index in the object list
+    bool CastsShadows;
+};
+
+// The top level hierarchy is rebuilt when refitting made its SAH cost
+// this much worse than right after the last build
+const float TLAS_REBUILD_COST = 1.5f;
+
+// Top level hierarchy, over the instances. Moving instances only refits
+// the boxes on the way from their leaves to the root.
+class SceneBvh{
+    public:
+        std::vector<BvhInstance> Instances;
+        std::vector<BvhNode> Nodes;
+        std::vector<unsigned int> Order;   // instance of each leaf entry
+        std::vector<unsigned int> Parents; // of each node, the root is its own
+        std::vector<unsigned int> Leaves;  // leaf of each instance
+        std::vector<unsigned int> Moved;   // instances moved since the last refit
+        float BuiltCost;                   // bvh_cost() after the last build
+        unsigned int Builds, Refits;
+
+        SceneBvh();
+
+        // The bounds of the instances, then the hierarchy over them
+        void build();
+
+        // Place an instance elsewhere, the hierarchy follows at refit()
+        void move(unsigned int instance, const glm::mat4& object_to_world);
+
+        // The boxes above the moved instances, or a new hierarchy past TLAS_REBUILD_COST
+        void refit();
+};
+
+#endif
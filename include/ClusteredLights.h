@@ -0,0 +1,79 @@
+#ifndef CLUSTEREDLIGHTS_H
+#define CLUSTEREDLIGHTS_H
+
+#include "Helpers.h"
+
+#include <vector>
+#include <glm/glm.hpp>  // glm::vec2
+#include <glm/vec3.hpp> // glm::vec3
+#include <glm/vec4.hpp> // glm::vec4
+#include <glm/mat4x4.hpp> // glm::mat4
+
+// A point light. Its contribution fades to zero at Radius; a Radius of 0
+// means the light reaches everything, without attenuation.
+struct PointLight{
+    glm::vec3 Position;
+    glm::vec3 Color;
+    float Radius;
+};
+
+// Number of RGBA32F texels per light in the light buffer:
+// position and radius (1), color (1)
+const int LIGHT_RECORD_SIZE = 2;
+
+// Texture units of the three buffers, starting at the unit given to upload()
+enum LightBufferUnit{
+    LIGHT_DATA_UNIT = 0,     // "lights": the light records
+    LIGHT_CLUSTER_UNIT = 1,  // "light_clusters": first index and count per cluster
+    LIGHT_INDEX_UNIT = 2     // "light_indices": light ids, cluster after cluster
+};
+
+
+// Per-cluster light lists for clustered forward shading.
+//
+// The view frustum is cut into GridX x GridY screen tiles and GridZ depth
+// slices, exponentially spaced between Near and Far so that the clusters
+// stay roughly cubic. Every frame, each light is added to the clusters its
+// bounding sphere overlaps; a fragment only loops over the lights of its
+// own cluster.
+class LightClusters{
+    public:
+        int GridX, GridY, GridZ;
+        float Near, Far;
+
+        std::vector<glm::vec4> Records; // LIGHT_RECORD_SIZE texels per light
+        std::vector<GLint> Clusters;    // first index and count per cluster
+        std::vector<GLint> Indices;     // light ids of the clusters
+        TextureBufferObject LightData;
+        TextureBufferObject ClusterData;
+        TextureBufferObject IndexData;
+
+        // Statistics of the last build
+        int MaxLightsPerCluster;
+
+        LightClusters();
+
+        void init();
+
+        // Assign the lights to the clusters of the given camera
+        void build(const std::vector<PointLight>& lights, const glm::mat4& view, const glm::mat4& projection);
+
+        // Upload the three buffers to the texture units starting at "unit"
+        void upload(GLuint unit);
+
+        // Depth slice of a view-space distance, the shaders use the same
+        // slice = log(depth) * slice_scale() + slice_bias()
+        int slice(float depth) const;
+        float slice_scale() const;
+        float slice_bias() const;
+
+        void free();
+};
+
+// Append "count" lights with random positions in [lower, upper], random
+// hues and radii in [min_radius, max_radius]. The same seed always gives
+// the same lights.
+void add_random_lights(std::vector<PointLight>& lights, int count, unsigned int seed,
+                       const glm::vec3& lower, const glm::vec3& upper, float min_radius, float max_radius);
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef FILEWATCHER_H
+#define FILEWATCHER_H
+
+#include <string>
+#include <vector>
+#include <ctime>
+
+// Reports when one of a few files has been rewritten. On Linux the parent
+// directories are watched with inotify, which also catches editors that
+// save by renaming a temporary file over the original; elsewhere the
+// modification times are compared on every poll.
+class FileWatcher{
+    public:
+        std::vector<std::string> Paths;
+#ifdef __linux__
+        int Fd;
+        std::vector<int> Watches;     // inotify watch of the directory of each path
+        std::vector<std::string> Names; // file name of each path inside its directory
+#else
+        std::vector<time_t> Times;
+#endif
+
+        FileWatcher();
+
+        // Start watching a file, false if it cannot be watched
+        bool add(const std::string& path);
+
+        // True if a watched file changed since the last poll, never blocks
+        bool poll();
+
+        void free();
+};
+
+#endif
@@ -0,0 +1,85 @@
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+#include "Helpers.h"
+
+#include <string>
+#include <vector>
+#include <ostream>
+
+// Command line of the --headless mode
+struct HeadlessOptions{
+    bool Enabled;
+    int Width, Height;
+    int Frames;              // -1: from the script, 1 without one
+    std::string ScriptPath;  // scene and camera path, see SceneScript.h
+    std::string OutputDir;   // frames are written there if not empty
+    std::string ImageFormat; // "ppm" or "png"
+    std::string TimingsPath; // per-frame timings as JSON if not empty
+    std::string TracePath;   // profiler trace, also without --headless (see Profiler.h)
+    bool OptimizeMeshes;     // reorder the loaded meshes, also without --headless (see MeshOptimize.h)
+    bool BakeAo;             // bake the ambient occlusion of the loaded meshes, also without --headless
+    std::string ScenePath;   // binary scene opened at start, saved with F5 and opened with F9 (see SceneFile.h)
+    double AutosaveInterval; // seconds between autosaves (see SceneAutosave.h), 0: off, < 0: 60 with a window, off without
+    std::string Renderer;    // "gl", or "cpu" for the software renderer without any GL context (see SoftwareRenderer.h),
+                             // or "raytrace" for the ray tracer (see RayTracer.h)
+    int Samples;             // rays per pixel of the ray tracer
+    int AoRays;              // ambient occlusion rays per sample of the ray tracer
+
+    HeadlessOptions();
+};
+
+// Read the options, false (with a message) on a bad command line
+bool parse_headless_options(int argc, char* argv[], HeadlessOptions& options);
+
+
+// An OpenGL context without any window, rendering into a framebuffer
+// object. It uses EGL on the Mesa surfaceless platform (llvmpipe on
+// machines without a GPU) and is only built when EGL is found.
+class HeadlessContext{
+    public:
+        void* Display;
+        void* Context;
+        GLuint Framebuffer;
+        GLuint ColorBuffer;
+        GLuint DepthStencilBuffer;
+        int Width, Height;
+
+        HeadlessContext();
+
+        // Create the context and make it current, false if it cannot be done
+        bool init(int width, int height);
+
+        // Create the framebuffer, after glewInit
+        void init_framebuffer();
+
+        // Read back the color buffer, RGB rows from top to bottom
+        void read_pixels(std::vector<unsigned char>& pixels);
+
+        void free();
+};
+
+
+// Time spent on one frame and the work it submitted. CpuMs is the
+// submission, FrameMs runs until the GPU is done. GpuMs is negative when
+// timer queries are missing.
+struct FrameTiming{
+    int Frame;
+    double CpuMs;
+    double GpuMs;
+    double FrameMs;
+    RenderStats Work;
+};
+
+bool write_ppm(const std::string& path, int width, int height, const std::vector<unsigned char>& pixels);
+
+// Uncompressed (stored deflate) RGB PNG, no dependency needed
+bool write_png(const std::string& path, int width, int height, const std::vector<unsigned char>& pixels);
+
+// The "frames" array of the timings, one object per line
+void write_frame_timings(std::ostream& out, const std::vector<FrameTiming>& timings, const std::string& indent);
+
+bool write_timings_json(const std::string& path, const std::vector<FrameTiming>& timings,
+                        int width, int height, const std::string& renderer);
+
+#endif
@@ -38,10 +38,58 @@ void _check_gl_error(const char *file, int line);
 /// [... some opengl calls]
 /// glCheckError();
 ///
+/// glGetError can synchronize with the driver, so the checks only exist in
+/// builds with DEBUG_GL (Debug builds, or the DEBUG_GL CMake option)
+///
+#ifdef DEBUG_GL
 #define check_gl_error() _check_gl_error(__FILE__,__LINE__)
+#else
+#define check_gl_error() ((void)0)
+#endif
+
+// Print the KHR_debug messages of the current context to std::cerr, as
+// they are raised. False if the context cannot report them.
+bool enable_gl_debug_output();
 
+// Name an OpenGL object after its role and the source line creating it,
+// for the debug messages and GL debuggers. The object must have been bound
+// once. Without DEBUG_GL the label_gl macro does nothing.
+void label_gl_object(GLenum type, GLuint id, const std::string &name, const char *file, int line);
+
+#ifdef DEBUG_GL
+#define label_gl(type,id,name) label_gl_object(type,id,name,__FILE__,__LINE__)
+#else
+#define label_gl(type,id,name) ((void)0)
 #endif
 
+// Work handed to OpenGL since the last reset_render_stats(). The buffer
+// wrappers count the bytes they upload, the IndirectDrawer its draws.
+struct RenderStats
+{
+  unsigned long long DrawCalls;
+  unsigned long long Triangles; // triangles of GL_TRIANGLES draws, instances included
+  unsigned long long Lines;     // segments of GL_LINES draws, instances included
+  unsigned long long BytesUploaded;
+};
+
+RenderStats& render_stats();
+
+void reset_render_stats();
+
+// Attribute locations bound by every Program before linking,
+// so that a configured VAO can be drawn with any of them
+enum VertexAttribute
+{
+  ATTRIB_POSITION = 0,
+  ATTRIB_COLOR = 1,
+  ATTRIB_NORMAL = 2,
+  ATTRIB_OBJECT_ID = 3,
+  ATTRIB_EDGE_FACE_A = 4,
+  ATTRIB_EDGE_FACE_B = 5,
+  ATTRIB_EDGE_CENTER = 6,
+  ATTRIB_OCCLUSION = 7
+};
+
 class VertexArrayObject
 {
 public:
@@ -59,6 +107,15 @@ public:
     void free();
 };
 
+class VertexBufferObject;
+
+// Read a VBO as the float attribute at a fixed location of the bound VAO
+void bindVertexAttribArray(GLuint location, VertexBufferObject& VBO);
+
+// Read a VBO as the integer attribute at a fixed location of the bound VAO,
+// advanced once every "divisor" instances (0: per vertex)
+void bindVertexAttribIArray(GLuint location, VertexBufferObject& VBO, GLuint divisor);
+
 class VertexBufferObject
 {
 public:
@@ -82,11 +139,18 @@ public:
       assert(!array.empty()); 
       glBindBuffer(GL_ARRAY_BUFFER, id);
       glBufferData(GL_ARRAY_BUFFER, sizeof(T) * array.size(), array.data(), GL_DYNAMIC_DRAW);
+      render_stats().BytesUploaded += sizeof(T) * array.size();
       cols = array.size();
       rows = array[0].length();
       check_gl_error();
     };
 
+    // Updates the VBO with one integer per vertex (or per instance)
+    void update(const std::vector<GLint>& array);
+
+    // Updates the VBO with one float per vertex
+    void update(const std::vector<float>& array);
+
     // Select this VBO for subsequent draw calls
     void bind();
 
@@ -95,6 +159,56 @@ public:
 };
 
 
+class IndexBufferObject
+{
+public:
+    typedef unsigned int GLuint;
+
+    GLuint id;
+    GLuint count;
+
+    IndexBufferObject() : id(0), count(0) {}
+
+    // Create a new empty index buffer
+    void init();
+
+    // Updates the index buffer
+    void update(const std::vector<GLuint>& array);
+
+    // Select this index buffer for the bound VAO
+    void bind();
+
+    // Release the id
+    void free();
+};
+
+class TextureBufferObject
+{
+public:
+    typedef unsigned int GLuint;
+
+    GLuint id;
+    GLuint texture;
+
+    TextureBufferObject() : id(0), texture(0) {}
+
+    // Create a new empty buffer and the buffer texture viewing it
+    void init(GLenum format = GL_RGBA32F);
+
+    // Updates the buffer, one texel per vec4
+    void update(const std::vector<glm::vec4>& array);
+
+    // Updates the buffer, one texel per int (GL_R32I)
+    void update(const std::vector<GLint>& array);
+
+    // Select the buffer texture on the given texture unit
+    void bind(GLuint unit);
+
+    // Release the ids
+    void free();
+};
+
+
 // This class wraps an OpenGL program composed of two shaders
 class Program
 {
@@ -130,4 +244,17 @@ public:
 
   GLuint create_shader_helper(GLint type, const std::string &shader_string);
 
+  // Replace program_shader by the binary stored in the cache file (false if rejected)
+  bool load_binary(const std::string &path);
+
+  // Store the binary of the linked program_shader in the cache file
+  void save_binary(const std::string &path) const;
+
 };
+
+// Directory where Program::init caches linked program binaries, keyed by
+// a hash of the sources and of the GL vendor/renderer/version.
+// Empty (the default) disables the cache.
+void set_program_cache_dir(const std::string &dir);
+
+#endif
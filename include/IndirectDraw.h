@@ -0,0 +1,101 @@
+#ifndef INDIRECTDRAW_H
+#define INDIRECTDRAW_H
+
+#include "Helpers.h"
+
+#include <vector>
+#include <glm/glm.hpp>  // glm::vec2
+#include <glm/vec4.hpp> // glm::vec4
+#include <glm/mat4x4.hpp> // glm::mat4
+
+// Number of RGBA32F texels per object in the object data buffer:
+// model matrix (4), normal matrix (3), object color (1)
+const int OBJECT_RECORD_SIZE = 8;
+
+// Layout mandated by glMultiDrawElementsIndirect
+struct DrawElementsIndirectCommand{
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLint baseVertex;
+    GLuint baseInstance;
+};
+
+// Appends the record of one object to the object data array.
+// color is what the unlit shader variant draws the object in.
+void pack_object_record(std::vector<glm::vec4>& records, const glm::mat4& model, const glm::vec4& color);
+
+
+// One object to draw, with the indices [First, First+Count) of the bound element buffer
+struct DrawItem{
+    unsigned int First;
+    unsigned int Count;
+    unsigned int Object;
+};
+
+// A list of draws sharing the same primitive, render state and VAO
+class DrawBatch{
+    public:
+        GLenum Primitive;
+        std::vector<DrawItem> Items;
+        unsigned int Offset;       // first command in the indirect buffer
+        unsigned int CommandCount; // items merged into instanced commands
+
+        DrawBatch(GLenum primitive = GL_TRIANGLES);
+
+        void clear();
+
+        void add(unsigned int first, unsigned int count, unsigned int object);
+};
+
+
+// Submits batches with one glMultiDrawElementsIndirect each when the context
+// supports it, and falls back to one glDrawElementsInstanced per command.
+//
+// Every draw reads its object index from a per-frame list of draw slots:
+// the first slots are the objects themselves (for single draws), then the
+// items of the appended batches in order. Consecutive items of a batch with
+// the same index range become one command with several instances. Shaders
+// find the slot of an instance as
+//   - object_id, an instanced array over DrawIdBuffer starting at
+//     baseInstance, on the indirect path;
+//   - draw_base + gl_InstanceID into the DrawIdTexture buffer texture,
+//     with the INSTANCED shader variants on the fallback path.
+class IndirectDrawer{
+    public:
+        bool MultiDraw;
+        GLint DrawBaseLocation; // "draw_base" uniform of the bound INSTANCED program
+        GLuint Buffer;
+        std::vector<DrawElementsIndirectCommand> Commands;
+        std::vector<GLint> DrawIds;
+        VertexBufferObject DrawIdBuffer;
+        TextureBufferObject DrawIdTexture;
+
+        IndirectDrawer();
+
+        void init();
+
+        // Start a frame with one slot for each of the first "objects" objects
+        void begin(unsigned int objects);
+
+        // Allocate the slots and commands of the batch
+        void append(DrawBatch& batch);
+
+        // Upload the commands and the draw slots, the texture goes to "unit"
+        void upload(GLuint unit);
+
+        void draw(const DrawBatch& batch);
+
+        // Single indexed draw of an object outside of any batch
+        void draw_object(GLenum primitive, unsigned int first, unsigned int count, unsigned int object);
+
+        // Single non-indexed draw of an object outside of any batch
+        void draw_arrays_object(GLenum primitive, unsigned int first, unsigned int count, unsigned int object);
+
+        void free();
+};
+
+// True if glMultiDrawElementsIndirect with a non-zero baseInstance can be used
+bool multi_draw_indirect_supported();
+
+#endif
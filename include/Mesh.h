@@ -0,0 +1,174 @@
+#ifndef MESH_H
+#define MESH_H
+
+#include "Bvh.h"
+#include "Helpers.h"
+#include "MeshOptimize.h"
+#include "Meshlets.h"
+
+#include <vector>
+#include <string>
+#include <stdint.h>
+#include <glm/glm.hpp>  // glm::vec2
+#include <glm/vec3.hpp> // glm::vec3
+
+// A level of detail: the indices [First, First+Count) of the element
+// buffer, and the largest distance between it and the full mesh. Its
+// edges are the line indices [EdgeFirst, EdgeFirst+EdgeCount), over the
+// mesh vertices, and the same edges over the feature edge vertices from
+// FeatureFirst.
+struct MeshLod{
+    unsigned int First;
+    unsigned int Count;
+    float Error; // in mesh units
+    unsigned int EdgeFirst;
+    unsigned int EdgeCount;
+    unsigned int FeatureFirst;
+};
+
+// Geometry of one OFF file, shared by all the objects loaded from it.
+// Vertices are indexed, so the vertex normals are exact and the GPU copy
+// is one vertex per OFF vertex.
+//
+// The levels of detail are simplified index lists over the same vertices,
+// stored after F in the element buffer, from the full mesh (Lods[0]) to
+// the coarsest one.
+//
+// Wireframes draw each edge once, as GL_LINES. For the feature edge mode
+// every edge also gets two vertices of its own after the mesh vertices,
+// carrying the normals of its faces, from which the FEATURE_EDGES shader
+// variants keep creases, borders and silhouettes (see MeshEdges.h).
+// Element buffer: F, LodIndices, EdgeIndices, the feature edge indices.
+//
+// The full mesh is also cut into meshlets, runs of F small enough to be
+// culled on their own when the object is close (see Meshlets.h).
+//
+// Bvh is the hierarchy the ray tracer walks over F, built with the other
+// data on a cache miss and kept in the cache file. The ambient occlusion
+// of the vertices is baked through it once and cached too, the shaders
+// multiply it into the ambient light.
+class Mesh{
+    public:
+        std::string Path;
+        uint64_t SourceHash; // of the OFF file, the key of the cache file
+        std::vector<glm::vec3> V;   // vertex positions
+        std::vector<glm::vec3> C;   // vertex colors
+        std::vector<glm::vec3> N_v; // vertex normals - phong
+        std::vector<glm::vec3> N_f; // one normal per face - flat
+        std::vector<float> AO;      // ambient occlusion per vertex, 1 if open or not baked
+        std::vector<unsigned int> F; // three vertex indices per face
+        std::vector<MeshLod> Lods;
+        std::vector<unsigned int> LodIndices; // triangles of Lods[1..], after F
+        std::vector<unsigned int> EdgeIndices; // two vertices per edge, of every level
+        std::vector<glm::vec4> EdgeFaces;      // two face normals per edge, see edge_faces()
+        std::vector<Meshlet> Meshlets;         // runs of F, in order
+        MeshletBounds Bounds;                  // their bounds for cull_meshlets()
+        MeshBvh Bvh;                           // over the faces of F, see Bvh.h
+        glm::vec3 BaryCenter;
+        glm::vec3 UnitScale;
+        float Radius; // bounding sphere around BaryCenter
+
+        // Set once the triangles and vertices are reordered by optimize(),
+        // with the efficiency of F in the vertex cache before and after
+        bool Optimized;
+        VertexCacheStats CacheBefore, CacheAfter;
+
+        // Set once AO is baked, only then is it written to the cache
+        bool AoBaked;
+
+        // GPU copy, configured once by upload()
+        VertexArrayObject VAO;
+        VertexBufferObject VBO;
+        VertexBufferObject CBO;
+        VertexBufferObject NBO;
+        VertexBufferObject AOBO;
+        IndexBufferObject EBO;
+        VertexBufferObject EdgeFaceA;  // face normals and edge midpoints of
+        VertexBufferObject EdgeFaceB;  // the feature edge vertices, zero for
+        VertexBufferObject EdgeCenter; // the mesh vertices
+        bool Uploaded;
+
+        Mesh();
+
+        void loadOFF(std::string filepath);
+
+        // Colors, normals and bounds of the vertices and faces just read
+        void init_geometry();
+
+        // Load an OFF file through the mesh cache (see MeshAsset.h): the
+        // geometry and the levels of detail are only built on a miss
+        void load(const std::string& filepath);
+
+        // The same from vertices and faces kept elsewhere (a scene file),
+        // under the hash of the OFF file they were read from
+        void load(const std::string& path, uint64_t source_hash, const glm::vec3* positions, unsigned int vertex_count,
+                  const unsigned int* faces, unsigned int index_count);
+
+        // The cached data of SourceHash, false on a miss
+        bool load_cache(const std::string& cache_path);
+
+        // Levels, order, meshlets, edges, hierarchy and bake of V and F, then the cache file
+        void build(const std::string& cache_path);
+
+        // Simplify F into a chain of levels, each about a quarter of the
+        // triangles of the previous one
+        void build_lods();
+
+        // Unique edges of every level, after the levels are final
+        void build_edges();
+
+        // Cut F into meshlets, reordering its triangles meshlet after meshlet
+        void build_meshlets();
+
+        // Reorder the triangles of every level for the vertex cache and
+        // against overdraw (see MeshOptimize.h), group those of F into
+        // meshlets, then the vertices in the order the levels use them.
+        // The shape is unchanged.
+        void optimize();
+
+        // Level to draw when one mesh unit covers pixels_per_unit pixels,
+        // given the level drawn last frame. A level is kept until its error
+        // exceeds a pixel and only replaced by a coarser one well below it,
+        // so that objects near a threshold do not switch every frame.
+        int select_lod(float pixels_per_unit, int current) const;
+
+        // Upload the buffers and record the whole vertex format in VAO, so
+        // that drawing the mesh is a VAO bind plus a draw. object_ids is
+        // bound as an instanced array when instanced_ids is set.
+        void upload(VertexBufferObject& object_ids, bool instanced_ids);
+
+        // Release the GPU copy
+        void free();
+
+        glm::vec3 get_bary_center();
+        glm::vec3 get_unit_scale();
+        float get_radius();
+};
+
+// Run Mesh::optimize() on the meshes loaded from now on, the default
+void set_mesh_optimization(bool enabled);
+
+// Bake the ambient occlusion of the meshes loaded from now on, the
+// default. Otherwise their AO is 1 everywhere.
+void set_mesh_ao_bake(bool enabled);
+
+// Threads that build the hierarchies of the meshes loaded from now on,
+// NULL (the default) builds them on the calling thread
+void set_mesh_build_pool(ThreadPool* pool);
+
+// Load the mesh of a file once and return its id
+unsigned int load_mesh(const std::string& filepath);
+
+// Mesh of a scene file: the one loaded from path if it has the contents
+// of source_hash, otherwise the given geometry (or its cache file)
+unsigned int load_mesh(const std::string& path, uint64_t source_hash, const glm::vec3* positions, unsigned int vertex_count,
+                       const unsigned int* faces, unsigned int index_count);
+
+Mesh& get_mesh(unsigned int id);
+
+unsigned int mesh_count();
+
+// Release the GPU copies of every loaded mesh
+void free_meshes();
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef MESHASSET_H
+#define MESHASSET_H
+
+#include <string>
+#include <stdint.h>
+
+class Mesh;
+
+// Binary copy of a mesh and of everything built from it, so that the
+// preprocessing runs once per OFF file instead of at every launch.
+//
+// File layout: "MESH", format version, hash of the OFF file bytes, then
+// chunks of a 4 character tag, a byte size and the bytes. Readers skip
+// the chunks they do not know. A file whose version or source hash does
+// not match is ignored and written again.
+
+// Directory of the cache files, empty (the default) disables the cache
+void set_mesh_cache_dir(const std::string& dir);
+
+// Path of the cache file of an OFF file with this hash, empty if the
+// cache is disabled
+std::string mesh_cache_path(uint64_t source_hash);
+
+// FNV-1a hash of a whole file, false if it cannot be read
+bool hash_file(const std::string& path, uint64_t& hash);
+
+// Write the geometry, the levels of detail, the edges, the meshlets, the
+// ray tracing hierarchy, the baked ambient occlusion and the optimization
+// state of a mesh
+bool save_mesh_asset(const std::string& path, const Mesh& mesh, uint64_t source_hash);
+
+// Read them back, false if the file is missing, stale or truncated
+bool load_mesh_asset(const std::string& path, Mesh& mesh, uint64_t source_hash);
+
+#endif
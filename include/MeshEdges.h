@@ -0,0 +1,37 @@
+#ifndef MESHEDGES_H
+#define MESHEDGES_H
+
+#include <vector>
+#include <glm/glm.hpp>  // glm::vec2
+#include <glm/vec3.hpp> // glm::vec3
+#include <glm/vec4.hpp> // glm::vec4
+
+// An edge shared by one or more triangles of a triangle list
+struct MeshEdge{
+    unsigned int A, B;     // vertices, in the order of the first triangle using it
+    unsigned int Faces[2]; // first two triangles using it, triangle t is indices[3t..3t+2]
+    unsigned int FaceCount;
+};
+
+// What a feature edge vertex shader does with an edge, stored in the w
+// of the first face normal
+enum EdgeKind{
+    EDGE_SILHOUETTE = 1, // drawn where one face is seen from the front and the other from the back
+    EDGE_FEATURE = 2     // crease, border or non-manifold: always drawn
+};
+
+// Faces meeting at more than 60 degrees make a crease
+const float EDGE_CREASE_COS = 0.5f;
+
+// Every edge of the triangles [first, first+count) of indices once, in the
+// order the triangles reach them. Half-edges are matched through a hash
+// table keyed by their sorted vertex pair.
+void extract_edges(const std::vector<unsigned int>& indices, unsigned int first, unsigned int count,
+                   std::vector<MeshEdge>& edges);
+
+// Normals of the two faces of an edge, with its EdgeKind in the first w.
+// A border edge gets its only face twice.
+void edge_faces(const MeshEdge& edge, const std::vector<unsigned int>& indices,
+                const std::vector<glm::vec3>& positions, glm::vec4& face_a, glm::vec4& face_b);
+
+#endif
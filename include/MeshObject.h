@@ -1,6 +1,8 @@
 #ifndef MESHOBJECT_H
 #define MESHOBJECT_H
 
+#include "Mesh.h"
+
 #include <vector>
 #include <string>
 #include <glm/glm.hpp>  // glm::vec2
@@ -16,24 +18,22 @@ enum Renderingmode{
 
 class MeshObject{
     public:
-        std::vector<glm::vec3> V;
-        std::vector<glm::vec3> C;
-        std::vector<glm::vec3> N_f; //the normal list for frags - flat
-        std::vector<glm::vec3> N_v; //the normal list for vertices - phong
         glm::vec3 ScaleVector, RotateVector, TranslateVector;
         glm::mat4 Model;
         Renderingmode Rmode;
-        unsigned int VBO_Pos;
+        unsigned int MeshId; // geometry, shared by all objects loaded from the same file
         glm::vec3 BaryCenter;
         glm::vec3 UnitScale;
+        int Lod; // level of detail drawn last frame
 
         MeshObject();
-        MeshObject(std::string filepath, unsigned int vbo_pos);
+        MeshObject(std::string filepath);
 
-        void loadOFF(std::string filepath);
+        Mesh& mesh() const { return get_mesh(MeshId); }
 
         glm::mat4 get_model_matrix();
-        glm::vec3 get_bary_center();
-        glm::vec3 get_unit_scale();
+
+        // World space sphere around the object
+        void get_bounding_sphere(glm::vec3& center, float& radius);
 };
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,52 @@
+#ifndef MESHOPTIMIZE_H
+#define MESHOPTIMIZE_H
+
+#include <vector>
+#include <glm/glm.hpp>  // glm::vec2
+#include <glm/vec3.hpp> // glm::vec3
+
+// Post-transform cache the triangle orders are optimized for and measured
+// with. Current GPUs behave roughly like a FIFO of 16 to 32 vertices.
+const unsigned int VERTEX_CACHE_SIZE = 16;
+
+// Efficiency of a triangle order in a simulated FIFO cache
+struct VertexCacheStats{
+    float ACMR; // vertices transformed per triangle, 0.5 at best, 3 at worst
+    float ATVR; // vertices transformed per vertex used, 1 at best
+};
+
+VertexCacheStats vertex_cache_stats(const std::vector<unsigned int>& indices, unsigned int vertex_count,
+                                    unsigned int cache_size = VERTEX_CACHE_SIZE);
+
+// Reorder the triangles for the vertex cache with Tipsify (Sander, Nehab
+// and Barczak 2007): fan around the most recent vertex that still has
+// triangles and is still in the cache. clusters receives the first
+// triangle of every run that had to restart from outside the cache, the
+// points where the order can be cut without hurting the cache.
+void optimize_vertex_cache(std::vector<unsigned int>& indices, unsigned int vertex_count,
+                           std::vector<unsigned int>& clusters, unsigned int cache_size = VERTEX_CACHE_SIZE);
+
+// Reorder the clusters of a cache optimized order so that the ones facing
+// out of the mesh come first and occlude the others. Clusters are also cut
+// wherever their own ACMR is under threshold times the one of the whole
+// order, which gives more of them for a bounded loss in cache efficiency.
+void optimize_overdraw(std::vector<unsigned int>& indices, const std::vector<glm::vec3>& positions,
+                       const std::vector<unsigned int>& clusters, float threshold = 1.05f,
+                       unsigned int cache_size = VERTEX_CACHE_SIZE);
+
+// Number the vertices in the order the index lists first use them, so the
+// vertex fetches walk through memory. The lists are rewritten, remap[old]
+// is the new index; unused vertices go last.
+void optimize_vertex_fetch(std::vector<std::vector<unsigned int>*>& index_lists, unsigned int vertex_count,
+                           std::vector<unsigned int>& remap);
+
+// Move the attribute of every vertex to its remapped index
+template<typename T>
+void remap_vertices(std::vector<T>& attribute, const std::vector<unsigned int>& remap){
+    std::vector<T> moved(attribute.size());
+    for(int i = 0;i < attribute.size();i++)
+        moved[remap[i]] = attribute[i];
+    attribute.swap(moved);
+}
+
+#endif
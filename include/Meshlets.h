@@ -0,0 +1,55 @@
+#ifndef MESHLETS_H
+#define MESHLETS_H
+
+#include <vector>
+#include <glm/glm.hpp>  // glm::vec2
+#include <glm/vec3.hpp> // glm::vec3
+#include <glm/vec4.hpp> // glm::vec4
+#include <glm/mat4x4.hpp> // glm::mat4
+
+const unsigned int MESHLET_MAX_VERTICES = 64;
+const unsigned int MESHLET_MAX_TRIANGLES = 124;
+
+// A run of triangles of an index list using few vertices, with the bounds
+// that decide if any of it can be seen
+struct Meshlet{
+    unsigned int First; // indices [First, First+Count) of the element buffer
+    unsigned int Count;
+    glm::vec4 Sphere;   // center, radius
+    glm::vec4 Cone;     // normal cone axis, cutoff (1: never back facing)
+};
+
+// Cut the triangles [first, first+count) of indices into meshlets and
+// reorder them meshlet after meshlet. A meshlet grows over neighbouring
+// triangles that add few vertices and keep its normal cone narrow; its
+// triangles stay in their previous order, and the meshlets follow the
+// order of their first triangle. The cones are only set when closed is
+// true, the back faces of an open mesh can be seen through its holes.
+void build_meshlets(std::vector<unsigned int>& indices, unsigned int first, unsigned int count,
+                    const std::vector<glm::vec3>& positions, bool closed, std::vector<Meshlet>& meshlets);
+
+// The meshlet bounds as arrays, padded to a multiple of 4, so that the
+// culling tests four meshlets at a time
+struct MeshletBounds{
+    std::vector<float> X, Y, Z, Radius;
+    std::vector<float> AxisX, AxisY, AxisZ, Cutoff;
+
+    void init(const std::vector<Meshlet>& meshlets);
+};
+
+// Where an object is seen from, in the space of its mesh
+struct MeshletView{
+    glm::vec4 Planes[6];  // frustum planes, normalized, inside is positive
+    glm::vec3 Eye;        // camera position (perspective)
+    glm::vec3 Direction;  // view direction, normalized (orthographic)
+    bool Perspective;
+
+    // From the model matrix of the object and the view and projection
+    void init(const glm::mat4& model, const glm::mat4& view, const glm::mat4& projection, bool perspective);
+};
+
+// Append to visible the meshlets in the frustum and not back facing
+void cull_meshlets(const MeshletBounds& bounds, unsigned int count, const MeshletView& view,
+                   std::vector<unsigned int>& visible);
+
+#endif
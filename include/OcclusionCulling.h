@@ -0,0 +1,86 @@
+#ifndef OCCLUSIONCULLING_H
+#define OCCLUSIONCULLING_H
+
+#include "ThreadPool.h"
+
+#include <vector>
+#include <utility>
+#include <glm/glm.hpp>  // glm::vec2
+#include <glm/vec3.hpp> // glm::vec3
+#include <glm/vec4.hpp> // glm::vec4
+#include <glm/mat4x4.hpp> // glm::mat4
+
+// Size of the occlusion depth buffer: OCCLUSION_WIDTH pixels across, the
+// height from the aspect ratio, rasterized in tiles of
+// OCCLUSION_TILE_WIDTH x OCCLUSION_TILE_HEIGHT pixels
+const int OCCLUSION_WIDTH = 256;
+const int OCCLUSION_TILE_WIDTH = 64;
+const int OCCLUSION_TILE_HEIGHT = 32;
+
+// An occluder: triangles [First, First+Count) of Indices over Positions,
+// placed by Model
+struct Occluder{
+    glm::mat4 Model;
+    const std::vector<glm::vec3>* Positions;
+    const std::vector<unsigned int>* Indices;
+    unsigned int First;
+    unsigned int Count;
+};
+
+// A triangle of an occluder on the depth buffer, counter clockwise, with
+// the pixels its bounds touch
+struct OccluderTriangle{
+    float X[3], Y[3], Z[3];
+    int MinX, MinY, MaxX, MaxY;
+};
+
+// Occlusion culling on the CPU, without reading anything back from the GPU.
+//
+// The occluders of a frame are rasterized into a small depth buffer,
+// each tile by one thread of the pool, four pixels at a time with SSE.
+// A pixel covered at its center takes the farthest depth of the triangle
+// over the pixel, and then the farthest depth of the 3x3 pixels around
+// it, so that the occluders never cover more than they do on screen.
+// A pyramid of the farthest depth of each 2x2 block is built on top, and
+// an object is hidden when the box around its bounding sphere on screen
+// is behind every depth of the pyramid under it.
+class OcclusionCuller{
+    public:
+        int Width, Height;
+        std::vector<float> Raster;               // depth in [0, 1] of the occluders
+        std::vector<float> Grow;                 // Raster grown across
+        std::vector<std::vector<float> > Levels; // Raster grown by a pixel, then the pyramid
+        std::vector<int> LevelWidth, LevelHeight;
+        std::vector<Occluder> Occluders;
+        std::vector<std::vector<OccluderTriangle> > Triangles; // of each occluder
+        std::vector<std::vector<std::pair<unsigned int,unsigned int> > > Bins; // occluder, triangle of each tile
+        int TilesX, TilesY;
+        std::vector<std::vector<glm::vec4> > Screen; // vertices on the buffer, per thread
+        glm::mat4 ViewProjection;
+        ThreadPool* Pool;
+
+        OcclusionCuller();
+
+        // Clear the occluders of the last frame and size the buffer for a
+        // framebuffer of this size
+        void begin(int framebuffer_width, int framebuffer_height, const glm::mat4& view_projection, ThreadPool* pool);
+
+        void add_occluder(const Occluder& occluder);
+
+        // Rasterize the occluders and build the pyramid
+        void rasterize();
+
+        // False if the sphere is hidden by the occluders or off screen
+        bool visible(const glm::vec3& center, float radius) const;
+
+        // visible() of every sphere (center, radius), spread over the pool
+        void test(const std::vector<glm::vec4>& spheres, std::vector<unsigned char>& visible) const;
+
+        // Triangles of one occluder on the buffer, screen is scratch space
+        void setup(const Occluder& occluder, std::vector<OccluderTriangle>& triangles, std::vector<glm::vec4>& screen) const;
+
+        // Depth of the occluder triangles in one tile
+        void rasterize_tile(int tile_x, int tile_y);
+};
+
+#endif
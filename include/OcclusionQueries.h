@@ -0,0 +1,72 @@
+#ifndef OCCLUSIONQUERIES_H
+#define OCCLUSIONQUERIES_H
+
+#include "Helpers.h"
+
+#include <vector>
+
+// Queries of one object, indexed like the object list
+struct ObjectQuery{
+    GLuint Query;
+    bool Issued;   // the query holds a result, or will: the draws can be conditional
+    bool Pending;  // its result is not read back yet
+    int Occluded;  // results in a row with the box hidden
+    int NextTest;  // first frame the box is drawn again
+};
+
+// Hardware occlusion queries, for the expensive objects the CPU culling
+// of OcclusionCulling.h keeps: it only knows the largest occluders, the
+// GPU tests against the depth of everything drawn.
+//
+// After the scene the box around the bounding sphere of an object is
+// drawn without writing color or depth, inside a GL_ANY_SAMPLES_PASSED
+// query (GL_SAMPLES_PASSED before GL 3.3). The next frame draws the object
+// between glBeginConditionalRender(GL_QUERY_NO_WAIT) and
+// glEndConditionalRender(): the GPU skips it if the box was hidden, and
+// draws it if the result is not there yet. The CPU never waits for a
+// result, and an object coming into view can show up a frame late.
+//
+// An object hidden for a while is queried less often, every
+// QUERY_MAX_INTERVAL frames at most, keeping its last result in between.
+const int QUERY_MAX_INTERVAL = 4;
+const int QUERY_BACKOFF = 8; // hidden results in a row per frame of interval
+
+class OcclusionQueries{
+    public:
+        std::vector<ObjectQuery> Objects;
+        GLenum Target;
+        int Frame;
+
+        OcclusionQueries();
+
+        void init();
+
+        // One query per object. The results are forgotten if the count
+        // changed, the indices no longer name the same objects.
+        void resize(unsigned int objects);
+
+        // Start a frame: read back the results that arrived, without waiting
+        void update();
+
+        // True if the box of the object is drawn this frame
+        bool due(unsigned int object) const;
+
+        // Draw the object unconditionally until its next query, for
+        // a box the near plane cuts
+        void forget(unsigned int object);
+
+        // True if the draws of the object can be conditional
+        bool conditional(unsigned int object) const { return Objects[object].Issued; }
+
+        // Query the samples of the draws in between
+        void begin(unsigned int object);
+        void end();
+
+        // Draws of the object skipped if its last box was hidden
+        void begin_conditional(unsigned int object);
+        void end_conditional();
+
+        void free();
+};
+
+#endif
@@ -0,0 +1,132 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+// Per-scope frame profiler, built with -DENABLE_PROFILER (the CMake option
+// ENABLE_PROFILER). Without it the PROFILE_* macros expand to nothing and
+// none of the code below exists.
+//
+//   PROFILE_FRAME_BEGIN();
+//   { PROFILE_SCOPE("shadow map"); ... }
+//   PROFILE_FRAME_END();
+//
+// A scope records its CPU time and, with timer queries, its GPU time
+// between two GL_TIMESTAMP queries. The queries of a frame are read back
+// PROFILER_LATENCY frames later, once the GPU is done with them, so the
+// profiler never waits for the GPU; results that are still not ready then
+// are dropped.
+
+#ifdef ENABLE_PROFILER
+
+#include "Helpers.h"
+
+#include <string>
+#include <vector>
+#include <map>
+#include <ostream>
+#include <chrono>
+
+const int PROFILER_LATENCY = 3; // frames in flight between a query and its readback
+const int PROFILER_WINDOW = 120; // frames of the rolling statistics
+
+// Mean/min/max over the last PROFILER_WINDOW samples
+class RollingStat{
+    public:
+        std::vector<double> Samples;
+        int Next;
+
+        RollingStat();
+
+        void add(double value);
+
+        double mean() const;
+        double min() const;
+        double max() const;
+};
+
+struct ProfileSample{
+    const char* Name; // a string literal, stored as is
+    int Depth;
+    double CpuBegin, CpuEnd; // ms since the profiler started
+    GLuint Begin, End;       // timestamp queries, 0 without GPU timers
+};
+
+// One complete event of the Chrome trace (chrome://tracing, Perfetto)
+struct TraceEvent{
+    const char* Name;
+    bool Gpu;
+    double Start, Duration; // ms, GPU times moved to the CPU clock
+};
+
+class FrameProfiler{
+    public:
+        bool GpuTimers;
+        std::vector<ProfileSample> Frames[PROFILER_LATENCY]; // samples of the frames in flight
+        int Frame;
+        int Depth;
+        int Open; // sample of the frame scope in the current slot
+        std::vector<GLuint> Queries; // free timestamp queries
+        std::chrono::high_resolution_clock::time_point Start;
+        double GpuOffset; // CPU ms minus GPU ms, measured once at init
+
+        std::map<std::string, RollingStat> CpuStats;
+        std::map<std::string, RollingStat> GpuStats;
+        int ReportFrames; // print the statistics every ReportFrames frames, 0: never
+
+        bool Tracing;
+        std::vector<TraceEvent> Trace;
+        size_t MaxTraceEvents;
+
+        FrameProfiler();
+
+        // tracing keeps every scope for write_trace, up to MaxTraceEvents
+        void init(bool tracing);
+
+        void begin_frame();
+        void end_frame();
+
+        // Open a scope and return its sample, closed by end()
+        int begin(const char* name);
+        void end(int sample);
+
+        void print_stats(std::ostream& out) const;
+
+        // Chrome trace-event JSON of the recorded scopes
+        bool write_trace(const std::string& path) const;
+
+        // Wait for the frames in flight, then release the queries
+        void free();
+
+        double now() const;
+
+        // Read back the samples of a slot into the statistics and the trace
+        void collect(int slot, bool wait);
+
+        GLuint query();
+};
+
+extern FrameProfiler PROFILER;
+
+// Opens a scope for the lifetime of the object
+class ProfileScope{
+    public:
+        int Sample;
+
+        ProfileScope(const char* name) { Sample = PROFILER.begin(name); }
+        ~ProfileScope() { PROFILER.end(Sample); }
+};
+
+#define PROFILE_CONCAT_(a,b) a##b
+#define PROFILE_CONCAT(a,b) PROFILE_CONCAT_(a,b)
+#define PROFILE_SCOPE(name) ProfileScope PROFILE_CONCAT(profile_scope_,__LINE__)(name)
+#define PROFILE_FRAME_BEGIN() PROFILER.begin_frame()
+#define PROFILE_FRAME_END() PROFILER.end_frame()
+
+#else
+
+#define PROFILE_SCOPE(name)
+#define PROFILE_FRAME_BEGIN()
+#define PROFILE_FRAME_END()
+
+#endif
+
+#endif
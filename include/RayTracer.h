@@ -0,0 +1,105 @@
+#ifndef RAYTRACER_H
+#define RAYTRACER_H
+
+#include "Bvh.h"
+#include "MeshObject.h"
+#include "SoftwareRenderer.h"
+#include "ThreadPool.h"
+
+#include <vector>
+#include <glm/glm.hpp>  // glm::vec2
+#include <glm/vec3.hpp> // glm::vec3
+#include <glm/mat3x3.hpp> // glm::mat3
+#include <glm/mat4x4.hpp> // glm::mat4
+
+// Image tiles of the ray tracer, each traced by one thread
+const int RAYTRACER_TILE_SIZE = 16;
+
+// Ambient occlusion rays look for geometry this far, in world units
+const float RAYTRACER_AO_DISTANCE = 0.5f;
+
+// Rays per vertex of bake_ambient_occlusion(), a square multiple of 4
+const int AO_BAKE_RAYS = 64;
+
+// Their length, relative to the bounding radius of the mesh
+const float AO_BAKE_DISTANCE = 0.5f;
+
+// Vertices baked per job
+const unsigned int AO_BAKE_VERTICES = 64;
+
+// What the shading needs of an instance of the scene hierarchy
+struct TracedObject{
+    const Mesh* Geometry;
+    glm::mat4 Model;
+    glm::mat3 NormalMatrix;
+    bool Lit;  // false for the light cube, drawn in white
+    bool Flat; // face normals instead of the vertex ones
+};
+
+// Stills of the scene traced on the CPU: the objects, rendering modes and
+// lights of the editor, with exact shadows from every light and optional
+// ambient occlusion.
+//
+// The bottom level BVH of each mesh is built when it is loaded (see
+// Mesh::Bvh), the top level one over the objects at the first still and
+// then only refit to the objects that moved, reported by move() or found
+// by comparing their transforms. The rays go through it in packets of 2x2
+// pixels, the four rays tested at once against each box and triangle with
+// SSE; the shadow and occlusion rays of a packet are traced as packets
+// too. Each sample adds one jittered ray per pixel to the running sum, so
+// a still refines sample after sample and the first one matches the
+// pixel centers of the rasterizers.
+class RayTracer{
+    public:
+        int Width, Height;
+        std::vector<unsigned char> Pixels; // RGB rows from top to bottom, like HeadlessContext::read_pixels
+        std::vector<glm::vec3> Sum;        // samples added per pixel, same rows
+        int Samples;
+        int AoRays; // per sample, 0 for the flat ambient term
+        ThreadPool* Pool;
+
+        SceneBvh Scene; // over the objects of the last begin()
+        std::vector<TracedObject> Objects; // by instance of Scene
+        std::vector<int> ObjectInstances;  // instance of Scene of each object, -1 for none
+
+        // The owner calls move() for every object it moves, begin() then
+        // only compares the transforms after moved_all()
+        bool MovesReported;
+        bool CompareAll;
+        SoftwareFrame Frame;
+        glm::mat4 InverseViewProjection;
+
+        // Rays traced since init(), counted per thread
+        std::vector<unsigned long> Rays;
+
+        RayTracer();
+
+        void init(int width, int height, ThreadPool* pool);
+
+        // Start a still of the objects: the scene hierarchy and an empty sum
+        void begin(const SoftwareFrame& frame, std::vector<MeshObject>& objects);
+
+        // An object was moved, rotated or scaled: its box in the scene
+        // hierarchy follows now, the boxes above it at the next begin()
+        void move(unsigned int object, const glm::mat4& model);
+
+        // The objects may have moved without move(), e.g. a scene was opened
+        void moved_all();
+
+        // Add one sample to every pixel and update Pixels
+        void trace_sample();
+
+        // One sample of the pixels of a tile
+        void trace_tile(int tile);
+
+        unsigned long ray_count() const;
+};
+
+// Ambient occlusion of each vertex of a mesh by the mesh itself: the part
+// of AO_BAKE_RAYS cosine distributed rays around its normal that leave
+// without hitting a face, so 1 where nothing is in the way. The rays go
+// through mesh.Bvh in packets of 4 like those of the tracer, the vertices
+// are spread over the pool. The result only depends on the mesh.
+void bake_ambient_occlusion(const Mesh& mesh, std::vector<float>& ao, ThreadPool* pool);
+
+#endif
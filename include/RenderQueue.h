@@ -0,0 +1,60 @@
+#ifndef RENDERQUEUE_H
+#define RENDERQUEUE_H
+
+#include <vector>
+#include <stdint.h>
+
+// Sort key layout, most significant bits first:
+// pass (4) | program (8) | render mode (4) | mesh (16) | depth (32)
+// Items with equal pass/program/mode share all render state and end up
+// next to each other, closest first. The mesh field only holds the low 16
+// bits of the mesh id: past 65536 meshes two meshes can share it, so
+// batches are cut on the mesh id itself too.
+const int KEY_DEPTH_SHIFT = 0;
+const int KEY_MESH_SHIFT = 32;
+const int KEY_MODE_SHIFT = 48;
+const int KEY_PROGRAM_SHIFT = 52;
+const int KEY_PASS_SHIFT = 60;
+
+enum RenderPass{
+    PASS_OPAQUE = 0, // filled triangles
+    PASS_EDGES = 1   // the unique edges of the meshes, as GL_LINES
+};
+
+// Render mode field: the Renderingmode of the object, or MODE_UNLIT
+const unsigned int MODE_UNLIT = 3;
+
+struct RenderItem{
+    uint64_t Key;
+    unsigned int Object;
+};
+
+uint64_t make_sort_key(unsigned int pass, unsigned int program, unsigned int mode, unsigned int mesh, float depth);
+
+inline unsigned int key_pass(uint64_t key) { return (key >> KEY_PASS_SHIFT) & 0xF; }
+inline unsigned int key_program(uint64_t key) { return (key >> KEY_PROGRAM_SHIFT) & 0xFF; }
+inline unsigned int key_mode(uint64_t key) { return (key >> KEY_MODE_SHIFT) & 0xF; }
+inline unsigned int key_mesh(uint64_t key) { return (key >> KEY_MESH_SHIFT) & 0xFFFF; }
+
+// The bits deciding the render state of an item (pass, program, mode)
+inline uint64_t key_state(uint64_t key) { return key >> KEY_MODE_SHIFT; }
+
+// Items drawn by one batch: same render state and same mesh VAO
+inline uint64_t key_batch(uint64_t key) { return key >> KEY_MESH_SHIFT; }
+
+
+class RenderQueue{
+    public:
+        std::vector<RenderItem> Items;
+
+        void clear();
+
+        void push(uint64_t key, unsigned int object);
+
+        // LSD radix sort on the keys, one byte per pass
+        void sort();
+
+    private:
+        std::vector<RenderItem> Scratch;
+};
+#endif
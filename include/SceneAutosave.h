@@ -0,0 +1,106 @@
+#ifndef SCENEAUTOSAVE_H
+#define SCENEAUTOSAVE_H
+
+#include "SceneFile.h"
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+// Objects per chunk of a snapshot, the unit of an incremental write
+const unsigned int AUTOSAVE_CHUNK_OBJECTS = 4096;
+
+// The objects [Index * AUTOSAVE_CHUNK_OBJECTS, ...) as they were captured,
+// never changed afterwards. Version is new at every capture.
+struct AutosaveChunk{
+    SceneObjects Objects;
+    unsigned int Version;
+};
+
+// The scene at a capture: the chunks are shared with the captures before
+// and after it as long as their objects do not change
+struct SceneSnapshot{
+    std::vector<std::shared_ptr<const AutosaveChunk> > Chunks;
+    std::vector<const Mesh*> Meshes; // every loaded mesh, the mesh table is indexed by MeshId
+    size_t Objects;
+};
+
+// Saves the scene to a scene file (see SceneFile.h) every Interval
+// seconds, on a thread of its own.
+//
+// The main thread only copies the chunks of objects changed since the
+// last capture, marked by changed() or found from the object count and
+// the selection, and hands the list of chunks to the thread. The thread
+// writes the whole file when the object count or the meshes changed,
+// otherwise it overwrites only the chunks whose version it has not
+// written yet, in a copy of the file. Either way the new file is renamed
+// over the previous one once complete. A capture waits while the thread
+// is still writing, the frame never does.
+class SceneAutosave{
+    public:
+        std::string Path;
+        double Interval; // seconds, 0 if off
+
+        // Captured state, main thread only
+        std::vector<std::shared_ptr<const AutosaveChunk> > Chunks;
+        std::vector<unsigned char> Dirty; // chunks changed since their capture
+        bool Unsaved;                     // chunks captured since the last snapshot
+        size_t CapturedObjects;
+        int CapturedSelection;
+        unsigned int Version;
+        std::chrono::steady_clock::time_point LastCapture;
+
+        // The thread and the snapshot waiting for it, guarded by Mutex
+        std::thread Worker;
+        std::mutex Mutex;
+        std::condition_variable Wake;
+        SceneSnapshot Pending;
+        bool HasPending;
+        bool Writing;
+        bool Quit;
+
+        // What the file holds, thread only
+        size_t SavedObjects;
+        std::vector<const Mesh*> SavedMeshes;
+        std::vector<unsigned int> SavedVersions; // of each chunk
+        SceneFileLayout SavedLayout;
+
+        SceneAutosave();
+        ~SceneAutosave();
+
+        // Start the thread, nothing is saved with an interval of 0
+        void init(const std::string& path, double interval);
+
+        // An object changed in place, its chunk is captured again
+        void changed(int object);
+
+        // Every object may have changed, e.g. after opening a scene
+        void changed_all();
+
+        // Copy the chunks changed since the last capture. update() does
+        // it too, but after loading or opening a large scene it is better
+        // done right away than in a frame.
+        void capture(const std::vector<MeshObject>& objects, int selected);
+
+        // Once per frame: capture the scene for the thread when Interval
+        // has passed and the thread is idle
+        void update(const std::vector<MeshObject>& objects, int selected);
+
+        // Save the current scene, then stop the thread
+        void free(const std::vector<MeshObject>& objects, int selected);
+
+        // Hand the captured chunks to the thread, replacing a waiting snapshot
+        void queue();
+
+        // Body of the thread
+        void run_worker();
+
+        // Write a snapshot, patching a copy of the file when it has the same layout
+        void write(const SceneSnapshot& snapshot);
+};
+
+#endif
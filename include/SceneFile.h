@@ -0,0 +1,91 @@
+#ifndef SCENEFILE_H
+#define SCENEFILE_H
+
+#include "MeshObject.h"
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <stdint.h>
+
+// Binary copy of the objects of the editor, opened by mapping the file
+// and copying its arrays, without parsing anything per object.
+//
+// File layout: "SCNE", format version, object count, mesh count, then
+// chunks of a 4 character tag, a byte size and the data, padded to 8
+// bytes so that every array can be read where it is mapped:
+//
+//   MESH  one SceneMeshRecord per mesh
+//   PATH  the paths of the meshes, one after the other
+//   VERT  the vertices of the meshes, each set once per OFF file contents
+//   TRIS  their faces, three vertex indices from the first vertex
+//   OMSH  mesh of each object, an index in MESH
+//   OTRN  translation of each object, then OROT its rotation, OSCL its
+//         scale and OUNI its scale to the unit cube
+//   OMOD  rendering mode of each object, one byte
+//   OFLG  flags of each object, one byte, see SCENE_OBJECT_SELECTED
+//
+// A mesh is taken from its OFF file when it has not changed since the
+// scene was saved, from the mesh cache, or built again from VERT and TRIS.
+
+// A mesh of a scene file. Meshes with the same hash share their geometry.
+struct SceneMeshRecord{
+    uint64_t Hash;        // of the OFF file, see hash_file()
+    uint32_t PathFirst;   // in PATH
+    uint32_t PathCount;
+    uint32_t VertexFirst; // in VERT
+    uint32_t VertexCount;
+    uint32_t IndexFirst;  // in TRIS
+    uint32_t IndexCount;
+};
+
+const uint8_t SCENE_OBJECT_SELECTED = 1;
+
+// The objects as a scene file stores them, one array per property
+struct SceneObjects{
+    std::vector<uint32_t> Meshes; // index in the mesh table
+    std::vector<glm::vec3> Translate;
+    std::vector<glm::vec3> Rotate;
+    std::vector<glm::vec3> Scale;
+    std::vector<glm::vec3> UnitScale;
+    std::vector<uint8_t> Modes;
+    std::vector<uint8_t> Flags;
+
+    size_t size() const { return Meshes.size(); }
+    void resize(size_t count);
+
+    // Object i from an object of the editor and the table index of its mesh
+    void set(size_t i, const MeshObject& object, uint32_t mesh, bool selected);
+
+    // The objects of other after these
+    void append(const SceneObjects& other);
+};
+
+// Where the object arrays of a written file start, in SceneObjects order
+const int SCENE_OBJECT_ARRAYS = 7;
+struct SceneFileLayout{
+    uint64_t Arrays[SCENE_OBJECT_ARRAYS];
+};
+
+// Write a scene of these meshes (the mesh table) and objects, false on
+// failure. The file is written next to path first, then renamed over it.
+bool write_scene_file(const std::string& path, const std::vector<const Mesh*>& meshes, const SceneObjects& objects,
+                      SceneFileLayout& layout);
+
+// Overwrite the objects from first in place, in a file just written by
+// write_scene_file() with at least first + objects.size() objects
+bool write_scene_objects(std::fstream& file, const SceneFileLayout& layout, const SceneObjects& objects, size_t first);
+
+// Rename a complete scene file over path, false (and temporary removed)
+// on failure
+bool replace_scene_file(const std::string& temporary, const std::string& path);
+
+// Write the objects and which one is selected, false on failure. The file
+// is written next to path first, then renamed over it.
+bool save_scene(const std::string& path, const std::vector<MeshObject>& objects, int selected);
+
+// Replace the objects by those of a scene file, false (objects unchanged)
+// if it cannot be read. selected is the selected object, 0 if none is.
+bool open_scene(const std::string& path, std::vector<MeshObject>& objects, int& selected);
+
+#endif
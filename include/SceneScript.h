@@ -0,0 +1,55 @@
+#ifndef SCENESCRIPT_H
+#define SCENESCRIPT_H
+
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>  // glm::vec2
+#include <glm/vec3.hpp> // glm::vec3
+
+// A scene and camera path for unattended runs, one command per line:
+//
+//   frames 120                 number of frames to render
+//   object data/bunny.off      add an object, it becomes the selected one
+//   mode phong                 wireframe, flat or phong for the selected object
+//   translate 0.2 0 -0.5       transformation of the selected object
+//   rotate 0 45 0
+//   scale 1.5 1.5 1.5
+//   select 2                   select an object by index
+//   light 0.5 0.5 0            move the light cube
+//   lights 1000 7              add random lights, with a seed
+//   projection orthographic    or perspective
+//   camera 0 0 0 2             camera position at a frame, interpolated
+//   key 30 l                   press an editor key at a frame
+//   save scene.scn             write the objects to a scene file (see SceneFile.h)
+//   open scene.scn             replace the objects by those of a scene file
+//   at 60 translate 0 0.1 0    run any other command at a frame
+//
+// '#' starts a comment. Commands without "at" run before the first frame.
+struct ScriptCommand{
+    int Frame;
+    std::string Name;
+    std::vector<std::string> Args;
+    int Line;
+};
+
+struct CameraKey{
+    int Frame;
+    glm::vec3 Position;
+};
+
+class SceneScript{
+    public:
+        int Frames;                        // -1 if not given
+        std::vector<ScriptCommand> Commands;
+        std::vector<CameraKey> Camera;     // sorted by frame
+
+        SceneScript();
+
+        // Parse a script, false (with the line of the error) if it is invalid
+        bool load(const std::string& path);
+
+        // Camera position at a frame, false if the script has no camera path
+        bool camera_at(int frame, glm::vec3& position) const;
+};
+
+#endif
@@ -0,0 +1,104 @@
+#ifndef SHADERLIBRARY_H
+#define SHADERLIBRARY_H
+
+#include "Helpers.h"
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+struct GLFWwindow;
+
+// Features a shader variant is specialized for, each one a #define in
+// both stages. Exactly one of UNLIT/WIREFRAME/FLAT/PHONG/PICKING picks
+// the shading, INSTANCED changes where the object index comes from and
+// FEATURE_EDGES culls the edges that are not creases, borders or silhouettes.
+enum ShaderFeature{
+    SHADER_UNLIT = 1,     // object color from the object data, no lighting
+    SHADER_FLAT = 2,      // lit, face normal from the screen-space derivatives
+    SHADER_PHONG = 4,     // lit, interpolated vertex normals
+    SHADER_WIREFRAME = 8, // edge overlay in the uni_color uniform
+    SHADER_INSTANCED = 16, // object index = draw_ids[draw_base + gl_InstanceID]
+    SHADER_PICKING = 32,  // position only, for the depth/stencil picking pass
+    SHADER_FEATURE_EDGES = 64 // lines over the feature edge vertices, see Mesh.h
+};
+
+// The #define lines of a feature set
+std::string shader_defines(unsigned int features);
+
+// The same on one line, to name the program of a variant
+std::string variant_name(unsigned int features);
+
+
+// Read a whole text file, false if it cannot be opened
+bool read_text_file(const std::string& path, std::string& text);
+
+
+// Programs compiled from one pair of sources with different feature sets.
+// Variants are compiled on first use and identified by a small index,
+// stored in the program field of the render queue keys.
+//
+// The sources can be reloaded from their files while the scene is drawn:
+// a worker thread with its own GL context, sharing objects with the main
+// one, recompiles every variant, and update() swaps them in between two
+// frames. If any variant fails the current programs are kept.
+class ShaderLibrary{
+    public:
+        std::string VertexPath;     // empty if the sources are not from files
+        std::string FragmentPath;
+        std::string VertexSource;   // sources without the #version line
+        std::string FragmentSource;
+        std::string FragmentDataName;
+        std::vector<unsigned int> Features;
+        std::vector<Program*> Programs;
+
+        // Background recompilation, guarded by Mutex
+        std::thread Worker;
+        GLFWwindow* WorkerContext;
+        std::mutex Mutex;
+        std::condition_variable Wake;
+        bool ReloadPending;
+        bool Quit;
+        std::vector<unsigned int> ReloadFeatures; // variants of the pending reload
+        std::vector<Program*> Reloaded; // finished programs waiting for update()
+        std::string ReloadedVertex;
+        std::string ReloadedFragment;
+
+        ShaderLibrary();
+
+        void init(const std::string& vertex_source, const std::string& fragment_source, const std::string& fragment_data_name);
+
+        // Read the sources from two files, false if one cannot be read
+        bool load(const std::string& vertex_path, const std::string& fragment_path, const std::string& fragment_data_name);
+
+        // Compile the reloads on "context" from now on. The context has to
+        // share objects with the one drawing and must not be current anywhere.
+        void start_worker(GLFWwindow* context);
+
+        // Recompile every variant from the files. Without a worker it is
+        // done right away, on the current context.
+        void reload();
+
+        // Swap in the programs of a finished reload, true if they changed.
+        // Call it where no program of the library is in use.
+        bool update();
+
+        // Index of the variant for a feature set, compiled if needed
+        unsigned int variant(unsigned int features);
+
+        Program& program(unsigned int index) { return *Programs[index]; }
+
+        unsigned int features(unsigned int index) const { return Features[index]; }
+
+        void free();
+
+        // Compile the feature sets from the files, true and the programs
+        // in "programs" if all of them linked
+        bool compile(const std::vector<unsigned int>& features, std::string& vertex_source, std::string& fragment_source, std::vector<Program*>& programs);
+
+        // Body of the worker thread
+        void run_worker();
+};
+#endif
@@ -0,0 +1,74 @@
+#ifndef SHADOWMAP_H
+#define SHADOWMAP_H
+
+#include "Helpers.h"
+
+#include <vector>
+#include <glm/glm.hpp>  // glm::vec2
+#include <glm/vec3.hpp> // glm::vec3
+#include <glm/vec4.hpp> // glm::vec4
+#include <glm/mat4x4.hpp> // glm::mat4
+
+// Omnidirectional shadow map of a point light: a depth cube map with one
+// 90 degree perspective view per face, stored in 16 bits.
+//
+// The faces are cached. A face is drawn again only when the light moved,
+// or when a caster moved, appeared or grew inside its frustum (at its old
+// or new place); a static scene pays for its shadows once.
+class CubeShadowMap{
+    public:
+        int Size;
+        float Near, Far;
+        GLuint Texture;
+        GLuint Framebuffer;
+
+        glm::vec3 LightPosition;
+        bool Dirty[6];
+        std::vector<glm::mat4> CasterModels;   // last known model matrix of each caster id
+        std::vector<glm::vec4> CasterSpheres;  // and its bounding sphere (center, radius)
+        std::vector<bool> CasterKnown;
+        int FacesDrawn;                        // faces drawn since the last reset, for statistics
+
+        CubeShadowMap();
+
+        void init(int size = 512, float near = 0.05f, float far = 20.0f);
+
+        // Dirty every face if the light moved
+        void set_light(const glm::vec3& position);
+
+        // Report the current placement of a caster, dirty the faces it
+        // enters or leaves if it changed
+        void update_caster(unsigned int id, const glm::mat4& model, const glm::vec3& center, float radius);
+
+        // True if the sphere overlaps the frustum of the face
+        bool face_sees(int face, const glm::vec3& center, float radius) const;
+
+        // Light projection * view of a face
+        glm::mat4 face_matrix(int face) const;
+
+        // Start drawing faces: the framebuffer and viewport are saved and replaced
+        void begin();
+
+        // Attach and clear a face, the draws that follow land in it
+        void begin_face(int face);
+
+        // Back to the previous framebuffer and viewport
+        void end();
+
+        // Shader constants: the reference depth of a point at distance m along
+        // the major axis of its face is depth_scale().x - depth_scale().y / m
+        glm::vec2 depth_scale() const;
+
+        void bind(GLuint unit);
+
+        void free();
+
+        // Dirty the faces seeing a sphere
+        void dirty_faces(const glm::vec3& center, float radius);
+
+        // State replaced by begin()
+        GLint SavedViewport[4];
+        GLint SavedFramebuffer;
+};
+
+#endif
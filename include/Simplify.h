@@ -0,0 +1,58 @@
+#ifndef SIMPLIFY_H
+#define SIMPLIFY_H
+
+#include <vector>
+#include <glm/glm.hpp>  // glm::vec2
+#include <glm/vec3.hpp> // glm::vec3
+
+// Sum of squared distances to a set of planes, weighted by triangle area
+// (Garland & Heckbert). Weight is the total area, to turn the sum into a
+// mean squared distance.
+struct Quadric{
+    double A2, AB, AC, AD, B2, BC, BD, C2, CD, D2;
+    double Weight;
+
+    Quadric();
+
+    // The plane n.p + d = 0 of a triangle of the given area, n normalized
+    Quadric(const glm::dvec3& n, double d, double area);
+
+    void add(const Quadric& q);
+
+    // Mean squared distance of p to the planes
+    double error(const glm::vec3& p) const;
+};
+
+
+// Simplifies a triangle mesh by collapsing vertices onto one of their
+// neighbors, in order of quadric error. Vertices are removed, never moved,
+// so every simplified index list still indexes the full vertex buffer.
+//
+// Border and non-manifold vertices are locked, collapses that flip a
+// triangle or merge vertices whose normals differ by more than 60 degrees
+// are rejected. simplify() can be called again with a smaller target to
+// continue from the current state, which gives a chain of levels.
+class MeshSimplifier{
+    public:
+        const std::vector<glm::vec3>* Positions;
+        const std::vector<glm::vec3>* Normals;
+        std::vector<unsigned int> Indices; // current triangles
+        std::vector<Quadric> Quadrics;     // per vertex, grows with the collapses
+        std::vector<bool> Locked;
+        float Error; // largest distance error of a collapse so far, RMS over its planes
+
+        MeshSimplifier();
+
+        void init(const std::vector<glm::vec3>& positions, const std::vector<glm::vec3>& normals,
+                  const std::vector<unsigned int>& indices);
+
+        // Collapse until at most "target" indices are left, or no collapse is
+        // allowed. False if the index count did not change.
+        bool simplify(unsigned int target);
+
+        // True if moving vertex "from" onto "to" flips or degenerates a triangle
+        bool flips(unsigned int from, unsigned int to, const std::vector<unsigned int>& offsets,
+                   const std::vector<unsigned int>& triangles) const;
+};
+
+#endif
@@ -0,0 +1,177 @@
+#ifndef SOFTWARERENDERER_H
+#define SOFTWARERENDERER_H
+
+#include "Helpers.h"
+#include "ThreadPool.h"
+#include "ClusteredLights.h"
+#include "ShadowMap.h"
+
+#include <vector>
+#include <stdint.h>
+#include <glm/glm.hpp>  // glm::vec2
+#include <glm/vec3.hpp> // glm::vec3
+#include <glm/vec4.hpp> // glm::vec4
+#include <glm/mat4x4.hpp> // glm::mat4
+
+// Screen tiles of the software renderer, each rasterized by one thread
+const int SOFTWARE_TILE_WIDTH = 64;
+const int SOFTWARE_TILE_HEIGHT = 32;
+
+// The draws are transformed in this many jobs of about the same number of
+// primitives, whatever the number of threads, so that the tiles read the
+// primitives in draw order and the images do not depend on the threads
+const int SOFTWARE_GEOMETRY_JOBS = 64;
+
+// Shading of a draw, as the shader variants of the same names
+enum SoftwareShading{
+    SOFTWARE_UNLIT,     // Color
+    SOFTWARE_FLAT,      // lit, face normal
+    SOFTWARE_PHONG,     // lit, interpolated vertex normals
+    SOFTWARE_WIREFRAME  // Color, lines only
+};
+
+// Passes a draw takes part in
+enum SoftwarePass{
+    SOFTWARE_PASS_IMAGE = 1,
+    SOFTWARE_PASS_SHADOW = 2 // triangles cast shadows from light 0
+};
+
+// Count indices from Indices over the vertex arrays, placed by Model
+struct SoftwareDraw{
+    GLenum Primitive; // GL_TRIANGLES or GL_LINES
+    SoftwareShading Shading;
+    const std::vector<glm::vec3>* Positions;
+    const std::vector<glm::vec3>* Colors;
+    const std::vector<glm::vec3>* Normals;
+    const std::vector<float>* Occlusion; // of the ambient light, NULL for none
+    const unsigned int* Indices;
+    unsigned int Count;
+    // Two face normals per line, to keep only the creases, borders and
+    // silhouettes like the FEATURE_EDGES variants, NULL to draw every line
+    const glm::vec4* EdgeFaces;
+    glm::mat4 Model;
+    glm::vec3 Color;
+    unsigned int Passes; // SoftwarePass flags
+};
+
+// The uniforms of a frame
+struct SoftwareFrame{
+    glm::mat4 View;
+    glm::mat4 Perspective;
+    glm::vec3 ViewPosition;
+    glm::vec3 Ambient;
+    glm::vec3 Background;
+    const std::vector<PointLight>* Lights; // light 0 casts the shadows
+    int ShadowPcf;                         // PCF kernel radius in texels
+};
+
+// A vertex after the vertex stage: clip coordinates, window coordinates
+// (y up) and depth with 1/w once in front of the camera, and the inputs
+// of the lighting
+struct SoftwareVertex{
+    glm::vec4 Clip;
+    float X, Y, Z, InvW;
+    glm::vec3 Position; // world
+    glm::vec3 Color;
+    glm::vec3 Normal;   // world
+    float Occlusion;
+};
+
+// A triangle or a line of a geometry job, over its vertices, with the
+// pixels its bounds touch. Triangles are counter clockwise on screen.
+struct SoftwarePrimitive{
+    unsigned int V[3];
+    unsigned int Draw;
+    int MinX, MinY, MaxX, MaxY;
+};
+
+// The primitives of one geometry job, and the ones of each tile
+struct SoftwareJob{
+    std::vector<SoftwareVertex> Vertices;
+    std::vector<SoftwarePrimitive> Triangles;
+    std::vector<SoftwarePrimitive> Lines;
+    std::vector<std::vector<unsigned int> > TriangleBins;
+    std::vector<std::vector<unsigned int> > LineBins;
+    std::vector<unsigned int> Cache; // vertex of each draw vertex + 1, 0 if not transformed
+    std::vector<unsigned int> Used;  // entries of Cache to reset
+};
+
+// The image of a frame rendered on the CPU, without any GL context: the
+// same geometry, modes and lighting as the scene shaders, for machines
+// without a GPU and as a deterministic reference.
+//
+// The draws are transformed and clipped in SOFTWARE_GEOMETRY_JOBS jobs,
+// each binning its primitives into the screen tiles they touch. Every
+// tile is then rendered by one thread of the pool from a depth and
+// triangle buffer of its own: the triangles are rasterized with edge
+// functions, four pixels at a time with SSE, each pixel is shaded once
+// from the triangle left in front, and the lines are drawn over them.
+// The shadows of light 0 come from a cube of depth buffers rendered the
+// same way, looked up like the samplerCubeShadow of the shaders.
+class SoftwareRenderer{
+    public:
+        int Width, Height;
+        std::vector<unsigned char> Pixels; // RGB rows from top to bottom, like HeadlessContext::read_pixels
+        std::vector<SoftwareDraw> Draws;
+        ThreadPool* Pool;
+
+        // Only the face matrices and the depth scale of a CPU copy
+        CubeShadowMap Shadow;
+        std::vector<float> ShadowDepth; // 6 faces of Size x Size window depths
+
+        // Frame being rendered
+        SoftwareFrame Frame;
+        bool Orthographic;
+        glm::mat4 ViewProjection;
+
+        // Pass being rendered, into the image or a shadow face
+        int TargetWidth, TargetHeight;
+        int TilesX, TilesY;
+        std::vector<unsigned int> PassDraws;  // draws of the pass
+        std::vector<unsigned long> PassFirst; // their first primitive, counted across them
+        std::vector<SoftwareJob> Jobs;
+
+        // Tile buffers of each thread
+        std::vector<std::vector<float> > TileDepth;
+        std::vector<std::vector<uint32_t> > TileTriangle; // job << 26 | triangle, ~0 if none
+        std::vector<std::vector<glm::vec3> > TileColor;
+
+        SoftwareRenderer();
+
+        void init(int width, int height, ThreadPool* pool);
+
+        // Drop the draws of the last frame
+        void clear();
+
+        void add(const SoftwareDraw& draw);
+
+        // Render the draws into Pixels
+        void render(const SoftwareFrame& frame);
+
+        // Vertex stage of the draws of a pass on the target, and the
+        // bins of its tiles
+        void transform(const glm::mat4& view_projection, bool shadow_pass);
+
+        // One geometry job: the primitives [first, first+count) of the pass
+        void transform_job(SoftwareJob& job, unsigned long first, unsigned long count,
+                           const glm::mat4& view_projection, bool shadow_pass);
+
+        // Depth and front triangle of the pixels of one tile, the depth of
+        // the triangles pushed back like glPolygonOffset(slope, units)
+        // with units in window depth
+        void rasterize_tile(int tile, float* depth, uint32_t* front, float units, float slope);
+
+        // Shade the pixels of one tile, draw its lines and store it
+        void shade_tile(int tile, float* depth, const uint32_t* front);
+
+        // Lighting of a point, like the fragment shader
+        glm::vec3 shade(const glm::vec3& position, const glm::vec3& normal, const glm::vec3& color, float occlusion) const;
+
+        // Fraction of light 0 reaching a point, fromlight going from the light to it
+        float shadow(glm::vec3 fromlight, const glm::vec3& normal) const;
+
+        // The cube faces seen by light 0
+        void render_shadows();
+};
+
+#endif
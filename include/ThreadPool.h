@@ -0,0 +1,71 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <stdint.h>
+
+// The jobs left to a thread in run(), padded to a cache line since the
+// other threads read it when they steal
+struct JobRange{
+    std::atomic<uint64_t> Jobs; // next job in the low 32 bits, end in the high ones
+    char Padding[64 - sizeof(std::atomic<uint64_t>)];
+};
+
+// Worker threads running the jobs of a parallel loop. run() deals the job
+// indices out in one contiguous range per thread, the workers and the
+// calling thread, and each thread runs its range from the front. A thread
+// that runs out steals the back half of the range of another one, so
+// neighbouring jobs mostly stay on one thread and uneven jobs still
+// balance. It returns once every job is done, so the jobs may use the
+// caller's data without further synchronization.
+class ThreadPool{
+    public:
+        std::vector<std::thread> Workers;
+        std::mutex Mutex;
+        std::condition_variable Wake;
+        std::condition_variable Done;
+        unsigned int Generation; // counts the loops, wakes the workers for a new one
+        unsigned int Busy;       // workers still in the current loop
+        bool Quit;
+
+        // The current loop, Ranges[i] for thread i
+        const std::function<void(unsigned int)>* Job;
+        unsigned int JobCount;
+        std::vector<JobRange> Ranges;
+
+        ThreadPool();
+        ~ThreadPool();
+
+        // Start the workers, by default one less than the hardware threads
+        // since the caller works too. Without init() run() is serial.
+        void init(unsigned int workers = 0);
+
+        // job(i) for every i in [0, count), in any order and any thread
+        void run(unsigned int count, const std::function<void(unsigned int)>& job);
+
+        // Threads taking part in run(), the caller included
+        unsigned int size() const { return Workers.size() + 1; }
+
+        // Index in [0, size()) of the thread running a job, 0 for the caller,
+        // to give each thread its own scratch data
+        static unsigned int worker();
+
+        void free();
+
+        // Body of the workers
+        void work(unsigned int index);
+
+        // Run the range of thread index, then stolen ones, until none is left
+        void run_jobs(unsigned int index);
+
+        // Move the back half of the range of another thread to thread
+        // index, false if every range is empty
+        bool steal(unsigned int index);
+};
+
+#endif
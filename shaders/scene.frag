@@ -0,0 +1,114 @@
+// Scene fragment shader. The #version line and the #define lines of the
+// variant are prepended by ShaderLibrary, see ShaderLibrary.h.
+// Edits are picked up while the editor runs.
+
+#if defined(FLAT) || defined(PHONG)
+in vec3 f_color;
+in vec3 f_position;
+in float f_view_depth;
+in float f_occlusion;
+uniform vec3 viewPos;
+uniform vec3 ambient;
+
+// Clustered lights, see ClusteredLights.h
+uniform samplerBuffer lights;          // position and radius, color
+uniform isamplerBuffer light_clusters; // first index and count per cluster
+uniform isamplerBuffer light_indices;
+uniform ivec3 cluster_grid;
+uniform vec2 cluster_tile;             // tile size in pixels
+uniform float cluster_scale;           // slice = log(depth) * scale + bias
+uniform float cluster_bias;
+
+// Cube shadow map of light 0, see ShadowMap.h
+uniform samplerCubeShadow shadow_map;
+uniform vec2 shadow_depth;  // reference depth = x - y / distance along the major axis
+uniform float shadow_texel; // texel size at unit distance
+uniform int shadow_pcf;     // PCF kernel radius in texels
+
+// Fraction of the light reaching the fragment, fromlight going from the light to it
+float shadow(vec3 fromlight, vec3 norm)
+{
+    vec3 a = abs(fromlight);
+    float m = max(a.x, max(a.y, a.z));
+
+    // push the lookup off the surface by about one texel against acne
+    fromlight += norm * (1.5 * shadow_texel * m);
+    a = abs(fromlight);
+    m = max(a.x, max(a.y, a.z));
+    float reference = shadow_depth.x - shadow_depth.y / (0.995 * m);
+
+    // the kernel spans the two axes of the face
+    vec3 u = a.x >= a.y && a.x >= a.z ? vec3(0.0, 1.0, 0.0) : vec3(1.0, 0.0, 0.0);
+    vec3 v = a.z >= a.x && a.z >= a.y ? vec3(0.0, 1.0, 0.0) : vec3(0.0, 0.0, 1.0);
+    u *= shadow_texel * m;
+    v *= shadow_texel * m;
+    float lit = 0.0;
+    for(int i = -shadow_pcf; i <= shadow_pcf; i++)
+        for(int j = -shadow_pcf; j <= shadow_pcf; j++)
+            lit += texture(shadow_map, vec4(fromlight + float(i) * u + float(j) * v, reference));
+    float width = float(2 * shadow_pcf + 1);
+    return lit / (width * width);
+}
+#endif
+#ifdef PHONG
+in vec3 f_normal;
+#endif
+#ifdef UNLIT
+flat in vec4 f_object_color;
+#endif
+#ifdef WIREFRAME
+uniform vec3 uni_color;
+#endif
+
+out vec4 outColor;
+
+void main()
+{
+#if defined(PICKING)
+    outColor = vec4(0.0);
+#elif defined(WIREFRAME)
+    outColor = vec4(uni_color, 1.0);
+#elif defined(UNLIT)
+    outColor = vec4(f_object_color.rgb, 1.0);
+#else
+    float specularStrength = 0.5;
+#ifdef FLAT
+    vec3 norm = normalize(cross(dFdx(f_position), dFdy(f_position)));
+#else
+    vec3 norm = normalize(f_normal);
+#endif
+    vec3 viewdir = normalize(viewPos - f_position);
+
+    // Only the lights of the cluster of this fragment
+    ivec3 cell = ivec3(ivec2(gl_FragCoord.xy / cluster_tile), int(log(max(f_view_depth, 1e-6)) * cluster_scale + cluster_bias));
+    cell = clamp(cell, ivec3(0), cluster_grid - 1);
+    int cluster = (cell.z * cluster_grid.y + cell.y) * cluster_grid.x + cell.x;
+    int first = texelFetch(light_clusters, 2 * cluster).r;
+    int count = texelFetch(light_clusters, 2 * cluster + 1).r;
+
+    vec3 lighting = ambient * f_occlusion;
+    for(int i = 0; i < count; i++){
+        int light = texelFetch(light_indices, first + i).r;
+        vec4 position_radius = texelFetch(lights, 2 * light);
+        vec3 lightcolor = texelFetch(lights, 2 * light + 1).rgb;
+
+        vec3 tolight = position_radius.xyz - f_position;
+        float attenuation = 1.0;
+        if(position_radius.w > 0.0){
+            float falloff = clamp(1.0 - dot(tolight, tolight) / (position_radius.w * position_radius.w), 0.0, 1.0);
+            attenuation = falloff * falloff;
+        }
+        if(light == 0)
+            attenuation *= shadow(-tolight, norm);
+
+        vec3 lightdir = normalize(tolight);
+        float diff = max(dot(norm, lightdir), 0.0);
+        vec3 diffuse = diff * lightcolor;
+        vec3 reflectdir = reflect(-lightdir, norm);
+        float spec = pow(max(dot(viewdir,reflectdir), 0.0), 30);
+        vec3 specular = specularStrength * spec * lightcolor;
+        lighting += attenuation * (diffuse + specular);
+    }
+    outColor = vec4(lighting * f_color, 1.0);
+#endif
+}
@@ -0,0 +1,83 @@
+// Scene vertex shader. The #version line and the #define lines of the
+// variant are prepended by ShaderLibrary, see ShaderLibrary.h.
+// Edits are picked up while the editor runs.
+
+in vec3 position;
+in vec3 color;
+in vec3 normal;
+in float occlusion; // baked ambient occlusion, see Mesh::AO
+
+#ifdef FEATURE_EDGES
+in vec4 edge_face_a; // normal of the first face, EdgeKind in w (see MeshEdges.h)
+in vec3 edge_face_b;
+in vec3 edge_center;
+uniform vec3 viewPos;
+#endif
+
+#ifdef INSTANCED
+uniform isamplerBuffer draw_ids;
+uniform int draw_base;
+#else
+in int object_id;
+#endif
+
+#if defined(FLAT) || defined(PHONG)
+out vec3 f_position;
+out vec3 f_color;
+out float f_view_depth;
+out float f_occlusion;
+#endif
+#ifdef PHONG
+out vec3 f_normal;
+#endif
+#ifdef UNLIT
+flat out vec4 f_object_color;
+#endif
+
+uniform mat4 view;
+uniform mat4 perspective;
+uniform samplerBuffer object_data;
+
+void main()
+{
+#ifdef INSTANCED
+    int object = texelFetch(draw_ids, draw_base + gl_InstanceID).r;
+#else
+    int object = object_id;
+#endif
+    int base = object * 8;
+    mat4 model = mat4(texelFetch(object_data, base),
+                      texelFetch(object_data, base + 1),
+                      texelFetch(object_data, base + 2),
+                      texelFetch(object_data, base + 3));
+    vec4 view_position = view * model * vec4(position, 1.0);
+    gl_Position = perspective * view_position;
+#if defined(FLAT) || defined(PHONG)
+    f_color = color;
+    f_position = vec3(model * vec4(position, 1.0));
+    f_view_depth = -view_position.z;
+    f_occlusion = occlusion;
+#endif
+#ifdef PHONG
+    mat3 normal_matrix = mat3(texelFetch(object_data, base + 4).xyz,
+                              texelFetch(object_data, base + 5).xyz,
+                              texelFetch(object_data, base + 6).xyz);
+    f_normal = normal_matrix * normal;
+#endif
+#ifdef UNLIT
+    f_object_color = texelFetch(object_data, base + 7);
+#endif
+#ifdef FEATURE_EDGES
+    // Only creases, borders and silhouettes are drawn, the other edges are
+    // moved out of the clip volume. Both ends decide from the edge midpoint.
+    mat3 edge_normal_matrix = mat3(texelFetch(object_data, base + 4).xyz,
+                                   texelFetch(object_data, base + 5).xyz,
+                                   texelFetch(object_data, base + 6).xyz);
+    vec3 to_eye = perspective[3][3] == 0.0 ? viewPos - vec3(model * vec4(edge_center, 1.0))
+                                           : vec3(view[0][2], view[1][2], view[2][2]);
+    float facing_a = dot(edge_normal_matrix * edge_face_a.xyz, to_eye);
+    float facing_b = dot(edge_normal_matrix * edge_face_b, to_eye);
+    if(edge_face_a.w < 1.5 && facing_a * facing_b > 0.0)
+        gl_Position = vec4(0.0, 0.0, 2.0, 1.0);
+#endif
+}
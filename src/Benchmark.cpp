@@ -0,0 +1,429 @@
+#include "Benchmark.h"
+#include "Bvh.h"
+#include "SceneFile.h"
+#include "ThreadPool.h"
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+#include <cstdio>
+#include <random>
+#include <cmath>
+#include <chrono>
+#include <thread>
+#include <glm/gtc/matrix_transform.hpp>
+
+BenchOptions::BenchOptions(){
+    Objects = 200;
+    Seed = 1;
+    Frames = 300;
+    Warmup = 30;
+    Width = 1280;
+    Height = 720;
+    Orbit = 3.5f;
+    DataDir = "data";
+    Lod = true;
+    OptimizeMeshes = true;
+    BakeAo = true;
+    FeatureEdges = false;
+    Meshlets = true;
+    Occlusion = true;
+    Queries = false;
+    Renderer = "gl";
+    Bvh = false;
+    Autosave = 0;
+}
+
+
+static void print_usage(const char* program){
+    std::cerr << "usage: " << program << " [--objects N] [--seed S] [--frames N] [--warmup N] [--size WxH] [--orbit R]"
+              << " [--data DIR] [--output FILE.json] [--label TEXT] [--trace FILE.json] [--lod on|off]"
+              << " [--optimize-meshes on|off] [--bake-ao on|off] [--edges all|feature] [--meshlets on|off]"
+              << " [--occlusion on|off] [--queries on|off] [--renderer gl|cpu] [--bvh on|off] [--scene FILE]"
+              << " [--autosave SECONDS]" << std::endl;
+}
+
+
+bool parse_bench_options(int argc, char* argv[], BenchOptions& options){
+    for(int i = 1;i < argc;i++){
+        std::string arg(argv[i]);
+        if(i + 1 >= argc){
+            print_usage(argv[0]);
+            return false;
+        }
+        std::string value(argv[++i]);
+        if(arg == "--objects")
+            options.Objects = atoi(value.c_str());
+        else if(arg == "--seed")
+            options.Seed = strtoul(value.c_str(),NULL,10);
+        else if(arg == "--frames")
+            options.Frames = atoi(value.c_str());
+        else if(arg == "--warmup")
+            options.Warmup = atoi(value.c_str());
+        else if(arg == "--size"){
+            if(sscanf(value.c_str(),"%dx%d",&options.Width,&options.Height) != 2 || options.Width <= 0 || options.Height <= 0){
+                std::cerr << "bad size " << value << ", expected WxH" << std::endl;
+                return false;
+            }
+        }
+        else if(arg == "--orbit")
+            options.Orbit = atof(value.c_str());
+        else if(arg == "--data")
+            options.DataDir = value;
+        else if(arg == "--output")
+            options.OutputPath = value;
+        else if(arg == "--label")
+            options.Label = value;
+        else if(arg == "--trace")
+            options.TracePath = value;
+        else if(arg == "--lod" && (value == "on" || value == "off"))
+            options.Lod = value == "on";
+        else if(arg == "--optimize-meshes" && (value == "on" || value == "off"))
+            options.OptimizeMeshes = value == "on";
+        else if(arg == "--bake-ao" && (value == "on" || value == "off"))
+            options.BakeAo = value == "on";
+        else if(arg == "--edges" && (value == "all" || value == "feature"))
+            options.FeatureEdges = value == "feature";
+        else if(arg == "--meshlets" && (value == "on" || value == "off"))
+            options.Meshlets = value == "on";
+        else if(arg == "--occlusion" && (value == "on" || value == "off"))
+            options.Occlusion = value == "on";
+        else if(arg == "--queries" && (value == "on" || value == "off"))
+            options.Queries = value == "on";
+        else if(arg == "--renderer" && (value == "gl" || value == "cpu"))
+            options.Renderer = value;
+        else if(arg == "--bvh" && (value == "on" || value == "off"))
+            options.Bvh = value == "on";
+        else if(arg == "--scene")
+            options.ScenePath = value;
+        else if(arg == "--autosave")
+            options.Autosave = std::max(atof(value.c_str()),0.0);
+        else{
+            print_usage(argv[0]);
+            return false;
+        }
+    }
+    if(options.Objects < 0 || options.Frames <= 0 || options.Warmup < 0 || options.Orbit <= 0){
+        print_usage(argv[0]);
+        return false;
+    }
+    return true;
+}
+
+
+// Uniform in [0,1). The standard distributions differ between libraries,
+// the generator itself does not.
+static float unit_random(std::mt19937& generator){
+    return (generator() >> 8) * (1.0f / 16777216.0f);
+}
+
+
+void generate_bench_scene(std::vector<MeshObject>& objects, const BenchOptions& options){
+    const char* files[3] = {"cube.off", "bumpy_cube.off", "bunny.off"};
+    const Renderingmode modes[3] = {WIREFRAME, FLAT, PHONG};
+    std::mt19937 generator(options.Seed);
+    for(int i = 0;i < options.Objects;i++){
+        int file = generator() % 3;
+        MeshObject object(options.DataDir + "/" + files[file]);
+        object.Rmode = modes[generator() % 3];
+        float x = unit_random(generator), y = unit_random(generator), z = unit_random(generator);
+        object.TranslateVector = glm::vec3(-2.0f + 4.0f * x,-0.5f + y,-2.0f + 4.0f * z);
+        x = unit_random(generator), y = unit_random(generator), z = unit_random(generator);
+        object.RotateVector = 360.0f * glm::vec3(x,y,z);
+        float scale = 0.2f + 0.2f * unit_random(generator);
+        object.ScaleVector = glm::vec3(scale,scale,scale);
+        objects.push_back(object);
+    }
+}
+
+
+glm::vec3 bench_camera(int frame, int frames, float radius){
+    float angle = 2.0f * 3.14159265f * frame / frames;
+    return glm::vec3(radius * cos(angle),1.5f * radius / 3.5f,radius * sin(angle));
+}
+
+
+double percentile(std::vector<double> values, double p){
+    if(values.empty())
+        return 0;
+    std::sort(values.begin(),values.end());
+    int rank = int(p * values.size() + 0.999999);
+    rank = std::min(std::max(rank,1),int(values.size()));
+    return values[rank - 1];
+}
+
+
+// "name": {"mean": ., "p50": ., "p99": ., "min": ., "max": .}
+static void write_distribution(std::ostream& out, const char* name, const std::vector<double>& values){
+    out << "  \"" << name << "\": ";
+    if(values.empty()){
+        out << "null,\n";
+        return;
+    }
+    double sum = 0;
+    for(int i = 0;i < values.size();i++)
+        sum += values[i];
+    out << "{\"mean\": " << sum / values.size() << ", \"p50\": " << percentile(values,0.5)
+        << ", \"p99\": " << percentile(values,0.99) << ", \"min\": " << *std::min_element(values.begin(),values.end())
+        << ", \"max\": " << *std::max_element(values.begin(),values.end()) << "},\n";
+}
+
+
+// Free text inside a JSON string, kept printable and without quotes
+static std::string json_text(const std::string& text){
+    std::string out;
+    for(int i = 0;i < text.size();i++){
+        if(text[i] != '"' && text[i] != '\\' && text[i] >= ' ')
+            out += text[i];
+    }
+    return out;
+}
+
+
+bool write_bench_results(const BenchOptions& options, const std::vector<FrameTiming>& timings, const std::string& renderer){
+    std::vector<double> frame_ms, cpu_ms, gpu_ms;
+    double draw_calls = 0, triangles = 0, lines = 0, bytes = 0;
+    for(int i = 0;i < timings.size();i++){
+        frame_ms.push_back(timings[i].FrameMs);
+        cpu_ms.push_back(timings[i].CpuMs);
+        if(timings[i].GpuMs >= 0)
+            gpu_ms.push_back(timings[i].GpuMs);
+        draw_calls += timings[i].Work.DrawCalls;
+        triangles += timings[i].Work.Triangles;
+        lines += timings[i].Work.Lines;
+        bytes += timings[i].Work.BytesUploaded;
+    }
+    int count = std::max(int(timings.size()),1);
+
+    std::cout << "bench: " << options.Objects << " objects, " << timings.size() << " frames, frame "
+              << percentile(frame_ms,0.5) << " ms p50, " << percentile(frame_ms,0.99) << " ms p99, "
+              << draw_calls / count << " draws, " << triangles / count << " triangles, " << lines / count << " lines, "
+              << bytes / count << " bytes uploaded per frame" << std::endl;
+    if(options.OutputPath.empty())
+        return true;
+
+    std::ofstream fout(options.OutputPath.c_str(), std::ios::out);
+    if(!fout){
+        std::cerr << "Cannot write " << options.OutputPath << std::endl;
+        return false;
+    }
+
+    fout << "{\n";
+    fout << "  \"label\": \"" << json_text(options.Label) << "\",\n";
+    fout << "  \"renderer\": \"" << json_text(renderer) << "\",\n";
+    fout << "  \"objects\": " << options.Objects << ",\n";
+    fout << "  \"seed\": " << options.Seed << ",\n";
+    fout << "  \"width\": " << options.Width << ",\n";
+    fout << "  \"height\": " << options.Height << ",\n";
+    fout << "  \"orbit\": " << options.Orbit << ",\n";
+    fout << "  \"warmup\": " << options.Warmup << ",\n";
+    fout << "  \"lod\": " << (options.Lod ? "true" : "false") << ",\n";
+    fout << "  \"optimize_meshes\": " << (options.OptimizeMeshes ? "true" : "false") << ",\n";
+    fout << "  \"bake_ao\": " << (options.BakeAo ? "true" : "false") << ",\n";
+    fout << "  \"edges\": \"" << (options.FeatureEdges ? "feature" : "all") << "\",\n";
+    fout << "  \"meshlets\": " << (options.Meshlets ? "true" : "false") << ",\n";
+    fout << "  \"occlusion\": " << (options.Occlusion ? "true" : "false") << ",\n";
+    fout << "  \"queries\": " << (options.Queries ? "true" : "false") << ",\n";
+    fout << "  \"frame_count\": " << timings.size() << ",\n";
+    write_distribution(fout,"frame_ms",frame_ms);
+    write_distribution(fout,"cpu_ms",cpu_ms);
+    write_distribution(fout,"gpu_ms",gpu_ms);
+    fout << "  \"draw_calls_per_frame\": " << draw_calls / count << ",\n";
+    fout << "  \"triangles_per_frame\": " << triangles / count << ",\n";
+    fout << "  \"lines_per_frame\": " << lines / count << ",\n";
+    fout << "  \"bytes_uploaded_per_frame\": " << bytes / count << ",\n";
+    fout << "  \"bytes_uploaded\": " << (unsigned long long) bytes << ",\n";
+    fout << "  \"frames\": [\n";
+    write_frame_timings(fout,timings,"    ");
+    fout << "  ]\n}\n";
+    return (bool) fout;
+}
+
+
+// One hierarchy build at a thread count: the mean of the builds done in
+// about a second, at least three
+struct BvhBuildTiming{
+    unsigned int Threads;
+    int Builds;
+    double Ms;
+};
+
+
+bool run_bvh_bench(const BenchOptions& options){
+    std::vector<MeshObject> objects;
+    try{
+        generate_bench_scene(objects,options);
+    }
+    catch(const char* error){
+        std::cerr << "Cannot load the benchmark meshes from " << options.DataDir << ": " << error << std::endl;
+        return false;
+    }
+
+    // every triangle of the scene in world space, as one mesh
+    std::vector<glm::vec3> positions;
+    std::vector<unsigned int> faces;
+    for(int i = 0;i < objects.size();i++){
+        const Mesh& mesh = objects[i].mesh();
+        glm::mat4 model = objects[i].get_model_matrix();
+        unsigned int base = positions.size();
+        for(int v = 0;v < mesh.V.size();v++)
+            positions.push_back(glm::vec3(model * glm::vec4(mesh.V[v],1.0f)));
+        for(int f = 0;f < mesh.F.size();f++)
+            faces.push_back(base + mesh.F[f]);
+    }
+    unsigned int triangles = faces.size() / 3;
+
+    std::vector<unsigned int> thread_counts;
+    unsigned int hardware = std::max(std::thread::hardware_concurrency(),1u);
+    for(unsigned int t = 1;t < hardware;t *= 2)
+        thread_counts.push_back(t);
+    thread_counts.push_back(hardware);
+
+    std::vector<BvhBuildTiming> builds;
+    MeshBvh bvh;
+    for(int c = 0;c < thread_counts.size();c++){
+        ThreadPool pool;
+        if(thread_counts[c] > 1)
+            pool.init(thread_counts[c] - 1);
+        BvhBuildTiming timing;
+        timing.Threads = thread_counts[c];
+        timing.Builds = 0;
+        auto start = std::chrono::high_resolution_clock::now();
+        double seconds = 0;
+        while(timing.Builds < 3 || seconds < 1.0){
+            bvh.build(positions,faces,&pool);
+            timing.Builds++;
+            seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+        }
+        timing.Ms = 1000.0 * seconds / timing.Builds;
+        builds.push_back(timing);
+        std::cout << "bvh: " << triangles << " triangles, " << timing.Threads << (timing.Threads == 1 ? " thread " : " threads ")
+                  << timing.Ms << " ms, " << triangles / timing.Ms / 1000.0 << " Mtriangles/s, speedup "
+                  << builds[0].Ms / timing.Ms << std::endl;
+    }
+    float sah_cost = bvh_cost(bvh.Nodes);
+
+    // the scene hierarchy over the objects, then a refit after moving all of them
+    SceneBvh scene;
+    for(int i = 0;i < objects.size();i++){
+        BvhInstance instance;
+        instance.Bvh = &objects[i].mesh().Bvh;
+        instance.ObjectToWorld = objects[i].get_model_matrix();
+        instance.WorldToObject = glm::inverse(instance.ObjectToWorld);
+        instance.Object = i;
+        instance.CastsShadows = true;
+        scene.Instances.push_back(instance);
+    }
+    int rounds = 100;
+    auto start = std::chrono::high_resolution_clock::now();
+    for(int r = 0;r < rounds;r++)
+        scene.build();
+    double tlas_build_ms = 1000.0 * std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count() / rounds;
+    unsigned int rebuilds = scene.Builds;
+    start = std::chrono::high_resolution_clock::now();
+    for(int r = 0;r < rounds;r++){
+        glm::mat4 shift = glm::translate(glm::mat4(1.0f),glm::vec3(0.001f,0.0f,0.0f));
+        for(int i = 0;i < scene.Instances.size();i++)
+            scene.move(i,shift * scene.Instances[i].ObjectToWorld);
+        scene.refit();
+    }
+    double tlas_refit_ms = 1000.0 * std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count() / rounds;
+    rebuilds = scene.Builds - rebuilds;
+    std::cout << "bvh: scene of " << objects.size() << " objects, build " << tlas_build_ms << " ms, move and refit "
+              << tlas_refit_ms << " ms, " << rebuilds << " rebuilds in " << rounds << " refits" << std::endl;
+    if(options.OutputPath.empty())
+        return true;
+
+    std::ofstream fout(options.OutputPath.c_str(), std::ios::out);
+    if(!fout){
+        std::cerr << "Cannot write " << options.OutputPath << std::endl;
+        return false;
+    }
+    fout << "{\n";
+    fout << "  \"label\": \"" << json_text(options.Label) << "\",\n";
+    fout << "  \"objects\": " << options.Objects << ",\n";
+    fout << "  \"seed\": " << options.Seed << ",\n";
+    fout << "  \"triangles\": " << triangles << ",\n";
+    fout << "  \"sah_cost\": " << sah_cost << ",\n";
+    fout << "  \"builds\": [\n";
+    for(int i = 0;i < builds.size();i++){
+        fout << "    {\"threads\": " << builds[i].Threads << ", \"builds\": " << builds[i].Builds << ", \"ms\": " << builds[i].Ms
+             << ", \"triangles_per_s\": " << triangles / builds[i].Ms * 1000.0 << ", \"speedup\": " << builds[0].Ms / builds[i].Ms
+             << "}" << (i + 1 < builds.size() ? "," : "") << "\n";
+    }
+    fout << "  ],\n";
+    fout << "  \"tlas\": {\"instances\": " << objects.size() << ", \"build_ms\": " << tlas_build_ms
+         << ", \"refit_ms\": " << tlas_refit_ms << ", \"rebuilds\": " << rebuilds << ", \"refits\": " << rounds << "}\n";
+    fout << "}\n";
+    return (bool) fout;
+}
+
+
+bool run_scene_bench(const BenchOptions& options){
+    std::vector<MeshObject> objects;
+    try{
+        generate_bench_scene(objects,options);
+    }
+    catch(const char* error){
+        std::cerr << "Cannot load the benchmark meshes from " << options.DataDir << ": " << error << std::endl;
+        return false;
+    }
+    int selected = objects.size() / 2;
+
+    auto start = std::chrono::high_resolution_clock::now();
+    if(!save_scene(options.ScenePath,objects,selected))
+        return false;
+    double save_ms = std::chrono::duration<double,std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    std::ifstream fin(options.ScenePath.c_str(), std::ios::in | std::ios::binary | std::ios::ate);
+    double megabytes = fin.tellg() / 1048576.0;
+    fin.close();
+
+    // the median of a few opens, the file is in the page cache after the first
+    std::vector<double> open_ms;
+    std::vector<MeshObject> opened;
+    int opened_selection = -1;
+    for(int r = 0;r < 5;r++){
+        std::vector<MeshObject>().swap(opened);
+        start = std::chrono::high_resolution_clock::now();
+        if(!open_scene(options.ScenePath,opened,opened_selection))
+            return false;
+        open_ms.push_back(std::chrono::duration<double,std::milli>(std::chrono::high_resolution_clock::now() - start).count());
+    }
+    double open_median = percentile(open_ms,0.5);
+
+    bool same = opened.size() == objects.size() && opened_selection == selected;
+    for(int i = 0;same && i < objects.size();i++){
+        same = opened[i].MeshId == objects[i].MeshId && opened[i].Rmode == objects[i].Rmode
+            && opened[i].TranslateVector == objects[i].TranslateVector && opened[i].RotateVector == objects[i].RotateVector
+            && opened[i].ScaleVector == objects[i].ScaleVector && opened[i].UnitScale == objects[i].UnitScale
+            && opened[i].BaryCenter == objects[i].BaryCenter;
+    }
+    std::cout << "scene: " << objects.size() << " objects, " << megabytes << " MB, save " << save_ms << " ms, open "
+              << open_median << " ms (first " << open_ms[0] << " ms), " << (same ? "unchanged" : "CHANGED") << std::endl;
+    if(!same)
+        return false;
+    if(options.OutputPath.empty())
+        return true;
+
+    std::ofstream fout(options.OutputPath.c_str(), std::ios::out);
+    if(!fout){
+        std::cerr << "Cannot write " << options.OutputPath << std::endl;
+        return false;
+    }
+    fout << "{\n";
+    fout << "  \"label\": \"" << json_text(options.Label) << "\",\n";
+    fout << "  \"objects\": " << options.Objects << ",\n";
+    fout << "  \"seed\": " << options.Seed << ",\n";
+    fout << "  \"megabytes\": " << megabytes << ",\n";
+    fout << "  \"save_ms\": " << save_ms << ",\n";
+    fout << "  \"open_ms\": [";
+    for(int i = 0;i < open_ms.size();i++)
+        fout << (i > 0 ? ", " : "") << open_ms[i];
+    fout << "],\n";
+    fout << "  \"open_median_ms\": " << open_median << "\n";
+    fout << "}\n";
+    return (bool) fout;
+}
@@ -0,0 +1,455 @@
+#include "Bvh.h"
+
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+// Primitives binned by one job of a parallel split
+static const unsigned int BVH_CHUNK = 1024;
+
+static void run_parallel(ThreadPool* pool, unsigned int count, const std::function<void(unsigned int)>& job){
+    if(pool)
+        pool->run(count,job);
+    else{
+        for(unsigned int i = 0;i < count;i++)
+            job(i);
+    }
+}
+
+
+// Component-wise, inlined where glm::min and glm::max call through a
+// function pointer per component
+static inline glm::vec3 min3(const glm::vec3& a, const glm::vec3& b){
+    return glm::vec3(a.x < b.x ? a.x : b.x,a.y < b.y ? a.y : b.y,a.z < b.z ? a.z : b.z);
+}
+
+
+static inline glm::vec3 max3(const glm::vec3& a, const glm::vec3& b){
+    return glm::vec3(a.x > b.x ? a.x : b.x,a.y > b.y ? a.y : b.y,a.z > b.z ? a.z : b.z);
+}
+
+
+static float box_area(const glm::vec3& lower, const glm::vec3& upper){
+    glm::vec3 d = upper - lower;
+    if(d.x < 0 || d.y < 0 || d.z < 0)
+        return 0.0f;
+    return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+}
+
+
+// The boxes of a range of primitives and the bins of their centers. The
+// bins stay empty until bin_range() once the bounds are known.
+struct BvhBins{
+    glm::vec3 Min, Max;             // of the boxes
+    glm::vec3 CenterMin, CenterMax; // of the centers
+    unsigned int Count[3][BVH_BINS];
+    glm::vec3 BinMin[3][BVH_BINS], BinMax[3][BVH_BINS];
+
+    void clear(){
+        Min = CenterMin = glm::vec3(1e30f);
+        Max = CenterMax = glm::vec3(-1e30f);
+        for(int a = 0;a < 3;a++){
+            for(int b = 0;b < BVH_BINS;b++){
+                Count[a][b] = 0;
+                BinMin[a][b] = glm::vec3(1e30f);
+                BinMax[a][b] = glm::vec3(-1e30f);
+            }
+        }
+    }
+};
+
+// Inputs of a build, shared by its jobs
+struct BvhBuild{
+    const std::vector<glm::vec3>* Mins;
+    const std::vector<glm::vec3>* Maxs;
+    std::vector<glm::vec3> Centers;
+    std::vector<unsigned int>* Order;
+    unsigned int LeafSize;
+};
+
+
+static inline int center_bin(float center, float lower, float scale){
+    return std::min(std::max(int((center - lower) * scale),0),BVH_BINS - 1);
+}
+
+
+static void bound_range(const BvhBuild& build, unsigned int first, unsigned int count, BvhBins& bins){
+    const std::vector<unsigned int>& order = *build.Order;
+    for(unsigned int i = first;i < first + count;i++){
+        unsigned int p = order[i];
+        bins.Min = min3(bins.Min,(*build.Mins)[p]);
+        bins.Max = max3(bins.Max,(*build.Maxs)[p]);
+        bins.CenterMin = min3(bins.CenterMin,build.Centers[p]);
+        bins.CenterMax = max3(bins.CenterMax,build.Centers[p]);
+    }
+}
+
+
+static void bin_range(const BvhBuild& build, unsigned int first, unsigned int count,
+                      const glm::vec3& lower, const glm::vec3& scale, BvhBins& bins){
+    const std::vector<unsigned int>& order = *build.Order;
+    for(unsigned int i = first;i < first + count;i++){
+        unsigned int p = order[i];
+        for(int a = 0;a < 3;a++){
+            int b = center_bin(build.Centers[p][a],lower[a],scale[a]);
+            bins.Count[a][b]++;
+            bins.BinMin[a][b] = min3(bins.BinMin[a][b],(*build.Mins)[p]);
+            bins.BinMax[a][b] = max3(bins.BinMax[a][b],(*build.Maxs)[p]);
+        }
+    }
+}
+
+
+// The box of a node and where to split it: the primitives of the first
+// left_count entries go left. False for a leaf. With a pool the range is
+// bounded and binned in chunks by all the threads; min, max and counts
+// merge exactly, so the split is the same either way.
+static bool split_node(BvhBuild& build, unsigned int first, unsigned int count, ThreadPool* pool,
+                       BvhNode& node, unsigned int& left_count){
+    BvhBins bins;
+    bins.clear();
+    unsigned int chunks = pool && count >= BVH_PARALLEL_PRIMITIVES ? std::min(64u,(count + BVH_CHUNK - 1) / BVH_CHUNK) : 1;
+    std::vector<BvhBins> partial(chunks > 1 ? chunks : 0);
+    auto chunk_first = [&](unsigned int c){ return first + (unsigned long) count * c / chunks; };
+    auto chunk_count = [&](unsigned int c){ return chunk_first(c + 1) - chunk_first(c); };
+    if(chunks > 1){
+        pool->run(chunks,[&](unsigned int c){
+            partial[c].clear();
+            bound_range(build,chunk_first(c),chunk_count(c),partial[c]);
+        });
+        for(unsigned int c = 0;c < chunks;c++){
+            bins.Min = min3(bins.Min,partial[c].Min);
+            bins.Max = max3(bins.Max,partial[c].Max);
+            bins.CenterMin = min3(bins.CenterMin,partial[c].CenterMin);
+            bins.CenterMax = max3(bins.CenterMax,partial[c].CenterMax);
+        }
+    }
+    else
+        bound_range(build,first,count,bins);
+    node.Min = bins.Min;
+    node.Max = bins.Max;
+    node.First = first;
+    node.Count = count;
+    if(count <= 1)
+        return false;
+
+    glm::vec3 lower = bins.CenterMin, extent = bins.CenterMax - bins.CenterMin, scale;
+    for(int a = 0;a < 3;a++)
+        scale[a] = extent[a] > 0 ? BVH_BINS / extent[a] : 0.0f;
+    if(chunks > 1){
+        pool->run(chunks,[&](unsigned int c){
+            bin_range(build,chunk_first(c),chunk_count(c),lower,scale,partial[c]);
+        });
+        for(unsigned int c = 0;c < chunks;c++){
+            for(int a = 0;a < 3;a++){
+                for(int b = 0;b < BVH_BINS;b++){
+                    bins.Count[a][b] += partial[c].Count[a][b];
+                    bins.BinMin[a][b] = min3(bins.BinMin[a][b],partial[c].BinMin[a][b]);
+                    bins.BinMax[a][b] = max3(bins.BinMax[a][b],partial[c].BinMax[a][b]);
+                }
+            }
+        }
+    }
+    else
+        bin_range(build,first,count,lower,scale,bins);
+
+    // the cheapest boundary between two bins, sweeping from both sides
+    float best = 1e30f;
+    int best_axis = -1, best_bin = 0;
+    for(int a = 0;a < 3;a++){
+        if(extent[a] <= 0)
+            continue;
+        float right_area[BVH_BINS];
+        unsigned int right_count[BVH_BINS];
+        glm::vec3 lo(1e30f), hi(-1e30f);
+        unsigned int n = 0;
+        for(int b = BVH_BINS - 1;b > 0;b--){
+            lo = min3(lo,bins.BinMin[a][b]);
+            hi = max3(hi,bins.BinMax[a][b]);
+            n += bins.Count[a][b];
+            right_area[b] = box_area(lo,hi);
+            right_count[b] = n;
+        }
+        lo = glm::vec3(1e30f);
+        hi = glm::vec3(-1e30f);
+        n = 0;
+        for(int b = 0;b < BVH_BINS - 1;b++){
+            lo = min3(lo,bins.BinMin[a][b]);
+            hi = max3(hi,bins.BinMax[a][b]);
+            n += bins.Count[a][b];
+            if(n == 0 || right_count[b + 1] == 0)
+                continue;
+            float cost = box_area(lo,hi) * n + right_area[b + 1] * right_count[b + 1];
+            if(cost < best){
+                best = cost;
+                best_axis = a;
+                best_bin = b;
+            }
+        }
+    }
+
+    float area = std::max(box_area(bins.Min,bins.Max),1e-30f);
+    float leaf_cost = BVH_INTERSECTION_COST * count;
+    float split_cost = BVH_TRAVERSAL_COST + BVH_INTERSECTION_COST * best / area;
+    if(count <= build.LeafSize && (best_axis < 0 || leaf_cost <= split_cost))
+        return false;
+
+    unsigned int* begin = &(*build.Order)[first];
+    if(best_axis < 0){
+        // every center in one place, any halves will do
+        left_count = count / 2;
+        return true;
+    }
+    float axis_lower = lower[best_axis], axis_scale = scale[best_axis];
+    unsigned int* middle = std::partition(begin,begin + count,[&](unsigned int p){
+        return center_bin(build.Centers[p][best_axis],axis_lower,axis_scale) <= best_bin;
+    });
+    left_count = middle - begin;
+    return true;
+}
+
+
+// Every node of a range, root first at nodes[0]. Inner nodes point into
+// nodes, leaves into the order of the whole build.
+static void build_subtree(BvhBuild& build, unsigned int first, unsigned int count, std::vector<BvhNode>& nodes){
+    nodes.clear();
+    BvhNode root;
+    root.First = first;
+    root.Count = count;
+    nodes.push_back(root);
+    std::vector<unsigned int> stack(1,0);
+    while(!stack.empty()){
+        unsigned int n = stack.back();
+        stack.pop_back();
+        BvhNode node;
+        unsigned int left_count = 0;
+        bool split = split_node(build,nodes[n].First,nodes[n].Count,NULL,node,left_count);
+        nodes[n].Min = node.Min;
+        nodes[n].Max = node.Max;
+        if(!split)
+            continue;
+        BvhNode left, right;
+        left.First = node.First;
+        left.Count = left_count;
+        right.First = node.First + left_count;
+        right.Count = node.Count - left_count;
+        nodes[n].First = nodes.size();
+        nodes[n].Count = 0;
+        stack.push_back(nodes.size());
+        nodes.push_back(left);
+        stack.push_back(nodes.size());
+        nodes.push_back(right);
+    }
+}
+
+
+void build_bvh(const std::vector<glm::vec3>& mins, const std::vector<glm::vec3>& maxs, unsigned int leaf_size,
+               std::vector<BvhNode>& nodes, std::vector<unsigned int>& order, ThreadPool* pool){
+    BvhBuild build;
+    build.Mins = &mins;
+    build.Maxs = &maxs;
+    build.Order = &order;
+    build.LeafSize = std::max(leaf_size,1u);
+    build.Centers.resize(mins.size());
+    for(int i = 0;i < mins.size();i++)
+        build.Centers[i] = 0.5f * (mins[i] + maxs[i]);
+    order.resize(mins.size());
+    for(int i = 0;i < order.size();i++)
+        order[i] = i;
+    nodes.clear();
+    if(order.empty())
+        return;
+
+    // the large nodes first, breadth first, each split by all the threads
+    BvhNode root;
+    root.First = 0;
+    root.Count = order.size();
+    nodes.push_back(root);
+    std::vector<unsigned int> pending(1,0), subtrees;
+    for(int p = 0;p < pending.size();p++){
+        unsigned int n = pending[p];
+        if(nodes[n].Count < BVH_PARALLEL_PRIMITIVES){
+            subtrees.push_back(n);
+            continue;
+        }
+        BvhNode node;
+        unsigned int left_count = 0;
+        bool split = split_node(build,nodes[n].First,nodes[n].Count,pool,node,left_count);
+        nodes[n] = node;
+        if(!split)
+            continue;
+        BvhNode left, right;
+        left.First = node.First;
+        left.Count = left_count;
+        right.First = node.First + left_count;
+        right.Count = node.Count - left_count;
+        nodes[n].First = nodes.size();
+        nodes[n].Count = 0;
+        pending.push_back(nodes.size());
+        nodes.push_back(left);
+        pending.push_back(nodes.size());
+        nodes.push_back(right);
+    }
+
+    // then the rest, a whole subtree per job, appended in order
+    std::vector<std::vector<BvhNode> > parts(subtrees.size());
+    run_parallel(pool,subtrees.size(),[&](unsigned int s){
+        build_subtree(build,nodes[subtrees[s]].First,nodes[subtrees[s]].Count,parts[s]);
+    });
+    for(int s = 0;s < subtrees.size();s++){
+        std::vector<BvhNode>& part = parts[s];
+        unsigned int base = nodes.size();
+        for(int i = 0;i < part.size();i++){
+            if(part[i].Count == 0)
+                part[i].First += base - 1;
+        }
+        nodes[subtrees[s]] = part[0];
+        nodes.insert(nodes.end(),part.begin() + 1,part.end());
+    }
+}
+
+
+float bvh_cost(const std::vector<BvhNode>& nodes){
+    if(nodes.empty())
+        return 0.0f;
+    float root = std::max(box_area(nodes[0].Min,nodes[0].Max),1e-30f);
+    float cost = 0.0f;
+    for(int i = 0;i < nodes.size();i++){
+        float weight = box_area(nodes[i].Min,nodes[i].Max) / root;
+        cost += weight * (nodes[i].Count ? BVH_INTERSECTION_COST * nodes[i].Count : BVH_TRAVERSAL_COST);
+    }
+    return cost;
+}
+
+
+void MeshBvh::build(const std::vector<glm::vec3>& positions, const std::vector<unsigned int>& faces, ThreadPool* pool){
+    unsigned int count = faces.size() / 3;
+    std::vector<glm::vec3> mins(count), maxs(count);
+    for(unsigned int f = 0;f < count;f++){
+        const glm::vec3& a = positions[faces[3 * f]];
+        const glm::vec3& b = positions[faces[3 * f + 1]];
+        const glm::vec3& c = positions[faces[3 * f + 2]];
+        mins[f] = min3(a,min3(b,c));
+        maxs[f] = max3(a,max3(b,c));
+    }
+    build_bvh(mins,maxs,BVH_LEAF_SIZE,Nodes,Triangles,pool);
+    init_triangles(positions,faces);
+}
+
+
+void MeshBvh::init_triangles(const std::vector<glm::vec3>& positions, const std::vector<unsigned int>& faces){
+    Vertex0.resize(Triangles.size());
+    Edge1.resize(Triangles.size());
+    Edge2.resize(Triangles.size());
+    for(int i = 0;i < Triangles.size();i++){
+        unsigned int f = Triangles[i];
+        const glm::vec3& a = positions[faces[3 * f]];
+        Vertex0[i] = a;
+        Edge1[i] = positions[faces[3 * f + 1]] - a;
+        Edge2[i] = positions[faces[3 * f + 2]] - a;
+    }
+}
+
+
+bool MeshBvh::valid(unsigned int faces) const{
+    if(Triangles.size() != faces || Nodes.empty() != (faces == 0))
+        return false;
+    for(int i = 0;i < Triangles.size();i++)
+        if(Triangles[i] >= faces)
+            return false;
+    // children after their parent, so that a walk always ends
+    for(int i = 0;i < Nodes.size();i++){
+        if(Nodes[i].Count > 0 && (unsigned long) Nodes[i].First + Nodes[i].Count > faces)
+            return false;
+        if(Nodes[i].Count == 0 && (Nodes[i].First <= i || (unsigned long) Nodes[i].First + 1 >= Nodes.size()))
+            return false;
+    }
+    return true;
+}
+
+
+SceneBvh::SceneBvh(){
+    BuiltCost = 0;
+    Builds = 0;
+    Refits = 0;
+}
+
+
+// The world box around the corners of the object box
+static void instance_bounds(BvhInstance& instance){
+    const BvhNode& root = instance.Bvh->Nodes[0];
+    instance.Min = glm::vec3(1e30f);
+    instance.Max = glm::vec3(-1e30f);
+    for(int c = 0;c < 8;c++){
+        glm::vec3 corner(c & 1 ? root.Max.x : root.Min.x,c & 2 ? root.Max.y : root.Min.y,c & 4 ? root.Max.z : root.Min.z);
+        glm::vec3 world = glm::vec3(instance.ObjectToWorld * glm::vec4(corner,1.0f));
+        instance.Min = min3(instance.Min,world);
+        instance.Max = max3(instance.Max,world);
+    }
+}
+
+
+void SceneBvh::build(){
+    std::vector<glm::vec3> mins(Instances.size()), maxs(Instances.size());
+    for(int i = 0;i < Instances.size();i++){
+        instance_bounds(Instances[i]);
+        mins[i] = Instances[i].Min;
+        maxs[i] = Instances[i].Max;
+    }
+    build_bvh(mins,maxs,1,Nodes,Order,NULL);
+
+    Parents.assign(Nodes.size(),0);
+    Leaves.assign(Instances.size(),0);
+    for(unsigned int n = 0;n < Nodes.size();n++){
+        if(Nodes[n].Count == 0){
+            Parents[Nodes[n].First] = n;
+            Parents[Nodes[n].First + 1] = n;
+        }
+        else{
+            for(unsigned int i = Nodes[n].First;i < Nodes[n].First + Nodes[n].Count;i++)
+                Leaves[Order[i]] = n;
+        }
+    }
+    BuiltCost = bvh_cost(Nodes);
+    Moved.clear();
+    Builds++;
+}
+
+
+void SceneBvh::move(unsigned int instance, const glm::mat4& object_to_world){
+    Instances[instance].ObjectToWorld = object_to_world;
+    Instances[instance].WorldToObject = glm::inverse(object_to_world);
+    instance_bounds(Instances[instance]);
+    Moved.push_back(instance);
+}
+
+
+void SceneBvh::refit(){
+    if(Moved.empty())
+        return;
+    for(int m = 0;m < Moved.size();m++){
+        unsigned int n = Leaves[Moved[m]];
+        BvhNode& leaf = Nodes[n];
+        leaf.Min = glm::vec3(1e30f);
+        leaf.Max = glm::vec3(-1e30f);
+        for(unsigned int i = leaf.First;i < leaf.First + leaf.Count;i++){
+            leaf.Min = min3(leaf.Min,Instances[Order[i]].Min);
+            leaf.Max = max3(leaf.Max,Instances[Order[i]].Max);
+        }
+        // up to the root, or to the first box that does not change
+        while(n != 0){
+            n = Parents[n];
+            BvhNode& node = Nodes[n];
+            glm::vec3 lower = min3(Nodes[node.First].Min,Nodes[node.First + 1].Min);
+            glm::vec3 upper = max3(Nodes[node.First].Max,Nodes[node.First + 1].Max);
+            if(lower == node.Min && upper == node.Max)
+                break;
+            node.Min = lower;
+            node.Max = upper;
+        }
+    }
+    Moved.clear();
+    Refits++;
+    if(bvh_cost(Nodes) > TLAS_REBUILD_COST * BuiltCost)
+        build();
+}
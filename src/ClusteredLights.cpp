@@ -0,0 +1,183 @@
+#include "ClusteredLights.h"
+
+#include <cmath>
+#include <random>
+#include <vector>
+#include <glm/glm.hpp>  // glm::vec2
+#include <glm/vec3.hpp> // glm::vec3
+#include <glm/vec4.hpp> // glm::vec4
+#include <glm/mat4x4.hpp> // glm::mat4
+
+LightClusters::LightClusters(){
+    GridX = 16;
+    GridY = 16;
+    GridZ = 24;
+    Near = 0.1f;
+    Far = 100.0f;
+    MaxLightsPerCluster = 0;
+}
+
+
+void LightClusters::init(){
+    LightData.init();
+    ClusterData.init(GL_R32I);
+    IndexData.init(GL_R32I);
+    label_gl(GL_BUFFER,LightData.id,"light records");
+    label_gl(GL_BUFFER,ClusterData.id,"light clusters");
+    label_gl(GL_BUFFER,IndexData.id,"light indices");
+}
+
+
+float LightClusters::slice_scale() const{
+    return GridZ / log(Far / Near);
+}
+
+
+float LightClusters::slice_bias() const{
+    return -GridZ * log(Near) / log(Far / Near);
+}
+
+
+int LightClusters::slice(float depth) const{
+    if(depth <= Near)
+        return 0;
+    int k = int(log(depth) * slice_scale() + slice_bias());
+    return k < GridZ ? k : GridZ - 1;
+}
+
+
+// Cluster ranges covered by one light, inclusive
+struct ClusterRange{
+    int X0, X1, Y0, Y1, Z0, Z1;
+};
+
+
+// Screen tile of a normalized device coordinate, clamped to the grid
+static int tile_of(float ndc, int grid){
+    int t = int(floor((ndc * 0.5f + 0.5f) * grid));
+    return t < 0 ? 0 : (t >= grid ? grid - 1 : t);
+}
+
+
+void LightClusters::build(const std::vector<PointLight>& lights, const glm::mat4& view, const glm::mat4& projection){
+    Records.clear();
+    for(int l = 0;l < lights.size();l++){
+        Records.push_back(glm::vec4(lights[l].Position,lights[l].Radius));
+        Records.push_back(glm::vec4(lights[l].Color,0.0f));
+    }
+
+    // Bound every light in cluster coordinates
+    std::vector<ClusterRange> ranges(lights.size());
+    std::vector<bool> visible(lights.size(),false);
+    for(int l = 0;l < lights.size();l++){
+        ClusterRange& range = ranges[l];
+        range.X0 = 0; range.X1 = GridX - 1;
+        range.Y0 = 0; range.Y1 = GridY - 1;
+        range.Z0 = 0; range.Z1 = GridZ - 1;
+        float r = lights[l].Radius;
+        if(r <= 0){
+            visible[l] = true;
+            continue;
+        }
+
+        glm::vec3 center = glm::vec3(view * glm::vec4(lights[l].Position,1.0f));
+        float depth = -center.z;
+        if(depth + r < Near || depth - r > Far)
+            continue;
+        range.Z0 = slice(depth - r);
+        range.Z1 = slice(depth + r);
+
+        // A sphere crossing the near plane can cover any tile, otherwise
+        // its view-space box projects to a conservative screen rectangle
+        if(depth - r > Near){
+            float x_min = 1e30f, y_min = 1e30f, x_max = -1e30f, y_max = -1e30f;
+            for(int c = 0;c < 8;c++){
+                glm::vec3 corner = center + r * glm::vec3(c & 1 ? 1 : -1, c & 2 ? 1 : -1, c & 4 ? 1 : -1);
+                glm::vec4 clip = projection * glm::vec4(corner,1.0f);
+                float x = clip.x / clip.w;
+                float y = clip.y / clip.w;
+                x_min = glm::min(x_min,x); x_max = glm::max(x_max,x);
+                y_min = glm::min(y_min,y); y_max = glm::max(y_max,y);
+            }
+            if(x_max < -1 || x_min > 1 || y_max < -1 || y_min > 1)
+                continue;
+            range.X0 = tile_of(x_min,GridX); range.X1 = tile_of(x_max,GridX);
+            range.Y0 = tile_of(y_min,GridY); range.Y1 = tile_of(y_max,GridY);
+        }
+        visible[l] = true;
+    }
+
+    // Count, prefix sum, then fill the light lists
+    int cluster_count = GridX * GridY * GridZ;
+    Clusters.assign(2 * cluster_count,0);
+    for(int l = 0;l < lights.size();l++){
+        if(!visible[l])
+            continue;
+        const ClusterRange& range = ranges[l];
+        for(int z = range.Z0;z <= range.Z1;z++)
+            for(int y = range.Y0;y <= range.Y1;y++)
+                for(int x = range.X0;x <= range.X1;x++)
+                    Clusters[2 * ((z * GridY + y) * GridX + x) + 1]++;
+    }
+    int total = 0;
+    MaxLightsPerCluster = 0;
+    for(int c = 0;c < cluster_count;c++){
+        Clusters[2 * c] = total;
+        total += Clusters[2 * c + 1];
+        MaxLightsPerCluster = glm::max(MaxLightsPerCluster,(int) Clusters[2 * c + 1]);
+        Clusters[2 * c + 1] = 0;
+    }
+    Indices.resize(total);
+    for(int l = 0;l < lights.size();l++){
+        if(!visible[l])
+            continue;
+        const ClusterRange& range = ranges[l];
+        for(int z = range.Z0;z <= range.Z1;z++)
+            for(int y = range.Y0;y <= range.Y1;y++)
+                for(int x = range.X0;x <= range.X1;x++){
+                    int c = (z * GridY + y) * GridX + x;
+                    Indices[Clusters[2 * c] + Clusters[2 * c + 1]++] = l;
+                }
+    }
+
+    // buffer textures cannot be empty, the padding is never read
+    if(Records.empty())
+        Records.assign(LIGHT_RECORD_SIZE,glm::vec4(0.0f));
+    if(Indices.empty())
+        Indices.push_back(0);
+}
+
+
+void LightClusters::upload(GLuint unit){
+    LightData.update(Records);
+    ClusterData.update(Clusters);
+    IndexData.update(Indices);
+    LightData.bind(unit + LIGHT_DATA_UNIT);
+    ClusterData.bind(unit + LIGHT_CLUSTER_UNIT);
+    IndexData.bind(unit + LIGHT_INDEX_UNIT);
+}
+
+
+void LightClusters::free(){
+    LightData.free();
+    ClusterData.free();
+    IndexData.free();
+}
+
+
+void add_random_lights(std::vector<PointLight>& lights, int count, unsigned int seed,
+                       const glm::vec3& lower, const glm::vec3& upper, float min_radius, float max_radius){
+    std::mt19937 generator(seed);
+    std::uniform_real_distribution<float> unit(0.0f,1.0f);
+    for(int i = 0;i < count;i++){
+        PointLight light;
+        light.Position = lower + (upper - lower) * glm::vec3(unit(generator),unit(generator),unit(generator));
+        light.Radius = min_radius + (max_radius - min_radius) * unit(generator);
+
+        // fully saturated hue, dimmed so that overlapping lights do not saturate
+        float h = 6.0f * unit(generator);
+        glm::vec3 hue = glm::clamp(glm::vec3(fabs(h - 3.0f) - 1.0f, 2.0f - fabs(h - 2.0f), 2.0f - fabs(h - 4.0f)),0.0f,1.0f);
+        light.Color = 0.5f * hue;
+        lights.push_back(light);
+    }
+}
@@ -0,0 +1,119 @@
+#include "FileWatcher.h"
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+FileWatcher::FileWatcher(){
+#ifdef __linux__
+    Fd = -1;
+#endif
+}
+
+
+#ifdef __linux__
+
+bool FileWatcher::add(const std::string& path){
+    if(Fd < 0){
+        Fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if(Fd < 0){
+            std::cerr << "inotify_init1 failed, " << path << " is not watched" << std::endl;
+            return false;
+        }
+    }
+
+    std::string::size_type slash = path.find_last_of('/');
+    std::string dir = slash == std::string::npos ? "." : path.substr(0,slash);
+    std::string name = slash == std::string::npos ? path : path.substr(slash + 1);
+
+    // the same directory always gives back the same watch descriptor
+    int watch = inotify_add_watch(Fd,dir.c_str(),IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+    if(watch < 0){
+        std::cerr << "Cannot watch " << dir << std::endl;
+        return false;
+    }
+    Paths.push_back(path);
+    Watches.push_back(watch);
+    Names.push_back(name);
+    return true;
+}
+
+
+bool FileWatcher::poll(){
+    if(Fd < 0)
+        return false;
+
+    bool changed = false;
+    char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    while(true){
+        ssize_t length = read(Fd,buffer,sizeof(buffer));
+        if(length <= 0)
+            break;
+        for(char* p = buffer;p < buffer + length;p += sizeof(struct inotify_event) + ((struct inotify_event*) p)->len){
+            const struct inotify_event* event = (const struct inotify_event*) p;
+            if(event->len == 0)
+                continue;
+            for(int i = 0;i < Paths.size();i++){
+                if(Watches[i] == event->wd && Names[i] == event->name)
+                    changed = true;
+            }
+        }
+    }
+    return changed;
+}
+
+
+void FileWatcher::free(){
+    if(Fd >= 0){
+        close(Fd);
+        Fd = -1;
+    }
+    Paths.clear();
+    Watches.clear();
+    Names.clear();
+}
+
+#else
+
+static time_t modification_time(const std::string& path){
+    struct stat info;
+    if(stat(path.c_str(),&info) != 0)
+        return 0;
+    return info.st_mtime;
+}
+
+
+bool FileWatcher::add(const std::string& path){
+    Paths.push_back(path);
+    Times.push_back(modification_time(path));
+    return true;
+}
+
+
+bool FileWatcher::poll(){
+    bool changed = false;
+    for(int i = 0;i < Paths.size();i++){
+        time_t time = modification_time(Paths[i]);
+        if(time != Times[i]){
+            Times[i] = time;
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+
+void FileWatcher::free(){
+    Paths.clear();
+    Times.clear();
+}
+
+#endif
@@ -0,0 +1,411 @@
+#include "Headless.h"
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+#include <cstdio>
+#include <stdint.h>
+
+#ifdef HAVE_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+HeadlessOptions::HeadlessOptions(){
+    Enabled = false;
+    Width = 640;
+    Height = 640;
+    Frames = -1;
+    ImageFormat = "ppm";
+    OptimizeMeshes = true;
+    BakeAo = true;
+    Renderer = "gl";
+    Samples = 16;
+    AoRays = 0;
+    AutosaveInterval = -1;
+}
+
+
+static void print_usage(const char* program){
+    std::cerr << "usage: " << program << " [--headless [--size WxH] [--frames N] [--script FILE]"
+              << " [--output DIR] [--format ppm|png] [--timings FILE.json] [--renderer gl|cpu|raytrace]"
+              << " [--samples N] [--ao N]] [--trace FILE.json]"
+              << " [--optimize-meshes on|off] [--bake-ao on|off] [--scene FILE] [--autosave SECONDS]" << std::endl;
+}
+
+
+bool parse_headless_options(int argc, char* argv[], HeadlessOptions& options){
+    bool headless_only = false;
+    for(int i = 1;i < argc;i++){
+        std::string arg(argv[i]);
+        if(arg == "--headless"){
+            options.Enabled = true;
+            continue;
+        }
+        if(i + 1 >= argc){
+            print_usage(argv[0]);
+            return false;
+        }
+        std::string value(argv[++i]);
+        if(arg == "--size"){
+            if(sscanf(value.c_str(),"%dx%d",&options.Width,&options.Height) != 2 || options.Width <= 0 || options.Height <= 0){
+                std::cerr << "bad size " << value << ", expected WxH" << std::endl;
+                return false;
+            }
+        }
+        else if(arg == "--frames")
+            options.Frames = atoi(value.c_str());
+        else if(arg == "--script")
+            options.ScriptPath = value;
+        else if(arg == "--output")
+            options.OutputDir = value;
+        else if(arg == "--format"){
+            if(value != "ppm" && value != "png"){
+                std::cerr << "unknown image format " << value << std::endl;
+                return false;
+            }
+            options.ImageFormat = value;
+        }
+        else if(arg == "--timings")
+            options.TimingsPath = value;
+        else if(arg == "--renderer"){
+            if(value != "gl" && value != "cpu" && value != "raytrace"){
+                std::cerr << "unknown renderer " << value << std::endl;
+                return false;
+            }
+            options.Renderer = value;
+        }
+        else if(arg == "--samples"){
+            options.Samples = atoi(value.c_str());
+            if(options.Samples <= 0){
+                std::cerr << "bad sample count " << value << std::endl;
+                return false;
+            }
+        }
+        else if(arg == "--ao")
+            options.AoRays = std::max(atoi(value.c_str()),0);
+        else if(arg == "--trace"){
+            options.TracePath = value;
+            continue;
+        }
+        else if(arg == "--optimize-meshes" && (value == "on" || value == "off")){
+            options.OptimizeMeshes = value == "on";
+            continue;
+        }
+        else if(arg == "--bake-ao" && (value == "on" || value == "off")){
+            options.BakeAo = value == "on";
+            continue;
+        }
+        else if(arg == "--scene"){
+            options.ScenePath = value;
+            continue;
+        }
+        else if(arg == "--autosave"){
+            options.AutosaveInterval = std::max(atof(value.c_str()),0.0);
+            continue;
+        }
+        else{
+            print_usage(argv[0]);
+            return false;
+        }
+        headless_only = true;
+    }
+    if(!options.Enabled && headless_only){
+        std::cerr << "these options need --headless" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+
+HeadlessContext::HeadlessContext(){
+    Display = NULL;
+    Context = NULL;
+    Framebuffer = 0;
+    ColorBuffer = 0;
+    DepthStencilBuffer = 0;
+    Width = 0;
+    Height = 0;
+}
+
+
+#ifdef HAVE_EGL
+
+bool HeadlessContext::init(int width, int height){
+    Width = width;
+    Height = height;
+
+    // The surfaceless platform needs neither a display server nor a GPU
+    EGLDisplay display = EGL_NO_DISPLAY;
+    PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display =
+        (PFNEGLGETPLATFORMDISPLAYEXTPROC) eglGetProcAddress("eglGetPlatformDisplayEXT");
+#ifdef EGL_PLATFORM_SURFACELESS_MESA
+    if(get_platform_display)
+        display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA,EGL_DEFAULT_DISPLAY,NULL);
+#endif
+    if(display == EGL_NO_DISPLAY)
+        display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    EGLint major, minor;
+    if(display == EGL_NO_DISPLAY || !eglInitialize(display,&major,&minor)){
+        std::cerr << "Cannot initialize EGL" << std::endl;
+        return false;
+    }
+
+    const EGLint config_attribs[] = {
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_NONE
+    };
+    EGLConfig config;
+    EGLint count;
+    if(!eglChooseConfig(display,config_attribs,&config,1,&count) || count == 0){
+        std::cerr << "No EGL config for desktop OpenGL" << std::endl;
+        eglTerminate(display);
+        return false;
+    }
+
+    // At least 3.2, like the window
+    eglBindAPI(EGL_OPENGL_API);
+    const EGLint context_attribs[] = {
+        EGL_CONTEXT_MAJOR_VERSION, 3,
+        EGL_CONTEXT_MINOR_VERSION, 2,
+#ifdef DEBUG_GL
+        EGL_CONTEXT_OPENGL_DEBUG, EGL_TRUE,
+#endif
+        EGL_NONE
+    };
+    EGLContext context = eglCreateContext(display,config,EGL_NO_CONTEXT,context_attribs);
+    if(context == EGL_NO_CONTEXT){
+        std::cerr << "Cannot create an EGL context" << std::endl;
+        eglTerminate(display);
+        return false;
+    }
+    if(!eglMakeCurrent(display,EGL_NO_SURFACE,EGL_NO_SURFACE,context)){
+        std::cerr << "Surfaceless EGL contexts are not supported" << std::endl;
+        eglDestroyContext(display,context);
+        eglTerminate(display);
+        return false;
+    }
+    Display = display;
+    Context = context;
+    return true;
+}
+
+
+void HeadlessContext::free(){
+    if(Framebuffer){
+        glDeleteFramebuffers(1,&Framebuffer);
+        glDeleteRenderbuffers(1,&ColorBuffer);
+        glDeleteRenderbuffers(1,&DepthStencilBuffer);
+        Framebuffer = 0;
+    }
+    if(Display){
+        eglMakeCurrent(Display,EGL_NO_SURFACE,EGL_NO_SURFACE,EGL_NO_CONTEXT);
+        eglDestroyContext(Display,Context);
+        eglTerminate(Display);
+        Display = NULL;
+        Context = NULL;
+    }
+}
+
+#else
+
+bool HeadlessContext::init(int width, int height){
+    std::cerr << "This build has no headless support, EGL was not found" << std::endl;
+    return false;
+}
+
+
+void HeadlessContext::free(){
+}
+
+#endif
+
+
+void HeadlessContext::init_framebuffer(){
+    glGenRenderbuffers(1,&ColorBuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER,ColorBuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER,GL_RGBA8,Width,Height);
+    glGenRenderbuffers(1,&DepthStencilBuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER,DepthStencilBuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER,GL_DEPTH24_STENCIL8,Width,Height);
+
+    glGenFramebuffers(1,&Framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER,Framebuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER,GL_COLOR_ATTACHMENT0,GL_RENDERBUFFER,ColorBuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER,GL_DEPTH_STENCIL_ATTACHMENT,GL_RENDERBUFFER,DepthStencilBuffer);
+    label_gl(GL_FRAMEBUFFER,Framebuffer,"headless framebuffer");
+    if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        std::cerr << "The headless framebuffer is incomplete" << std::endl;
+    glViewport(0,0,Width,Height);
+    check_gl_error();
+}
+
+
+void HeadlessContext::read_pixels(std::vector<unsigned char>& pixels){
+    std::vector<unsigned char> rows(3 * Width * Height);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER,Framebuffer);
+    glPixelStorei(GL_PACK_ALIGNMENT,1);
+    glReadPixels(0,0,Width,Height,GL_RGB,GL_UNSIGNED_BYTE,rows.data());
+
+    // OpenGL starts at the bottom row
+    pixels.resize(rows.size());
+    for(int y = 0;y < Height;y++)
+        std::copy(rows.begin() + 3 * Width * (Height - 1 - y),rows.begin() + 3 * Width * (Height - y),pixels.begin() + 3 * Width * y);
+}
+
+
+bool write_ppm(const std::string& path, int width, int height, const std::vector<unsigned char>& pixels){
+    std::ofstream fout(path.c_str(), std::ios::out | std::ios::binary);
+    if(!fout)
+        return false;
+    fout << "P6\n" << width << " " << height << "\n255\n";
+    fout.write((const char*) pixels.data(),pixels.size());
+    return (bool) fout;
+}
+
+
+static uint32_t crc32(const unsigned char* data, size_t size, uint32_t crc = 0){
+    static uint32_t table[256];
+    static bool ready = false;
+    if(!ready){
+        for(uint32_t n = 0;n < 256;n++){
+            uint32_t c = n;
+            for(int k = 0;k < 8;k++)
+                c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            table[n] = c;
+        }
+        ready = true;
+    }
+    crc = ~crc;
+    for(size_t i = 0;i < size;i++)
+        crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+
+static void put_u32(std::vector<unsigned char>& out, uint32_t value){
+    out.push_back(value >> 24);
+    out.push_back(value >> 16);
+    out.push_back(value >> 8);
+    out.push_back(value);
+}
+
+
+static void put_chunk(std::ofstream& fout, const char* type, const std::vector<unsigned char>& data){
+    std::vector<unsigned char> chunk;
+    put_u32(chunk,data.size());
+    chunk.insert(chunk.end(),type,type + 4);
+    chunk.insert(chunk.end(),data.begin(),data.end());
+    put_u32(chunk,crc32(&chunk[4],chunk.size() - 4));
+    fout.write((const char*) chunk.data(),chunk.size());
+}
+
+
+bool write_png(const std::string& path, int width, int height, const std::vector<unsigned char>& pixels){
+    std::ofstream fout(path.c_str(), std::ios::out | std::ios::binary);
+    if(!fout)
+        return false;
+    const unsigned char signature[8] = {137, 80, 78, 71, 13, 10, 26, 10};
+    fout.write((const char*) signature,8);
+
+    std::vector<unsigned char> header;
+    put_u32(header,width);
+    put_u32(header,height);
+    header.push_back(8); // bit depth
+    header.push_back(2); // RGB
+    header.push_back(0); // deflate
+    header.push_back(0); // adaptive filtering
+    header.push_back(0); // no interlace
+    put_chunk(fout,"IHDR",header);
+
+    // Scanlines with filter type 0, in stored deflate blocks of at most 65535 bytes
+    std::vector<unsigned char> raw;
+    raw.reserve((3 * width + 1) * height);
+    for(int y = 0;y < height;y++){
+        raw.push_back(0);
+        raw.insert(raw.end(),pixels.begin() + 3 * width * y,pixels.begin() + 3 * width * (y + 1));
+    }
+    std::vector<unsigned char> zlib;
+    zlib.push_back(0x78);
+    zlib.push_back(0x01);
+    size_t offset = 0;
+    do{
+        size_t size = raw.size() - offset < 65535 ? raw.size() - offset : 65535;
+        zlib.push_back(offset + size == raw.size() ? 1 : 0);
+        zlib.push_back(size & 0xFF);
+        zlib.push_back(size >> 8);
+        zlib.push_back(~size & 0xFF);
+        zlib.push_back((~size >> 8) & 0xFF);
+        zlib.insert(zlib.end(),raw.begin() + offset,raw.begin() + offset + size);
+        offset += size;
+    }while(offset < raw.size());
+    uint32_t a = 1, b = 0;
+    for(size_t i = 0;i < raw.size();i++){
+        a = (a + raw[i]) % 65521;
+        b = (b + a) % 65521;
+    }
+    put_u32(zlib,(b << 16) | a);
+    put_chunk(fout,"IDAT",zlib);
+    put_chunk(fout,"IEND",std::vector<unsigned char>());
+    return (bool) fout;
+}
+
+
+void write_frame_timings(std::ostream& out, const std::vector<FrameTiming>& timings, const std::string& indent){
+    for(int i = 0;i < timings.size();i++){
+        const FrameTiming& t = timings[i];
+        out << indent << "{\"frame\": " << t.Frame << ", \"frame_ms\": " << t.FrameMs << ", \"cpu_ms\": " << t.CpuMs << ", \"gpu_ms\": ";
+        if(t.GpuMs >= 0)
+            out << t.GpuMs;
+        else
+            out << "null";
+        out << ", \"draw_calls\": " << t.Work.DrawCalls << ", \"triangles\": " << t.Work.Triangles << ", \"lines\": " << t.Work.Lines
+            << ", \"bytes_uploaded\": " << t.Work.BytesUploaded << "}" << (i + 1 < timings.size() ? "," : "") << "\n";
+    }
+}
+
+
+bool write_timings_json(const std::string& path, const std::vector<FrameTiming>& timings,
+                        int width, int height, const std::string& renderer){
+    std::ofstream fout(path.c_str(), std::ios::out);
+    if(!fout)
+        return false;
+
+    double frame_sum = 0, cpu_sum = 0, gpu_sum = 0;
+    int gpu_count = 0;
+    for(int i = 0;i < timings.size();i++){
+        frame_sum += timings[i].FrameMs;
+        cpu_sum += timings[i].CpuMs;
+        if(timings[i].GpuMs >= 0){
+            gpu_sum += timings[i].GpuMs;
+            gpu_count++;
+        }
+    }
+
+    // the renderer string is printable ASCII in practice, quotes are dropped
+    std::string name;
+    for(int i = 0;i < renderer.size();i++){
+        if(renderer[i] != '"' && renderer[i] != '\\')
+            name += renderer[i];
+    }
+
+    fout << "{\n";
+    fout << "  \"renderer\": \"" << name << "\",\n";
+    fout << "  \"width\": " << width << ",\n";
+    fout << "  \"height\": " << height << ",\n";
+    fout << "  \"frame_count\": " << timings.size() << ",\n";
+    fout << "  \"frame_ms_mean\": " << (timings.empty() ? 0 : frame_sum / timings.size()) << ",\n";
+    fout << "  \"cpu_ms_mean\": " << (timings.empty() ? 0 : cpu_sum / timings.size()) << ",\n";
+    if(gpu_count > 0)
+        fout << "  \"gpu_ms_mean\": " << gpu_sum / gpu_count << ",\n";
+    else
+        fout << "  \"gpu_ms_mean\": null,\n";
+    fout << "  \"frames\": [\n";
+    write_frame_timings(fout,timings,"    ");
+    fout << "  ]\n}\n";
+    return (bool) fout;
+}
@@ -2,6 +2,100 @@
 
 #include <iostream>
 #include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <stdint.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#  include <direct.h>
+#endif
+
+static std::string program_cache_dir;
+static RenderStats stats = {0, 0, 0, 0};
+
+RenderStats& render_stats()
+{
+  return stats;
+}
+
+void reset_render_stats()
+{
+  stats.DrawCalls = 0;
+  stats.Triangles = 0;
+  stats.Lines = 0;
+  stats.BytesUploaded = 0;
+}
+
+void set_program_cache_dir(const std::string &dir)
+{
+  program_cache_dir = dir;
+}
+
+static bool program_binary_supported()
+{
+#ifdef __APPLE__
+  GLint formats = 0;
+  glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+  return formats > 0;
+#else
+  if (!GLEW_VERSION_4_1 && !GLEW_ARB_get_program_binary)
+    return false;
+  GLint formats = 0;
+  glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+  return formats > 0;
+#endif
+}
+
+// FNV-1a, 64 bit
+static uint64_t hash_string(uint64_t hash, const std::string &s)
+{
+  for (size_t i = 0; i < s.size(); i++)
+  {
+    hash ^= (unsigned char) s[i];
+    hash *= 1099511628211ULL;
+  }
+  // separator, so that ("ab","c") and ("a","bc") differ
+  hash ^= 0xff;
+  hash *= 1099511628211ULL;
+  return hash;
+}
+
+static std::string driver_string()
+{
+  std::string driver;
+  driver += (const char*) glGetString(GL_VENDOR);
+  driver += "|";
+  driver += (const char*) glGetString(GL_RENDERER);
+  driver += "|";
+  driver += (const char*) glGetString(GL_VERSION);
+  return driver;
+}
+
+// Path of the cache file of a program, empty if the cache cannot be used
+static std::string program_cache_path(
+  const std::string &vertex_shader_string,
+  const std::string &fragment_shader_string,
+  const std::string &fragment_data_name)
+{
+  if (program_cache_dir.empty() || !program_binary_supported())
+    return "";
+
+  uint64_t hash = 14695981039346656037ULL;
+  hash = hash_string(hash, vertex_shader_string);
+  hash = hash_string(hash, fragment_shader_string);
+  hash = hash_string(hash, fragment_data_name);
+  hash = hash_string(hash, driver_string());
+
+#ifdef _WIN32
+  _mkdir(program_cache_dir.c_str());
+#else
+  mkdir(program_cache_dir.c_str(), 0755);
+#endif
+
+  std::ostringstream path;
+  path << program_cache_dir << "/" << std::hex << std::setw(16) << std::setfill('0') << hash << ".bin";
+  return path.str();
+}
 
 void VertexArrayObject::init()
 {
@@ -21,12 +115,55 @@ void VertexArrayObject::free()
   check_gl_error();
 }
 
+void bindVertexAttribArray(GLuint location, VertexBufferObject& VBO)
+{
+  VBO.bind();
+  glEnableVertexAttribArray(location);
+  glVertexAttribPointer(location, VBO.rows, GL_FLOAT, GL_FALSE, 0, 0);
+  check_gl_error();
+}
+
+void bindVertexAttribIArray(GLuint location, VertexBufferObject& VBO, GLuint divisor)
+{
+  VBO.bind();
+  glEnableVertexAttribArray(location);
+  glVertexAttribIPointer(location, VBO.rows, GL_INT, 0, 0);
+  // Instanced arrays are core only since 3.3, leave plain per-vertex attributes alone
+  if (divisor != 0)
+    glVertexAttribDivisor(location, divisor);
+  check_gl_error();
+}
+
 void VertexBufferObject::init()
 {
   glGenBuffers(1,&id);
   check_gl_error();
 }
 
+void VertexBufferObject::update(const std::vector<GLint>& array)
+{
+  assert(id != 0);
+  assert(!array.empty());
+  glBindBuffer(GL_ARRAY_BUFFER, id);
+  glBufferData(GL_ARRAY_BUFFER, sizeof(GLint) * array.size(), array.data(), GL_DYNAMIC_DRAW);
+  render_stats().BytesUploaded += sizeof(GLint) * array.size();
+  cols = array.size();
+  rows = 1;
+  check_gl_error();
+}
+
+void VertexBufferObject::update(const std::vector<float>& array)
+{
+  assert(id != 0);
+  assert(!array.empty());
+  glBindBuffer(GL_ARRAY_BUFFER, id);
+  glBufferData(GL_ARRAY_BUFFER, sizeof(float) * array.size(), array.data(), GL_DYNAMIC_DRAW);
+  render_stats().BytesUploaded += sizeof(float) * array.size();
+  cols = array.size();
+  rows = 1;
+  check_gl_error();
+}
+
 void VertexBufferObject::bind()
 {
   glBindBuffer(GL_ARRAY_BUFFER,id);
@@ -39,12 +176,89 @@ void VertexBufferObject::free()
   check_gl_error();
 }
 
+void IndexBufferObject::init()
+{
+  glGenBuffers(1,&id);
+  check_gl_error();
+}
+
+void IndexBufferObject::update(const std::vector<GLuint>& array)
+{
+  assert(id != 0);
+  assert(!array.empty());
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, id);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint) * array.size(), array.data(), GL_STATIC_DRAW);
+  render_stats().BytesUploaded += sizeof(GLuint) * array.size();
+  count = array.size();
+  check_gl_error();
+}
+
+void IndexBufferObject::bind()
+{
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,id);
+  check_gl_error();
+}
+
+void IndexBufferObject::free()
+{
+  glDeleteBuffers(1,&id);
+  check_gl_error();
+}
+
+void TextureBufferObject::init(GLenum format)
+{
+  glGenBuffers(1,&id);
+  glBindBuffer(GL_TEXTURE_BUFFER,id);
+  glGenTextures(1,&texture);
+  glBindTexture(GL_TEXTURE_BUFFER,texture);
+  glTexBuffer(GL_TEXTURE_BUFFER,format,id);
+  check_gl_error();
+}
+
+void TextureBufferObject::update(const std::vector<glm::vec4>& array)
+{
+  assert(id != 0);
+  assert(!array.empty());
+  glBindBuffer(GL_TEXTURE_BUFFER, id);
+  glBufferData(GL_TEXTURE_BUFFER, sizeof(glm::vec4) * array.size(), array.data(), GL_STREAM_DRAW);
+  render_stats().BytesUploaded += sizeof(glm::vec4) * array.size();
+  check_gl_error();
+}
+
+void TextureBufferObject::update(const std::vector<GLint>& array)
+{
+  assert(id != 0);
+  assert(!array.empty());
+  glBindBuffer(GL_TEXTURE_BUFFER, id);
+  glBufferData(GL_TEXTURE_BUFFER, sizeof(GLint) * array.size(), array.data(), GL_STREAM_DRAW);
+  render_stats().BytesUploaded += sizeof(GLint) * array.size();
+  check_gl_error();
+}
+
+void TextureBufferObject::bind(GLuint unit)
+{
+  glActiveTexture(GL_TEXTURE0 + unit);
+  glBindTexture(GL_TEXTURE_BUFFER,texture);
+  check_gl_error();
+}
+
+void TextureBufferObject::free()
+{
+  glDeleteTextures(1,&texture);
+  glDeleteBuffers(1,&id);
+  check_gl_error();
+}
+
 bool Program::init(
   const std::string &vertex_shader_string,
   const std::string &fragment_shader_string,
   const std::string &fragment_data_name)
 {
   using namespace std;
+  string cache_path = program_cache_path(vertex_shader_string, fragment_shader_string, fragment_data_name);
+  if (!cache_path.empty() && load_binary(cache_path))
+    return true;
+
   vertex_shader = create_shader_helper(GL_VERTEX_SHADER, vertex_shader_string);
   fragment_shader = create_shader_helper(GL_FRAGMENT_SHADER, fragment_shader_string);
 
@@ -52,10 +266,21 @@ bool Program::init(
     return false;
 
   program_shader = glCreateProgram();
+  if (!cache_path.empty())
+    glProgramParameteri(program_shader, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
 
   glAttachShader(program_shader, vertex_shader);
   glAttachShader(program_shader, fragment_shader);
 
+  glBindAttribLocation(program_shader, ATTRIB_POSITION, "position");
+  glBindAttribLocation(program_shader, ATTRIB_COLOR, "color");
+  glBindAttribLocation(program_shader, ATTRIB_NORMAL, "normal");
+  glBindAttribLocation(program_shader, ATTRIB_OBJECT_ID, "object_id");
+  glBindAttribLocation(program_shader, ATTRIB_EDGE_FACE_A, "edge_face_a");
+  glBindAttribLocation(program_shader, ATTRIB_EDGE_FACE_B, "edge_face_b");
+  glBindAttribLocation(program_shader, ATTRIB_EDGE_CENTER, "edge_center");
+  glBindAttribLocation(program_shader, ATTRIB_OCCLUSION, "occlusion");
+
   glBindFragDataLocation(program_shader, 0, fragment_data_name.c_str());
   glLinkProgram(program_shader);
 
@@ -67,14 +292,91 @@ bool Program::init(
     char buffer[512];
     glGetProgramInfoLog(program_shader, 512, NULL, buffer);
     cerr << "Linker error: " << endl << buffer << endl;
+    glDeleteProgram(program_shader);
     program_shader = 0;
     return false;
   }
 
+  if (!cache_path.empty())
+    save_binary(cache_path);
+
+  check_gl_error();
+  return true;
+}
+
+// Cache file layout: "GLPB", driver string length and bytes, binary
+// format, binary length and bytes. The driver string is checked again so
+// that a hash collision cannot feed a foreign binary to the driver.
+bool Program::load_binary(const std::string &path)
+{
+  std::ifstream fin(path.c_str(), std::ios::in | std::ios::binary);
+  if (!fin)
+    return false;
+
+  char magic[4];
+  uint32_t driver_length, format, length;
+  fin.read(magic, 4);
+  fin.read((char*) &driver_length, sizeof(driver_length));
+  if (!fin || std::string(magic, 4) != "GLPB" || driver_length > 4096)
+    return false;
+  std::string driver(driver_length, '\0');
+  fin.read(&driver[0], driver_length);
+  fin.read((char*) &format, sizeof(format));
+  fin.read((char*) &length, sizeof(length));
+  if (!fin || driver != driver_string() || length > (64u << 20))
+    return false;
+  std::vector<char> binary(length);
+  fin.read(binary.data(), length);
+  if (!fin)
+    return false;
+
+  GLuint program = glCreateProgram();
+  glProgramBinary(program, format, binary.data(), length);
+  GLint status;
+  glGetProgramiv(program, GL_LINK_STATUS, &status);
+  // the driver may reject binaries it produced itself, e.g. after an update
+  if (status != GL_TRUE)
+  {
+    glDeleteProgram(program);
+    glGetError();
+    return false;
+  }
+
+  program_shader = program;
   check_gl_error();
   return true;
 }
 
+void Program::save_binary(const std::string &path) const
+{
+  GLint length = 0;
+  glGetProgramiv(program_shader, GL_PROGRAM_BINARY_LENGTH, &length);
+  if (length <= 0)
+    return;
+
+  std::vector<char> binary(length);
+  GLenum format;
+  glGetProgramBinary(program_shader, length, NULL, &format, binary.data());
+  check_gl_error();
+
+  std::ofstream fout(path.c_str(), std::ios::out | std::ios::binary);
+  if (!fout)
+  {
+    std::cerr << "Cannot write program cache " << path << std::endl;
+    return;
+  }
+  std::string driver = driver_string();
+  uint32_t driver_length = driver.size();
+  uint32_t format32 = format;
+  uint32_t length32 = length;
+  fout.write("GLPB", 4);
+  fout.write((const char*) &driver_length, sizeof(driver_length));
+  fout.write(driver.data(), driver_length);
+  fout.write((const char*) &format32, sizeof(format32));
+  fout.write((const char*) &length32, sizeof(length32));
+  fout.write(binary.data(), length);
+}
+
 void Program::bind()
 {
   glUseProgram(program_shader);
@@ -163,6 +465,81 @@ GLuint Program::create_shader_helper(GLint type, const std::string &shader_strin
   return id;
 }
 
+static bool debug_output_supported()
+{
+#ifdef __APPLE__
+  // macOS stops at OpenGL 4.1, without KHR_debug
+  return false;
+#else
+  return GLEW_VERSION_4_3 || GLEW_KHR_debug;
+#endif
+}
+
+#ifndef __APPLE__
+static const char *debug_source_name(GLenum source)
+{
+  switch (source)
+  {
+    case GL_DEBUG_SOURCE_API:             return "api";
+    case GL_DEBUG_SOURCE_WINDOW_SYSTEM:   return "window system";
+    case GL_DEBUG_SOURCE_SHADER_COMPILER: return "shader compiler";
+    case GL_DEBUG_SOURCE_THIRD_PARTY:     return "third party";
+    case GL_DEBUG_SOURCE_APPLICATION:     return "application";
+    default:                              return "other";
+  }
+}
+
+static const char *debug_type_name(GLenum type)
+{
+  switch (type)
+  {
+    case GL_DEBUG_TYPE_ERROR:               return "error";
+    case GL_DEBUG_TYPE_DEPRECATED_BEHAVIOR: return "deprecated";
+    case GL_DEBUG_TYPE_UNDEFINED_BEHAVIOR:  return "undefined behavior";
+    case GL_DEBUG_TYPE_PORTABILITY:         return "portability";
+    case GL_DEBUG_TYPE_PERFORMANCE:         return "performance";
+    default:                                return "message";
+  }
+}
+
+static void GLAPIENTRY debug_message(GLenum source, GLenum type, GLuint id, GLenum severity,
+                                     GLsizei length, const GLchar *message, const void *user)
+{
+  if (severity == GL_DEBUG_SEVERITY_NOTIFICATION)
+    return;
+  const char *level = severity == GL_DEBUG_SEVERITY_HIGH ? "high" :
+                      severity == GL_DEBUG_SEVERITY_MEDIUM ? "medium" : "low";
+  std::cerr << "GL " << debug_type_name(type) << " (" << debug_source_name(source) << ", "
+            << level << ", " << id << "): " << message << std::endl;
+}
+#endif
+
+bool enable_gl_debug_output()
+{
+  if (!debug_output_supported())
+    return false;
+#ifndef __APPLE__
+  // synchronous, so that a debugger stops in the call raising the message
+  glEnable(GL_DEBUG_OUTPUT);
+  glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+  glDebugMessageCallback(debug_message, NULL);
+#endif
+  return true;
+}
+
+void label_gl_object(GLenum type, GLuint id, const std::string &name, const char *file, int line)
+{
+  if (!debug_output_supported() || id == 0)
+    return;
+#ifndef __APPLE__
+  std::string path(file);
+  std::string::size_type slash = path.find_last_of("/\\");
+  std::ostringstream label;
+  label << name << " (" << (slash == std::string::npos ? path : path.substr(slash + 1)) << ":" << line << ")";
+  glObjectLabel(type, id, -1, label.str().c_str());
+#endif
+}
+
 void _check_gl_error(const char *file, int line)
 {
   GLenum err (glGetError());
@@ -0,0 +1,213 @@
+#include "IndirectDraw.h"
+
+#include <iostream>
+#include <vector>
+#include <glm/glm.hpp>  // glm::vec2
+#include <glm/mat3x3.hpp> // glm::mat3
+#include <glm/mat4x4.hpp> // glm::mat4
+
+void pack_object_record(std::vector<glm::vec4>& records, const glm::mat4& model, const glm::vec4& color){
+    glm::mat3 normal_matrix = glm::transpose(glm::inverse(glm::mat3(model)));
+    records.push_back(model[0]);
+    records.push_back(model[1]);
+    records.push_back(model[2]);
+    records.push_back(model[3]);
+    records.push_back(glm::vec4(normal_matrix[0],0));
+    records.push_back(glm::vec4(normal_matrix[1],0));
+    records.push_back(glm::vec4(normal_matrix[2],0));
+    records.push_back(color);
+}
+
+
+DrawBatch::DrawBatch(GLenum primitive){
+    Primitive = primitive;
+    Offset = 0;
+    CommandCount = 0;
+}
+
+
+void DrawBatch::clear(){
+    Items.clear();
+    Offset = 0;
+    CommandCount = 0;
+}
+
+
+void DrawBatch::add(unsigned int first, unsigned int count, unsigned int object){
+    DrawItem item;
+    item.First = first;
+    item.Count = count;
+    item.Object = object;
+    Items.push_back(item);
+}
+
+
+IndirectDrawer::IndirectDrawer(){
+    MultiDraw = false;
+    DrawBaseLocation = -1;
+    Buffer = 0;
+}
+
+
+void IndirectDrawer::init(){
+    MultiDraw = multi_draw_indirect_supported();
+    std::cout << "multi-draw indirect: " << (MultiDraw ? "enabled" : "fallback loop") << std::endl;
+
+    // With MultiDraw the VAOs read DrawIdBuffer as object_id, see Mesh::upload
+    DrawIds.assign(1,0);
+    if(MultiDraw){
+        glGenBuffers(1,&Buffer);
+        DrawIdBuffer.init();
+        DrawIdBuffer.update(DrawIds);
+        label_gl(GL_BUFFER,DrawIdBuffer.id,"draw slots");
+    }
+    else{
+        DrawIdTexture.init(GL_R32I);
+        DrawIdTexture.update(DrawIds);
+        label_gl(GL_BUFFER,DrawIdTexture.id,"draw slots");
+    }
+    check_gl_error();
+}
+
+
+void IndirectDrawer::begin(unsigned int objects){
+    Commands.clear();
+    DrawIds.resize(objects);
+    for(int i = 0;i < objects;i++)
+        DrawIds[i] = i;
+}
+
+
+void IndirectDrawer::append(DrawBatch& batch){
+    batch.Offset = Commands.size();
+    for(int i = 0;i < batch.Items.size();i++){
+        const DrawItem& item = batch.Items[i];
+        unsigned int slot = DrawIds.size();
+        DrawIds.push_back(item.Object);
+
+        // the previous command ends at the previous slot, extend it if it draws the same range
+        if(Commands.size() > batch.Offset){
+            DrawElementsIndirectCommand& last = Commands.back();
+            if(last.firstIndex == item.First && last.count == item.Count){
+                last.instanceCount++;
+                continue;
+            }
+        }
+
+        DrawElementsIndirectCommand cmd;
+        cmd.count = item.Count;
+        cmd.instanceCount = 1;
+        cmd.firstIndex = item.First;
+        cmd.baseVertex = 0;
+        cmd.baseInstance = slot;
+        Commands.push_back(cmd);
+    }
+    batch.CommandCount = Commands.size() - batch.Offset;
+}
+
+
+void IndirectDrawer::upload(GLuint unit){
+    if(MultiDraw){
+        DrawIdBuffer.update(DrawIds);
+        if(Commands.empty())
+            return;
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER,Buffer);
+        glBufferData(GL_DRAW_INDIRECT_BUFFER,sizeof(DrawElementsIndirectCommand)*Commands.size(),Commands.data(),GL_STREAM_DRAW);
+        render_stats().BytesUploaded += sizeof(DrawElementsIndirectCommand)*Commands.size();
+    }
+    else{
+        DrawIdTexture.update(DrawIds);
+        DrawIdTexture.bind(unit);
+    }
+    check_gl_error();
+}
+
+
+void IndirectDrawer::draw(const DrawBatch& batch){
+    if(batch.CommandCount == 0)
+        return;
+    if(batch.Primitive == GL_TRIANGLES){
+        for(int i = batch.Offset;i < batch.Offset + batch.CommandCount;i++)
+            render_stats().Triangles += Commands[i].count / 3 * Commands[i].instanceCount;
+    }
+    else if(batch.Primitive == GL_LINES){
+        for(int i = batch.Offset;i < batch.Offset + batch.CommandCount;i++)
+            render_stats().Lines += Commands[i].count / 2 * Commands[i].instanceCount;
+    }
+#ifndef __APPLE__
+    if(MultiDraw){
+        render_stats().DrawCalls++;
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER,Buffer);
+        glMultiDrawElementsIndirect(batch.Primitive,GL_UNSIGNED_INT,
+            (const void*)(sizeof(DrawElementsIndirectCommand)*batch.Offset),
+            batch.CommandCount,0);
+        return;
+    }
+#endif
+    render_stats().DrawCalls += batch.CommandCount;
+    for(int i = batch.Offset;i < batch.Offset + batch.CommandCount;i++){
+        const DrawElementsIndirectCommand& cmd = Commands[i];
+        glUniform1i(DrawBaseLocation,cmd.baseInstance);
+        glDrawElementsInstanced(batch.Primitive,cmd.count,GL_UNSIGNED_INT,
+            (const void*)(sizeof(GLuint)*cmd.firstIndex),cmd.instanceCount);
+    }
+}
+
+
+void IndirectDrawer::draw_object(GLenum primitive, unsigned int first, unsigned int count, unsigned int object){
+    render_stats().DrawCalls++;
+    if(primitive == GL_TRIANGLES)
+        render_stats().Triangles += count / 3;
+    else if(primitive == GL_LINES)
+        render_stats().Lines += count / 2;
+#ifndef __APPLE__
+    if(MultiDraw){
+        glDrawElementsInstancedBaseInstance(primitive,count,GL_UNSIGNED_INT,
+            (const void*)(sizeof(GLuint)*first),1,object);
+        return;
+    }
+#endif
+    glUniform1i(DrawBaseLocation,object);
+    glDrawElementsInstanced(primitive,count,GL_UNSIGNED_INT,(const void*)(sizeof(GLuint)*first),1);
+}
+
+
+void IndirectDrawer::draw_arrays_object(GLenum primitive, unsigned int first, unsigned int count, unsigned int object){
+    render_stats().DrawCalls++;
+    if(primitive == GL_TRIANGLES)
+        render_stats().Triangles += count / 3;
+    else if(primitive == GL_LINES)
+        render_stats().Lines += count / 2;
+#ifndef __APPLE__
+    if(MultiDraw){
+        glDrawArraysInstancedBaseInstance(primitive,first,count,1,object);
+        return;
+    }
+#endif
+    glUniform1i(DrawBaseLocation,object);
+    glDrawArraysInstanced(primitive,first,count,1);
+}
+
+
+void IndirectDrawer::free(){
+    if(Buffer){
+        glDeleteBuffers(1,&Buffer);
+        Buffer = 0;
+    }
+    if(DrawIdBuffer.id)
+        DrawIdBuffer.free();
+    if(DrawIdTexture.id)
+        DrawIdTexture.free();
+    check_gl_error();
+}
+
+
+bool multi_draw_indirect_supported(){
+#ifdef __APPLE__
+    // macOS stops at OpenGL 4.1
+    return false;
+#else
+    return (GLEW_VERSION_4_3 || GLEW_ARB_multi_draw_indirect) &&
+           (GLEW_VERSION_4_2 || GLEW_ARB_base_instance);
+#endif
+}
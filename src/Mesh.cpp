@@ -0,0 +1,543 @@
+#include "Mesh.h"
+#include "MeshAsset.h"
+#include "MeshEdges.h"
+#include "RayTracer.h"
+#include "Simplify.h"
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <glm/glm.hpp>  // glm::vec2
+#include <glm/vec3.hpp> // glm::vec3
+
+// Levels of detail: at most LOD_MAX_LEVELS including the full mesh, none
+// under LOD_MIN_TRIANGLES. The drawn level has an error under
+// LOD_PIXEL_ERROR pixels, and is only replaced by a coarser one when that
+// one is LOD_HYSTERESIS below the threshold.
+const int LOD_MAX_LEVELS = 5;
+const unsigned int LOD_MIN_TRIANGLES = 32;
+const float LOD_PIXEL_ERROR = 1.0f;
+const float LOD_HYSTERESIS = 0.25f;
+
+static bool mesh_optimization = true;
+static bool mesh_ao_bake = true;
+static ThreadPool* mesh_build_pool = NULL;
+
+void set_mesh_optimization(bool enabled){
+    mesh_optimization = enabled;
+}
+
+
+void set_mesh_ao_bake(bool enabled){
+    mesh_ao_bake = enabled;
+}
+
+
+void set_mesh_build_pool(ThreadPool* pool){
+    mesh_build_pool = pool;
+}
+
+
+Mesh::Mesh(){
+    BaryCenter = glm::vec3(0,0,0);
+    UnitScale = glm::vec3(1,1,1);
+    Radius = 0;
+    SourceHash = 0;
+    Optimized = false;
+    AoBaked = false;
+    Uploaded = false;
+}
+
+
+void Mesh::loadOFF(std::string filepath){
+    std::string off_flag;
+    std::ifstream fin;
+    fin.open(filepath, std::ios::in);
+    fin >> off_flag;
+    if(off_flag != "OFF"){
+        throw "Not a vaild OFF file!";
+    }
+
+    int vertex_num, face_num, edge_num;
+    fin >> vertex_num >> face_num >> edge_num;
+
+    Path = filepath;
+    V.clear();
+    F.clear();
+
+    for(int i = 0;i < vertex_num;i++){
+        float v1, v2, v3;
+        fin >> v1 >> v2 >> v3;
+        V.push_back(glm::vec3(v1,v2,v3));
+    }
+
+    for(int i = 0;i < face_num;i++){
+        int size, id1, id2, id3;
+        fin >> size >> id1 >> id2 >> id3;
+        F.push_back(id1);
+        F.push_back(id2);
+        F.push_back(id3);
+    }
+
+    init_geometry();
+}
+
+
+void Mesh::init_geometry(){
+    C.assign(V.size(),glm::vec3(0.8f,0.8f,0.8f));
+    AO.assign(V.size(),1.0f);
+    N_f.clear();
+
+    std::vector<glm::vec3> normal_sum(V.size(),glm::vec3(0.0,0.0,0.0));
+
+    for(int i = 0;i < F.size();i += 3){
+        unsigned int id1 = F[i], id2 = F[i+1], id3 = F[i+2];
+
+        // calculate face normal vector
+        glm::highp_vec3 face_normal = glm::cross(V[id2]-V[id1],V[id3]-V[id1]);
+        face_normal = glm::normalize(face_normal);
+        N_f.push_back(face_normal);
+
+        // accumulate the face normal on its vertices
+        normal_sum[id1] += face_normal;
+        normal_sum[id2] += face_normal;
+        normal_sum[id3] += face_normal;
+    }
+
+    // calculate vertex normal
+    N_v.resize(V.size());
+    for(int i = 0;i < V.size();i++){
+        N_v[i] = glm::normalize(normal_sum[i]);
+    }
+
+    BaryCenter = get_bary_center();
+    UnitScale = get_unit_scale();
+    Radius = get_radius();
+}
+
+
+void Mesh::load(const std::string& filepath){
+    std::string cache_path;
+    Path = filepath;
+    SourceHash = 0;
+    if(hash_file(filepath,SourceHash))
+        cache_path = mesh_cache_path(SourceHash);
+    if(load_cache(cache_path))
+        return;
+
+    loadOFF(filepath);
+    build(cache_path);
+}
+
+
+void Mesh::load(const std::string& path, uint64_t source_hash, const glm::vec3* positions, unsigned int vertex_count,
+                const unsigned int* faces, unsigned int index_count){
+    Path = path;
+    SourceHash = source_hash;
+    std::string cache_path = mesh_cache_path(source_hash);
+    if(load_cache(cache_path))
+        return;
+
+    V.assign(positions,positions + vertex_count);
+    F.assign(faces,faces + index_count);
+    init_geometry();
+    build(cache_path);
+}
+
+
+bool Mesh::load_cache(const std::string& cache_path){
+    // a file of the other optimization setting is written again
+    if(cache_path.empty() || !load_mesh_asset(cache_path,*this,SourceHash) || Optimized != mesh_optimization)
+        return false;
+
+    C.assign(V.size(),glm::vec3(0.8f,0.8f,0.8f));
+    N_f.clear();
+    for(int i = 0;i < F.size();i += 3)
+        N_f.push_back(glm::normalize(glm::cross(V[F[i+1]]-V[F[i]],V[F[i+2]]-V[F[i]])));
+    BaryCenter = get_bary_center();
+    UnitScale = get_unit_scale();
+    Radius = get_radius();
+    Bounds.init(Meshlets);
+    Bvh.init_triangles(V,F);
+
+    // a file without the bake gets it, the bake of a file is only
+    // ignored when baking is off
+    if(mesh_ao_bake && !AoBaked){
+        bake_ambient_occlusion(*this,AO,mesh_build_pool);
+        AoBaked = true;
+        save_mesh_asset(cache_path,*this,SourceHash);
+    }
+    else if(!mesh_ao_bake){
+        AO.assign(V.size(),1.0f);
+        AoBaked = false;
+    }
+    return true;
+}
+
+
+void Mesh::build(const std::string& cache_path){
+    Optimized = false;
+    build_lods();
+    if(Lods.size() > 1){
+        std::cout << Path << ": levels of detail of";
+        for(int i = 0;i < Lods.size();i++)
+            std::cout << " " << Lods[i].Count / 3;
+        std::cout << " triangles" << std::endl;
+    }
+    if(mesh_optimization){
+        optimize();
+        std::cout << Path << ": vertex cache ACMR " << CacheBefore.ACMR << " -> " << CacheAfter.ACMR
+                  << ", ATVR " << CacheBefore.ATVR << " -> " << CacheAfter.ATVR << std::endl;
+    }
+    else
+        build_meshlets();
+    build_edges();
+    Bvh.build(V,F,mesh_build_pool);
+    AoBaked = mesh_ao_bake;
+    if(AoBaked){
+        auto start = std::chrono::high_resolution_clock::now();
+        bake_ambient_occlusion(*this,AO,mesh_build_pool);
+        std::cout << Path << ": ambient occlusion of " << V.size() << " vertices baked in "
+                  << std::chrono::duration<double,std::milli>(std::chrono::high_resolution_clock::now() - start).count()
+                  << " ms" << std::endl;
+    }
+    if(!cache_path.empty())
+        save_mesh_asset(cache_path,*this,SourceHash);
+}
+
+
+void Mesh::build_lods(){
+    Lods.clear();
+    LodIndices.clear();
+    MeshLod full = {0, (unsigned int) F.size(), 0.0f, 0, 0, 0};
+    Lods.push_back(full);
+
+    MeshSimplifier simplifier;
+    simplifier.init(V,N_v,F);
+    unsigned int count = F.size();
+    while(Lods.size() < LOD_MAX_LEVELS){
+        unsigned int target = count / 4 / 3 * 3;
+        if(target < LOD_MIN_TRIANGLES * 3 || !simplifier.simplify(target))
+            break;
+        // locked borders and creases can stop the simplification early
+        if(simplifier.Indices.size() * 5 > count * 4)
+            break;
+        MeshLod lod;
+        lod.First = F.size() + LodIndices.size();
+        lod.Count = simplifier.Indices.size();
+        lod.Error = simplifier.Error;
+        lod.EdgeFirst = lod.EdgeCount = lod.FeatureFirst = 0;
+        Lods.push_back(lod);
+        LodIndices.insert(LodIndices.end(),simplifier.Indices.begin(),simplifier.Indices.end());
+        count = lod.Count;
+    }
+}
+
+
+void Mesh::build_edges(){
+    EdgeIndices.clear();
+    EdgeFaces.clear();
+    unsigned int first = F.size() + LodIndices.size();
+    for(int l = 0;l < Lods.size();l++){
+        const std::vector<unsigned int>& indices = l == 0 ? F : LodIndices;
+        unsigned int offset = l == 0 ? 0 : F.size();
+        std::vector<MeshEdge> edges;
+        extract_edges(indices,Lods[l].First - offset,Lods[l].Count,edges);
+
+        Lods[l].EdgeFirst = first + EdgeIndices.size();
+        Lods[l].EdgeCount = 2 * edges.size();
+        for(int e = 0;e < edges.size();e++){
+            glm::vec4 face_a, face_b;
+            edge_faces(edges[e],indices,V,face_a,face_b);
+            EdgeIndices.push_back(edges[e].A);
+            EdgeIndices.push_back(edges[e].B);
+            EdgeFaces.push_back(face_a);
+            EdgeFaces.push_back(face_b);
+        }
+    }
+    for(int l = 0;l < Lods.size();l++)
+        Lods[l].FeatureFirst = Lods[l].EdgeFirst + EdgeIndices.size();
+}
+
+
+void Mesh::build_meshlets(){
+    // cones only for closed meshes, nothing culls the back faces seen
+    // through the holes of the others
+    std::vector<MeshEdge> edges;
+    extract_edges(F,0,F.size(),edges);
+    bool closed = true;
+    for(int e = 0;e < edges.size() && closed;e++)
+        closed = edges[e].FaceCount == 2;
+
+    ::build_meshlets(F,0,F.size(),V,closed,Meshlets);
+    Bounds.init(Meshlets);
+
+    // the face normals and the center follow the triangle order
+    N_f.clear();
+    for(int i = 0;i < F.size();i += 3)
+        N_f.push_back(glm::normalize(glm::cross(V[F[i+1]]-V[F[i]],V[F[i+2]]-V[F[i]])));
+    BaryCenter = get_bary_center();
+}
+
+
+// Tipsify, then the overdraw ordering of its clusters
+static void optimize_triangle_order(std::vector<unsigned int>& indices, const std::vector<glm::vec3>& positions){
+    std::vector<unsigned int> clusters;
+    optimize_vertex_cache(indices,positions.size(),clusters);
+    optimize_overdraw(indices,positions,clusters);
+}
+
+
+void Mesh::optimize(){
+    CacheBefore = vertex_cache_stats(F,V.size());
+
+    // every level is drawn on its own
+    optimize_triangle_order(F,V);
+    for(int l = 1;l < Lods.size();l++){
+        std::vector<unsigned int>::iterator first = LodIndices.begin() + (Lods[l].First - F.size());
+        std::vector<unsigned int> level(first,first + Lods[l].Count);
+        optimize_triangle_order(level,V);
+        std::copy(level.begin(),level.end(),first);
+    }
+
+    // the meshlets regroup the triangles of F, before the vertices follow
+    build_meshlets();
+
+    std::vector<std::vector<unsigned int>*> index_lists;
+    index_lists.push_back(&F);
+    index_lists.push_back(&LodIndices);
+    std::vector<unsigned int> remap;
+    optimize_vertex_fetch(index_lists,V.size(),remap);
+    remap_vertices(V,remap);
+    remap_vertices(C,remap);
+    remap_vertices(N_v,remap);
+
+    // the sums over the corners run in the new order, as after a cache hit
+    N_f.clear();
+    for(int i = 0;i < F.size();i += 3)
+        N_f.push_back(glm::normalize(glm::cross(V[F[i+1]]-V[F[i]],V[F[i+2]]-V[F[i]])));
+    BaryCenter = get_bary_center();
+    UnitScale = get_unit_scale();
+    Radius = get_radius();
+
+    CacheAfter = vertex_cache_stats(F,V.size());
+    Optimized = true;
+}
+
+
+int Mesh::select_lod(float pixels_per_unit, int current) const{
+    if(Lods.size() <= 1)
+        return 0;
+    current = std::min(std::max(current,0),int(Lods.size()) - 1);
+
+    // the errors grow with the level
+    if(Lods[current].Error * pixels_per_unit > LOD_PIXEL_ERROR){
+        int level = 0;
+        while(level + 1 < Lods.size() && Lods[level+1].Error * pixels_per_unit <= LOD_PIXEL_ERROR)
+            level++;
+        return level;
+    }
+    int level = current;
+    while(level + 1 < Lods.size() && Lods[level+1].Error * pixels_per_unit <= LOD_PIXEL_ERROR * (1.0f - LOD_HYSTERESIS))
+        level++;
+    return level;
+}
+
+
+void Mesh::upload(VertexBufferObject& object_ids, bool instanced_ids){
+    VAO.init();
+    VAO.bind();
+
+    // the feature edge vertices follow the mesh vertices, the edge
+    // attributes are only set for them
+    std::vector<glm::vec3> positions(V), colors(C), normals(N_v);
+    std::vector<float> occlusion(AO);
+    std::vector<glm::vec4> face_a(V.size(),glm::vec4(0.0f)), face_b(V.size(),glm::vec4(0.0f));
+    std::vector<glm::vec3> centers(V.size(),glm::vec3(0.0f));
+    for(int i = 0;i < EdgeIndices.size();i++){
+        unsigned int v = EdgeIndices[i];
+        unsigned int e = i / 2;
+        positions.push_back(V[v]);
+        colors.push_back(C[v]);
+        normals.push_back(N_v[v]);
+        occlusion.push_back(AO[v]);
+        face_a.push_back(EdgeFaces[2 * e]);
+        face_b.push_back(EdgeFaces[2 * e + 1]);
+        centers.push_back(0.5f * (V[EdgeIndices[2 * e]] + V[EdgeIndices[2 * e + 1]]));
+    }
+    std::vector<unsigned int> indices(F);
+    indices.insert(indices.end(),LodIndices.begin(),LodIndices.end());
+    indices.insert(indices.end(),EdgeIndices.begin(),EdgeIndices.end());
+    for(int i = 0;i < EdgeIndices.size();i++)
+        indices.push_back(V.size() + i);
+
+    VBO.init();
+    VBO.update(positions);
+    CBO.init();
+    CBO.update(colors);
+    NBO.init();
+    NBO.update(normals);
+    AOBO.init();
+    AOBO.update(occlusion);
+    EdgeFaceA.init();
+    EdgeFaceA.update(face_a);
+    EdgeFaceB.init();
+    EdgeFaceB.update(face_b);
+    EdgeCenter.init();
+    EdgeCenter.update(centers);
+    EBO.init();
+    EBO.update(indices);
+
+    // fixed locations, the VAO works with every program
+    bindVertexAttribArray(ATTRIB_POSITION,VBO);
+    bindVertexAttribArray(ATTRIB_COLOR,CBO);
+    bindVertexAttribArray(ATTRIB_NORMAL,NBO);
+    bindVertexAttribArray(ATTRIB_OCCLUSION,AOBO);
+    bindVertexAttribArray(ATTRIB_EDGE_FACE_A,EdgeFaceA);
+    bindVertexAttribArray(ATTRIB_EDGE_FACE_B,EdgeFaceB);
+    bindVertexAttribArray(ATTRIB_EDGE_CENTER,EdgeCenter);
+    if(instanced_ids)
+        bindVertexAttribIArray(ATTRIB_OBJECT_ID,object_ids,1);
+
+    // the element buffer binding is part of the VAO state
+    EBO.bind();
+
+    label_gl(GL_VERTEX_ARRAY,VAO.id,Path);
+    label_gl(GL_BUFFER,VBO.id,Path + " positions");
+    label_gl(GL_BUFFER,CBO.id,Path + " colors");
+    label_gl(GL_BUFFER,NBO.id,Path + " normals");
+    label_gl(GL_BUFFER,AOBO.id,Path + " ambient occlusion");
+    label_gl(GL_BUFFER,EdgeFaceA.id,Path + " edge faces a");
+    label_gl(GL_BUFFER,EdgeFaceB.id,Path + " edge faces b");
+    label_gl(GL_BUFFER,EdgeCenter.id,Path + " edge centers");
+    label_gl(GL_BUFFER,EBO.id,Path + " indices");
+    Uploaded = true;
+}
+
+
+void Mesh::free(){
+    if(!Uploaded)
+        return;
+    VAO.free();
+    VBO.free();
+    CBO.free();
+    NBO.free();
+    AOBO.free();
+    EdgeFaceA.free();
+    EdgeFaceB.free();
+    EdgeCenter.free();
+    EBO.free();
+    Uploaded = false;
+}
+
+
+// The center and the extent are taken over the triangle corners, so a
+// vertex counts once per face using it
+glm::vec3 Mesh::get_bary_center(){
+    glm::vec3 sum(0,0,0);
+    int v_num = F.size();
+    for(int i = 0;i < F.size();i++){
+        sum += V[F[i]];
+    }
+    return glm::vec3(sum.x/v_num,sum.y/v_num,sum.z/v_num);
+}
+
+
+glm::vec3 Mesh::get_unit_scale(){
+    float x_min = 1e-30;
+    float y_min = 1e-30;
+    float z_min = 1e-30;
+    float x_max = -1e-30;
+    float y_max = -1e-30;
+    float z_max = -1e-30;
+
+    for(int i = 0;i < F.size();i++){
+        const glm::vec3& v = V[F[i]];
+        x_min = x_min < v.x? x_min:v.x;
+        y_min = y_min < v.y? y_min:v.y;
+        z_min = z_min < v.z? z_min:v.z;
+        x_max = x_max > v.x? x_max:v.x;
+        y_max = y_max > v.y? y_max:v.y;
+        z_max = z_max > v.z? z_max:v.z;
+    }
+
+    float x_scale = x_max - x_min;
+    float y_scale = y_max - y_min;
+    float z_scale = z_max - z_min;
+
+    float max_scale = glm::max(x_scale,glm::max(y_scale,z_scale));
+
+    return glm::vec3(1.0/max_scale,1.0/max_scale,1.0/max_scale);
+}
+
+
+float Mesh::get_radius(){
+    float radius = 0;
+    for(int i = 0;i < V.size();i++)
+        radius = glm::max(radius,glm::length(V[i] - BaryCenter));
+    return radius;
+}
+
+
+static std::vector<Mesh*> meshes;
+static std::map<std::string, unsigned int> mesh_ids;
+
+unsigned int load_mesh(const std::string& filepath){
+    std::map<std::string, unsigned int>::iterator it = mesh_ids.find(filepath);
+    if(it != mesh_ids.end())
+        return it->second;
+
+    Mesh* mesh = new Mesh();
+    mesh->load(filepath);
+    unsigned int id = meshes.size();
+    meshes.push_back(mesh);
+    mesh_ids[filepath] = id;
+    return id;
+}
+
+
+unsigned int load_mesh(const std::string& path, uint64_t source_hash, const glm::vec3* positions, unsigned int vertex_count,
+                       const unsigned int* faces, unsigned int index_count){
+    std::map<std::string, unsigned int>::iterator it = mesh_ids.find(path);
+    if(it != mesh_ids.end() && meshes[it->second]->SourceHash == source_hash)
+        return it->second;
+
+    // a file changed since then keeps both versions, the other one by its hash
+    std::string key = path;
+    if(it != mesh_ids.end()){
+        char hash[17];
+        snprintf(hash, sizeof(hash), "%016llx", (unsigned long long) source_hash);
+        key = path + "#" + hash;
+        it = mesh_ids.find(key);
+        if(it != mesh_ids.end())
+            return it->second;
+    }
+
+    Mesh* mesh = new Mesh();
+    mesh->load(path,source_hash,positions,vertex_count,faces,index_count);
+    unsigned int id = meshes.size();
+    meshes.push_back(mesh);
+    mesh_ids[key] = id;
+    return id;
+}
+
+
+Mesh& get_mesh(unsigned int id){
+    return *meshes[id];
+}
+
+
+unsigned int mesh_count(){
+    return meshes.size();
+}
+
+
+void free_meshes(){
+    for(int i = 0;i < meshes.size();i++)
+        meshes[i]->free();
+}
@@ -0,0 +1,291 @@
+#include "MeshAsset.h"
+#include "Mesh.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <sys/stat.h>
+#ifdef _WIN32
+#  include <direct.h>
+#endif
+
+// Bumped whenever a chunk changes meaning, old files are then rebuilt
+static const uint32_t MESH_ASSET_VERSION = 4;
+
+static std::string mesh_cache_dir;
+
+void set_mesh_cache_dir(const std::string& dir){
+    mesh_cache_dir = dir;
+}
+
+
+std::string mesh_cache_path(uint64_t source_hash){
+    if(mesh_cache_dir.empty())
+        return "";
+
+#ifdef _WIN32
+    _mkdir(mesh_cache_dir.c_str());
+#else
+    mkdir(mesh_cache_dir.c_str(), 0755);
+#endif
+
+    std::ostringstream path;
+    path << mesh_cache_dir << "/" << std::hex << std::setw(16) << std::setfill('0') << source_hash << ".mesh";
+    return path.str();
+}
+
+
+bool hash_file(const std::string& path, uint64_t& hash){
+    std::ifstream fin(path.c_str(), std::ios::in | std::ios::binary);
+    if(!fin)
+        return false;
+    hash = 14695981039346656037ULL;
+    char buffer[65536];
+    while(fin){
+        fin.read(buffer,sizeof(buffer));
+        std::streamsize n = fin.gcount();
+        for(std::streamsize i = 0;i < n;i++){
+            hash ^= (unsigned char) buffer[i];
+            hash *= 1099511628211ULL;
+        }
+    }
+    return true;
+}
+
+
+// One level of detail as stored, the error is in mesh units
+struct LodRecord{
+    uint32_t First;
+    uint32_t Count;
+    float Error;
+    uint32_t EdgeFirst;
+    uint32_t EdgeCount;
+    uint32_t FeatureFirst;
+};
+
+
+// One meshlet as stored: sphere center and radius, cone axis and cutoff
+struct MeshletRecord{
+    uint32_t First;
+    uint32_t Count;
+    float Sphere[4];
+    float Cone[4];
+};
+
+
+// Optimization state, only written for optimized meshes
+struct OptimizeRecord{
+    uint32_t CacheSize;
+    float AcmrBefore, AtvrBefore;
+    float AcmrAfter, AtvrAfter;
+};
+
+
+template<typename T>
+static void write_chunk(std::ofstream& fout, const char* tag, const std::vector<T>& data){
+    uint32_t size = data.size() * sizeof(T);
+    fout.write(tag, 4);
+    fout.write((const char*) &size, sizeof(size));
+    if(size > 0)
+        fout.write((const char*) data.data(), size);
+}
+
+
+// Chunk payload as an array of T, false if the size does not fit
+template<typename T>
+static bool read_chunk(const std::vector<char>& bytes, std::vector<T>& data){
+    if(bytes.size() % sizeof(T) != 0)
+        return false;
+    data.resize(bytes.size() / sizeof(T));
+    if(!bytes.empty())
+        memcpy(data.data(), bytes.data(), bytes.size());
+    return true;
+}
+
+
+bool save_mesh_asset(const std::string& path, const Mesh& mesh, uint64_t source_hash){
+    std::ofstream fout(path.c_str(), std::ios::out | std::ios::binary);
+    if(!fout){
+        std::cerr << "Cannot write mesh cache " << path << std::endl;
+        return false;
+    }
+
+    std::vector<LodRecord> lods(mesh.Lods.size());
+    for(int i = 0;i < mesh.Lods.size();i++){
+        lods[i].First = mesh.Lods[i].First;
+        lods[i].Count = mesh.Lods[i].Count;
+        lods[i].Error = mesh.Lods[i].Error;
+        lods[i].EdgeFirst = mesh.Lods[i].EdgeFirst;
+        lods[i].EdgeCount = mesh.Lods[i].EdgeCount;
+        lods[i].FeatureFirst = mesh.Lods[i].FeatureFirst;
+    }
+
+    std::vector<MeshletRecord> meshlets(mesh.Meshlets.size());
+    for(int i = 0;i < mesh.Meshlets.size();i++){
+        meshlets[i].First = mesh.Meshlets[i].First;
+        meshlets[i].Count = mesh.Meshlets[i].Count;
+        for(int k = 0;k < 4;k++){
+            meshlets[i].Sphere[k] = mesh.Meshlets[i].Sphere[k];
+            meshlets[i].Cone[k] = mesh.Meshlets[i].Cone[k];
+        }
+    }
+
+    fout.write("MESH", 4);
+    fout.write((const char*) &MESH_ASSET_VERSION, sizeof(MESH_ASSET_VERSION));
+    fout.write((const char*) &source_hash, sizeof(source_hash));
+    write_chunk(fout, "VERT", mesh.V);
+    write_chunk(fout, "NORM", mesh.N_v);
+    write_chunk(fout, "TRIS", mesh.F);
+    write_chunk(fout, "LODS", lods);
+    write_chunk(fout, "LIDX", mesh.LodIndices);
+    write_chunk(fout, "EDGE", mesh.EdgeIndices);
+    write_chunk(fout, "EFAC", mesh.EdgeFaces);
+    write_chunk(fout, "MLET", meshlets);
+    write_chunk(fout, "BVHN", mesh.Bvh.Nodes);
+    write_chunk(fout, "BVHT", mesh.Bvh.Triangles);
+    if(mesh.AoBaked)
+        write_chunk(fout, "AOCC", mesh.AO);
+    if(mesh.Optimized){
+        OptimizeRecord record = {VERTEX_CACHE_SIZE, mesh.CacheBefore.ACMR, mesh.CacheBefore.ATVR,
+                                 mesh.CacheAfter.ACMR, mesh.CacheAfter.ATVR};
+        write_chunk(fout, "OPTM", std::vector<OptimizeRecord>(1,record));
+    }
+    return bool(fout);
+}
+
+
+bool load_mesh_asset(const std::string& path, Mesh& mesh, uint64_t source_hash){
+    std::ifstream fin(path.c_str(), std::ios::in | std::ios::binary);
+    if(!fin)
+        return false;
+
+    char magic[4];
+    uint32_t version;
+    uint64_t hash;
+    fin.read(magic, 4);
+    fin.read((char*) &version, sizeof(version));
+    fin.read((char*) &hash, sizeof(hash));
+    if(!fin || std::string(magic, 4) != "MESH" || version != MESH_ASSET_VERSION || hash != source_hash)
+        return false;
+
+    std::vector<glm::vec3> V, N;
+    std::vector<float> ao;
+    std::vector<unsigned int> F, lod_indices, edge_indices;
+    std::vector<glm::vec4> edge_faces;
+    std::vector<LodRecord> lods;
+    std::vector<MeshletRecord> meshlets;
+    std::vector<OptimizeRecord> optimized;
+    MeshBvh bvh;
+    bool valid = true;
+    while(true){
+        char tag[4];
+        uint32_t size;
+        fin.read(tag, 4);
+        fin.read((char*) &size, sizeof(size));
+        if(!fin)
+            break;
+        if(size > (256u << 20))
+            return false;
+        std::vector<char> bytes(size);
+        if(size > 0)
+            fin.read(bytes.data(), size);
+        if(!fin)
+            return false;
+
+        std::string name(tag, 4);
+        if(name == "VERT")
+            valid = valid && read_chunk(bytes, V);
+        else if(name == "NORM")
+            valid = valid && read_chunk(bytes, N);
+        else if(name == "TRIS")
+            valid = valid && read_chunk(bytes, F);
+        else if(name == "LODS")
+            valid = valid && read_chunk(bytes, lods);
+        else if(name == "LIDX")
+            valid = valid && read_chunk(bytes, lod_indices);
+        else if(name == "EDGE")
+            valid = valid && read_chunk(bytes, edge_indices);
+        else if(name == "EFAC")
+            valid = valid && read_chunk(bytes, edge_faces);
+        else if(name == "MLET")
+            valid = valid && read_chunk(bytes, meshlets);
+        else if(name == "BVHN")
+            valid = valid && read_chunk(bytes, bvh.Nodes);
+        else if(name == "BVHT")
+            valid = valid && read_chunk(bytes, bvh.Triangles);
+        else if(name == "AOCC")
+            valid = valid && read_chunk(bytes, ao);
+        else if(name == "OPTM")
+            valid = valid && read_chunk(bytes, optimized);
+    }
+    if(!valid || V.empty() || N.size() != V.size() || F.empty() || lods.empty() || edge_faces.size() != edge_indices.size())
+        return false;
+
+    // every index must stay inside the buffers it is drawn from
+    for(int i = 0;i < F.size();i++)
+        if(F[i] >= V.size())
+            return false;
+    for(int i = 0;i < lod_indices.size();i++)
+        if(lod_indices[i] >= V.size())
+            return false;
+    for(int i = 0;i < edge_indices.size();i++)
+        if(edge_indices[i] >= V.size())
+            return false;
+    uint64_t index_count = F.size() + lod_indices.size() + 2 * edge_indices.size();
+    for(int i = 0;i < lods.size();i++){
+        if(uint64_t(lods[i].First) + lods[i].Count > index_count || uint64_t(lods[i].EdgeFirst) + lods[i].EdgeCount > index_count
+           || uint64_t(lods[i].FeatureFirst) + lods[i].EdgeCount > index_count)
+            return false;
+    }
+    if(meshlets.empty())
+        return false;
+    for(int i = 0;i < meshlets.size();i++)
+        if(uint64_t(meshlets[i].First) + meshlets[i].Count > F.size())
+            return false;
+    if(!bvh.valid(F.size() / 3) || (!ao.empty() && ao.size() != V.size()))
+        return false;
+
+    mesh.V.swap(V);
+    mesh.N_v.swap(N);
+    mesh.F.swap(F);
+    mesh.LodIndices.swap(lod_indices);
+    mesh.EdgeIndices.swap(edge_indices);
+    mesh.EdgeFaces.swap(edge_faces);
+    mesh.Bvh.Nodes.swap(bvh.Nodes);
+    mesh.Bvh.Triangles.swap(bvh.Triangles);
+    mesh.AoBaked = !ao.empty();
+    if(ao.empty())
+        ao.assign(mesh.V.size(), 1.0f);
+    mesh.AO.swap(ao);
+    mesh.Lods.resize(lods.size());
+    for(int i = 0;i < lods.size();i++){
+        mesh.Lods[i].First = lods[i].First;
+        mesh.Lods[i].Count = lods[i].Count;
+        mesh.Lods[i].Error = lods[i].Error;
+        mesh.Lods[i].EdgeFirst = lods[i].EdgeFirst;
+        mesh.Lods[i].EdgeCount = lods[i].EdgeCount;
+        mesh.Lods[i].FeatureFirst = lods[i].FeatureFirst;
+    }
+    mesh.Meshlets.resize(meshlets.size());
+    for(int i = 0;i < meshlets.size();i++){
+        mesh.Meshlets[i].First = meshlets[i].First;
+        mesh.Meshlets[i].Count = meshlets[i].Count;
+        for(int k = 0;k < 4;k++){
+            mesh.Meshlets[i].Sphere[k] = meshlets[i].Sphere[k];
+            mesh.Meshlets[i].Cone[k] = meshlets[i].Cone[k];
+        }
+    }
+    // an order optimized for another cache size counts as not optimized
+    mesh.Optimized = optimized.size() == 1 && optimized[0].CacheSize == VERTEX_CACHE_SIZE;
+    if(mesh.Optimized){
+        mesh.CacheBefore.ACMR = optimized[0].AcmrBefore;
+        mesh.CacheBefore.ATVR = optimized[0].AtvrBefore;
+        mesh.CacheAfter.ACMR = optimized[0].AcmrAfter;
+        mesh.CacheAfter.ATVR = optimized[0].AtvrAfter;
+    }
+    return true;
+}
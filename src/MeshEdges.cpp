@@ -0,0 +1,81 @@
+#include "MeshEdges.h"
+
+#include <vector>
+#include <stdint.h>
+#include <glm/glm.hpp>  // glm::vec2
+#include <glm/vec3.hpp> // glm::vec3
+#include <glm/vec4.hpp> // glm::vec4
+
+static uint64_t edge_key(unsigned int a, unsigned int b){
+    return a < b ? (uint64_t(a) << 32) | b : (uint64_t(b) << 32) | a;
+}
+
+
+static unsigned int hash_key(uint64_t key){
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    return (unsigned int) key;
+}
+
+
+void extract_edges(const std::vector<unsigned int>& indices, unsigned int first, unsigned int count,
+                   std::vector<MeshEdge>& edges){
+    edges.clear();
+
+    // open addressing, at most half full: slot -> edge index + 1
+    unsigned int size = 1;
+    while(size < 2 * count)
+        size *= 2;
+    std::vector<unsigned int> table(size,0);
+    std::vector<uint64_t> keys(size);
+
+    for(unsigned int i = first;i + 3 <= first + count;i += 3){
+        unsigned int triangle = i / 3;
+        for(int k = 0;k < 3;k++){
+            unsigned int a = indices[i + k], b = indices[i + (k + 1) % 3];
+            uint64_t key = edge_key(a,b);
+            unsigned int slot = hash_key(key) & (size - 1);
+            while(table[slot] != 0 && keys[slot] != key)
+                slot = (slot + 1) & (size - 1);
+            if(table[slot] == 0){
+                MeshEdge edge;
+                edge.A = a;
+                edge.B = b;
+                edge.Faces[0] = triangle;
+                edge.Faces[1] = triangle;
+                edge.FaceCount = 1;
+                edges.push_back(edge);
+                table[slot] = edges.size();
+                keys[slot] = key;
+            }
+            else{
+                MeshEdge& edge = edges[table[slot] - 1];
+                if(edge.FaceCount == 1)
+                    edge.Faces[1] = triangle;
+                edge.FaceCount++;
+            }
+        }
+    }
+}
+
+
+static glm::vec3 face_normal(const std::vector<unsigned int>& indices, unsigned int first,
+                             const std::vector<glm::vec3>& positions){
+    const glm::vec3& p0 = positions[indices[first]];
+    const glm::vec3& p1 = positions[indices[first + 1]];
+    const glm::vec3& p2 = positions[indices[first + 2]];
+    glm::vec3 n = glm::cross(p1 - p0,p2 - p0);
+    float length = glm::length(n);
+    return length > 0 ? n / length : n;
+}
+
+
+void edge_faces(const MeshEdge& edge, const std::vector<unsigned int>& indices,
+                const std::vector<glm::vec3>& positions, glm::vec4& face_a, glm::vec4& face_b){
+    glm::vec3 a = face_normal(indices,3 * edge.Faces[0],positions);
+    glm::vec3 b = face_normal(indices,3 * edge.Faces[1],positions);
+    bool feature = edge.FaceCount != 2 || glm::dot(a,b) < EDGE_CREASE_COS;
+    face_a = glm::vec4(a,feature ? EDGE_FEATURE : EDGE_SILHOUETTE);
+    face_b = glm::vec4(b,0.0f);
+}
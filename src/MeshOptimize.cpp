@@ -0,0 +1,265 @@
+#include "MeshOptimize.h"
+
+#include <vector>
+#include <algorithm>
+#include <glm/glm.hpp>  // glm::vec2
+#include <glm/vec3.hpp> // glm::vec3
+
+// A FIFO cache as the number of misses when each vertex entered it: a
+// vertex is cached while fewer than cache_size misses followed it
+class FifoCache{
+    public:
+        std::vector<long long> Entered;
+        long long Misses;
+        unsigned int Size;
+
+        FifoCache(unsigned int vertex_count, unsigned int size){
+            Entered.assign(vertex_count,-(long long) size - 1);
+            Misses = 0;
+            Size = size;
+        }
+
+        // True on a miss
+        bool access(unsigned int v){
+            if(Misses - Entered[v] < Size)
+                return false;
+            Entered[v] = Misses++;
+            return true;
+        }
+
+        // Forget every vertex
+        void flush(){
+            Misses += Size;
+        }
+};
+
+
+VertexCacheStats vertex_cache_stats(const std::vector<unsigned int>& indices, unsigned int vertex_count,
+                                    unsigned int cache_size){
+    FifoCache cache(vertex_count,cache_size);
+    std::vector<bool> used(vertex_count,false);
+    unsigned int transformed = 0, used_count = 0;
+    for(int i = 0;i < indices.size();i++){
+        if(cache.access(indices[i]))
+            transformed++;
+        if(!used[indices[i]]){
+            used[indices[i]] = true;
+            used_count++;
+        }
+    }
+    VertexCacheStats stats;
+    stats.ACMR = indices.size() < 3 ? 0 : float(transformed) / (indices.size() / 3);
+    stats.ATVR = used_count == 0 ? 0 : float(transformed) / used_count;
+    return stats;
+}
+
+
+void optimize_vertex_cache(std::vector<unsigned int>& indices, unsigned int vertex_count,
+                           std::vector<unsigned int>& clusters, unsigned int cache_size){
+    clusters.clear();
+    unsigned int triangle_count = indices.size() / 3;
+    if(triangle_count == 0)
+        return;
+
+    // triangles around each vertex, and how many of them are not emitted yet
+    std::vector<unsigned int> offsets(vertex_count + 1,0);
+    for(int i = 0;i < triangle_count * 3;i++)
+        offsets[indices[i] + 1]++;
+    for(int v = 0;v < vertex_count;v++)
+        offsets[v + 1] += offsets[v];
+    std::vector<unsigned int> adjacency(triangle_count * 3);
+    std::vector<unsigned int> fill(offsets.begin(),offsets.end() - 1);
+    for(int i = 0;i < triangle_count * 3;i++)
+        adjacency[fill[indices[i]]++] = i / 3;
+    std::vector<unsigned int> live(vertex_count);
+    for(int v = 0;v < vertex_count;v++)
+        live[v] = offsets[v + 1] - offsets[v];
+
+    // cache_time[v]: value of time when v last entered the cache, it is
+    // cached while time - cache_time[v] <= cache_size
+    std::vector<unsigned int> cache_time(vertex_count,0);
+    unsigned int time = cache_size + 1;
+    std::vector<bool> emitted(triangle_count,false);
+    std::vector<unsigned int> dead_end;
+    std::vector<unsigned int> candidates;
+    std::vector<unsigned int> order;
+    order.reserve(triangle_count * 3);
+    unsigned int cursor = 0;
+
+    int fan = -1;
+    bool restart = true;
+    while(cursor < vertex_count && live[cursor] == 0)
+        cursor++;
+    if(cursor < vertex_count)
+        fan = cursor;
+
+    while(fan >= 0){
+        if(restart)
+            clusters.push_back(order.size() / 3);
+
+        // emit the remaining triangles around the fanning vertex
+        candidates.clear();
+        for(int j = offsets[fan];j < offsets[fan + 1];j++){
+            unsigned int t = adjacency[j];
+            if(emitted[t])
+                continue;
+            emitted[t] = true;
+            for(int k = 0;k < 3;k++){
+                unsigned int v = indices[3 * t + k];
+                order.push_back(v);
+                dead_end.push_back(v);
+                candidates.push_back(v);
+                live[v]--;
+                if(time - cache_time[v] > cache_size){
+                    cache_time[v] = time;
+                    time++;
+                }
+            }
+        }
+
+        // the next fan: the oldest candidate that stays cached while its
+        // triangles are emitted, or else any candidate with triangles left
+        int next = -1;
+        int best = -1;
+        for(int j = 0;j < candidates.size();j++){
+            unsigned int v = candidates[j];
+            if(live[v] == 0)
+                continue;
+            int priority = 0;
+            if(time - cache_time[v] + 2 * live[v] <= cache_size)
+                priority = time - cache_time[v];
+            if(priority > best){
+                best = priority;
+                next = v;
+            }
+        }
+
+        // dead end: back to a recent vertex with triangles left, or the
+        // next one in index order
+        restart = false;
+        if(next < 0){
+            while(!dead_end.empty()){
+                unsigned int v = dead_end.back();
+                dead_end.pop_back();
+                if(live[v] > 0){
+                    next = v;
+                    restart = time - cache_time[v] > cache_size;
+                    break;
+                }
+            }
+        }
+        if(next < 0){
+            while(cursor < vertex_count && live[cursor] == 0)
+                cursor++;
+            if(cursor < vertex_count){
+                next = cursor;
+                restart = true;
+            }
+        }
+        fan = next;
+    }
+    indices.swap(order);
+}
+
+
+// A run of triangles of the overdraw ordering
+struct TriangleCluster{
+    unsigned int First, Count; // in triangles
+    float Order;               // clusters are drawn by decreasing Order
+};
+
+
+static bool drawn_before(const TriangleCluster& a, const TriangleCluster& b){
+    if(a.Order != b.Order)
+        return a.Order > b.Order;
+    return a.First < b.First;
+}
+
+
+void optimize_overdraw(std::vector<unsigned int>& indices, const std::vector<glm::vec3>& positions,
+                       const std::vector<unsigned int>& clusters, float threshold, unsigned int cache_size){
+    unsigned int triangle_count = indices.size() / 3;
+    if(triangle_count == 0 || clusters.empty())
+        return;
+    float target = threshold * vertex_cache_stats(indices,positions.size(),cache_size).ACMR;
+
+    // cut the hard clusters where their own ACMR is good enough
+    std::vector<TriangleCluster> runs;
+    FifoCache cache(positions.size(),cache_size);
+    for(int c = 0;c < clusters.size();c++){
+        unsigned int end = c + 1 < clusters.size() ? clusters[c + 1] : triangle_count;
+        unsigned int first = clusters[c];
+        unsigned int misses = 0;
+        cache.flush();
+        for(unsigned int t = clusters[c];t < end;t++){
+            for(int k = 0;k < 3;k++)
+                misses += cache.access(indices[3 * t + k]);
+            if(t + 1 < end && misses <= target * (t + 1 - first)){
+                TriangleCluster run = {first, t + 1 - first, 0.0f};
+                runs.push_back(run);
+                first = t + 1;
+                misses = 0;
+                cache.flush();
+            }
+        }
+        if(first < end){
+            TriangleCluster run = {first, end - first, 0.0f};
+            runs.push_back(run);
+        }
+    }
+
+    // a cluster facing away from the center of the mesh is more likely
+    // to hide the others than to be hidden
+    glm::vec3 mesh_center(0,0,0);
+    float mesh_area = 0;
+    std::vector<glm::vec3> centers(runs.size()), normals(runs.size());
+    for(int r = 0;r < runs.size();r++){
+        glm::vec3 center(0,0,0), normal(0,0,0);
+        float area = 0;
+        for(unsigned int t = runs[r].First;t < runs[r].First + runs[r].Count;t++){
+            const glm::vec3& p0 = positions[indices[3 * t]];
+            const glm::vec3& p1 = positions[indices[3 * t + 1]];
+            const glm::vec3& p2 = positions[indices[3 * t + 2]];
+            glm::vec3 n = glm::cross(p1 - p0,p2 - p0);
+            float a = 0.5f * glm::length(n);
+            center += a * (p0 + p1 + p2) / 3.0f;
+            normal += n;
+            area += a;
+        }
+        mesh_center += center;
+        mesh_area += area;
+        centers[r] = area > 0 ? center / area : positions[indices[3 * runs[r].First]];
+        normals[r] = glm::length(normal) > 0 ? glm::normalize(normal) : normal;
+    }
+    if(mesh_area > 0)
+        mesh_center /= mesh_area;
+    for(int r = 0;r < runs.size();r++)
+        runs[r].Order = glm::dot(centers[r] - mesh_center,normals[r]);
+    std::sort(runs.begin(),runs.end(),drawn_before);
+
+    std::vector<unsigned int> order;
+    order.reserve(indices.size());
+    for(int r = 0;r < runs.size();r++)
+        order.insert(order.end(),indices.begin() + 3 * runs[r].First,indices.begin() + 3 * (runs[r].First + runs[r].Count));
+    indices.swap(order);
+}
+
+
+void optimize_vertex_fetch(std::vector<std::vector<unsigned int>*>& index_lists, unsigned int vertex_count,
+                           std::vector<unsigned int>& remap){
+    const unsigned int unused = ~0u;
+    remap.assign(vertex_count,unused);
+    unsigned int next = 0;
+    for(int l = 0;l < index_lists.size();l++){
+        std::vector<unsigned int>& indices = *index_lists[l];
+        for(int i = 0;i < indices.size();i++){
+            if(remap[indices[i]] == unused)
+                remap[indices[i]] = next++;
+            indices[i] = remap[indices[i]];
+        }
+    }
+    for(int v = 0;v < vertex_count;v++){
+        if(remap[v] == unused)
+            remap[v] = next++;
+    }
+}
@@ -0,0 +1,282 @@
+#include "Meshlets.h"
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <glm/glm.hpp>  // glm::vec2
+#include <glm/vec3.hpp> // glm::vec3
+#include <glm/vec4.hpp> // glm::vec4
+#include <glm/mat4x4.hpp> // glm::mat4
+#include <glm/gtc/matrix_transform.hpp>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define MESHLETS_SSE
+#endif
+
+// Sphere around the corners of the triangles [first, first+count) and
+// their normal cone
+static void meshlet_bounds(const std::vector<unsigned int>& indices, unsigned int first, unsigned int count,
+                           const std::vector<glm::vec3>& positions, bool closed, Meshlet& meshlet){
+    glm::vec3 lo = positions[indices[first]], hi = lo;
+    for(unsigned int i = first;i < first + count;i++){
+        lo = glm::min(lo,positions[indices[i]]);
+        hi = glm::max(hi,positions[indices[i]]);
+    }
+    glm::vec3 center = (lo + hi) * 0.5f;
+    float radius = 0.0f;
+    for(unsigned int i = first;i < first + count;i++)
+        radius = std::max(radius,glm::length(positions[indices[i]] - center));
+    meshlet.Sphere = glm::vec4(center,radius);
+    meshlet.Cone = glm::vec4(0.0f,0.0f,0.0f,1.0f);
+    if(!closed)
+        return;
+
+    std::vector<glm::vec3> normals;
+    glm::vec3 axis(0.0f);
+    for(unsigned int i = first;i + 3 <= first + count;i += 3){
+        glm::vec3 a = positions[indices[i]], b = positions[indices[i + 1]], c = positions[indices[i + 2]];
+        glm::vec3 n = glm::cross(b - a,c - a);
+        float length = glm::length(n);
+        if(length == 0.0f)
+            continue;
+        normals.push_back(n / length);
+        axis += n / length;
+    }
+    if(glm::length(axis) < 1e-6f)
+        return;
+    axis = glm::normalize(axis);
+
+    // the cone has to hold every face normal; one wider than ~85 degrees
+    // almost never faces away, so it is left out of the test
+    float min_dot = 1.0f;
+    for(int i = 0;i < normals.size();i++)
+        min_dot = std::min(min_dot,glm::dot(axis,normals[i]));
+    if(min_dot <= 0.1f)
+        return;
+    meshlet.Cone = glm::vec4(axis,std::sqrt(1.0f - min_dot * min_dot));
+}
+
+
+// Candidates joining a meshlet are scored by the vertices they add plus
+// MESHLET_CONE_WEIGHT times how far their normal is from the cone axis
+const float MESHLET_CONE_WEIGHT = 2.0f;
+
+void build_meshlets(std::vector<unsigned int>& indices, unsigned int first, unsigned int count,
+                    const std::vector<glm::vec3>& positions, bool closed, std::vector<Meshlet>& meshlets){
+    meshlets.clear();
+    unsigned int triangles = count / 3;
+    if(triangles == 0)
+        return;
+
+    // triangles around each vertex, as offsets into adjacency
+    std::vector<unsigned int> offsets(positions.size() + 1,0);
+    for(unsigned int i = 0;i < 3 * triangles;i++)
+        offsets[indices[first + i] + 1]++;
+    for(int v = 0;v < positions.size();v++)
+        offsets[v + 1] += offsets[v];
+    std::vector<unsigned int> adjacency(3 * triangles);
+    std::vector<unsigned int> fill(offsets.begin(),offsets.end() - 1);
+    for(unsigned int i = 0;i < 3 * triangles;i++)
+        adjacency[fill[indices[first + i]]++] = i / 3;
+
+    std::vector<glm::vec3> normals(triangles);
+    for(unsigned int t = 0;t < triangles;t++){
+        const unsigned int* corner = &indices[first + 3 * t];
+        glm::vec3 n = glm::cross(positions[corner[1]] - positions[corner[0]],positions[corner[2]] - positions[corner[0]]);
+        float length = glm::length(n);
+        normals[t] = length > 0.0f ? n / length : glm::vec3(0.0f);
+    }
+
+    // grow each meshlet from the first triangle left, in the order given,
+    // so that the optimized order mostly survives between meshlets
+    std::vector<bool> used(triangles,false);
+    std::vector<unsigned int> stamp(positions.size(),0); // meshlet number + 1 of the vertices in it
+    std::vector<unsigned int> order, members, vertices;
+    order.reserve(triangles);
+    unsigned int seed = 0;
+    while(true){
+        while(seed < triangles && used[seed])
+            seed++;
+        if(seed == triangles)
+            break;
+        unsigned int current = meshlets.size() + 1;
+        members.clear();
+        vertices.clear();
+        glm::vec3 axis(0.0f);
+        unsigned int next = seed;
+        while(true){
+            used[next] = true;
+            members.push_back(next);
+            axis += normals[next];
+            for(int k = 0;k < 3;k++){
+                unsigned int v = indices[first + 3 * next + k];
+                if(stamp[v] != current){
+                    stamp[v] = current;
+                    vertices.push_back(v);
+                }
+            }
+            if(members.size() == MESHLET_MAX_TRIANGLES)
+                break;
+
+            // best unused triangle touching the meshlet that still fits
+            glm::vec3 direction = glm::length(axis) > 0.0f ? glm::normalize(axis) : axis;
+            float best_score = 1e30f;
+            unsigned int best = triangles;
+            for(int i = 0;i < vertices.size();i++){
+                for(unsigned int j = offsets[vertices[i]];j < offsets[vertices[i] + 1];j++){
+                    unsigned int t = adjacency[j];
+                    if(used[t])
+                        continue;
+                    unsigned int added = 0;
+                    for(int k = 0;k < 3;k++)
+                        added += stamp[indices[first + 3 * t + k]] != current;
+                    if(vertices.size() + added > MESHLET_MAX_VERTICES)
+                        continue;
+                    float score = added + MESHLET_CONE_WEIGHT * (1.0f - glm::dot(direction,normals[t]));
+                    if(score < best_score){
+                        best_score = score;
+                        best = t;
+                    }
+                }
+            }
+            if(best == triangles)
+                break;
+            next = best;
+        }
+
+        // inside a meshlet the triangles keep their order
+        std::sort(members.begin(),members.end());
+        Meshlet meshlet;
+        meshlet.First = first + 3 * order.size();
+        meshlet.Count = 3 * members.size();
+        meshlets.push_back(meshlet);
+        order.insert(order.end(),members.begin(),members.end());
+    }
+
+    std::vector<unsigned int> reordered(3 * triangles);
+    for(unsigned int t = 0;t < triangles;t++)
+        for(int k = 0;k < 3;k++)
+            reordered[3 * t + k] = indices[first + 3 * order[t] + k];
+    std::copy(reordered.begin(),reordered.end(),indices.begin() + first);
+    for(int m = 0;m < meshlets.size();m++)
+        meshlet_bounds(indices,meshlets[m].First,meshlets[m].Count,positions,closed,meshlets[m]);
+}
+
+
+void MeshletBounds::init(const std::vector<Meshlet>& meshlets){
+    // the padding is an empty sphere behind every plane, never visible
+    unsigned int size = (meshlets.size() + 3) & ~3u;
+    X.assign(size,0.0f);
+    Y.assign(size,0.0f);
+    Z.assign(size,0.0f);
+    Radius.assign(size,-1e30f);
+    AxisX.assign(size,0.0f);
+    AxisY.assign(size,0.0f);
+    AxisZ.assign(size,0.0f);
+    Cutoff.assign(size,1.0f);
+    for(int i = 0;i < meshlets.size();i++){
+        X[i] = meshlets[i].Sphere.x;
+        Y[i] = meshlets[i].Sphere.y;
+        Z[i] = meshlets[i].Sphere.z;
+        Radius[i] = meshlets[i].Sphere.w;
+        AxisX[i] = meshlets[i].Cone.x;
+        AxisY[i] = meshlets[i].Cone.y;
+        AxisZ[i] = meshlets[i].Cone.z;
+        Cutoff[i] = meshlets[i].Cone.w;
+    }
+}
+
+
+void MeshletView::init(const glm::mat4& model, const glm::mat4& view, const glm::mat4& projection, bool perspective){
+    // planes from the rows of the clip matrix, in the space of the mesh
+    glm::mat4 clip = projection * view * model;
+    glm::vec4 rows[4];
+    for(int i = 0;i < 4;i++)
+        rows[i] = glm::vec4(clip[0][i],clip[1][i],clip[2][i],clip[3][i]);
+    for(int i = 0;i < 3;i++){
+        Planes[2 * i] = rows[3] + rows[i];
+        Planes[2 * i + 1] = rows[3] - rows[i];
+    }
+    for(int i = 0;i < 6;i++)
+        Planes[i] /= glm::length(glm::vec3(Planes[i]));
+
+    // facing is kept by any affine map, so the cones are tested against
+    // the camera brought into the mesh space
+    glm::mat4 to_mesh = glm::inverse(view * model);
+    Eye = glm::vec3(to_mesh * glm::vec4(0.0f,0.0f,0.0f,1.0f));
+    Direction = glm::normalize(glm::vec3(to_mesh * glm::vec4(0.0f,0.0f,-1.0f,0.0f)));
+    Perspective = perspective;
+}
+
+
+#ifdef MESHLETS_SSE
+void cull_meshlets(const MeshletBounds& bounds, unsigned int count, const MeshletView& view,
+                   std::vector<unsigned int>& visible){
+    for(unsigned int i = 0;i < count;i += 4){
+        __m128 x = _mm_loadu_ps(&bounds.X[i]);
+        __m128 y = _mm_loadu_ps(&bounds.Y[i]);
+        __m128 z = _mm_loadu_ps(&bounds.Z[i]);
+        __m128 radius = _mm_loadu_ps(&bounds.Radius[i]);
+        __m128 negative_radius = _mm_sub_ps(_mm_setzero_ps(),radius);
+
+        // outside if entirely behind one plane
+        __m128 culled = _mm_setzero_ps();
+        for(int p = 0;p < 6;p++){
+            const glm::vec4& plane = view.Planes[p];
+            __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x,_mm_set1_ps(plane.x)),
+                                                    _mm_mul_ps(y,_mm_set1_ps(plane.y))),
+                                         _mm_add_ps(_mm_mul_ps(z,_mm_set1_ps(plane.z)),
+                                                    _mm_set1_ps(plane.w)));
+            culled = _mm_or_ps(culled,_mm_cmplt_ps(distance,negative_radius));
+        }
+
+        // back facing if the whole cone points away from the camera
+        __m128 ax = _mm_loadu_ps(&bounds.AxisX[i]);
+        __m128 ay = _mm_loadu_ps(&bounds.AxisY[i]);
+        __m128 az = _mm_loadu_ps(&bounds.AxisZ[i]);
+        __m128 cutoff = _mm_loadu_ps(&bounds.Cutoff[i]);
+        if(view.Perspective){
+            __m128 dx = _mm_sub_ps(x,_mm_set1_ps(view.Eye.x));
+            __m128 dy = _mm_sub_ps(y,_mm_set1_ps(view.Eye.y));
+            __m128 dz = _mm_sub_ps(z,_mm_set1_ps(view.Eye.z));
+            __m128 along = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx,ax),_mm_mul_ps(dy,ay)),_mm_mul_ps(dz,az));
+            __m128 distance = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx,dx),_mm_mul_ps(dy,dy)),_mm_mul_ps(dz,dz)));
+            culled = _mm_or_ps(culled,_mm_cmpge_ps(along,_mm_add_ps(_mm_mul_ps(cutoff,distance),radius)));
+        }
+        else{
+            __m128 along = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(view.Direction.x),ax),
+                                                 _mm_mul_ps(_mm_set1_ps(view.Direction.y),ay)),
+                                      _mm_mul_ps(_mm_set1_ps(view.Direction.z),az));
+            culled = _mm_or_ps(culled,_mm_cmpge_ps(along,cutoff));
+        }
+
+        int mask = ~_mm_movemask_ps(culled) & 15;
+        for(unsigned int k = 0;k < 4 && i + k < count;k++){
+            if(mask & (1 << k))
+                visible.push_back(i + k);
+        }
+    }
+}
+#else
+void cull_meshlets(const MeshletBounds& bounds, unsigned int count, const MeshletView& view,
+                   std::vector<unsigned int>& visible){
+    for(unsigned int i = 0;i < count;i++){
+        glm::vec3 center(bounds.X[i],bounds.Y[i],bounds.Z[i]);
+        float radius = bounds.Radius[i];
+        bool culled = false;
+        for(int p = 0;p < 6 && !culled;p++)
+            culled = glm::dot(glm::vec3(view.Planes[p]),center) + view.Planes[p].w < -radius;
+
+        glm::vec3 axis(bounds.AxisX[i],bounds.AxisY[i],bounds.AxisZ[i]);
+        if(view.Perspective){
+            glm::vec3 d = center - view.Eye;
+            culled = culled || glm::dot(d,axis) >= bounds.Cutoff[i] * glm::length(d) + radius;
+        }
+        else
+            culled = culled || glm::dot(view.Direction,axis) >= bounds.Cutoff[i];
+        if(!culled)
+            visible.push_back(i);
+    }
+}
+#endif
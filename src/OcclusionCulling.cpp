@@ -0,0 +1,276 @@
+#include "OcclusionCulling.h"
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <glm/glm.hpp>  // glm::vec2
+#include <glm/vec3.hpp> // glm::vec3
+#include <glm/vec4.hpp> // glm::vec4
+#include <glm/mat4x4.hpp> // glm::mat4
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define OCCLUSION_SSE
+#endif
+
+// Spheres tested by one job of test()
+const unsigned int OCCLUSION_TEST_BATCH = 64;
+
+OcclusionCuller::OcclusionCuller(){
+    Width = Height = 0;
+    Pool = NULL;
+}
+
+
+void OcclusionCuller::begin(int framebuffer_width, int framebuffer_height, const glm::mat4& view_projection, ThreadPool* pool){
+    // whole tiles across, so that every row of a tile is whole SSE blocks
+    int height = std::max(1,(int) std::ceil(float(OCCLUSION_WIDTH) * framebuffer_height / std::max(framebuffer_width,1)));
+    if(Width != OCCLUSION_WIDTH || Height != height){
+        Width = OCCLUSION_WIDTH;
+        Height = height;
+        Levels.clear();
+        LevelWidth.clear();
+        LevelHeight.clear();
+        int w = Width, h = Height;
+        while(true){
+            Levels.push_back(std::vector<float>(w * h));
+            LevelWidth.push_back(w);
+            LevelHeight.push_back(h);
+            if(w == 1 && h == 1)
+                break;
+            w = (w + 1) / 2;
+            h = (h + 1) / 2;
+        }
+    }
+    Raster.assign(Width * Height,1.0f);
+    Occluders.clear();
+    ViewProjection = view_projection;
+    Pool = pool;
+}
+
+
+void OcclusionCuller::add_occluder(const Occluder& occluder){
+    Occluders.push_back(occluder);
+}
+
+
+void OcclusionCuller::setup(const Occluder& occluder, std::vector<OccluderTriangle>& triangles, std::vector<glm::vec4>& screen) const{
+    triangles.clear();
+    glm::mat4 mvp = ViewProjection * occluder.Model;
+    const std::vector<glm::vec3>& positions = *occluder.Positions;
+    const std::vector<unsigned int>& indices = *occluder.Indices;
+
+    // the vertices of the level once, w = 1 when done, -1 for those before
+    // the near plane
+    screen.assign(positions.size(),glm::vec4(0.0f));
+    for(unsigned int i = occluder.First;i < occluder.First + occluder.Count;i++){
+        glm::vec4& vertex = screen[indices[i]];
+        if(vertex.w != 0.0f)
+            continue;
+        glm::vec4 clip = mvp * glm::vec4(positions[indices[i]],1.0f);
+        if(clip.w <= 0.0f || clip.z < -clip.w)
+            vertex = glm::vec4(0.0f,0.0f,0.0f,-1.0f);
+        else
+            vertex = glm::vec4((clip.x / clip.w * 0.5f + 0.5f) * Width,(clip.y / clip.w * 0.5f + 0.5f) * Height,
+                               clip.z / clip.w * 0.5f + 0.5f,1.0f);
+    }
+
+    for(unsigned int i = occluder.First;i + 3 <= occluder.First + occluder.Count;i += 3){
+        // the triangles crossing the near plane are left out, an occluder
+        // can only miss pixels
+        const glm::vec4& a = screen[indices[i]];
+        const glm::vec4& b = screen[indices[i + 1]];
+        const glm::vec4& c = screen[indices[i + 2]];
+        if(a.w < 0.0f || b.w < 0.0f || c.w < 0.0f)
+            continue;
+
+        float area = (b.x - a.x) * (c.y - a.y) - (c.x - a.x) * (b.y - a.y);
+        if(area == 0.0f)
+            continue;
+        const glm::vec4* corners[3] = {&a, area > 0.0f ? &b : &c, area > 0.0f ? &c : &b};
+        OccluderTriangle t;
+        for(int k = 0;k < 3;k++){
+            t.X[k] = corners[k]->x;
+            t.Y[k] = corners[k]->y;
+            t.Z[k] = corners[k]->z;
+        }
+        t.MinX = std::max((int) std::floor(std::min(t.X[0],std::min(t.X[1],t.X[2]))),0);
+        t.MinY = std::max((int) std::floor(std::min(t.Y[0],std::min(t.Y[1],t.Y[2]))),0);
+        t.MaxX = std::min((int) std::ceil(std::max(t.X[0],std::max(t.X[1],t.X[2]))) - 1,Width - 1);
+        t.MaxY = std::min((int) std::ceil(std::max(t.Y[0],std::max(t.Y[1],t.Y[2]))) - 1,Height - 1);
+        if(t.MinX <= t.MaxX && t.MinY <= t.MaxY)
+            triangles.push_back(t);
+    }
+}
+
+
+void OcclusionCuller::rasterize_tile(int tile_x, int tile_y){
+    int x0 = tile_x * OCCLUSION_TILE_WIDTH, y0 = tile_y * OCCLUSION_TILE_HEIGHT;
+    int x1 = std::min(x0 + OCCLUSION_TILE_WIDTH,Width) - 1, y1 = std::min(y0 + OCCLUSION_TILE_HEIGHT,Height) - 1;
+    float* depth = Raster.data();
+
+    const std::vector<std::pair<unsigned int,unsigned int> >& bin = Bins[tile_y * TilesX + tile_x];
+    for(int n = 0;n < bin.size();n++){
+        const OccluderTriangle& t = Triangles[bin[n].first][bin[n].second];
+        int min_x = std::max(t.MinX,x0) & ~3, max_x = std::min(t.MaxX,x1);
+        int min_y = std::max(t.MinY,y0), max_y = std::min(t.MaxY,y1);
+
+        // edge functions at the pixel centers, inside when all are positive
+        float a[3], b[3], c[3];
+        for(int k = 0;k < 3;k++){
+            int l = (k + 1) % 3;
+            a[k] = t.Y[k] - t.Y[l];
+            b[k] = t.X[l] - t.X[k];
+            c[k] = -(a[k] * t.X[k] + b[k] * t.Y[k]) + 0.5f * (a[k] + b[k]);
+        }
+
+        // depth plane, at the pixel corner where it is the farthest
+        float dx1 = t.X[1] - t.X[0], dy1 = t.Y[1] - t.Y[0], dz1 = t.Z[1] - t.Z[0];
+        float dx2 = t.X[2] - t.X[0], dy2 = t.Y[2] - t.Y[0], dz2 = t.Z[2] - t.Z[0];
+        float area = dx1 * dy2 - dx2 * dy1;
+        float zx = (dz1 * dy2 - dz2 * dy1) / area;
+        float zy = (dz2 * dx1 - dz1 * dx2) / area;
+        float zc = t.Z[0] - zx * t.X[0] - zy * t.Y[0] + std::max(zx,0.0f) + std::max(zy,0.0f);
+
+#ifdef OCCLUSION_SSE
+        __m128 ramp = _mm_set_ps(3.0f,2.0f,1.0f,0.0f);
+        __m128 zero = _mm_setzero_ps();
+        for(int y = min_y;y <= max_y;y++){
+            float* row = depth + y * Width;
+            for(int x = min_x;x <= max_x;x += 4){
+                __m128 px = _mm_add_ps(_mm_set1_ps(float(x)),ramp);
+                __m128 inside = _mm_cmple_ps(px,_mm_set1_ps(float(max_x)));
+                for(int k = 0;k < 3;k++){
+                    __m128 e = _mm_add_ps(_mm_mul_ps(px,_mm_set1_ps(a[k])),_mm_set1_ps(b[k] * y + c[k]));
+                    inside = _mm_and_ps(inside,_mm_cmpge_ps(e,zero));
+                }
+                if(_mm_movemask_ps(inside) == 0)
+                    continue;
+                __m128 z = _mm_add_ps(_mm_mul_ps(px,_mm_set1_ps(zx)),_mm_set1_ps(zy * y + zc));
+                __m128 d = _mm_loadu_ps(row + x);
+                __m128 nearest = _mm_min_ps(d,z);
+                _mm_storeu_ps(row + x,_mm_or_ps(_mm_and_ps(inside,nearest),_mm_andnot_ps(inside,d)));
+            }
+        }
+#else
+        for(int y = min_y;y <= max_y;y++){
+            float* row = depth + y * Width;
+            for(int x = min_x;x <= max_x;x++){
+                bool inside = true;
+                for(int k = 0;k < 3;k++)
+                    inside = inside && a[k] * x + b[k] * y + c[k] >= 0.0f;
+                if(inside)
+                    row[x] = std::min(row[x],zx * x + zy * y + zc);
+            }
+        }
+#endif
+    }
+}
+
+
+void OcclusionCuller::rasterize(){
+    Triangles.resize(Occluders.size());
+    Screen.resize(Pool->size());
+    Pool->run(Occluders.size(),[this](unsigned int i){
+        setup(Occluders[i],Triangles[i],Screen[ThreadPool::worker()]);
+    });
+
+    // the triangles touching each tile, in the order of the occluders
+    TilesX = (Width + OCCLUSION_TILE_WIDTH - 1) / OCCLUSION_TILE_WIDTH;
+    TilesY = (Height + OCCLUSION_TILE_HEIGHT - 1) / OCCLUSION_TILE_HEIGHT;
+    Bins.resize(TilesX * TilesY);
+    for(int b = 0;b < Bins.size();b++)
+        Bins[b].clear();
+    for(unsigned int o = 0;o < Triangles.size();o++){
+        for(unsigned int i = 0;i < Triangles[o].size();i++){
+            const OccluderTriangle& t = Triangles[o][i];
+            for(int y = t.MinY / OCCLUSION_TILE_HEIGHT;y <= t.MaxY / OCCLUSION_TILE_HEIGHT;y++)
+                for(int x = t.MinX / OCCLUSION_TILE_WIDTH;x <= t.MaxX / OCCLUSION_TILE_WIDTH;x++)
+                    Bins[y * TilesX + x].push_back(std::make_pair(o,i));
+        }
+    }
+    Pool->run(TilesX * TilesY,[this](unsigned int i){
+        rasterize_tile(i % TilesX,i / TilesX);
+    });
+
+    // a pixel covered at its center may not be covered all over: each one
+    // takes the farthest depth around it, the uncovered pixels grow by one
+    Grow.resize(Width * Height);
+    Pool->run(Height,[this](unsigned int y){
+        const float* row = &Raster[y * Width];
+        float* grown = &Grow[y * Width];
+        for(int x = 0;x < Width;x++)
+            grown[x] = std::max(row[std::max(x - 1,0)],std::max(row[x],row[std::min(x + 1,Width - 1)]));
+    });
+    Pool->run(Height,[this](unsigned int y){
+        const float* above = &Grow[std::max((int) y - 1,0) * Width];
+        const float* row = &Grow[y * Width];
+        const float* below = &Grow[std::min((int) y + 1,Height - 1) * Width];
+        float* level = &Levels[0][y * Width];
+        for(int x = 0;x < Width;x++)
+            level[x] = std::max(above[x],std::max(row[x],below[x]));
+    });
+
+    // each texel the farthest depth of the 2x2 under it
+    for(int l = 1;l < Levels.size();l++){
+        const std::vector<float>& below = Levels[l - 1];
+        int w = LevelWidth[l - 1], h = LevelHeight[l - 1];
+        for(int y = 0;y < LevelHeight[l];y++){
+            int y_a = 2 * y, y_b = std::min(2 * y + 1,h - 1);
+            for(int x = 0;x < LevelWidth[l];x++){
+                int x_a = 2 * x, x_b = std::min(2 * x + 1,w - 1);
+                Levels[l][y * LevelWidth[l] + x] = std::max(std::max(below[y_a * w + x_a],below[y_a * w + x_b]),
+                                                            std::max(below[y_b * w + x_a],below[y_b * w + x_b]));
+            }
+        }
+    }
+}
+
+
+bool OcclusionCuller::visible(const glm::vec3& center, float radius) const{
+    // screen bounds and nearest depth of the box around the sphere
+    float min_x = 1e30f, min_y = 1e30f, max_x = -1e30f, max_y = -1e30f, min_z = 1e30f;
+    for(int i = 0;i < 8;i++){
+        glm::vec3 corner = center + radius * glm::vec3(i & 1 ? 1.0f : -1.0f,i & 2 ? 1.0f : -1.0f,i & 4 ? 1.0f : -1.0f);
+        glm::vec4 clip = ViewProjection * glm::vec4(corner,1.0f);
+        if(clip.w <= 0.0f || clip.z < -clip.w)
+            return true;
+        float x = (clip.x / clip.w * 0.5f + 0.5f) * Width;
+        float y = (clip.y / clip.w * 0.5f + 0.5f) * Height;
+        min_x = std::min(min_x,x);
+        max_x = std::max(max_x,x);
+        min_y = std::min(min_y,y);
+        max_y = std::max(max_y,y);
+        min_z = std::min(min_z,clip.z / clip.w * 0.5f + 0.5f);
+    }
+    if(max_x < 0.0f || max_y < 0.0f || min_x > Width || min_y > Height || min_z > 1.0f)
+        return false;
+
+    int x0 = std::max((int) std::floor(min_x),0), x1 = std::min((int) std::floor(max_x),Width - 1);
+    int y0 = std::max((int) std::floor(min_y),0), y1 = std::min((int) std::floor(max_y),Height - 1);
+
+    // the level where the bounds span at most 4x4 texels
+    int level = 0;
+    while(level + 1 < Levels.size() && ((x1 >> level) - (x0 >> level) > 3 || (y1 >> level) - (y0 >> level) > 3))
+        level++;
+    const std::vector<float>& depth = Levels[level];
+    int w = LevelWidth[level];
+    for(int y = y0 >> level;y <= y1 >> level;y++){
+        for(int x = x0 >> level;x <= x1 >> level;x++){
+            if(min_z <= depth[y * w + x])
+                return true;
+        }
+    }
+    return false;
+}
+
+
+void OcclusionCuller::test(const std::vector<glm::vec4>& spheres, std::vector<unsigned char>& visible) const{
+    visible.resize(spheres.size());
+    unsigned int jobs = (spheres.size() + OCCLUSION_TEST_BATCH - 1) / OCCLUSION_TEST_BATCH;
+    Pool->run(jobs,[this,&spheres,&visible](unsigned int job){
+        unsigned int end = std::min((unsigned int) spheres.size(),(job + 1) * OCCLUSION_TEST_BATCH);
+        for(unsigned int i = job * OCCLUSION_TEST_BATCH;i < end;i++)
+            visible[i] = this->visible(glm::vec3(spheres[i]),spheres[i].w);
+    });
+}
@@ -0,0 +1,94 @@
+#include "OcclusionQueries.h"
+
+#include <algorithm>
+#include <vector>
+
+OcclusionQueries::OcclusionQueries(){
+    Target = GL_SAMPLES_PASSED;
+    Frame = 0;
+}
+
+
+void OcclusionQueries::init(){
+    // any sample is enough, and lets the GPU stop counting early
+    Target = GLEW_VERSION_3_3 || GLEW_ARB_occlusion_query2 ? GL_ANY_SAMPLES_PASSED : GL_SAMPLES_PASSED;
+}
+
+
+void OcclusionQueries::resize(unsigned int objects){
+    if(Objects.size() == objects)
+        return;
+    free();
+    Objects.resize(objects);
+    for(int i = 0;i < Objects.size();i++){
+        glGenQueries(1,&Objects[i].Query);
+        Objects[i].Issued = false;
+        Objects[i].Pending = false;
+        Objects[i].Occluded = 0;
+        Objects[i].NextTest = 0;
+    }
+}
+
+
+void OcclusionQueries::update(){
+    Frame++;
+    for(int i = 0;i < Objects.size();i++){
+        ObjectQuery& object = Objects[i];
+        if(!object.Pending)
+            continue;
+        GLuint available = 0;
+        glGetQueryObjectuiv(object.Query,GL_QUERY_RESULT_AVAILABLE,&available);
+        if(!available)
+            continue;
+        GLuint samples = 0;
+        glGetQueryObjectuiv(object.Query,GL_QUERY_RESULT,&samples);
+        object.Pending = false;
+        object.Occluded = samples ? 0 : object.Occluded + 1;
+        // a box that shows up is tested again right away
+        if(samples)
+            object.NextTest = Frame;
+    }
+}
+
+
+bool OcclusionQueries::due(unsigned int object) const{
+    return !Objects[object].Pending && Frame >= Objects[object].NextTest;
+}
+
+
+void OcclusionQueries::forget(unsigned int object){
+    Objects[object].Issued = false;
+    Objects[object].Occluded = 0;
+    Objects[object].NextTest = Frame;
+}
+
+
+void OcclusionQueries::begin(unsigned int object){
+    ObjectQuery& query = Objects[object];
+    glBeginQuery(Target,query.Query);
+    query.Issued = true;
+    query.Pending = true;
+    query.NextTest = Frame + std::min(1 + query.Occluded / QUERY_BACKOFF,QUERY_MAX_INTERVAL);
+}
+
+
+void OcclusionQueries::end(){
+    glEndQuery(Target);
+}
+
+
+void OcclusionQueries::begin_conditional(unsigned int object){
+    glBeginConditionalRender(Objects[object].Query,GL_QUERY_NO_WAIT);
+}
+
+
+void OcclusionQueries::end_conditional(){
+    glEndConditionalRender();
+}
+
+
+void OcclusionQueries::free(){
+    for(int i = 0;i < Objects.size();i++)
+        glDeleteQueries(1,&Objects[i].Query);
+    Objects.clear();
+}
@@ -0,0 +1,217 @@
+#include "Profiler.h"
+
+#ifdef ENABLE_PROFILER
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+FrameProfiler PROFILER;
+
+RollingStat::RollingStat(){
+    Next = 0;
+}
+
+
+void RollingStat::add(double value){
+    if(Samples.size() < PROFILER_WINDOW)
+        Samples.push_back(value);
+    else
+        Samples[Next] = value;
+    Next = (Next + 1) % PROFILER_WINDOW;
+}
+
+
+double RollingStat::mean() const{
+    double sum = 0;
+    for(int i = 0;i < Samples.size();i++)
+        sum += Samples[i];
+    return Samples.empty() ? 0 : sum / Samples.size();
+}
+
+
+double RollingStat::min() const{
+    return Samples.empty() ? 0 : *std::min_element(Samples.begin(),Samples.end());
+}
+
+
+double RollingStat::max() const{
+    return Samples.empty() ? 0 : *std::max_element(Samples.begin(),Samples.end());
+}
+
+
+FrameProfiler::FrameProfiler(){
+    GpuTimers = false;
+    Frame = 0;
+    Depth = 0;
+    Open = -1;
+    GpuOffset = 0;
+    ReportFrames = 300;
+    Tracing = false;
+    MaxTraceEvents = 1000000;
+}
+
+
+void FrameProfiler::init(bool tracing){
+    Tracing = tracing;
+    Start = std::chrono::high_resolution_clock::now();
+#ifdef __APPLE__
+    GpuTimers = true;
+#else
+    GpuTimers = GLEW_VERSION_3_3 || GLEW_ARB_timer_query;
+#endif
+    if(GpuTimers){
+        GLint64 gpu_now;
+        glGetInteger64v(GL_TIMESTAMP,&gpu_now);
+        GpuOffset = now() - gpu_now / 1e6;
+    }
+    std::cout << "profiler: " << (GpuTimers ? "CPU and GPU timers" : "CPU timers only") << std::endl;
+    check_gl_error();
+}
+
+
+double FrameProfiler::now() const{
+    return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - Start).count();
+}
+
+
+GLuint FrameProfiler::query(){
+    if(Queries.empty()){
+        GLuint ids[16];
+        glGenQueries(16,ids);
+        Queries.assign(ids,ids + 16);
+    }
+    GLuint id = Queries.back();
+    Queries.pop_back();
+    return id;
+}
+
+
+void FrameProfiler::begin_frame(){
+    // the slot now reused was filled PROFILER_LATENCY frames ago
+    int slot = Frame % PROFILER_LATENCY;
+    collect(slot,false);
+    Depth = 0;
+    Open = begin("frame");
+}
+
+
+void FrameProfiler::end_frame(){
+    end(Open);
+    Open = -1;
+    Frame++;
+    if(ReportFrames > 0 && Frame % ReportFrames == 0)
+        print_stats(std::cout);
+}
+
+
+int FrameProfiler::begin(const char* name){
+    std::vector<ProfileSample>& samples = Frames[Frame % PROFILER_LATENCY];
+    ProfileSample sample;
+    sample.Name = name;
+    sample.Depth = Depth++;
+    sample.Begin = sample.End = 0;
+    if(GpuTimers){
+        sample.Begin = query();
+        glQueryCounter(sample.Begin,GL_TIMESTAMP);
+    }
+    sample.CpuBegin = now();
+    sample.CpuEnd = sample.CpuBegin;
+    samples.push_back(sample);
+    return samples.size() - 1;
+}
+
+
+void FrameProfiler::end(int index){
+    if(index < 0)
+        return;
+    ProfileSample& sample = Frames[Frame % PROFILER_LATENCY][index];
+    sample.CpuEnd = now();
+    if(GpuTimers){
+        sample.End = query();
+        glQueryCounter(sample.End,GL_TIMESTAMP);
+    }
+    Depth--;
+}
+
+
+void FrameProfiler::collect(int slot, bool wait){
+    std::vector<ProfileSample>& samples = Frames[slot];
+    for(int i = 0;i < samples.size();i++){
+        const ProfileSample& sample = samples[i];
+        CpuStats[sample.Name].add(sample.CpuEnd - sample.CpuBegin);
+        if(Tracing && Trace.size() < MaxTraceEvents){
+            TraceEvent event = {sample.Name, false, sample.CpuBegin, sample.CpuEnd - sample.CpuBegin};
+            Trace.push_back(event);
+        }
+        if(!sample.Begin)
+            continue;
+
+        GLint available = 1;
+        if(!wait)
+            glGetQueryObjectiv(sample.End,GL_QUERY_RESULT_AVAILABLE,&available);
+        if(available){
+            GLuint64 begin, end;
+            glGetQueryObjectui64v(sample.Begin,GL_QUERY_RESULT,&begin);
+            glGetQueryObjectui64v(sample.End,GL_QUERY_RESULT,&end);
+            double duration = (end - begin) / 1e6;
+            GpuStats[sample.Name].add(duration);
+            if(Tracing && Trace.size() < MaxTraceEvents){
+                TraceEvent event = {sample.Name, true, begin / 1e6 + GpuOffset, duration};
+                Trace.push_back(event);
+            }
+        }
+        Queries.push_back(sample.Begin);
+        Queries.push_back(sample.End);
+    }
+    samples.clear();
+}
+
+
+void FrameProfiler::print_stats(std::ostream& out) const{
+    out << "profile of the last " << PROFILER_WINDOW << " frames (ms, mean/min/max):" << std::endl;
+    for(std::map<std::string, RollingStat>::const_iterator it = CpuStats.begin();it != CpuStats.end();++it){
+        out << "  " << it->first << ": cpu " << it->second.mean() << "/" << it->second.min() << "/" << it->second.max();
+        std::map<std::string, RollingStat>::const_iterator gpu = GpuStats.find(it->first);
+        if(gpu != GpuStats.end())
+            out << ", gpu " << gpu->second.mean() << "/" << gpu->second.min() << "/" << gpu->second.max();
+        out << std::endl;
+    }
+}
+
+
+bool FrameProfiler::write_trace(const std::string& path) const{
+    std::ofstream fout(path.c_str(), std::ios::out);
+    if(!fout)
+        return false;
+
+    // complete ("X") events in microseconds, CPU scopes on thread 1, GPU scopes on thread 2
+    fout << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+    fout << "  {\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 1, \"args\": {\"name\": \"CPU\"}},\n";
+    fout << "  {\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 2, \"args\": {\"name\": \"GPU\"}}";
+    fout.setf(std::ios::fixed);
+    fout.precision(3);
+    for(int i = 0;i < Trace.size();i++){
+        fout << ",\n  {\"name\": \"" << Trace[i].Name << "\", \"cat\": \"" << (Trace[i].Gpu ? "gpu" : "cpu")
+             << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << (Trace[i].Gpu ? 2 : 1)
+             << ", \"ts\": " << Trace[i].Start * 1000 << ", \"dur\": " << Trace[i].Duration * 1000 << "}";
+    }
+    fout << "\n]}\n";
+    return (bool) fout;
+}
+
+
+void FrameProfiler::free(){
+    if(GpuTimers)
+        glFinish();
+    for(int i = 0;i < PROFILER_LATENCY;i++)
+        collect((Frame + i) % PROFILER_LATENCY,true);
+    if(!Queries.empty())
+        glDeleteQueries(Queries.size(),Queries.data());
+    Queries.clear();
+    check_gl_error();
+}
+
+#endif
@@ -0,0 +1,653 @@
+#include "RayTracer.h"
+
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <stdint.h>
+#include <string.h>
+#include <glm/glm.hpp>  // glm::vec2
+#include <glm/vec3.hpp> // glm::vec3
+#include <glm/vec4.hpp> // glm::vec4
+#include <glm/mat4x4.hpp> // glm::mat4
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define RAYTRACER_SSE
+#endif
+
+// Four floats processed together, the lanes of a packet. Comparisons give
+// lanes with every bit set, and bits4() one bit per lane.
+#ifdef RAYTRACER_SSE
+typedef __m128 Float4;
+static inline Float4 splat4(float a){ return _mm_set1_ps(a); }
+static inline Float4 load4(const float* a){ return _mm_loadu_ps(a); }
+static inline void store4(float* a, Float4 b){ _mm_storeu_ps(a,b); }
+static inline Float4 add4(Float4 a, Float4 b){ return _mm_add_ps(a,b); }
+static inline Float4 sub4(Float4 a, Float4 b){ return _mm_sub_ps(a,b); }
+static inline Float4 mul4(Float4 a, Float4 b){ return _mm_mul_ps(a,b); }
+static inline Float4 div4(Float4 a, Float4 b){ return _mm_div_ps(a,b); }
+static inline Float4 min4(Float4 a, Float4 b){ return _mm_min_ps(a,b); }
+static inline Float4 max4(Float4 a, Float4 b){ return _mm_max_ps(a,b); }
+static inline Float4 less4(Float4 a, Float4 b){ return _mm_cmplt_ps(a,b); }
+static inline Float4 lesseq4(Float4 a, Float4 b){ return _mm_cmple_ps(a,b); }
+static inline Float4 and4(Float4 a, Float4 b){ return _mm_and_ps(a,b); }
+static inline Float4 select4(Float4 mask, Float4 a, Float4 b){ return _mm_or_ps(_mm_and_ps(mask,a),_mm_andnot_ps(mask,b)); }
+static inline int bits4(Float4 mask){ return _mm_movemask_ps(mask); }
+#else
+struct Float4{ float V[4]; };
+static inline float lane_mask(bool b){ uint32_t u = b ? 0xffffffffu : 0u; float f; memcpy(&f,&u,4); return f; }
+static inline bool lane_set(float f){ uint32_t u; memcpy(&u,&f,4); return u != 0; }
+static inline Float4 splat4(float a){ Float4 r; for(int k = 0;k < 4;k++) r.V[k] = a; return r; }
+static inline Float4 load4(const float* a){ Float4 r; for(int k = 0;k < 4;k++) r.V[k] = a[k]; return r; }
+static inline void store4(float* a, Float4 b){ for(int k = 0;k < 4;k++) a[k] = b.V[k]; }
+static inline Float4 add4(Float4 a, Float4 b){ for(int k = 0;k < 4;k++) a.V[k] += b.V[k]; return a; }
+static inline Float4 sub4(Float4 a, Float4 b){ for(int k = 0;k < 4;k++) a.V[k] -= b.V[k]; return a; }
+static inline Float4 mul4(Float4 a, Float4 b){ for(int k = 0;k < 4;k++) a.V[k] *= b.V[k]; return a; }
+static inline Float4 div4(Float4 a, Float4 b){ for(int k = 0;k < 4;k++) a.V[k] /= b.V[k]; return a; }
+static inline Float4 min4(Float4 a, Float4 b){ for(int k = 0;k < 4;k++) a.V[k] = a.V[k] < b.V[k] ? a.V[k] : b.V[k]; return a; }
+static inline Float4 max4(Float4 a, Float4 b){ for(int k = 0;k < 4;k++) a.V[k] = a.V[k] > b.V[k] ? a.V[k] : b.V[k]; return a; }
+static inline Float4 less4(Float4 a, Float4 b){ for(int k = 0;k < 4;k++) a.V[k] = lane_mask(a.V[k] < b.V[k]); return a; }
+static inline Float4 lesseq4(Float4 a, Float4 b){ for(int k = 0;k < 4;k++) a.V[k] = lane_mask(a.V[k] <= b.V[k]); return a; }
+static inline Float4 and4(Float4 a, Float4 b){ for(int k = 0;k < 4;k++) a.V[k] = lane_mask(lane_set(a.V[k]) && lane_set(b.V[k])); return a; }
+static inline Float4 select4(Float4 mask, Float4 a, Float4 b){ for(int k = 0;k < 4;k++) a.V[k] = lane_set(mask.V[k]) ? a.V[k] : b.V[k]; return a; }
+static inline int bits4(Float4 mask){ int b = 0; for(int k = 0;k < 4;k++) b |= lane_set(mask.V[k]) << k; return b; }
+#endif
+
+static const int NO_HIT = -1;
+
+// Four rays, in the space of the hierarchy they go through
+struct RayPacket{
+    float Origin[3][4];
+    float Direction[3][4];
+    float T[4];    // the nearest hit so far, or the end of the ray
+    float U[4], V[4];
+    int Instance[4]; // NO_HIT while nothing is hit
+    unsigned int Triangle[4]; // face of F
+};
+
+// Nodes left behind by a traversal, far more than the depth of the
+// hierarchies of the editor. Deeper subtrees get a traversal of their own.
+static const int TRAVERSAL_STACK = 256;
+
+// Lanes of the active rays entering a box before their T, with the
+// distance to its entry
+static inline int hit_box(const BvhNode& node, const Float4 origin[3], const Float4 inverse[3], Float4 t, int active, Float4& entry){
+    Float4 t0 = mul4(sub4(splat4(node.Min.x),origin[0]),inverse[0]);
+    Float4 t1 = mul4(sub4(splat4(node.Max.x),origin[0]),inverse[0]);
+    Float4 near = min4(t0,t1), far = max4(t0,t1);
+    t0 = mul4(sub4(splat4(node.Min.y),origin[1]),inverse[1]);
+    t1 = mul4(sub4(splat4(node.Max.y),origin[1]),inverse[1]);
+    near = max4(near,min4(t0,t1));
+    far = min4(far,max4(t0,t1));
+    t0 = mul4(sub4(splat4(node.Min.z),origin[2]),inverse[2]);
+    t1 = mul4(sub4(splat4(node.Max.z),origin[2]),inverse[2]);
+    near = max4(near,min4(t0,t1));
+    far = min4(far,max4(t0,t1));
+    entry = max4(near,splat4(0.0f));
+    return bits4(lesseq4(entry,min4(far,t))) & active;
+}
+
+
+// Smallest entry of the lanes of a box
+static inline float nearest_entry(Float4 entry, int lanes){
+    float e[4];
+    store4(e,entry);
+    float nearest = 1e30f;
+    for(int k = 0;k < 4;k++){
+        if(lanes & (1 << k))
+            nearest = std::min(nearest,e[k]);
+    }
+    return nearest;
+}
+
+
+// Walk a hierarchy from root with the active rays of a packet, the nearer
+// child of the packet first. leaf(node, active) tests the primitives of a
+// leaf and returns the rays still traced, traversal ends when none are
+// left. Returns the rays still traced.
+template<class Leaf>
+static int traverse(const std::vector<BvhNode>& nodes, RayPacket& packet, int active, Leaf leaf, unsigned int root = 0){
+    if(nodes.empty() || !active)
+        return active;
+    Float4 origin[3], inverse[3];
+    for(int a = 0;a < 3;a++){
+        origin[a] = load4(packet.Origin[a]);
+        // no zero direction, the slabs would give 0 * inf
+        float d[4];
+        for(int k = 0;k < 4;k++)
+            d[k] = fabs(packet.Direction[a][k]) > 1e-20f ? packet.Direction[a][k] : 1e-20f;
+        inverse[a] = div4(splat4(1.0f),load4(d));
+    }
+
+    unsigned int stack[TRAVERSAL_STACK];
+    int top = 0;
+    Float4 entry;
+    if(!hit_box(nodes[root],origin,inverse,load4(packet.T),active,entry))
+        return active;
+    unsigned int n = root;
+    while(true){
+        const BvhNode& node = nodes[n];
+        if(node.Count == 0){
+            Float4 t = load4(packet.T), entry_a, entry_b;
+            int a = hit_box(nodes[node.First],origin,inverse,t,active,entry_a);
+            int b = hit_box(nodes[node.First + 1],origin,inverse,t,active,entry_b);
+            if(a && b){
+                bool a_first = nearest_entry(entry_a,a) <= nearest_entry(entry_b,b);
+                unsigned int near = a_first ? node.First : node.First + 1;
+                unsigned int far = a_first ? node.First + 1 : node.First;
+                if(top < TRAVERSAL_STACK){
+                    stack[top++] = far;
+                    n = near;
+                    continue;
+                }
+                // no room to leave the farther one behind: the nearer
+                // subtree is walked right away, then the farther one
+                active = traverse(nodes,packet,active,leaf,near);
+                if(!active)
+                    return 0;
+                n = far;
+                continue;
+            }
+            if(a || b){
+                n = a ? node.First : node.First + 1;
+                continue;
+            }
+        }
+        else{
+            active = leaf(node,active);
+            if(!active)
+                return 0;
+        }
+
+        // the nodes left behind, unless the hits found since are nearer
+        do{
+            if(top == 0)
+                return active;
+            n = stack[--top];
+        }while(!hit_box(nodes[n],origin,inverse,load4(packet.T),active,entry));
+    }
+}
+
+
+// The triangles of a mesh hierarchy, for the rays of a packet in object
+// space. With any_hit a ray stops at its first hit.
+static void intersect_mesh(const MeshBvh& bvh, RayPacket& packet, int active, int instance, bool any_hit){
+    Float4 origin[3], direction[3];
+    for(int a = 0;a < 3;a++){
+        origin[a] = load4(packet.Origin[a]);
+        direction[a] = load4(packet.Direction[a]);
+    }
+    traverse(bvh.Nodes,packet,active,[&](const BvhNode& node, int lanes) -> int {
+        for(unsigned int i = node.First;i < node.First + node.Count;i++){
+            // Moller-Trumbore, one triangle against the four rays
+            const glm::vec3& v0 = bvh.Vertex0[i];
+            const glm::vec3& e1 = bvh.Edge1[i];
+            const glm::vec3& e2 = bvh.Edge2[i];
+            Float4 e1x = splat4(e1.x), e1y = splat4(e1.y), e1z = splat4(e1.z);
+            Float4 e2x = splat4(e2.x), e2y = splat4(e2.y), e2z = splat4(e2.z);
+            Float4 px = sub4(mul4(direction[1],e2z),mul4(direction[2],e2y));
+            Float4 py = sub4(mul4(direction[2],e2x),mul4(direction[0],e2z));
+            Float4 pz = sub4(mul4(direction[0],e2y),mul4(direction[1],e2x));
+            Float4 det = add4(add4(mul4(e1x,px),mul4(e1y,py)),mul4(e1z,pz));
+            Float4 inv_det = div4(splat4(1.0f),det);
+            Float4 sx = sub4(origin[0],splat4(v0.x)), sy = sub4(origin[1],splat4(v0.y)), sz = sub4(origin[2],splat4(v0.z));
+            Float4 u = mul4(add4(add4(mul4(sx,px),mul4(sy,py)),mul4(sz,pz)),inv_det);
+            Float4 qx = sub4(mul4(sy,e1z),mul4(sz,e1y));
+            Float4 qy = sub4(mul4(sz,e1x),mul4(sx,e1z));
+            Float4 qz = sub4(mul4(sx,e1y),mul4(sy,e1x));
+            Float4 v = mul4(add4(add4(mul4(direction[0],qx),mul4(direction[1],qy)),mul4(direction[2],qz)),inv_det);
+            Float4 t = mul4(add4(add4(mul4(e2x,qx),mul4(e2y,qy)),mul4(e2z,qz)),inv_det);
+
+            Float4 zero = splat4(0.0f);
+            Float4 hit = and4(and4(lesseq4(zero,u),lesseq4(zero,v)),lesseq4(add4(u,v),splat4(1.0f)));
+            Float4 nearest = load4(packet.T);
+            hit = and4(hit,and4(less4(zero,t),less4(t,nearest)));
+            int hits = bits4(hit) & lanes;
+            if(!hits)
+                continue;
+            store4(packet.T,select4(hit,t,nearest));
+            store4(packet.U,select4(hit,u,load4(packet.U)));
+            store4(packet.V,select4(hit,v,load4(packet.V)));
+            for(int k = 0;k < 4;k++){
+                if(hits & (1 << k)){
+                    packet.Instance[k] = instance;
+                    packet.Triangle[k] = bvh.Triangles[i];
+                }
+            }
+            if(any_hit){
+                lanes &= ~hits;
+                if(!lanes)
+                    return 0;
+            }
+        }
+        return lanes;
+    });
+}
+
+
+// The nearest hits of the rays of a packet in the scene, or with any_hit
+// whether each one is blocked before its T, only by the shadow casters
+static void intersect_scene(const SceneBvh& scene, RayPacket& packet, int active, bool any_hit){
+    for(int k = 0;k < 4;k++)
+        packet.Instance[k] = NO_HIT;
+    traverse(scene.Nodes,packet,active,[&](const BvhNode& node, int lanes) -> int {
+        for(unsigned int i = node.First;i < node.First + node.Count;i++){
+            unsigned int index = scene.Order[i];
+            const BvhInstance& instance = scene.Instances[index];
+            if(any_hit && !instance.CastsShadows)
+                continue;
+
+            // the rays in object space keep their T, the direction is not normalized again
+            RayPacket local = packet;
+            for(int k = 0;k < 4;k++){
+                glm::vec4 o = instance.WorldToObject * glm::vec4(packet.Origin[0][k],packet.Origin[1][k],packet.Origin[2][k],1.0f);
+                glm::vec4 d = instance.WorldToObject * glm::vec4(packet.Direction[0][k],packet.Direction[1][k],packet.Direction[2][k],0.0f);
+                for(int a = 0;a < 3;a++){
+                    local.Origin[a][k] = o[a];
+                    local.Direction[a][k] = d[a];
+                }
+            }
+            intersect_mesh(*instance.Bvh,local,lanes,index,any_hit);
+            for(int k = 0;k < 4;k++){
+                if(local.Instance[k] != packet.Instance[k]){
+                    packet.Instance[k] = local.Instance[k];
+                    packet.Triangle[k] = local.Triangle[k];
+                    packet.T[k] = local.T[k];
+                    packet.U[k] = local.U[k];
+                    packet.V[k] = local.V[k];
+                    if(any_hit)
+                        lanes &= ~(1 << k);
+                }
+            }
+            if(!lanes)
+                return 0;
+        }
+        return lanes;
+    });
+}
+
+
+// A number in [0, 1) for a dimension of a sample of a pixel, the same
+// whatever the thread tracing it
+static float random_float(uint32_t pixel, uint32_t sample, uint32_t dimension){
+    uint32_t x = pixel * 0x9e3779b9u ^ sample * 0x85ebca6bu ^ dimension * 0xc2b2ae35u;
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return (x >> 8) * (1.0f / 16777216.0f);
+}
+
+
+static int lane_count(int lanes){
+    return (lanes & 1) + (lanes >> 1 & 1) + (lanes >> 2 & 1) + (lanes >> 3 & 1);
+}
+
+
+// Cosine distributed around the unit vector n, for u1 and u2 uniform in [0, 1)
+static glm::vec3 cosine_direction(const glm::vec3& n, float u1, float u2){
+    float phi = 6.2831853f * u1;
+    float radius = sqrtf(u2);
+    glm::vec3 tangent = glm::normalize(glm::cross(fabs(n.x) > 0.5f ? glm::vec3(0,1,0) : glm::vec3(1,0,0),n));
+    glm::vec3 bitangent = glm::cross(n,tangent);
+    return radius * cosf(phi) * tangent + radius * sinf(phi) * bitangent + sqrtf(1.0f - u2) * n;
+}
+
+
+static void set_ray(RayPacket& packet, int k, const glm::vec3& origin, const glm::vec3& direction, float t){
+    for(int a = 0;a < 3;a++){
+        packet.Origin[a][k] = origin[a];
+        packet.Direction[a][k] = direction[a];
+    }
+    packet.T[k] = t;
+    packet.U[k] = 0.0f;
+    packet.V[k] = 0.0f;
+}
+
+
+RayTracer::RayTracer(){
+    Width = 0;
+    Height = 0;
+    Samples = 0;
+    AoRays = 0;
+    Pool = NULL;
+    MovesReported = false;
+    CompareAll = true;
+}
+
+
+void RayTracer::init(int width, int height, ThreadPool* pool){
+    Width = width;
+    Height = height;
+    Pool = pool;
+    Pixels.assign(3 * Width * Height,0);
+    Sum.assign(Width * Height,glm::vec3(0.0f));
+    Rays.assign(Pool ? Pool->size() : 1,0);
+}
+
+
+void RayTracer::begin(const SoftwareFrame& frame, std::vector<MeshObject>& objects){
+    Frame = frame;
+    InverseViewProjection = glm::inverse(Frame.Perspective * Frame.View);
+    Samples = 0;
+    std::fill(Sum.begin(),Sum.end(),glm::vec3(0.0f));
+
+    // the meshes come with their hierarchies. The scene one is kept while
+    // the same objects are traced, and only refit over those that moved.
+    std::vector<BvhInstance> instances;
+    Objects.clear();
+    for(int i = 0;i < objects.size();i++){
+        MeshObject& object = objects[i];
+        const MeshBvh& bvh = object.mesh().Bvh;
+        if(bvh.empty())
+            continue;
+
+        // the light cube is seen but lets the light out
+        BvhInstance instance;
+        instance.Bvh = &bvh;
+        instance.ObjectToWorld = object.get_model_matrix();
+        instance.WorldToObject = glm::inverse(instance.ObjectToWorld);
+        instance.Object = i;
+        instance.CastsShadows = i > 0;
+        instances.push_back(instance);
+
+        TracedObject traced;
+        traced.Geometry = &object.mesh();
+        traced.Model = instance.ObjectToWorld;
+        traced.NormalMatrix = glm::transpose(glm::inverse(glm::mat3(instance.ObjectToWorld)));
+        traced.Lit = i > 0;
+        traced.Flat = object.Rmode == FLAT;
+        Objects.push_back(traced);
+    }
+
+    bool same = !Scene.Nodes.empty() && instances.size() == Scene.Instances.size();
+    for(int i = 0;same && i < instances.size();i++)
+        same = instances[i].Object == Scene.Instances[i].Object && instances[i].Bvh == Scene.Instances[i].Bvh;
+    if(!same){
+        Scene.Instances.swap(instances);
+        Scene.build();
+        ObjectInstances.assign(objects.size(),-1);
+        for(int i = 0;i < Scene.Instances.size();i++)
+            ObjectInstances[Scene.Instances[i].Object] = i;
+        CompareAll = false;
+        return;
+    }
+
+    // the moves reported since the last still are in Scene already
+    if(!MovesReported || CompareAll){
+        for(int i = 0;i < instances.size();i++){
+            if(instances[i].ObjectToWorld != Scene.Instances[i].ObjectToWorld)
+                Scene.move(i,instances[i].ObjectToWorld);
+        }
+        CompareAll = false;
+    }
+    Scene.refit();
+}
+
+
+void RayTracer::move(unsigned int object, const glm::mat4& model){
+    if(object < ObjectInstances.size() && ObjectInstances[object] >= 0)
+        Scene.move(ObjectInstances[object],model);
+}
+
+
+void RayTracer::moved_all(){
+    CompareAll = true;
+}
+
+
+void RayTracer::trace_sample(){
+    int tiles_x = (Width + RAYTRACER_TILE_SIZE - 1) / RAYTRACER_TILE_SIZE;
+    int tiles_y = (Height + RAYTRACER_TILE_SIZE - 1) / RAYTRACER_TILE_SIZE;
+    if(Pool)
+        Pool->run(tiles_x * tiles_y,[&](unsigned int tile){ trace_tile(tile); });
+    else{
+        for(int tile = 0;tile < tiles_x * tiles_y;tile++)
+            trace_tile(tile);
+    }
+    Samples++;
+}
+
+
+void RayTracer::trace_tile(int tile){
+    int tiles_x = (Width + RAYTRACER_TILE_SIZE - 1) / RAYTRACER_TILE_SIZE;
+    int x0 = (tile % tiles_x) * RAYTRACER_TILE_SIZE, y0 = (tile / tiles_x) * RAYTRACER_TILE_SIZE;
+    int x1 = std::min(x0 + RAYTRACER_TILE_SIZE,Width), y1 = std::min(y0 + RAYTRACER_TILE_SIZE,Height);
+    const std::vector<PointLight>& lights = *Frame.Lights;
+    const float specular_strength = 0.5f;
+    unsigned long rays = 0;
+
+    for(int y = y0;y < y1;y += 2){
+        for(int x = x0;x < x1;x += 2){
+            // primary rays through the 2x2 pixels, jittered after the first
+            // sample, from the near plane to the far one
+            RayPacket packet;
+            int active = 0;
+            int pixel[4];
+            for(int k = 0;k < 4;k++){
+                int px = x + (k & 1), py = y + (k >> 1);
+                pixel[k] = py * Width + px;
+                if(px >= x1 || py >= y1){
+                    set_ray(packet,k,glm::vec3(0.0f),glm::vec3(0.0f,0.0f,1.0f),0.0f);
+                    continue;
+                }
+                active |= 1 << k;
+                float jx = Samples ? random_float(pixel[k],Samples,0) : 0.5f;
+                float jy = Samples ? random_float(pixel[k],Samples,1) : 0.5f;
+                float nx = 2.0f * (px + jx) / Width - 1.0f, ny = 1.0f - 2.0f * (py + jy) / Height;
+                glm::vec4 near = InverseViewProjection * glm::vec4(nx,ny,-1.0f,1.0f);
+                glm::vec4 far = InverseViewProjection * glm::vec4(nx,ny,1.0f,1.0f);
+                glm::vec3 origin = glm::vec3(near) / near.w;
+                glm::vec3 direction = glm::vec3(far) / far.w - origin;
+                float length = glm::length(direction);
+                set_ray(packet,k,origin,direction / length,length);
+            }
+            intersect_scene(Scene,packet,active,false);
+            rays += lane_count(active);
+
+            // the hits, with the normal of the triangle facing the ray to
+            // move the secondary rays off the surface
+            glm::vec3 color[4], position[4], start[4], normal[4], face[4], albedo[4];
+            float offset[4], baked[4];
+            int lit = 0;
+            for(int k = 0;k < 4;k++){
+                if(!(active & (1 << k)))
+                    continue;
+                if(packet.Instance[k] == NO_HIT){
+                    color[k] = Frame.Background;
+                    continue;
+                }
+                const TracedObject& object = Objects[packet.Instance[k]];
+                const Mesh& mesh = *object.Geometry;
+                unsigned int f = packet.Triangle[k];
+                unsigned int a = mesh.F[3 * f], b = mesh.F[3 * f + 1], c = mesh.F[3 * f + 2];
+                float w[3] = {1.0f - packet.U[k] - packet.V[k],packet.U[k],packet.V[k]};
+                glm::vec3 direction(packet.Direction[0][k],packet.Direction[1][k],packet.Direction[2][k]);
+                glm::vec3 origin(packet.Origin[0][k],packet.Origin[1][k],packet.Origin[2][k]);
+                position[k] = origin + packet.T[k] * direction;
+                if(!object.Lit){
+                    color[k] = glm::vec3(1.0f,1.0f,1.0f);
+                    continue;
+                }
+
+                glm::vec3 pa = glm::vec3(object.Model * glm::vec4(mesh.V[a],1.0f));
+                glm::vec3 pb = glm::vec3(object.Model * glm::vec4(mesh.V[b],1.0f));
+                glm::vec3 pc = glm::vec3(object.Model * glm::vec4(mesh.V[c],1.0f));
+                face[k] = glm::normalize(glm::cross(pb - pa,pc - pa));
+                float side = 1.0f;
+                if(glm::dot(face[k],direction) > 0){
+                    face[k] = -face[k];
+                    side = -1.0f;
+                }
+                start[k] = position[k];
+                if(object.Flat)
+                    normal[k] = face[k];
+                else{
+                    normal[k] = glm::normalize(object.NormalMatrix * (w[0] * mesh.N_v[a] + w[1] * mesh.N_v[b] + w[2] * mesh.N_v[c]));
+
+                    // the secondary rays start from the smooth surface the
+                    // normals describe rather than from the flat triangle:
+                    // the hit moved onto the tangent planes of the vertex
+                    // normals it is below (Hanika, "Hacking the Shadow
+                    // Terminator"), else coarse meshes shadow themselves
+                    // triangle by triangle where the light grazes them
+                    const glm::vec3 corner[3] = {pa,pb,pc};
+                    const unsigned int vertex[3] = {a,b,c};
+                    for(int i = 0;i < 3;i++){
+                        glm::vec3 n = side * glm::normalize(object.NormalMatrix * mesh.N_v[vertex[i]]);
+                        float below = std::min(glm::dot(position[k] - corner[i],n),0.0f);
+                        start[k] -= w[i] * below * n;
+                    }
+                }
+                albedo[k] = w[0] * mesh.C[a] + w[1] * mesh.C[b] + w[2] * mesh.C[c];
+                baked[k] = w[0] * mesh.AO[a] + w[1] * mesh.AO[b] + w[2] * mesh.AO[c];
+                glm::vec3 size = glm::abs(position[k]);
+                offset[k] = 1e-4f * (1.0f + std::max(size.x,std::max(size.y,size.z)));
+                start[k] += offset[k] * face[k];
+                lit |= 1 << k;
+            }
+
+            // the ambient term, times the unoccluded part of the hemisphere
+            // when traced
+            glm::vec3 lighting[4];
+            for(int k = 0;k < 4;k++)
+                lighting[k] = Frame.Ambient;
+            if(lit && AoRays > 0){
+                int visible[4] = {0,0,0,0};
+                for(int r = 0;r < AoRays;r++){
+                    RayPacket occlusion;
+                    for(int k = 0;k < 4;k++){
+                        if(!(lit & (1 << k))){
+                            set_ray(occlusion,k,glm::vec3(0.0f),glm::vec3(0.0f,0.0f,1.0f),0.0f);
+                            continue;
+                        }
+                        glm::vec3 direction = cosine_direction(face[k],random_float(pixel[k],Samples,2 + 2 * r),
+                                                               random_float(pixel[k],Samples,3 + 2 * r));
+                        set_ray(occlusion,k,start[k],direction,RAYTRACER_AO_DISTANCE);
+                    }
+                    intersect_scene(Scene,occlusion,lit,true);
+                    rays += lane_count(lit);
+                    for(int k = 0;k < 4;k++)
+                        visible[k] += occlusion.Instance[k] == NO_HIT;
+                }
+                for(int k = 0;k < 4;k++)
+                    lighting[k] *= float(visible[k]) / AoRays;
+            }
+            else{
+                // the occlusion of the meshes by themselves, as the shaders
+                for(int k = 0;k < 4;k++)
+                    if(lit & (1 << k))
+                        lighting[k] *= baked[k];
+            }
+
+            // the lights the shading normals face, each behind a shadow ray
+            for(int l = 0;l < lights.size() && lit;l++){
+                RayPacket shadow;
+                glm::vec3 contribution[4];
+                int lanes = 0;
+                for(int k = 0;k < 4;k++){
+                    set_ray(shadow,k,glm::vec3(0.0f),glm::vec3(0.0f,0.0f,1.0f),0.0f);
+                    if(!(lit & (1 << k)))
+                        continue;
+                    glm::vec3 tolight = lights[l].Position - position[k];
+                    float attenuation = 1.0f;
+                    if(lights[l].Radius > 0){
+                        float falloff = glm::clamp(1.0f - glm::dot(tolight,tolight) / (lights[l].Radius * lights[l].Radius),0.0f,1.0f);
+                        attenuation = falloff * falloff;
+                    }
+                    float distance = glm::length(tolight);
+                    if(attenuation <= 0 || distance <= 0)
+                        continue;
+                    glm::vec3 lightdir = tolight / distance;
+                    if(glm::dot(normal[k],lightdir) <= 0)
+                        continue;
+
+                    glm::vec3 viewdir = glm::normalize(Frame.ViewPosition - position[k]);
+                    float diff = std::max(glm::dot(normal[k],lightdir),0.0f);
+                    glm::vec3 reflectdir = glm::reflect(-lightdir,normal[k]);
+                    float spec = pow(std::max(glm::dot(viewdir,reflectdir),0.0f),30.0f);
+                    contribution[k] = attenuation * (diff * lights[l].Color + specular_strength * spec * lights[l].Color);
+                    glm::vec3 toshadow = lights[l].Position - start[k];
+                    float length = glm::length(toshadow);
+                    if(length <= 0)
+                        continue;
+                    set_ray(shadow,k,start[k],toshadow / length,length);
+                    lanes |= 1 << k;
+                }
+                if(!lanes)
+                    continue;
+                intersect_scene(Scene,shadow,lanes,true);
+                rays += lane_count(lanes);
+                for(int k = 0;k < 4;k++){
+                    if((lanes & (1 << k)) && shadow.Instance[k] == NO_HIT)
+                        lighting[k] += contribution[k];
+                }
+            }
+
+            // into the running sum, and the mean so far into the image
+            for(int k = 0;k < 4;k++){
+                if(!(active & (1 << k)))
+                    continue;
+                if(lit & (1 << k))
+                    color[k] = lighting[k] * albedo[k];
+                Sum[pixel[k]] += color[k];
+                glm::vec3 c = glm::clamp(Sum[pixel[k]] / float(Samples + 1),0.0f,1.0f);
+                unsigned char* out = &Pixels[3 * pixel[k]];
+                for(int i = 0;i < 3;i++)
+                    out[i] = (unsigned char)(c[i] * 255.0f + 0.5f);
+            }
+        }
+    }
+    Rays[ThreadPool::worker()] += rays;
+}
+
+
+unsigned long RayTracer::ray_count() const{
+    unsigned long total = 0;
+    for(int t = 0;t < Rays.size();t++)
+        total += Rays[t];
+    return total;
+}
+
+
+void bake_ambient_occlusion(const Mesh& mesh, std::vector<float>& ao, ThreadPool* pool){
+    ao.assign(mesh.V.size(),1.0f);
+    if(mesh.Bvh.empty())
+        return;
+    float distance = AO_BAKE_DISTANCE * mesh.Radius;
+    float offset = 1e-3f * mesh.Radius;
+    int strata = int(sqrtf(float(AO_BAKE_RAYS)));
+    unsigned int jobs = (mesh.V.size() + AO_BAKE_VERTICES - 1) / AO_BAKE_VERTICES;
+    auto bake = [&](unsigned int job){
+        unsigned int last = std::min<unsigned int>((job + 1) * AO_BAKE_VERTICES,mesh.V.size());
+        for(unsigned int v = job * AO_BAKE_VERTICES;v < last;v++){
+            glm::vec3 n = mesh.N_v[v];
+            if(!(glm::dot(n,n) > 0.5f))
+                continue;
+            glm::vec3 origin = mesh.V[v] + offset * n;
+            int visible = 0;
+            // stratified over the unit square, jittered inside the cells
+            for(int r = 0;r < AO_BAKE_RAYS;r += 4){
+                RayPacket packet;
+                for(int k = 0;k < 4;k++){
+                    int ray = r + k;
+                    float u1 = (ray % strata + random_float(v,ray,0)) / strata;
+                    float u2 = (ray / strata % strata + random_float(v,ray,1)) / strata;
+                    set_ray(packet,k,origin,cosine_direction(n,u1,u2),distance);
+                    packet.Instance[k] = NO_HIT;
+                }
+                intersect_mesh(mesh.Bvh,packet,15,0,true);
+                for(int k = 0;k < 4;k++)
+                    visible += packet.Instance[k] == NO_HIT;
+            }
+            ao[v] = float(visible) / AO_BAKE_RAYS;
+        }
+    };
+    if(pool)
+        pool->run(jobs,bake);
+    else{
+        for(unsigned int job = 0;job < jobs;job++)
+            bake(job);
+    }
+}
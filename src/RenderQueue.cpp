@@ -0,0 +1,57 @@
+#include "RenderQueue.h"
+
+#include <cstring>
+#include <vector>
+
+uint64_t make_sort_key(unsigned int pass, unsigned int program, unsigned int mode, unsigned int mesh, float depth){
+    // the bit pattern of a non-negative float grows with its value
+    if(!(depth > 0.0f))
+        depth = 0.0f;
+    uint32_t depth_bits;
+    std::memcpy(&depth_bits,&depth,sizeof(depth_bits));
+
+    return ((uint64_t)(pass & 0xF) << KEY_PASS_SHIFT) |
+           ((uint64_t)(program & 0xFF) << KEY_PROGRAM_SHIFT) |
+           ((uint64_t)(mode & 0xF) << KEY_MODE_SHIFT) |
+           ((uint64_t)(mesh & 0xFFFF) << KEY_MESH_SHIFT) |
+           ((uint64_t)depth_bits << KEY_DEPTH_SHIFT);
+}
+
+
+void RenderQueue::clear(){
+    Items.clear();
+}
+
+
+void RenderQueue::push(uint64_t key, unsigned int object){
+    RenderItem item;
+    item.Key = key;
+    item.Object = object;
+    Items.push_back(item);
+}
+
+
+void RenderQueue::sort(){
+    Scratch.resize(Items.size());
+
+    for(int shift = 0;shift < 64;shift += 8){
+        unsigned int count[256];
+        std::memset(count,0,sizeof(count));
+        for(int i = 0;i < Items.size();i++)
+            count[(Items[i].Key >> shift) & 0xFF]++;
+
+        // all keys share this byte, the pass would not move anything
+        if(count[(Items.empty() ? 0 : (Items[0].Key >> shift) & 0xFF)] == Items.size())
+            continue;
+
+        unsigned int offset = 0;
+        for(int b = 0;b < 256;b++){
+            unsigned int c = count[b];
+            count[b] = offset;
+            offset += c;
+        }
+        for(int i = 0;i < Items.size();i++)
+            Scratch[count[(Items[i].Key >> shift) & 0xFF]++] = Items[i];
+        Items.swap(Scratch);
+    }
+}
@@ -0,0 +1,229 @@
+#include "SceneAutosave.h"
+#include "Mesh.h"
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+
+SceneAutosave::SceneAutosave(){
+    Interval = 0;
+    CapturedObjects = 0;
+    CapturedSelection = -1;
+    Unsaved = false;
+    Version = 0;
+    HasPending = false;
+    Writing = false;
+    Quit = false;
+    SavedObjects = (size_t) -1;
+}
+
+
+SceneAutosave::~SceneAutosave(){
+    if(Worker.joinable()){
+        {
+            std::lock_guard<std::mutex> lock(Mutex);
+            Quit = true;
+            Wake.notify_one();
+        }
+        Worker.join();
+    }
+}
+
+
+void SceneAutosave::init(const std::string& path, double interval){
+    Path = path;
+    Interval = interval;
+    LastCapture = std::chrono::steady_clock::now();
+    if(Interval > 0)
+        Worker = std::thread(&SceneAutosave::run_worker,this);
+}
+
+
+void SceneAutosave::changed(int object){
+    if(object >= 0 && object / AUTOSAVE_CHUNK_OBJECTS < Dirty.size())
+        Dirty[object / AUTOSAVE_CHUNK_OBJECTS] = 1;
+}
+
+
+void SceneAutosave::changed_all(){
+    Dirty.assign(Dirty.size(),1);
+}
+
+
+void SceneAutosave::capture(const std::vector<MeshObject>& objects, int selected){
+    if(!Worker.joinable())
+        return;
+
+    // new chunks are dirty, removed objects cannot be told apart from
+    // changed ones, added ones fill the last chunk up
+    size_t count = (objects.size() + AUTOSAVE_CHUNK_OBJECTS - 1) / AUTOSAVE_CHUNK_OBJECTS;
+    Chunks.resize(count);
+    Dirty.resize(count,1);
+    if(objects.size() < CapturedObjects)
+        changed_all();
+    else if(objects.size() > CapturedObjects)
+        changed(CapturedObjects);
+    if(selected != CapturedSelection){
+        changed(CapturedSelection);
+        changed(selected);
+    }
+    if(objects.size() != CapturedObjects)
+        Unsaved = true;
+
+    for(size_t c = 0;c < count;c++){
+        if(!Dirty[c])
+            continue;
+        size_t first = c * AUTOSAVE_CHUNK_OBJECTS;
+        size_t size = std::min<size_t>(AUTOSAVE_CHUNK_OBJECTS,objects.size() - first);
+        std::shared_ptr<AutosaveChunk> chunk = std::make_shared<AutosaveChunk>();
+        chunk->Objects.resize(size);
+        for(size_t i = 0;i < size;i++)
+            chunk->Objects.set(i, objects[first + i], objects[first + i].MeshId, int(first + i) == selected);
+        chunk->Version = ++Version;
+        Chunks[c] = chunk;
+        Dirty[c] = 0;
+        Unsaved = true;
+    }
+    CapturedObjects = objects.size();
+    CapturedSelection = selected;
+}
+
+
+void SceneAutosave::queue(){
+    // the snapshot only copies pointers, the chunks are shared
+    SceneSnapshot snapshot;
+    snapshot.Chunks = Chunks;
+    snapshot.Meshes.resize(mesh_count());
+    for(int m = 0;m < snapshot.Meshes.size();m++)
+        snapshot.Meshes[m] = &get_mesh(m);
+    snapshot.Objects = CapturedObjects;
+    Unsaved = false;
+
+    std::lock_guard<std::mutex> lock(Mutex);
+    std::swap(Pending,snapshot);
+    HasPending = true;
+    Wake.notify_one();
+}
+
+
+void SceneAutosave::update(const std::vector<MeshObject>& objects, int selected){
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if(!Worker.joinable() || std::chrono::duration<double>(now - LastCapture).count() < Interval)
+        return;
+    {
+        std::lock_guard<std::mutex> lock(Mutex);
+        if(HasPending || Writing)
+            return;
+    }
+
+    LastCapture = now;
+    capture(objects,selected);
+    if(Unsaved)
+        queue();
+}
+
+
+void SceneAutosave::free(const std::vector<MeshObject>& objects, int selected){
+    if(!Worker.joinable())
+        return;
+
+    // a newer snapshot replaces one still waiting, it has all its changes
+    capture(objects,selected);
+    if(Unsaved)
+        queue();
+    {
+        std::lock_guard<std::mutex> lock(Mutex);
+        Quit = true;
+        Wake.notify_one();
+    }
+    Worker.join();
+}
+
+
+void SceneAutosave::run_worker(){
+    std::unique_lock<std::mutex> lock(Mutex);
+    while(true){
+        while(!HasPending && !Quit)
+            Wake.wait(lock);
+        if(!HasPending)
+            break;
+        SceneSnapshot snapshot;
+        std::swap(snapshot,Pending);
+        HasPending = false;
+        Writing = true;
+        lock.unlock();
+
+        write(snapshot);
+
+        lock.lock();
+        Writing = false;
+    }
+}
+
+
+// Copy of a file, false if it cannot be read or written whole
+static bool copy_file(const std::string& from, const std::string& to){
+    std::ifstream fin(from.c_str(), std::ios::in | std::ios::binary);
+    std::ofstream fout(to.c_str(), std::ios::out | std::ios::binary);
+    if(!fin || !fout)
+        return false;
+    fout << fin.rdbuf();
+    return bool(fin) && bool(fout);
+}
+
+
+void SceneAutosave::write(const SceneSnapshot& snapshot){
+    auto start = std::chrono::high_resolution_clock::now();
+    unsigned int written = 0;
+
+    // the chunks are patched into a copy, renamed over the file once
+    // complete: a crash on the way leaves the previous autosave whole. A
+    // failed patch falls back to a whole file.
+    bool in_place = snapshot.Objects == SavedObjects && snapshot.Meshes == SavedMeshes;
+    if(in_place){
+        std::string temporary = Path + ".tmp";
+        in_place = copy_file(Path,temporary);
+        {
+            std::fstream file(temporary.c_str(), std::ios::in | std::ios::out | std::ios::binary);
+            for(int c = 0;c < snapshot.Chunks.size() && file && in_place;c++){
+                if(snapshot.Chunks[c]->Version == SavedVersions[c])
+                    continue;
+                write_scene_objects(file, SavedLayout, snapshot.Chunks[c]->Objects, c * AUTOSAVE_CHUNK_OBJECTS);
+                written++;
+            }
+            file.flush();
+            in_place = in_place && bool(file);
+        }
+        if(in_place)
+            in_place = replace_scene_file(temporary,Path);
+        else
+            std::remove(temporary.c_str());
+        if(!in_place)
+            written = 0;
+    }
+    if(!in_place){
+        SceneObjects objects;
+        for(int c = 0;c < snapshot.Chunks.size();c++)
+            objects.append(snapshot.Chunks[c]->Objects);
+        if(!write_scene_file(Path, snapshot.Meshes, objects, SavedLayout)){
+            SavedObjects = (size_t) -1;
+            return;
+        }
+        written = snapshot.Chunks.size();
+    }
+
+    SavedObjects = snapshot.Objects;
+    SavedMeshes = snapshot.Meshes;
+    SavedVersions.resize(snapshot.Chunks.size());
+    for(int c = 0;c < snapshot.Chunks.size();c++)
+        SavedVersions[c] = snapshot.Chunks[c]->Version;
+    if(written > 0){
+        std::cout << "autosave: " << written << " of " << snapshot.Chunks.size() << " chunks" << (in_place ? "" : " (whole file)")
+                  << " written to " << Path << " in "
+                  << std::chrono::duration<double,std::milli>(std::chrono::high_resolution_clock::now() - start).count()
+                  << " ms" << std::endl;
+    }
+}
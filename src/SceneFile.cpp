@@ -0,0 +1,369 @@
+#include "SceneFile.h"
+#include "Mesh.h"
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <cstdio>
+#include <cstring>
+#ifndef _WIN32
+#  include <fcntl.h>
+#  include <unistd.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#endif
+
+// Bumped whenever a chunk changes meaning
+static const uint32_t SCENE_FILE_VERSION = 1;
+
+// "SCNE", version, object count, mesh count
+static const size_t SCENE_HEADER_SIZE = 16;
+
+
+void SceneObjects::resize(size_t count){
+    Meshes.resize(count);
+    Translate.resize(count);
+    Rotate.resize(count);
+    Scale.resize(count);
+    UnitScale.resize(count);
+    Modes.resize(count);
+    Flags.resize(count);
+}
+
+
+void SceneObjects::set(size_t i, const MeshObject& object, uint32_t mesh, bool selected){
+    Meshes[i] = mesh;
+    Translate[i] = object.TranslateVector;
+    Rotate[i] = object.RotateVector;
+    Scale[i] = object.ScaleVector;
+    UnitScale[i] = object.UnitScale;
+    Modes[i] = object.Rmode;
+    Flags[i] = selected ? SCENE_OBJECT_SELECTED : 0;
+}
+
+
+void SceneObjects::append(const SceneObjects& other){
+    Meshes.insert(Meshes.end(),other.Meshes.begin(),other.Meshes.end());
+    Translate.insert(Translate.end(),other.Translate.begin(),other.Translate.end());
+    Rotate.insert(Rotate.end(),other.Rotate.begin(),other.Rotate.end());
+    Scale.insert(Scale.end(),other.Scale.begin(),other.Scale.end());
+    UnitScale.insert(UnitScale.end(),other.UnitScale.begin(),other.UnitScale.end());
+    Modes.insert(Modes.end(),other.Modes.begin(),other.Modes.end());
+    Flags.insert(Flags.end(),other.Flags.begin(),other.Flags.end());
+}
+
+
+// A chunk and its padding, offset receives where its data starts
+template<typename T>
+static bool write_chunk(std::ofstream& fout, const char* tag, const std::vector<T>& data, uint64_t* offset = NULL){
+    static const char padding[8] = {0};
+    uint64_t bytes = (uint64_t) data.size() * sizeof(T);
+    if(bytes > 0xffffffffu)
+        return false;
+    uint32_t size = bytes;
+    fout.write(tag, 4);
+    fout.write((const char*) &size, sizeof(size));
+    if(offset != NULL)
+        *offset = fout.tellp();
+    if(size > 0)
+        fout.write((const char*) data.data(), size);
+    fout.write(padding, (8 - size % 8) % 8);
+    return true;
+}
+
+
+bool write_scene_file(const std::string& path, const std::vector<const Mesh*>& meshes, const SceneObjects& objects,
+                      SceneFileLayout& layout){
+    // the geometry once per OFF file contents
+    std::vector<SceneMeshRecord> records(meshes.size());
+    std::vector<char> paths;
+    std::vector<glm::vec3> vertices;
+    std::vector<unsigned int> indices;
+    std::map<uint64_t,uint32_t> geometry;
+    for(int m = 0;m < meshes.size();m++){
+        const Mesh& mesh = *meshes[m];
+        SceneMeshRecord& record = records[m];
+        record.Hash = mesh.SourceHash;
+        record.PathFirst = paths.size();
+        record.PathCount = mesh.Path.size();
+        paths.insert(paths.end(),mesh.Path.begin(),mesh.Path.end());
+        std::map<uint64_t,uint32_t>::iterator shared = geometry.find(mesh.SourceHash);
+        if(shared != geometry.end()){
+            record.VertexFirst = records[shared->second].VertexFirst;
+            record.VertexCount = records[shared->second].VertexCount;
+            record.IndexFirst = records[shared->second].IndexFirst;
+            record.IndexCount = records[shared->second].IndexCount;
+            continue;
+        }
+        geometry[mesh.SourceHash] = m;
+        record.VertexFirst = vertices.size();
+        record.VertexCount = mesh.V.size();
+        record.IndexFirst = indices.size();
+        record.IndexCount = mesh.F.size();
+        vertices.insert(vertices.end(),mesh.V.begin(),mesh.V.end());
+        indices.insert(indices.end(),mesh.F.begin(),mesh.F.end());
+    }
+
+    // a crash while writing leaves the previous file
+    std::string temporary = path + ".tmp";
+    {
+        std::ofstream fout(temporary.c_str(), std::ios::out | std::ios::binary);
+        if(!fout){
+            std::cerr << "Cannot write the scene " << path << std::endl;
+            return false;
+        }
+        uint32_t header[3] = {SCENE_FILE_VERSION, (uint32_t) objects.size(), (uint32_t) records.size()};
+        fout.write("SCNE", 4);
+        fout.write((const char*) header, sizeof(header));
+        bool written = write_chunk(fout, "MESH", records) && write_chunk(fout, "PATH", paths)
+                    && write_chunk(fout, "VERT", vertices) && write_chunk(fout, "TRIS", indices)
+                    && write_chunk(fout, "OMSH", objects.Meshes, &layout.Arrays[0])
+                    && write_chunk(fout, "OTRN", objects.Translate, &layout.Arrays[1])
+                    && write_chunk(fout, "OROT", objects.Rotate, &layout.Arrays[2])
+                    && write_chunk(fout, "OSCL", objects.Scale, &layout.Arrays[3])
+                    && write_chunk(fout, "OUNI", objects.UnitScale, &layout.Arrays[4])
+                    && write_chunk(fout, "OMOD", objects.Modes, &layout.Arrays[5])
+                    && write_chunk(fout, "OFLG", objects.Flags, &layout.Arrays[6]);
+        if(!written || !fout){
+            std::cerr << "Cannot write the scene " << path << std::endl;
+            fout.close();
+            std::remove(temporary.c_str());
+            return false;
+        }
+    }
+    return replace_scene_file(temporary,path);
+}
+
+
+bool replace_scene_file(const std::string& temporary, const std::string& path){
+#ifdef _WIN32
+    std::remove(path.c_str());
+#endif
+    if(std::rename(temporary.c_str(),path.c_str()) != 0){
+        std::cerr << "Cannot write the scene " << path << std::endl;
+        std::remove(temporary.c_str());
+        return false;
+    }
+    return true;
+}
+
+
+template<typename T>
+static void write_range(std::fstream& file, uint64_t offset, const std::vector<T>& data, size_t first){
+    file.seekp(offset + first * sizeof(T));
+    if(!data.empty())
+        file.write((const char*) data.data(), data.size() * sizeof(T));
+}
+
+
+bool write_scene_objects(std::fstream& file, const SceneFileLayout& layout, const SceneObjects& objects, size_t first){
+    write_range(file, layout.Arrays[0], objects.Meshes, first);
+    write_range(file, layout.Arrays[1], objects.Translate, first);
+    write_range(file, layout.Arrays[2], objects.Rotate, first);
+    write_range(file, layout.Arrays[3], objects.Scale, first);
+    write_range(file, layout.Arrays[4], objects.UnitScale, first);
+    write_range(file, layout.Arrays[5], objects.Modes, first);
+    write_range(file, layout.Arrays[6], objects.Flags, first);
+    return (bool) file;
+}
+
+
+bool save_scene(const std::string& path, const std::vector<MeshObject>& objects, int selected){
+    // the meshes of the objects, in the order they are first used
+    std::vector<const Mesh*> meshes;
+    std::vector<int> mesh_index(mesh_count(),-1);
+    SceneObjects arrays;
+    arrays.resize(objects.size());
+    for(int i = 0;i < objects.size();i++){
+        unsigned int id = objects[i].MeshId;
+        if(mesh_index[id] < 0){
+            mesh_index[id] = meshes.size();
+            meshes.push_back(&get_mesh(id));
+        }
+        arrays.set(i, objects[i], mesh_index[id], i == selected);
+    }
+    SceneFileLayout layout;
+    return write_scene_file(path, meshes, arrays, layout);
+}
+
+
+// A whole file, mapped read only, or read into memory without mmap
+class MappedFile{
+    public:
+        const char* Data;
+        size_t Size;
+#ifdef _WIN32
+        std::vector<char> Bytes;
+#endif
+
+        MappedFile(){
+            Data = NULL;
+            Size = 0;
+        }
+
+        ~MappedFile(){
+#ifndef _WIN32
+            if(Data != NULL)
+                munmap((void*) Data, Size);
+#endif
+        }
+
+        bool open(const std::string& path){
+#ifdef _WIN32
+            std::ifstream fin(path.c_str(), std::ios::in | std::ios::binary | std::ios::ate);
+            if(!fin)
+                return false;
+            Bytes.resize(fin.tellg());
+            fin.seekg(0);
+            if(!Bytes.empty())
+                fin.read(Bytes.data(), Bytes.size());
+            if(!fin || Bytes.empty())
+                return false;
+            Data = Bytes.data();
+            Size = Bytes.size();
+            return true;
+#else
+            int fd = ::open(path.c_str(), O_RDONLY);
+            if(fd < 0)
+                return false;
+            struct stat status;
+            if(fstat(fd,&status) != 0 || status.st_size <= 0){
+                ::close(fd);
+                return false;
+            }
+            void* data = mmap(NULL, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            ::close(fd);
+            if(data == MAP_FAILED)
+                return false;
+            Data = (const char*) data;
+            Size = status.st_size;
+            return true;
+#endif
+        }
+
+    private:
+        MappedFile(const MappedFile&);
+        MappedFile& operator=(const MappedFile&);
+};
+
+
+struct SceneChunk{
+    const char* Data;
+    uint32_t Size;
+};
+
+
+// Chunk of a tag as an array of T, false if it is missing or does not fit
+template<typename T>
+static bool find_chunk(const std::map<std::string,SceneChunk>& chunks, const char* tag, const T*& data, size_t& count){
+    std::map<std::string,SceneChunk>::const_iterator it = chunks.find(tag);
+    if(it == chunks.end() || it->second.Size % sizeof(T) != 0)
+        return false;
+    data = (const T*) it->second.Data;
+    count = it->second.Size / sizeof(T);
+    return true;
+}
+
+
+bool open_scene(const std::string& path, std::vector<MeshObject>& objects, int& selected){
+    MappedFile file;
+    if(!file.open(path)){
+        std::cerr << "Cannot read the scene " << path << std::endl;
+        return false;
+    }
+
+    uint32_t header[3];
+    if(file.Size < SCENE_HEADER_SIZE || memcmp(file.Data, "SCNE", 4) != 0){
+        std::cerr << path << ": not a scene file" << std::endl;
+        return false;
+    }
+    memcpy(header, file.Data + 4, sizeof(header));
+    if(header[0] != SCENE_FILE_VERSION){
+        std::cerr << path << ": scene file version " << header[0] << ", expected " << SCENE_FILE_VERSION << std::endl;
+        return false;
+    }
+    size_t object_count = header[1];
+    size_t scene_mesh_count = header[2];
+
+    // payloads start 8 byte aligned in the mapping, they are used in place
+    std::map<std::string,SceneChunk> chunks;
+    size_t offset = SCENE_HEADER_SIZE;
+    while(offset + 8 <= file.Size){
+        SceneChunk chunk;
+        memcpy(&chunk.Size, file.Data + offset + 4, sizeof(chunk.Size));
+        chunk.Data = file.Data + offset + 8;
+        std::string tag(file.Data + offset, 4);
+        offset += 8;
+        if(chunk.Size > file.Size - offset){
+            std::cerr << path << ": truncated " << tag << " chunk" << std::endl;
+            return false;
+        }
+        chunks[tag] = chunk;
+        offset += (chunk.Size + size_t(7)) / 8 * 8;
+    }
+
+    const SceneMeshRecord* records;
+    const char* paths;
+    const glm::vec3 *vertices, *translate, *rotate, *scale, *unit;
+    const unsigned int* indices;
+    const uint32_t* object_meshes;
+    const uint8_t *modes, *flags;
+    size_t record_count, path_bytes, vertex_count, index_count;
+    size_t counts[7];
+    bool valid = find_chunk(chunks, "MESH", records, record_count) && find_chunk(chunks, "PATH", paths, path_bytes)
+              && find_chunk(chunks, "VERT", vertices, vertex_count) && find_chunk(chunks, "TRIS", indices, index_count)
+              && find_chunk(chunks, "OMSH", object_meshes, counts[0]) && find_chunk(chunks, "OTRN", translate, counts[1])
+              && find_chunk(chunks, "OROT", rotate, counts[2]) && find_chunk(chunks, "OSCL", scale, counts[3])
+              && find_chunk(chunks, "OUNI", unit, counts[4]) && find_chunk(chunks, "OMOD", modes, counts[5])
+              && find_chunk(chunks, "OFLG", flags, counts[6]);
+    valid = valid && record_count == scene_mesh_count;
+    for(int i = 0;valid && i < 7;i++)
+        valid = counts[i] == object_count;
+    for(int m = 0;valid && m < record_count;m++){
+        const SceneMeshRecord& record = records[m];
+        valid = uint64_t(record.PathFirst) + record.PathCount <= path_bytes && record.VertexCount > 0
+             && uint64_t(record.VertexFirst) + record.VertexCount <= vertex_count && record.IndexCount > 0
+             && record.IndexCount % 3 == 0 && uint64_t(record.IndexFirst) + record.IndexCount <= index_count;
+        for(unsigned int i = 0;valid && i < record.IndexCount;i++)
+            valid = indices[record.IndexFirst + i] < record.VertexCount;
+    }
+    if(!valid){
+        std::cerr << path << ": invalid scene file" << std::endl;
+        return false;
+    }
+
+    std::vector<unsigned int> mesh_ids(record_count);
+    std::vector<glm::vec3> centers(record_count);
+    for(int m = 0;m < record_count;m++){
+        const SceneMeshRecord& record = records[m];
+        std::string mesh_path(paths + record.PathFirst, record.PathCount);
+        mesh_ids[m] = load_mesh(mesh_path, record.Hash, vertices + record.VertexFirst, record.VertexCount,
+                                indices + record.IndexFirst, record.IndexCount);
+        centers[m] = get_mesh(mesh_ids[m]).BaryCenter;
+    }
+
+    std::vector<MeshObject> loaded(object_count);
+    int selection = -1;
+    for(size_t i = 0;i < object_count;i++){
+        if(object_meshes[i] >= record_count || modes[i] > PHONG){
+            std::cerr << path << ": invalid object " << i << std::endl;
+            return false;
+        }
+        MeshObject& object = loaded[i];
+        object.MeshId = mesh_ids[object_meshes[i]];
+        object.BaryCenter = centers[object_meshes[i]];
+        object.TranslateVector = translate[i];
+        object.RotateVector = rotate[i];
+        object.ScaleVector = scale[i];
+        object.UnitScale = unit[i];
+        object.Rmode = (Renderingmode) modes[i];
+        if(selection < 0 && (flags[i] & SCENE_OBJECT_SELECTED))
+            selection = i;
+    }
+
+    objects.swap(loaded);
+    selected = selection >= 0 ? selection : 0;
+    return true;
+}
@@ -0,0 +1,136 @@
+#include "SceneScript.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+
+SceneScript::SceneScript(){
+    Frames = -1;
+}
+
+
+static bool is_number(const std::string& word){
+    char* end;
+    strtod(word.c_str(),&end);
+    return !word.empty() && *end == '\0';
+}
+
+
+// Number of arguments of a command, -1 if unknown
+static int argument_count(const std::string& name){
+    if(name == "frames" || name == "object" || name == "mode" || name == "select" || name == "projection"
+       || name == "save" || name == "open")
+        return 1;
+    if(name == "lights" || name == "key")
+        return 2;
+    if(name == "translate" || name == "rotate" || name == "scale" || name == "light")
+        return 3;
+    if(name == "camera")
+        return 4;
+    return -1;
+}
+
+
+static bool compare_keys(const CameraKey& a, const CameraKey& b){
+    return a.Frame < b.Frame;
+}
+
+
+bool SceneScript::load(const std::string& path){
+    std::ifstream fin(path.c_str(), std::ios::in);
+    if(!fin){
+        std::cerr << "Cannot read the script " << path << std::endl;
+        return false;
+    }
+
+    std::string text;
+    int line = 0;
+    while(std::getline(fin,text)){
+        line++;
+        std::string::size_type comment = text.find('#');
+        if(comment != std::string::npos)
+            text = text.substr(0,comment);
+        std::istringstream words(text);
+        std::vector<std::string> args;
+        std::string word;
+        while(words >> word)
+            args.push_back(word);
+        if(args.empty())
+            continue;
+
+        ScriptCommand command;
+        command.Frame = 0;
+        command.Line = line;
+        if(args[0] == "at"){
+            if(args.size() < 3 || !is_number(args[1])){
+                std::cerr << path << ":" << line << ": expected \"at <frame> <command>\"" << std::endl;
+                return false;
+            }
+            command.Frame = atoi(args[1].c_str());
+            args.erase(args.begin(),args.begin() + 2);
+        }
+        command.Name = args[0];
+        command.Args.assign(args.begin() + 1,args.end());
+
+        int count = argument_count(command.Name);
+        if(count < 0){
+            std::cerr << path << ":" << line << ": unknown command " << command.Name << std::endl;
+            return false;
+        }
+        if(command.Args.size() != count){
+            std::cerr << path << ":" << line << ": " << command.Name << " takes " << count << " arguments" << std::endl;
+            return false;
+        }
+        bool numeric = command.Name != "object" && command.Name != "mode" && command.Name != "projection"
+                    && command.Name != "save" && command.Name != "open";
+        for(int i = 0;i < command.Args.size() && numeric;i++){
+            if(command.Name == "key" && i == 1)
+                break;
+            if(!is_number(command.Args[i])){
+                std::cerr << path << ":" << line << ": " << command.Args[i] << " is not a number" << std::endl;
+                return false;
+            }
+        }
+
+        if(command.Name == "frames")
+            Frames = atoi(command.Args[0].c_str());
+        else if(command.Name == "camera"){
+            CameraKey key;
+            key.Frame = atoi(command.Args[0].c_str());
+            key.Position = glm::vec3(atof(command.Args[1].c_str()),atof(command.Args[2].c_str()),atof(command.Args[3].c_str()));
+            Camera.push_back(key);
+        }
+        else{
+            if(command.Name == "key")
+                command.Frame = atoi(command.Args[0].c_str());
+            Commands.push_back(command);
+        }
+    }
+    std::stable_sort(Camera.begin(),Camera.end(),compare_keys);
+    return true;
+}
+
+
+bool SceneScript::camera_at(int frame, glm::vec3& position) const{
+    if(Camera.empty())
+        return false;
+    if(frame <= Camera.front().Frame){
+        position = Camera.front().Position;
+        return true;
+    }
+    for(int i = 1;i < Camera.size();i++){
+        if(frame <= Camera[i].Frame){
+            const CameraKey& a = Camera[i-1];
+            const CameraKey& b = Camera[i];
+            float t = b.Frame == a.Frame ? 1.0f : float(frame - a.Frame) / (b.Frame - a.Frame);
+            position = glm::mix(a.Position,b.Position,t);
+            return true;
+        }
+    }
+    position = Camera.back().Position;
+    return true;
+}
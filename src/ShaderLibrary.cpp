@@ -0,0 +1,247 @@
+#include "ShaderLibrary.h"
+
+#ifdef __APPLE__
+#define GL_SILENCE_DEPRECATION
+#endif
+#include <GLFW/glfw3.h>
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+std::string shader_defines(unsigned int features){
+    std::string defines;
+    if(features & SHADER_UNLIT)
+        defines += "#define UNLIT\n";
+    if(features & SHADER_FLAT)
+        defines += "#define FLAT\n";
+    if(features & SHADER_PHONG)
+        defines += "#define PHONG\n";
+    if(features & SHADER_WIREFRAME)
+        defines += "#define WIREFRAME\n";
+    if(features & SHADER_INSTANCED)
+        defines += "#define INSTANCED\n";
+    if(features & SHADER_PICKING)
+        defines += "#define PICKING\n";
+    if(features & SHADER_FEATURE_EDGES)
+        defines += "#define FEATURE_EDGES\n";
+    return defines;
+}
+
+
+std::string variant_name(unsigned int features){
+    std::string defines = shader_defines(features);
+    std::string name;
+    for(int i = 0;i < defines.size();i++){
+        if(defines[i] == '\n')
+            name += i + 1 < defines.size() ? ", " : "";
+        else
+            name += defines[i];
+    }
+    return name;
+}
+
+
+bool read_text_file(const std::string& path, std::string& text){
+    std::ifstream fin(path.c_str(), std::ios::in);
+    if(!fin)
+        return false;
+    std::stringstream buffer;
+    buffer << fin.rdbuf();
+    text = buffer.str();
+    return true;
+}
+
+
+ShaderLibrary::ShaderLibrary(){
+    WorkerContext = NULL;
+    ReloadPending = false;
+    Quit = false;
+}
+
+
+void ShaderLibrary::init(const std::string& vertex_source, const std::string& fragment_source, const std::string& fragment_data_name){
+    VertexSource = vertex_source;
+    FragmentSource = fragment_source;
+    FragmentDataName = fragment_data_name;
+}
+
+
+bool ShaderLibrary::load(const std::string& vertex_path, const std::string& fragment_path, const std::string& fragment_data_name){
+    std::string vertex_source, fragment_source;
+    if(!read_text_file(vertex_path,vertex_source)){
+        std::cerr << "Cannot read " << vertex_path << std::endl;
+        return false;
+    }
+    if(!read_text_file(fragment_path,fragment_source)){
+        std::cerr << "Cannot read " << fragment_path << std::endl;
+        return false;
+    }
+    VertexPath = vertex_path;
+    FragmentPath = fragment_path;
+    init(vertex_source,fragment_source,fragment_data_name);
+    return true;
+}
+
+
+void ShaderLibrary::start_worker(GLFWwindow* context){
+    WorkerContext = context;
+    Worker = std::thread(&ShaderLibrary::run_worker,this);
+}
+
+
+void ShaderLibrary::reload(){
+    if(VertexPath.empty())
+        return;
+
+    if(!Worker.joinable()){
+        std::vector<Program*> programs;
+        std::string vertex_source, fragment_source;
+        if(compile(Features,vertex_source,fragment_source,programs)){
+            std::lock_guard<std::mutex> lock(Mutex);
+            Reloaded = programs;
+            ReloadedVertex = vertex_source;
+            ReloadedFragment = fragment_source;
+        }
+        return;
+    }
+
+    // a reload asked for while one is compiling runs again after it
+    std::lock_guard<std::mutex> lock(Mutex);
+    ReloadFeatures = Features;
+    ReloadPending = true;
+    Wake.notify_one();
+}
+
+
+bool ShaderLibrary::update(){
+    std::lock_guard<std::mutex> lock(Mutex);
+    if(Reloaded.empty())
+        return false;
+
+    // the reload only knows the variants that existed when it was asked for
+    for(int i = 0;i < Reloaded.size();i++){
+        Programs[i]->free();
+        delete Programs[i];
+        Programs[i] = Reloaded[i];
+    }
+    VertexSource = ReloadedVertex;
+    FragmentSource = ReloadedFragment;
+    if(Reloaded.size() < Programs.size() && Worker.joinable()){
+        ReloadFeatures = Features;
+        ReloadPending = true;
+        Wake.notify_one();
+    }
+    Reloaded.clear();
+    std::cout << "shaders reloaded" << std::endl;
+    return true;
+}
+
+
+unsigned int ShaderLibrary::variant(unsigned int features){
+    for(int i = 0;i < Features.size();i++){
+        if(Features[i] == features)
+            return i;
+    }
+
+    std::string header = "#version 150 core\n" + shader_defines(features);
+    Program* program = new Program();
+    if(!program->init(header + VertexSource, header + FragmentSource, FragmentDataName))
+        std::cerr << "Shader variant failed:" << std::endl << shader_defines(features) << std::endl;
+    label_gl(GL_PROGRAM,program->program_shader,variant_name(features));
+
+    Features.push_back(features);
+    Programs.push_back(program);
+    return Programs.size() - 1;
+}
+
+
+bool ShaderLibrary::compile(const std::vector<unsigned int>& features, std::string& vertex_source, std::string& fragment_source, std::vector<Program*>& programs){
+    if(!read_text_file(VertexPath,vertex_source) || !read_text_file(FragmentPath,fragment_source)){
+        std::cerr << "Cannot read the shaders, keeping the previous ones" << std::endl;
+        return false;
+    }
+
+    for(int i = 0;i < features.size();i++){
+        std::string header = "#version 150 core\n" + shader_defines(features[i]);
+        Program* program = new Program();
+        if(!program->init(header + vertex_source, header + fragment_source, FragmentDataName)){
+            std::cerr << "Shader variant failed:" << std::endl << shader_defines(features[i])
+                      << "keeping the previous shaders" << std::endl;
+            program->free();
+            delete program;
+            for(int j = 0;j < programs.size();j++){
+                programs[j]->free();
+                delete programs[j];
+            }
+            programs.clear();
+            return false;
+        }
+        label_gl(GL_PROGRAM,program->program_shader,variant_name(features[i]));
+        programs.push_back(program);
+    }
+    return true;
+}
+
+
+void ShaderLibrary::run_worker(){
+    glfwMakeContextCurrent(WorkerContext);
+
+    std::unique_lock<std::mutex> lock(Mutex);
+    while(true){
+        while(!ReloadPending && !Quit)
+            Wake.wait(lock);
+        if(Quit)
+            break;
+        ReloadPending = false;
+        std::vector<unsigned int> features = ReloadFeatures;
+        lock.unlock();
+
+        std::vector<Program*> programs;
+        std::string vertex_source, fragment_source;
+        bool linked = compile(features,vertex_source,fragment_source,programs);
+
+        // the objects must be complete before the main context uses them
+        glFinish();
+
+        lock.lock();
+        if(linked){
+            for(int i = 0;i < Reloaded.size();i++){
+                Reloaded[i]->free();
+                delete Reloaded[i];
+            }
+            Reloaded = programs;
+            ReloadedVertex = vertex_source;
+            ReloadedFragment = fragment_source;
+        }
+    }
+    lock.unlock();
+
+    glfwMakeContextCurrent(NULL);
+}
+
+
+void ShaderLibrary::free(){
+    if(Worker.joinable()){
+        {
+            std::lock_guard<std::mutex> lock(Mutex);
+            Quit = true;
+            Wake.notify_one();
+        }
+        Worker.join();
+    }
+
+    for(int i = 0;i < Reloaded.size();i++){
+        Reloaded[i]->free();
+        delete Reloaded[i];
+    }
+    Reloaded.clear();
+    for(int i = 0;i < Programs.size();i++){
+        Programs[i]->free();
+        delete Programs[i];
+    }
+    Programs.clear();
+    Features.clear();
+}
@@ -0,0 +1,170 @@
+#include "ShadowMap.h"
+
+#include <cmath>
+#include <vector>
+#include <glm/glm.hpp>  // glm::vec2
+#include <glm/vec3.hpp> // glm::vec3
+#include <glm/vec4.hpp> // glm::vec4
+#include <glm/mat4x4.hpp> // glm::mat4
+#include <glm/gtc/matrix_transform.hpp> // glm::lookAt, glm::perspective
+
+// Viewing direction and up vector of the cube map faces, in the
+// GL_TEXTURE_CUBE_MAP_POSITIVE_X + face order
+static const glm::vec3 FaceDirections[6] = {
+    glm::vec3(1,0,0), glm::vec3(-1,0,0),
+    glm::vec3(0,1,0), glm::vec3(0,-1,0),
+    glm::vec3(0,0,1), glm::vec3(0,0,-1)
+};
+static const glm::vec3 FaceUps[6] = {
+    glm::vec3(0,-1,0), glm::vec3(0,-1,0),
+    glm::vec3(0,0,1), glm::vec3(0,0,-1),
+    glm::vec3(0,-1,0), glm::vec3(0,-1,0)
+};
+
+
+CubeShadowMap::CubeShadowMap(){
+    Size = 512;
+    Near = 0.05f;
+    Far = 20.0f;
+    Texture = 0;
+    Framebuffer = 0;
+    LightPosition = glm::vec3(0,0,0);
+    for(int f = 0;f < 6;f++)
+        Dirty[f] = true;
+    FacesDrawn = 0;
+}
+
+
+void CubeShadowMap::init(int size, float near, float far){
+    Size = size;
+    Near = near;
+    Far = far;
+
+    // 16 bit depth is plenty for the short range of the light
+    glGenTextures(1,&Texture);
+    glBindTexture(GL_TEXTURE_CUBE_MAP,Texture);
+    for(int f = 0;f < 6;f++)
+        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + f,0,GL_DEPTH_COMPONENT16,Size,Size,0,GL_DEPTH_COMPONENT,GL_UNSIGNED_SHORT,NULL);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP,GL_TEXTURE_MIN_FILTER,GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP,GL_TEXTURE_MAG_FILTER,GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP,GL_TEXTURE_WRAP_S,GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP,GL_TEXTURE_WRAP_T,GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP,GL_TEXTURE_WRAP_R,GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP,GL_TEXTURE_COMPARE_MODE,GL_COMPARE_REF_TO_TEXTURE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP,GL_TEXTURE_COMPARE_FUNC,GL_LEQUAL);
+    glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
+    label_gl(GL_TEXTURE,Texture,"cube shadow map");
+
+    glGenFramebuffers(1,&Framebuffer);
+    check_gl_error();
+}
+
+
+void CubeShadowMap::set_light(const glm::vec3& position){
+    if(position == LightPosition)
+        return;
+    LightPosition = position;
+    for(int f = 0;f < 6;f++)
+        Dirty[f] = true;
+}
+
+
+void CubeShadowMap::update_caster(unsigned int id, const glm::mat4& model, const glm::vec3& center, float radius){
+    if(id >= CasterModels.size()){
+        CasterModels.resize(id + 1);
+        CasterSpheres.resize(id + 1);
+        CasterKnown.resize(id + 1,false);
+    }
+    if(CasterKnown[id] && CasterModels[id] == model)
+        return;
+
+    // the faces it leaves lose a shadow, the faces it enters gain one
+    if(CasterKnown[id])
+        dirty_faces(glm::vec3(CasterSpheres[id]),CasterSpheres[id].w);
+    dirty_faces(center,radius);
+    CasterModels[id] = model;
+    CasterSpheres[id] = glm::vec4(center,radius);
+    CasterKnown[id] = true;
+}
+
+
+void CubeShadowMap::dirty_faces(const glm::vec3& center, float radius){
+    for(int f = 0;f < 6;f++){
+        if(!Dirty[f] && face_sees(f,center,radius))
+            Dirty[f] = true;
+    }
+}
+
+
+// The frustum of a face is bounded by the four planes through the light at
+// 45 degrees from its axis, and by the near and far distances along it
+bool CubeShadowMap::face_sees(int face, const glm::vec3& center, float radius) const{
+    glm::vec3 d = center - LightPosition;
+    int axis = face / 2;
+    float along = face % 2 == 0 ? d[axis] : -d[axis];
+    if(along + radius < Near || along - radius > Far)
+        return false;
+
+    float slack = radius * sqrt(2.0f);
+    for(int k = 1;k < 3;k++){
+        float across = d[(axis + k) % 3];
+        if(along - across < -slack || along + across < -slack)
+            return false;
+    }
+    return true;
+}
+
+
+glm::mat4 CubeShadowMap::face_matrix(int face) const{
+    glm::mat4 projection = glm::perspective(glm::radians(90.0f),1.0f,Near,Far);
+    glm::mat4 view = glm::lookAt(LightPosition,LightPosition + FaceDirections[face],FaceUps[face]);
+    return projection * view;
+}
+
+
+glm::vec2 CubeShadowMap::depth_scale() const{
+    return glm::vec2(0.5f * (Far + Near) / (Far - Near) + 0.5f, Far * Near / (Far - Near));
+}
+
+
+void CubeShadowMap::begin(){
+    glGetIntegerv(GL_VIEWPORT,SavedViewport);
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING,&SavedFramebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER,Framebuffer);
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+    glViewport(0,0,Size,Size);
+}
+
+
+void CubeShadowMap::begin_face(int face){
+    glFramebufferTexture2D(GL_FRAMEBUFFER,GL_DEPTH_ATTACHMENT,GL_TEXTURE_CUBE_MAP_POSITIVE_X + face,Texture,0);
+    glClear(GL_DEPTH_BUFFER_BIT);
+    Dirty[face] = false;
+    FacesDrawn++;
+}
+
+
+void CubeShadowMap::end(){
+    glBindFramebuffer(GL_FRAMEBUFFER,SavedFramebuffer);
+    glViewport(SavedViewport[0],SavedViewport[1],SavedViewport[2],SavedViewport[3]);
+    check_gl_error();
+}
+
+
+void CubeShadowMap::bind(GLuint unit){
+    glActiveTexture(GL_TEXTURE0 + unit);
+    glBindTexture(GL_TEXTURE_CUBE_MAP,Texture);
+}
+
+
+void CubeShadowMap::free(){
+    if(Framebuffer){
+        glDeleteFramebuffers(1,&Framebuffer);
+        Framebuffer = 0;
+    }
+    if(Texture){
+        glDeleteTextures(1,&Texture);
+        Texture = 0;
+    }
+}
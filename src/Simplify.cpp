@@ -0,0 +1,220 @@
+#include "Simplify.h"
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <glm/glm.hpp>  // glm::vec2
+#include <glm/vec3.hpp> // glm::vec3
+
+Quadric::Quadric(){
+    A2 = AB = AC = AD = B2 = BC = BD = C2 = CD = D2 = 0;
+    Weight = 0;
+}
+
+
+Quadric::Quadric(const glm::dvec3& n, double d, double area){
+    A2 = area * n.x * n.x; AB = area * n.x * n.y; AC = area * n.x * n.z; AD = area * n.x * d;
+    B2 = area * n.y * n.y; BC = area * n.y * n.z; BD = area * n.y * d;
+    C2 = area * n.z * n.z; CD = area * n.z * d;
+    D2 = area * d * d;
+    Weight = area;
+}
+
+
+void Quadric::add(const Quadric& q){
+    A2 += q.A2; AB += q.AB; AC += q.AC; AD += q.AD;
+    B2 += q.B2; BC += q.BC; BD += q.BD;
+    C2 += q.C2; CD += q.CD;
+    D2 += q.D2;
+    Weight += q.Weight;
+}
+
+
+double Quadric::error(const glm::vec3& p) const{
+    double x = p.x, y = p.y, z = p.z;
+    double e = A2 * x * x + 2 * AB * x * y + 2 * AC * x * z + 2 * AD * x
+             + B2 * y * y + 2 * BC * y * z + 2 * BD * y
+             + C2 * z * z + 2 * CD * z
+             + D2;
+    return Weight > 0 ? std::max(e,0.0) / Weight : 0;
+}
+
+
+// A candidate collapse of From onto To
+struct Collapse{
+    unsigned int From, To;
+    double Cost;
+};
+
+
+static bool cheaper(const Collapse& a, const Collapse& b){
+    if(a.Cost != b.Cost)
+        return a.Cost < b.Cost;
+    if(a.From != b.From)
+        return a.From < b.From;
+    return a.To < b.To;
+}
+
+
+MeshSimplifier::MeshSimplifier(){
+    Positions = NULL;
+    Normals = NULL;
+    Error = 0;
+}
+
+
+void MeshSimplifier::init(const std::vector<glm::vec3>& positions, const std::vector<glm::vec3>& normals,
+                          const std::vector<unsigned int>& indices){
+    Positions = &positions;
+    Normals = &normals;
+    Indices = indices;
+    Error = 0;
+
+    Quadrics.assign(positions.size(),Quadric());
+    for(int t = 0;t + 2 < Indices.size();t += 3){
+        const glm::vec3& p0 = positions[Indices[t]];
+        const glm::vec3& p1 = positions[Indices[t+1]];
+        const glm::vec3& p2 = positions[Indices[t+2]];
+        glm::dvec3 n = glm::cross(glm::dvec3(p1 - p0),glm::dvec3(p2 - p0));
+        double length = glm::length(n);
+        if(length <= 0)
+            continue;
+        n /= length;
+        Quadric q(n,-glm::dot(n,glm::dvec3(p0)),0.5 * length);
+        for(int k = 0;k < 3;k++)
+            Quadrics[Indices[t+k]].add(q);
+    }
+
+    // An edge used by one triangle is a border, by more than two non-manifold
+    std::vector<std::pair<unsigned int, unsigned int> > edges;
+    for(int t = 0;t + 2 < Indices.size();t += 3){
+        for(int k = 0;k < 3;k++){
+            unsigned int a = Indices[t+k], b = Indices[t+(k+1)%3];
+            edges.push_back(std::make_pair(std::min(a,b),std::max(a,b)));
+        }
+    }
+    std::sort(edges.begin(),edges.end());
+    Locked.assign(positions.size(),false);
+    for(int i = 0;i < edges.size();){
+        int j = i;
+        while(j < edges.size() && edges[j] == edges[i])
+            j++;
+        if(j - i != 2){
+            Locked[edges[i].first] = true;
+            Locked[edges[i].second] = true;
+        }
+        i = j;
+    }
+}
+
+
+bool MeshSimplifier::flips(unsigned int from, unsigned int to, const std::vector<unsigned int>& offsets,
+                           const std::vector<unsigned int>& triangles) const{
+    const std::vector<glm::vec3>& V = *Positions;
+    for(int i = offsets[from];i < offsets[from+1];i++){
+        unsigned int t = triangles[i];
+        unsigned int a = Indices[t], b = Indices[t+1], c = Indices[t+2];
+        if(a == to || b == to || c == to)
+            continue; // removed by the collapse
+        glm::vec3 before = glm::cross(V[b] - V[a],V[c] - V[a]);
+        glm::vec3 pa = a == from ? V[to] : V[a];
+        glm::vec3 pb = b == from ? V[to] : V[b];
+        glm::vec3 pc = c == from ? V[to] : V[c];
+        glm::vec3 after = glm::cross(pb - pa,pc - pa);
+        float lengths = glm::length(before) * glm::length(after);
+        if(lengths <= 0 || glm::dot(before,after) < 0.25f * lengths)
+            return true;
+    }
+    return false;
+}
+
+
+bool MeshSimplifier::simplify(unsigned int target){
+    const std::vector<glm::vec3>& V = *Positions;
+    const std::vector<glm::vec3>& N = *Normals;
+    unsigned int start = Indices.size();
+
+    // Each pass collapses a set of edges far enough apart that their
+    // triangles do not overlap, then rebuilds the index list
+    while(Indices.size() > target){
+        // triangles around each vertex
+        std::vector<unsigned int> offsets(V.size() + 1,0);
+        for(int i = 0;i < Indices.size();i++)
+            offsets[Indices[i] + 1]++;
+        for(int v = 0;v < V.size();v++)
+            offsets[v + 1] += offsets[v];
+        std::vector<unsigned int> triangles(Indices.size());
+        std::vector<unsigned int> fill(offsets.begin(),offsets.end() - 1);
+        for(int i = 0;i < Indices.size();i++)
+            triangles[fill[Indices[i]]++] = i - i % 3;
+
+        // the cheaper direction of every edge
+        std::vector<Collapse> collapses;
+        for(int t = 0;t < Indices.size();t += 3){
+            for(int k = 0;k < 3;k++){
+                unsigned int a = Indices[t+k], b = Indices[t+(k+1)%3];
+                if(a > b)
+                    continue; // listed by the other triangle of the edge, which has it as (b, a)
+                if(glm::dot(N[a],N[b]) < 0.5f)
+                    continue;
+                Quadric q = Quadrics[a];
+                q.add(Quadrics[b]);
+                Collapse c;
+                c.Cost = -1;
+                if(!Locked[a]){
+                    c.From = a;
+                    c.To = b;
+                    c.Cost = q.error(V[b]);
+                }
+                if(!Locked[b]){
+                    double cost = q.error(V[a]);
+                    if(c.Cost < 0 || cost < c.Cost){
+                        c.From = b;
+                        c.To = a;
+                        c.Cost = cost;
+                    }
+                }
+                if(c.Cost >= 0)
+                    collapses.push_back(c);
+            }
+        }
+        std::sort(collapses.begin(),collapses.end(),cheaper);
+
+        // every collapse removes about two triangles
+        unsigned int wanted = (Indices.size() - target) / 6 + 1;
+        std::vector<bool> touched(V.size(),false);
+        std::vector<unsigned int> remap(V.size());
+        for(int v = 0;v < V.size();v++)
+            remap[v] = v;
+        unsigned int done = 0;
+        for(int i = 0;i < collapses.size() && done < wanted;i++){
+            const Collapse& c = collapses[i];
+            if(touched[c.From] || touched[c.To] || flips(c.From,c.To,offsets,triangles))
+                continue;
+            remap[c.From] = c.To;
+            Quadrics[c.To].add(Quadrics[c.From]);
+            Error = std::max(Error,float(sqrt(c.Cost)));
+            for(int j = offsets[c.From];j < offsets[c.From+1];j++){
+                for(int k = 0;k < 3;k++)
+                    touched[Indices[triangles[j]+k]] = true;
+            }
+            done++;
+        }
+        if(done == 0)
+            break;
+
+        // drop the triangles that lost a corner
+        std::vector<unsigned int> next;
+        next.reserve(Indices.size());
+        for(int t = 0;t < Indices.size();t += 3){
+            unsigned int a = remap[Indices[t]], b = remap[Indices[t+1]], c = remap[Indices[t+2]];
+            if(a == b || b == c || c == a)
+                continue;
+            next.push_back(a);
+            next.push_back(b);
+            next.push_back(c);
+        }
+        Indices.swap(next);
+    }
+    return Indices.size() < start;
+}
@@ -0,0 +1,686 @@
+#include "SoftwareRenderer.h"
+
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <glm/glm.hpp>  // glm::vec2
+#include <glm/vec3.hpp> // glm::vec3
+#include <glm/vec4.hpp> // glm::vec4
+#include <glm/mat4x4.hpp> // glm::mat4
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define SOFTWARE_SSE
+#endif
+
+// Triangles are clipped this many half viewports away from the center,
+// so that the edge functions keep their precision
+static const float GUARD_BAND = 4.0f;
+
+// Lines pass the depth test on the faces they lie on
+static const float LINE_DEPTH_BIAS = 1e-5f;
+
+// Polygon offset of the shadow casters, as glPolygonOffset(1.1, 4.0) on
+// a 16 bit depth buffer
+static const float SHADOW_OFFSET_SLOPE = 1.1f;
+static const float SHADOW_OFFSET_UNITS = 4.0f / 65536.0f;
+
+static const uint32_t NO_TRIANGLE = 0xffffffffu;
+static const int TRIANGLE_BITS = 26; // of the front triangle ids, the job above
+
+// Signed distance of a clip space point to the planes of the outcodes:
+// near, far, then left, right, bottom, top at guard times the viewport
+static float plane_distance(const glm::vec4& p, int plane, float guard){
+    switch(plane){
+        case 0: return p.z + p.w;
+        case 1: return p.w - p.z;
+        case 2: return p.x + guard * p.w;
+        case 3: return guard * p.w - p.x;
+        case 4: return p.y + guard * p.w;
+        default: return guard * p.w - p.y;
+    }
+}
+
+
+static unsigned int outcode(const glm::vec4& p, float guard){
+    unsigned int code = 0;
+    for(int plane = 0;plane < 6;plane++){
+        if(plane_distance(p,plane,guard) < 0)
+            code |= 1u << plane;
+    }
+    return code;
+}
+
+
+static SoftwareVertex lerp_vertex(const SoftwareVertex& a, const SoftwareVertex& b, float t){
+    SoftwareVertex v;
+    v.Clip = a.Clip + t * (b.Clip - a.Clip);
+    v.Position = a.Position + t * (b.Position - a.Position);
+    v.Color = a.Color + t * (b.Color - a.Color);
+    v.Normal = a.Normal + t * (b.Normal - a.Normal);
+    v.Occlusion = a.Occlusion + t * (b.Occlusion - a.Occlusion);
+    return v;
+}
+
+
+// Window coordinates of a vertex in front of the camera
+static void project_vertex(SoftwareVertex& v, int width, int height){
+    v.InvW = 1.0f / v.Clip.w;
+    v.X = (v.Clip.x * v.InvW * 0.5f + 0.5f) * width;
+    v.Y = (v.Clip.y * v.InvW * 0.5f + 0.5f) * height;
+    v.Z = v.Clip.z * v.InvW * 0.5f + 0.5f;
+}
+
+
+static void run_parallel(ThreadPool* pool, unsigned int count, const std::function<void(unsigned int)>& job){
+    if(pool)
+        pool->run(count,job);
+    else{
+        for(unsigned int i = 0;i < count;i++)
+            job(i);
+    }
+}
+
+
+SoftwareRenderer::SoftwareRenderer(){
+    Width = 0;
+    Height = 0;
+    Pool = NULL;
+    TargetWidth = 0;
+    TargetHeight = 0;
+    TilesX = 0;
+    TilesY = 0;
+    Orthographic = false;
+}
+
+
+void SoftwareRenderer::init(int width, int height, ThreadPool* pool){
+    Width = width;
+    Height = height;
+    Pool = pool;
+    Pixels.assign(3 * Width * Height,0);
+    Jobs.resize(SOFTWARE_GEOMETRY_JOBS);
+
+    unsigned int threads = Pool ? Pool->size() : 1;
+    TileDepth.resize(threads);
+    TileTriangle.resize(threads);
+    TileColor.resize(threads);
+    for(int t = 0;t < threads;t++){
+        TileDepth[t].resize(SOFTWARE_TILE_WIDTH * SOFTWARE_TILE_HEIGHT);
+        TileTriangle[t].resize(SOFTWARE_TILE_WIDTH * SOFTWARE_TILE_HEIGHT);
+        TileColor[t].resize(SOFTWARE_TILE_WIDTH * SOFTWARE_TILE_HEIGHT);
+    }
+    ShadowDepth.resize(6 * Shadow.Size * Shadow.Size);
+}
+
+
+void SoftwareRenderer::clear(){
+    Draws.clear();
+}
+
+
+void SoftwareRenderer::add(const SoftwareDraw& draw){
+    render_stats().DrawCalls++;
+    if(draw.Primitive == GL_TRIANGLES)
+        render_stats().Triangles += draw.Count / 3;
+    else
+        render_stats().Lines += draw.Count / 2;
+    Draws.push_back(draw);
+}
+
+
+void SoftwareRenderer::render(const SoftwareFrame& frame){
+    Frame = frame;
+    Orthographic = Frame.Perspective[3][3] != 0.0f;
+    if(!Frame.Lights->empty()){
+        Shadow.set_light((*Frame.Lights)[0].Position);
+        render_shadows();
+    }
+
+    TargetWidth = Width;
+    TargetHeight = Height;
+    ViewProjection = Frame.Perspective * Frame.View;
+    transform(ViewProjection,false);
+    run_parallel(Pool,TilesX * TilesY,[&](unsigned int tile){
+        unsigned int thread = ThreadPool::worker();
+        rasterize_tile(tile,&TileDepth[thread][0],&TileTriangle[thread][0],0.0f,0.0f);
+        shade_tile(tile,&TileDepth[thread][0],&TileTriangle[thread][0]);
+    });
+}
+
+
+void SoftwareRenderer::render_shadows(){
+    // every face is drawn again, the CPU copy is not cached like the GPU one
+    int size = Shadow.Size;
+    for(int f = 0;f < 6;f++){
+        TargetWidth = size;
+        TargetHeight = size;
+        transform(Shadow.face_matrix(f),true);
+        float* face = &ShadowDepth[f * size * size];
+        run_parallel(Pool,TilesX * TilesY,[&](unsigned int tile){
+            unsigned int thread = ThreadPool::worker();
+            float* depth = &TileDepth[thread][0];
+            rasterize_tile(tile,depth,&TileTriangle[thread][0],SHADOW_OFFSET_UNITS,SHADOW_OFFSET_SLOPE);
+
+            // stored in 16 bits like the texture
+            int x0 = (tile % TilesX) * SOFTWARE_TILE_WIDTH, y0 = (tile / TilesX) * SOFTWARE_TILE_HEIGHT;
+            int x1 = std::min(x0 + SOFTWARE_TILE_WIDTH,size), y1 = std::min(y0 + SOFTWARE_TILE_HEIGHT,size);
+            for(int y = y0;y < y1;y++){
+                for(int x = x0;x < x1;x++){
+                    float d = glm::clamp(depth[(y - y0) * SOFTWARE_TILE_WIDTH + x - x0],0.0f,1.0f);
+                    face[y * size + x] = floor(d * 65535.0f + 0.5f) / 65535.0f;
+                }
+            }
+        });
+    }
+}
+
+
+void SoftwareRenderer::transform(const glm::mat4& view_projection, bool shadow_pass){
+    TilesX = (TargetWidth + SOFTWARE_TILE_WIDTH - 1) / SOFTWARE_TILE_WIDTH;
+    TilesY = (TargetHeight + SOFTWARE_TILE_HEIGHT - 1) / SOFTWARE_TILE_HEIGHT;
+
+    // the primitives of the pass counted across its draws
+    PassDraws.clear();
+    PassFirst.clear();
+    unsigned long total = 0;
+    for(int d = 0;d < Draws.size();d++){
+        const SoftwareDraw& draw = Draws[d];
+        if(!(draw.Passes & (shadow_pass ? SOFTWARE_PASS_SHADOW : SOFTWARE_PASS_IMAGE)))
+            continue;
+        if(shadow_pass && draw.Primitive != GL_TRIANGLES)
+            continue;
+        PassDraws.push_back(d);
+        PassFirst.push_back(total);
+        total += draw.Primitive == GL_TRIANGLES ? draw.Count / 3 : draw.Count / 2;
+    }
+    PassFirst.push_back(total);
+
+    run_parallel(Pool,SOFTWARE_GEOMETRY_JOBS,[&](unsigned int j){
+        unsigned long first = total * j / SOFTWARE_GEOMETRY_JOBS;
+        unsigned long last = total * (j + 1) / SOFTWARE_GEOMETRY_JOBS;
+        transform_job(Jobs[j],first,last - first,view_projection,shadow_pass);
+    });
+}
+
+
+void SoftwareRenderer::transform_job(SoftwareJob& job, unsigned long first, unsigned long count,
+                                     const glm::mat4& view_projection, bool shadow_pass){
+    job.Vertices.clear();
+    job.Triangles.clear();
+    job.Lines.clear();
+    job.TriangleBins.resize(TilesX * TilesY);
+    job.LineBins.resize(TilesX * TilesY);
+    for(int t = 0;t < job.TriangleBins.size();t++){
+        job.TriangleBins[t].clear();
+        job.LineBins[t].clear();
+    }
+    if(count == 0)
+        return;
+
+    int p = std::upper_bound(PassFirst.begin(),PassFirst.end(),first) - PassFirst.begin() - 1;
+    unsigned long end = first + count;
+    for(;p < PassDraws.size() && PassFirst[p] < end;p++){
+        unsigned int d = PassDraws[p];
+        const SoftwareDraw& draw = Draws[d];
+        const std::vector<glm::vec3>& positions = *draw.Positions;
+        glm::mat4 mvp = view_projection * draw.Model;
+        glm::mat3 normal_matrix = glm::transpose(glm::inverse(glm::mat3(draw.Model)));
+        glm::vec3 view_row(Frame.View[0][2],Frame.View[1][2],Frame.View[2][2]);
+
+        // each vertex of the draw is transformed once
+        for(int i = 0;i < job.Used.size();i++)
+            job.Cache[job.Used[i]] = 0;
+        job.Used.clear();
+        if(job.Cache.size() < positions.size())
+            job.Cache.resize(positions.size(),0);
+        auto fetch = [&](unsigned int index) -> unsigned int {
+            if(job.Cache[index])
+                return job.Cache[index] - 1;
+            SoftwareVertex v;
+            glm::vec4 position(positions[index],1.0f);
+            v.Clip = mvp * position;
+            if(!shadow_pass){
+                v.Position = glm::vec3(draw.Model * position);
+                v.Color = draw.Colors ? (*draw.Colors)[index] : glm::vec3(0.0f);
+                v.Normal = draw.Normals ? normal_matrix * (*draw.Normals)[index] : glm::vec3(0.0f);
+                v.Occlusion = draw.Occlusion ? (*draw.Occlusion)[index] : 1.0f;
+            }
+            if(v.Clip.w > 0)
+                project_vertex(v,TargetWidth,TargetHeight);
+            job.Vertices.push_back(v);
+            job.Cache[index] = job.Vertices.size();
+            job.Used.push_back(index);
+            return job.Vertices.size() - 1;
+        };
+
+        unsigned long from = std::max(first,PassFirst[p]) - PassFirst[p];
+        unsigned long to = std::min(end,PassFirst[p + 1]) - PassFirst[p];
+        for(unsigned long k = from;k < to;k++){
+            if(draw.Primitive == GL_LINES){
+                // only the feature edges and the silhouettes, as FEATURE_EDGES
+                if(draw.EdgeFaces){
+                    const glm::vec4& face_a = draw.EdgeFaces[2 * k];
+                    const glm::vec4& face_b = draw.EdgeFaces[2 * k + 1];
+                    glm::vec3 center = 0.5f * (positions[draw.Indices[2 * k]] + positions[draw.Indices[2 * k + 1]]);
+                    glm::vec3 to_eye = Orthographic ? view_row : Frame.ViewPosition - glm::vec3(draw.Model * glm::vec4(center,1.0f));
+                    float facing_a = glm::dot(normal_matrix * glm::vec3(face_a),to_eye);
+                    float facing_b = glm::dot(normal_matrix * glm::vec3(face_b),to_eye);
+                    if(face_a.w < 1.5f && facing_a * facing_b > 0.0f)
+                        continue;
+                }
+                SoftwareVertex ends[2] = {job.Vertices[fetch(draw.Indices[2 * k])],job.Vertices[fetch(draw.Indices[2 * k + 1])]};
+
+                // clipped to the view volume
+                float t0 = 0.0f, t1 = 1.0f;
+                bool inside = true;
+                for(int plane = 0;plane < 6 && inside;plane++){
+                    float da = plane_distance(ends[0].Clip,plane,1.0f), db = plane_distance(ends[1].Clip,plane,1.0f);
+                    if(da < 0 && db < 0)
+                        inside = false;
+                    else if(da < 0)
+                        t0 = std::max(t0,da / (da - db));
+                    else if(db < 0)
+                        t1 = std::min(t1,da / (da - db));
+                }
+                if(!inside || t0 >= t1)
+                    continue;
+                SoftwarePrimitive line;
+                line.Draw = d;
+                for(int e = 0;e < 2;e++){
+                    SoftwareVertex v = lerp_vertex(ends[0],ends[1],e == 0 ? t0 : t1);
+                    project_vertex(v,TargetWidth,TargetHeight);
+                    line.V[e] = job.Vertices.size();
+                    job.Vertices.push_back(v);
+                }
+                line.V[2] = line.V[1];
+                const SoftwareVertex& a = job.Vertices[line.V[0]];
+                const SoftwareVertex& b = job.Vertices[line.V[1]];
+                line.MinX = std::max(int(floor(std::min(a.X,b.X))) - 1,0);
+                line.MinY = std::max(int(floor(std::min(a.Y,b.Y))) - 1,0);
+                line.MaxX = std::min(int(ceil(std::max(a.X,b.X))),TargetWidth - 1);
+                line.MaxY = std::min(int(ceil(std::max(a.Y,b.Y))),TargetHeight - 1);
+                if(line.MinX > line.MaxX || line.MinY > line.MaxY)
+                    continue;
+                for(int ty = line.MinY / SOFTWARE_TILE_HEIGHT;ty <= line.MaxY / SOFTWARE_TILE_HEIGHT;ty++){
+                    for(int tx = line.MinX / SOFTWARE_TILE_WIDTH;tx <= line.MaxX / SOFTWARE_TILE_WIDTH;tx++)
+                        job.LineBins[ty * TilesX + tx].push_back(job.Lines.size());
+                }
+                job.Lines.push_back(line);
+                continue;
+            }
+
+            unsigned int corners[3];
+            for(int c = 0;c < 3;c++)
+                corners[c] = fetch(draw.Indices[3 * k + c]);
+            unsigned int codes[3];
+            for(int c = 0;c < 3;c++)
+                codes[c] = outcode(job.Vertices[corners[c]].Clip,GUARD_BAND);
+            if(codes[0] & codes[1] & codes[2])
+                continue;
+
+            // clipped against the planes it crosses, then cut into a fan
+            unsigned int polygon[9];
+            int size = 3;
+            for(int c = 0;c < 3;c++)
+                polygon[c] = corners[c];
+            unsigned int crossed = codes[0] | codes[1] | codes[2];
+            for(int plane = 0;plane < 6 && size > 0;plane++){
+                if(!(crossed & (1u << plane)))
+                    continue;
+                unsigned int clipped[9];
+                int clipped_size = 0;
+                for(int c = 0;c < size;c++){
+                    unsigned int a = polygon[c], b = polygon[(c + 1) % size];
+                    float da = plane_distance(job.Vertices[a].Clip,plane,GUARD_BAND);
+                    float db = plane_distance(job.Vertices[b].Clip,plane,GUARD_BAND);
+                    if(da >= 0)
+                        clipped[clipped_size++] = a;
+                    if((da >= 0) != (db >= 0) && clipped_size < 9){
+                        SoftwareVertex v = lerp_vertex(job.Vertices[a],job.Vertices[b],da / (da - db));
+                        project_vertex(v,TargetWidth,TargetHeight);
+                        clipped[clipped_size++] = job.Vertices.size();
+                        job.Vertices.push_back(v);
+                    }
+                }
+                size = clipped_size;
+                for(int c = 0;c < size;c++)
+                    polygon[c] = clipped[c];
+            }
+
+            for(int c = 1;c + 1 < size;c++){
+                SoftwarePrimitive triangle;
+                triangle.V[0] = polygon[0];
+                triangle.V[1] = polygon[c];
+                triangle.V[2] = polygon[c + 1];
+                triangle.Draw = d;
+                const SoftwareVertex& a = job.Vertices[triangle.V[0]];
+                const SoftwareVertex& b = job.Vertices[triangle.V[1]];
+                const SoftwareVertex& e = job.Vertices[triangle.V[2]];
+                float area = (b.X - a.X) * (e.Y - a.Y) - (e.X - a.X) * (b.Y - a.Y);
+                if(!(area != 0.0f))
+                    continue;
+                if(area < 0)
+                    std::swap(triangle.V[1],triangle.V[2]);
+                triangle.MinX = std::max(int(floor(std::min(a.X,std::min(b.X,e.X)))),0);
+                triangle.MinY = std::max(int(floor(std::min(a.Y,std::min(b.Y,e.Y)))),0);
+                triangle.MaxX = std::min(int(ceil(std::max(a.X,std::max(b.X,e.X)))),TargetWidth - 1);
+                triangle.MaxY = std::min(int(ceil(std::max(a.Y,std::max(b.Y,e.Y)))),TargetHeight - 1);
+                if(triangle.MinX > triangle.MaxX || triangle.MinY > triangle.MaxY)
+                    continue;
+                for(int ty = triangle.MinY / SOFTWARE_TILE_HEIGHT;ty <= triangle.MaxY / SOFTWARE_TILE_HEIGHT;ty++){
+                    for(int tx = triangle.MinX / SOFTWARE_TILE_WIDTH;tx <= triangle.MaxX / SOFTWARE_TILE_WIDTH;tx++)
+                        job.TriangleBins[ty * TilesX + tx].push_back(job.Triangles.size());
+                }
+                job.Triangles.push_back(triangle);
+            }
+        }
+    }
+}
+
+
+// Edge functions of a counter clockwise triangle, positive inside: edge i
+// is the one facing vertex i. A pixel center on an edge belongs to the
+// triangle on the side the edge points to, so that two triangles sharing
+// it never both take it; the values are exact negations of each other.
+struct TriangleSetup{
+    float A[3], B[3], C[3];
+    bool Inclusive[3];
+    float InvArea;
+};
+
+static void setup_triangle(const SoftwareVertex* v[3], TriangleSetup& s){
+    for(int i = 0;i < 3;i++){
+        const SoftwareVertex& p = *v[(i + 1) % 3];
+        const SoftwareVertex& q = *v[(i + 2) % 3];
+        s.A[i] = p.Y - q.Y;
+        s.B[i] = q.X - p.X;
+        s.C[i] = p.X * q.Y - q.X * p.Y;
+        s.Inclusive[i] = s.A[i] > 0 || (s.A[i] == 0 && s.B[i] < 0);
+    }
+    s.InvArea = 1.0f / (s.A[0] * v[0]->X + s.B[0] * v[0]->Y + s.C[0]);
+}
+
+
+void SoftwareRenderer::rasterize_tile(int tile, float* depth, uint32_t* front, float units, float slope){
+    int x0 = (tile % TilesX) * SOFTWARE_TILE_WIDTH, y0 = (tile / TilesX) * SOFTWARE_TILE_HEIGHT;
+    int x1 = std::min(x0 + SOFTWARE_TILE_WIDTH,TargetWidth) - 1, y1 = std::min(y0 + SOFTWARE_TILE_HEIGHT,TargetHeight) - 1;
+    for(int i = 0;i < SOFTWARE_TILE_WIDTH * SOFTWARE_TILE_HEIGHT;i++){
+        depth[i] = 1.0f;
+        front[i] = NO_TRIANGLE;
+    }
+
+    for(int j = 0;j < Jobs.size();j++){
+        const SoftwareJob& job = Jobs[j];
+        const std::vector<unsigned int>& bin = job.TriangleBins[tile];
+        for(int b = 0;b < bin.size();b++){
+            const SoftwarePrimitive& triangle = job.Triangles[bin[b]];
+            const SoftwareVertex* v[3] = {&job.Vertices[triangle.V[0]],&job.Vertices[triangle.V[1]],&job.Vertices[triangle.V[2]]};
+            TriangleSetup s;
+            setup_triangle(v,s);
+
+            // window depth is linear on screen: z = zx * x + zy * y + zc
+            float dz1 = v[1]->Z - v[0]->Z, dz2 = v[2]->Z - v[0]->Z;
+            float zx = (s.A[1] * dz1 + s.A[2] * dz2) * s.InvArea;
+            float zy = (s.B[1] * dz1 + s.B[2] * dz2) * s.InvArea;
+            float zc = v[0]->Z - zx * v[0]->X - zy * v[0]->Y;
+            if(units != 0.0f || slope != 0.0f)
+                zc += units + slope * std::max(fabs(zx),fabs(zy));
+            uint32_t id = uint32_t(j) << TRIANGLE_BITS | bin[b];
+
+            int min_x = std::max(triangle.MinX,x0), max_x = std::min(triangle.MaxX,x1);
+            int min_y = std::max(triangle.MinY,y0), max_y = std::min(triangle.MaxY,y1);
+            int start_x = x0 + ((min_x - x0) & ~3);
+            for(int y = min_y;y <= max_y;y++){
+                float py = y + 0.5f;
+                float* depth_row = depth + (y - y0) * SOFTWARE_TILE_WIDTH - x0;
+                uint32_t* front_row = front + (y - y0) * SOFTWARE_TILE_WIDTH - x0;
+#ifdef SOFTWARE_SSE
+                __m128 row_e[3], a[3];
+                __m128i inclusive[3];
+                for(int i = 0;i < 3;i++){
+                    row_e[i] = _mm_set1_ps(s.B[i] * py + s.C[i]);
+                    a[i] = _mm_set1_ps(s.A[i]);
+                    inclusive[i] = _mm_set1_epi32(s.Inclusive[i] ? -1 : 0);
+                }
+                __m128 row_z = _mm_set1_ps(zy * py + zc);
+                __m128 step_z = _mm_set1_ps(zx);
+                __m128i ids = _mm_set1_epi32(int(id));
+                for(int x = start_x;x <= max_x;x += 4){
+                    __m128 px = _mm_add_ps(_mm_set1_ps(float(x)),_mm_setr_ps(0.5f,1.5f,2.5f,3.5f));
+                    __m128i mask = _mm_set1_epi32(-1);
+                    for(int i = 0;i < 3;i++){
+                        __m128 e = _mm_add_ps(_mm_mul_ps(a[i],px),row_e[i]);
+                        __m128i inside = _mm_castps_si128(_mm_cmpgt_ps(e,_mm_setzero_ps()));
+                        __m128i on_edge = _mm_and_si128(_mm_castps_si128(_mm_cmpeq_ps(e,_mm_setzero_ps())),inclusive[i]);
+                        mask = _mm_and_si128(mask,_mm_or_si128(inside,on_edge));
+                    }
+                    __m128 z = _mm_add_ps(_mm_mul_ps(step_z,px),row_z);
+                    __m128 old_z = _mm_loadu_ps(depth_row + x);
+                    mask = _mm_and_si128(mask,_mm_castps_si128(_mm_cmplt_ps(z,old_z)));
+                    if(_mm_movemask_epi8(mask) == 0)
+                        continue;
+                    __m128 m = _mm_castsi128_ps(mask);
+                    _mm_storeu_ps(depth_row + x,_mm_or_ps(_mm_and_ps(m,z),_mm_andnot_ps(m,old_z)));
+                    __m128i old_id = _mm_loadu_si128((const __m128i*)(front_row + x));
+                    _mm_storeu_si128((__m128i*)(front_row + x),_mm_or_si128(_mm_and_si128(mask,ids),_mm_andnot_si128(mask,old_id)));
+                }
+#else
+                for(int x = min_x;x <= max_x;x++){
+                    float px = x + 0.5f;
+                    bool covered = true;
+                    for(int i = 0;i < 3;i++){
+                        float e = s.A[i] * px + (s.B[i] * py + s.C[i]);
+                        covered = covered && (e > 0 || (e == 0 && s.Inclusive[i]));
+                    }
+                    float z = zx * px + (zy * py + zc);
+                    if(covered && z < depth_row[x]){
+                        depth_row[x] = z;
+                        front_row[x] = id;
+                    }
+                }
+#endif
+            }
+        }
+    }
+}
+
+
+void SoftwareRenderer::shade_tile(int tile, float* depth, const uint32_t* front){
+    int x0 = (tile % TilesX) * SOFTWARE_TILE_WIDTH, y0 = (tile / TilesX) * SOFTWARE_TILE_HEIGHT;
+    int x1 = std::min(x0 + SOFTWARE_TILE_WIDTH,TargetWidth) - 1, y1 = std::min(y0 + SOFTWARE_TILE_HEIGHT,TargetHeight) - 1;
+    glm::vec3* color = &TileColor[ThreadPool::worker()][0];
+
+    // each pixel once, from the triangle in front
+    for(int y = y0;y <= y1;y++){
+        for(int x = x0;x <= x1;x++){
+            int i = (y - y0) * SOFTWARE_TILE_WIDTH + x - x0;
+            if(front[i] == NO_TRIANGLE){
+                color[i] = Frame.Background;
+                continue;
+            }
+            const SoftwareJob& job = Jobs[front[i] >> TRIANGLE_BITS];
+            const SoftwarePrimitive& triangle = job.Triangles[front[i] & ((1u << TRIANGLE_BITS) - 1)];
+            const SoftwareDraw& draw = Draws[triangle.Draw];
+            if(draw.Shading == SOFTWARE_UNLIT || draw.Shading == SOFTWARE_WIREFRAME){
+                color[i] = draw.Color;
+                continue;
+            }
+            const SoftwareVertex* v[3] = {&job.Vertices[triangle.V[0]],&job.Vertices[triangle.V[1]],&job.Vertices[triangle.V[2]]};
+            TriangleSetup s;
+            setup_triangle(v,s);
+
+            // perspective correct weights of the vertices
+            float px = x + 0.5f, py = y + 0.5f;
+            float w[3], sum = 0;
+            for(int k = 0;k < 3;k++){
+                w[k] = (s.A[k] * px + (s.B[k] * py + s.C[k])) * s.InvArea * v[k]->InvW;
+                sum += w[k];
+            }
+            for(int k = 0;k < 3;k++)
+                w[k] /= sum;
+            glm::vec3 position = w[0] * v[0]->Position + w[1] * v[1]->Position + w[2] * v[2]->Position;
+            glm::vec3 vertex_color = w[0] * v[0]->Color + w[1] * v[1]->Color + w[2] * v[2]->Color;
+
+            // counter clockwise on screen, the face normal looks at the
+            // camera like the one from the screen-space derivatives
+            glm::vec3 normal;
+            if(draw.Shading == SOFTWARE_FLAT)
+                normal = glm::cross(v[1]->Position - v[0]->Position,v[2]->Position - v[0]->Position);
+            else
+                normal = w[0] * v[0]->Normal + w[1] * v[1]->Normal + w[2] * v[2]->Normal;
+            float occlusion = w[0] * v[0]->Occlusion + w[1] * v[1]->Occlusion + w[2] * v[2]->Occlusion;
+            color[i] = shade(position,glm::normalize(normal),vertex_color,occlusion);
+        }
+    }
+
+    // lines over the faces, stepping along their major axis
+    for(int j = 0;j < Jobs.size();j++){
+        const SoftwareJob& job = Jobs[j];
+        const std::vector<unsigned int>& bin = job.LineBins[tile];
+        for(int b = 0;b < bin.size();b++){
+            const SoftwarePrimitive& line = job.Lines[bin[b]];
+            const SoftwareDraw& draw = Draws[line.Draw];
+            const SoftwareVertex& a = job.Vertices[line.V[0]];
+            const SoftwareVertex& e = job.Vertices[line.V[1]];
+            bool x_major = fabs(e.X - a.X) >= fabs(e.Y - a.Y);
+            float from = x_major ? a.X : a.Y, to = x_major ? e.X : e.Y;
+            if(from == to)
+                continue;
+            int lo = x_major ? x0 : y0, hi = x_major ? x1 : y1;
+            int first = std::max(int(ceil(std::min(from,to) - 0.5f)),lo);
+            int last = std::min(int(ceil(std::max(from,to) - 0.5f)) - 1,hi);
+            for(int c = first;c <= last;c++){
+                float t = (c + 0.5f - from) / (to - from);
+                float minor = x_major ? a.Y + t * (e.Y - a.Y) : a.X + t * (e.X - a.X);
+                // a line on a pixel border falls on the lower pixel, like the diamond rule
+                int x = x_major ? c : int(ceil(minor)) - 1;
+                int y = x_major ? int(ceil(minor)) - 1 : c;
+                if(x < x0 || x > x1 || y < y0 || y > y1)
+                    continue;
+                int i = (y - y0) * SOFTWARE_TILE_WIDTH + x - x0;
+                float z = a.Z + t * (e.Z - a.Z);
+                if(z > depth[i] + LINE_DEPTH_BIAS)
+                    continue;
+                depth[i] = z;
+                if(draw.Shading != SOFTWARE_PHONG){
+                    color[i] = draw.Color;
+                    continue;
+                }
+                float wa = (1.0f - t) * a.InvW, we = t * e.InvW;
+                float sum = wa + we;
+                wa /= sum;
+                we /= sum;
+                color[i] = shade(wa * a.Position + we * e.Position,glm::normalize(wa * a.Normal + we * e.Normal),
+                                 wa * a.Color + we * e.Color,wa * a.Occlusion + we * e.Occlusion);
+            }
+        }
+    }
+
+    // rounded like the unsigned normalized framebuffer, rows top to bottom
+    for(int y = y0;y <= y1;y++){
+        unsigned char* row = &Pixels[3 * ((Height - 1 - y) * Width + x0)];
+        for(int x = x0;x <= x1;x++){
+            glm::vec3 c = glm::clamp(color[(y - y0) * SOFTWARE_TILE_WIDTH + x - x0],0.0f,1.0f);
+            for(int k = 0;k < 3;k++)
+                *row++ = (unsigned char)(c[k] * 255.0f + 0.5f);
+        }
+    }
+}
+
+
+glm::vec3 SoftwareRenderer::shade(const glm::vec3& position, const glm::vec3& normal, const glm::vec3& color, float occlusion) const{
+    // every light, those of the clusters of the shaders are the ones reaching it
+    const float specular_strength = 0.5f;
+    glm::vec3 viewdir = glm::normalize(Frame.ViewPosition - position);
+    glm::vec3 lighting = Frame.Ambient * occlusion;
+    const std::vector<PointLight>& lights = *Frame.Lights;
+    for(int l = 0;l < lights.size();l++){
+        glm::vec3 tolight = lights[l].Position - position;
+        float attenuation = 1.0f;
+        if(lights[l].Radius > 0){
+            float falloff = glm::clamp(1.0f - glm::dot(tolight,tolight) / (lights[l].Radius * lights[l].Radius),0.0f,1.0f);
+            attenuation = falloff * falloff;
+        }
+        if(attenuation <= 0)
+            continue;
+        if(l == 0)
+            attenuation *= shadow(-tolight,normal);
+
+        glm::vec3 lightdir = glm::normalize(tolight);
+        float diff = std::max(glm::dot(normal,lightdir),0.0f);
+        glm::vec3 reflectdir = glm::reflect(-lightdir,normal);
+        float spec = pow(std::max(glm::dot(viewdir,reflectdir),0.0f),30.0f);
+        lighting += attenuation * (diff * lights[l].Color + specular_strength * spec * lights[l].Color);
+    }
+    return lighting * color;
+}
+
+
+float SoftwareRenderer::shadow(glm::vec3 fromlight, const glm::vec3& normal) const{
+    int size = Shadow.Size;
+    float texel = 2.0f / size;
+    glm::vec2 depth_scale = Shadow.depth_scale();
+
+    // the lookup of the shader, off the surface by about one texel
+    glm::vec3 a = glm::abs(fromlight);
+    float m = std::max(a.x,std::max(a.y,a.z));
+    fromlight += normal * (1.5f * texel * m);
+    a = glm::abs(fromlight);
+    m = std::max(a.x,std::max(a.y,a.z));
+    float reference = depth_scale.x - depth_scale.y / (0.995f * m);
+    glm::vec3 u = a.x >= a.y && a.x >= a.z ? glm::vec3(0.0f,1.0f,0.0f) : glm::vec3(1.0f,0.0f,0.0f);
+    glm::vec3 v = a.z >= a.x && a.z >= a.y ? glm::vec3(0.0f,1.0f,0.0f) : glm::vec3(0.0f,0.0f,1.0f);
+    u *= texel * m;
+    v *= texel * m;
+
+    float lit = 0;
+    int pcf = Frame.ShadowPcf;
+    for(int i = -pcf;i <= pcf;i++){
+        for(int j = -pcf;j <= pcf;j++){
+            glm::vec3 r = fromlight + float(i) * u + float(j) * v;
+
+            // cube map face and coordinates, as in the GL specification
+            glm::vec3 ar = glm::abs(r);
+            int face;
+            float sc, tc, ma;
+            if(ar.x >= ar.y && ar.x >= ar.z){
+                face = r.x > 0 ? 0 : 1;
+                sc = r.x > 0 ? -r.z : r.z;
+                tc = -r.y;
+                ma = ar.x;
+            }
+            else if(ar.y >= ar.z){
+                face = r.y > 0 ? 2 : 3;
+                sc = r.x;
+                tc = r.y > 0 ? r.z : -r.z;
+                ma = ar.y;
+            }
+            else{
+                face = r.z > 0 ? 4 : 5;
+                sc = r.z > 0 ? r.x : -r.x;
+                tc = -r.y;
+                ma = ar.z;
+            }
+            float s = (0.5f * (sc / ma + 1.0f)) * size - 0.5f;
+            float t = (0.5f * (tc / ma + 1.0f)) * size - 0.5f;
+
+            // bilinear filtering of the comparisons
+            int s0 = int(floor(s)), t0 = int(floor(t));
+            float fs = s - s0, ft = t - t0;
+            const float* depth = &ShadowDepth[face * size * size];
+            float sample = 0;
+            for(int k = 0;k < 4;k++){
+                int sx = glm::clamp(s0 + (k & 1),0,size - 1);
+                int ty = glm::clamp(t0 + (k >> 1),0,size - 1);
+                float weight = ((k & 1) ? fs : 1.0f - fs) * ((k >> 1) ? ft : 1.0f - ft);
+                if(reference <= depth[ty * size + sx])
+                    sample += weight;
+            }
+            lit += sample;
+        }
+    }
+    float width = float(2 * pcf + 1);
+    return lit / (width * width);
+}
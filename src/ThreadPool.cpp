@@ -0,0 +1,143 @@
+#include "ThreadPool.h"
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <functional>
+
+static thread_local unsigned int worker_index = 0;
+
+static uint64_t pack_range(unsigned int begin, unsigned int end){
+    return uint64_t(end) << 32 | begin;
+}
+
+ThreadPool::ThreadPool(){
+    Generation = 0;
+    Busy = 0;
+    Quit = false;
+    Job = NULL;
+    JobCount = 0;
+}
+
+
+ThreadPool::~ThreadPool(){
+    free();
+}
+
+
+void ThreadPool::init(unsigned int workers){
+    if(workers == 0){
+        unsigned int threads = std::thread::hardware_concurrency();
+        workers = threads > 1 ? threads - 1 : 0;
+    }
+    Quit = false;
+    std::vector<JobRange> ranges(workers + 1);
+    Ranges.swap(ranges);
+    for(unsigned int i = 0;i < workers;i++)
+        Workers.push_back(std::thread(&ThreadPool::work,this,i + 1));
+}
+
+
+void ThreadPool::run(unsigned int count, const std::function<void(unsigned int)>& job){
+    if(Workers.empty() || count <= 1){
+        for(unsigned int i = 0;i < count;i++)
+            job(i);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(Mutex);
+        Job = &job;
+        JobCount = count;
+        unsigned int threads = size();
+        for(unsigned int t = 0;t < threads;t++)
+            Ranges[t].Jobs.store(pack_range(uint64_t(count) * t / threads,uint64_t(count) * (t + 1) / threads));
+        Busy = Workers.size();
+        Generation++;
+    }
+    Wake.notify_all();
+
+    run_jobs(0);
+
+    // the job has to outlive every worker still running it
+    std::unique_lock<std::mutex> lock(Mutex);
+    while(Busy > 0)
+        Done.wait(lock);
+    Job = NULL;
+}
+
+
+unsigned int ThreadPool::worker(){
+    return worker_index;
+}
+
+
+void ThreadPool::work(unsigned int index){
+    worker_index = index;
+    unsigned int seen = 0;
+    std::unique_lock<std::mutex> lock(Mutex);
+    while(true){
+        while(Generation == seen && !Quit)
+            Wake.wait(lock);
+        if(Quit)
+            break;
+        seen = Generation;
+        lock.unlock();
+
+        run_jobs(index);
+
+        lock.lock();
+        if(--Busy == 0)
+            Done.notify_one();
+    }
+}
+
+
+void ThreadPool::run_jobs(unsigned int index){
+    const std::function<void(unsigned int)>& job = *Job;
+    std::atomic<uint64_t>& jobs = Ranges[index].Jobs;
+    do{
+        // the front of the range, its back may be stolen meanwhile
+        uint64_t range = jobs.load();
+        while(uint32_t(range) < uint32_t(range >> 32)){
+            if(jobs.compare_exchange_weak(range,range + 1)){
+                job(uint32_t(range));
+                range = jobs.load();
+            }
+        }
+    }while(steal(index));
+}
+
+
+bool ThreadPool::steal(unsigned int index){
+    // A stolen range is on no list until it is stored below: another
+    // thread may stop early meanwhile, but the jobs still run here
+    unsigned int threads = size();
+    for(unsigned int k = 1;k < threads;k++){
+        std::atomic<uint64_t>& victim = Ranges[(index + k) % threads].Jobs;
+        uint64_t range = victim.load();
+        while(uint32_t(range) < uint32_t(range >> 32)){
+            unsigned int begin = uint32_t(range), end = uint32_t(range >> 32);
+            unsigned int middle = begin + (end - begin) / 2;
+            if(victim.compare_exchange_weak(range,pack_range(begin,middle))){
+                Ranges[index].Jobs.store(pack_range(middle,end));
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+
+void ThreadPool::free(){
+    if(Workers.empty())
+        return;
+    {
+        std::lock_guard<std::mutex> lock(Mutex);
+        Quit = true;
+    }
+    Wake.notify_all();
+    for(int i = 0;i < Workers.size();i++)
+        Workers[i].join();
+    Workers.clear();
+}
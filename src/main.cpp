@@ -3,6 +3,23 @@
 // OpenGL Helpers to reduce the clutter
 #include "Helpers.h"
 #include "MeshObject.h"
+#include "MeshAsset.h"
+#include "IndirectDraw.h"
+#include "RenderQueue.h"
+#include "ShaderLibrary.h"
+#include "FileWatcher.h"
+#include "ClusteredLights.h"
+#include "ShadowMap.h"
+#include "Headless.h"
+#include "SceneScript.h"
+#include "Benchmark.h"
+#include "Profiler.h"
+#include "OcclusionCulling.h"
+#include "OcclusionQueries.h"
+#include "SoftwareRenderer.h"
+#include "RayTracer.h"
+#include "SceneFile.h"
+#include "SceneAutosave.h"
 
 #ifdef __APPLE__
 #define GL_SILENCE_DEPRECATION
@@ -24,18 +41,84 @@
 #include <chrono>
 #include <string>
 #include <iostream>
+#include <cstdio>
+#include <cctype>
+#include <algorithm>
+#include <functional>
+#include <sys/stat.h>
 
-// VertexBufferObject wrapper
+// VertexBufferObject wrapper, the meshes own their buffers
 VertexBufferObject VBO;
 VertexBufferObject CBO;
 VertexBufferObject NBO;
 
+// Per-object data (model/normal matrix, color) read by the vertex shader
+TextureBufferObject ObjectData;
+std::vector<glm::vec4> ObjectRecords;
+
+// Shader variants, one per shading mode, see ShaderLibrary.h
+ShaderLibrary Shaders;
+unsigned int UNLIT_SHADER, WIREFRAME_SHADER, FLAT_SHADER, PHONG_SHADER, PICKING_SHADER;
+unsigned int FEATURE_UNLIT_SHADER, FEATURE_WIREFRAME_SHADER, FEATURE_PHONG_SHADER;
+FileWatcher ShaderWatcher;
+
+// Point lights, the first one follows the light cube object. The clusters
+// tell each fragment which of them reach it.
+std::vector<PointLight> Lights;
+LightClusters Clusters;
+
+// Cube shadow map of the light cube, filtered with a (2 * SHADOW_PCF + 1)^2 kernel
+CubeShadowMap Shadow;
+int SHADOW_PCF = 1;
+bool LIGHT_BENCHMARK = false;
+
+// Draw submission: the sorted queue is cut into one batch per render state and mesh
+IndirectDrawer Drawer;
+RenderQueue Queue;
+std::vector<DrawBatch> Batches;
+std::vector<uint64_t> BatchKeys;
+std::vector<unsigned int> BatchMeshes; // the key only has the low 16 bits of the mesh id
+
+// Draw each object at the level of detail of its size on screen, see Mesh::select_lod
+bool LOD_ENABLED = true;
+
+// Draw only the meshlets of the full meshes that are in the frustum and
+// not back facing, see Meshlets.h
+bool MESHLET_CULLING = true;
+std::vector<unsigned int> VisibleMeshlets;
+
+// Skip the objects hidden behind the largest ones on screen, tested on
+// the CPU against a depth buffer of at most OCCLUDER_TRIANGLES occluder
+// triangles, see OcclusionCulling.h
+bool OCCLUSION_CULLING = true;
+const unsigned int OCCLUDER_TRIANGLES = 16384;
+ThreadPool Workers;
+OcclusionCuller Occlusion;
+std::vector<std::pair<float,int> > OccluderCandidates;
+std::vector<glm::vec4> ObjectSpheres;
+std::vector<unsigned char> ObjectVisible;
+
+// Draw the objects of at least QUERY_MIN_TRIANGLES triangles only if the
+// box around them passed the depth test last frame, see OcclusionQueries.h.
+// Each gets a batch of its own, QueryObjects are the objects queried this
+// frame and BatchQueries the object of each batch, -1 for the others.
+bool OCCLUSION_QUERIES = false;
+const unsigned int QUERY_MIN_TRIANGLES = 256;
+OcclusionQueries Queries;
+std::vector<unsigned char> QueryObjects;
+std::vector<int> QueryTests;
+std::vector<int> BatchQueries;
+
+// Edges drawn by the wireframe and the flat overlay: all of them, or only
+// the creases, borders and silhouettes
+bool FEATURE_EDGES_ONLY = false;
+
 // Contains the vertex positions
-// The default 6 vertices are used to show axis
-std::vector<glm::vec3> V(6);
-std::vector<glm::vec3> C(6);
-std::vector<glm::vec3> N_v(6);
-std::vector<glm::vec3> N_f(6);
+// The 6 vertices are used to show axis, the 36 after them are the
+// triangles of the [-1,1] cube drawn by the occlusion queries
+std::vector<glm::vec3> V(42);
+std::vector<glm::vec3> C(42);
+std::vector<glm::vec3> N_v(42);
 
 // Constants
 const glm::mat4 UnitMatrix(
@@ -49,6 +132,10 @@ const glm::mat4 UnitMatrix(
 std::vector<MeshObject> ObjectList;
 int OBJECT_SELECTED = -1;
 
+// Picking request, served by the next frame
+bool PICK_PENDING = false;
+int PICK_X, PICK_Y;
+
 // View Matrix constructors
 glm::vec3 CamaraPosition(0,0,1);
 glm::vec3 CamaraUp(0,1,0);
@@ -68,6 +155,165 @@ enum mode {
 };
 mode Operation_mode = TRANSLATION_MODE;
 
+// Unattended rendering without a window, see Headless.h
+HeadlessOptions HEADLESS;
+HeadlessContext Headless;
+
+// Measured runs of a generated scene, the bench executable, see Benchmark.h
+BenchOptions BENCH;
+bool BENCHMARK_RUN = false;
+
+// Scene saved in the background every few seconds, see SceneAutosave.h.
+// Objects changed in place are marked with Autosave.changed().
+SceneAutosave Autosave;
+
+// Stills of the --renderer raytrace runs. Objects moved in place are
+// reported with Tracer.move(), see RayTracer.h.
+RayTracer Tracer;
+
+
+// Bind a shader variant for the draws that follow
+void use_shader(unsigned int variant)
+{
+    Program& program = Shaders.program(variant);
+    program.bind();
+    Drawer.DrawBaseLocation = program.uniform("draw_base");
+}
+
+
+// Point the buffer texture samplers of every variant at their units
+void set_sampler_units()
+{
+    for(int v = 0;v < Shaders.Programs.size();v++){
+        Shaders.program(v).bind();
+        glUniform1i(Shaders.program(v).uniform("object_data"),0);
+        glUniform1i(Shaders.program(v).uniform("draw_ids"),1);
+        glUniform1i(Shaders.program(v).uniform("lights"),2 + LIGHT_DATA_UNIT);
+        glUniform1i(Shaders.program(v).uniform("light_clusters"),2 + LIGHT_CLUSTER_UNIT);
+        glUniform1i(Shaders.program(v).uniform("light_indices"),2 + LIGHT_INDEX_UNIT);
+        glUniform1i(Shaders.program(v).uniform("shadow_map"),5);
+    }
+}
+
+
+// Benchmark scene: 1000 random lights over a grid of bumpy cubes
+void load_light_benchmark()
+{
+    add_random_lights(Lights,1000,1,glm::vec3(-1.5f,-0.5f,-2.0f),glm::vec3(1.5f,1.0f,1.0f),0.2f,0.5f);
+    for(int x = 0;x < 8;x++){
+        for(int z = 0;z < 8;z++){
+            MeshObject object("/home/kurisute/Desktop/CG/assignments/assignment-3/data/bumpy_cube.off");
+            object.Rmode = PHONG;
+            object.ScaleVector = glm::vec3(0.3,0.3,0.3);
+            object.TranslateVector = glm::vec3(-1.4 + 0.4 * x,-0.5,-2.0 + 0.4 * z);
+            ObjectList.push_back(object);
+        }
+    }
+    LIGHT_BENCHMARK = true;
+    std::cout << "light benchmark: " << Lights.size() << " lights, " << ObjectList.size() << " objects" << std::endl;
+}
+
+
+// Scene file of the F5 and F9 keys
+std::string scene_file_path()
+{
+    return HEADLESS.ScenePath.empty() ? "scene.scn" : HEADLESS.ScenePath;
+}
+
+
+// Write the objects to a scene file, see SceneFile.h
+bool save_scene_file(const std::string& path)
+{
+    auto start = std::chrono::high_resolution_clock::now();
+    if(!save_scene(path,ObjectList,OBJECT_SELECTED))
+        return false;
+    std::cout << "scene saved to " << path << ": " << ObjectList.size() << " objects in "
+              << std::chrono::duration<double,std::milli>(std::chrono::high_resolution_clock::now() - start).count()
+              << " ms" << std::endl;
+    return true;
+}
+
+
+// Replace the objects by those of a scene file. The shadow faces and the
+// occlusion queries know nothing about the new objects.
+bool open_scene_file(const std::string& path)
+{
+    auto start = std::chrono::high_resolution_clock::now();
+    if(!open_scene(path,ObjectList,OBJECT_SELECTED))
+        return false;
+    Autosave.changed_all();
+    Autosave.capture(ObjectList,OBJECT_SELECTED);
+    Tracer.moved_all();
+    Shadow.CasterKnown.assign(Shadow.CasterKnown.size(),false);
+    for(int f = 0;f < 6;f++)
+        Shadow.Dirty[f] = true;
+    for(int i = 0;i < Queries.Objects.size();i++)
+        Queries.forget(i);
+    std::cout << "scene opened from " << path << ": " << ObjectList.size() << " objects in "
+              << std::chrono::duration<double,std::milli>(std::chrono::high_resolution_clock::now() - start).count()
+              << " ms" << std::endl;
+    return true;
+}
+
+
+// Directory of the executable with a trailing slash, empty if unknown
+std::string executable_dir(const char* argv0)
+{
+    std::string path(argv0);
+    std::string::size_type slash = path.find_last_of("/\\");
+    if(slash == std::string::npos)
+        return "";
+    return path.substr(0,slash + 1);
+}
+
+// executable_dir() of this run, the caches are written next to the executable
+std::string ExecutableDir;
+
+
+// Name of the profiler scope drawing the batches of a render state
+const char* pass_scope_name(uint64_t key)
+{
+    if(key_mode(key) == MODE_UNLIT)
+        return "light cube";
+    if(key_program(key) == UNLIT_SHADER || key_program(key) == FEATURE_UNLIT_SHADER)
+        return "selected object";
+    if(key_pass(key) == PASS_EDGES)
+        return key_mode(key) == FLAT ? "flat edges" : "wireframe objects";
+    return key_mode(key) == FLAT ? "flat objects" : "phong objects";
+}
+
+
+// Apply the render state of batch key "next", coming from batch key "prev".
+// Only the state that differs between the two is touched.
+void apply_render_state(bool first, uint64_t prev, uint64_t next)
+{
+    if(first || key_program(prev) != key_program(next))
+        use_shader(key_program(next));
+}
+
+
+// Size of the window, or of the framebuffer of a headless run
+void get_window_size(GLFWwindow* window, int* width, int* height)
+{
+    if(window)
+        glfwGetWindowSize(window, width, height);
+    else{
+        *width = Headless.Width;
+        *height = Headless.Height;
+    }
+}
+
+
+void get_framebuffer_size(GLFWwindow* window, int* width, int* height)
+{
+    if(window)
+        glfwGetFramebufferSize(window, width, height);
+    else{
+        *width = Headless.Width;
+        *height = Headless.Height;
+    }
+}
+
 
 void framebuffer_size_callback(GLFWwindow* window, int width, int height)
 {
@@ -112,18 +358,21 @@ void mouse_button_callback(GLFWwindow* window, int button, int action, int mods)
 
     // Update the position of the first vertex if the left button is pressed
     if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_PRESS){
-        glReadPixels(xpos, height - ypos - 1, 1, 1, GL_STENCIL_INDEX, GL_UNSIGNED_INT, &OBJECT_SELECTED);
-        std::cout << "selected:" << OBJECT_SELECTED << std::endl; 
+        PICK_PENDING = true;
+        PICK_X = xpos;
+        PICK_Y = height - ypos - 1;
     }
-
-    // Upload the change to the GPU
-    VBO.update(V);
 }
 
 
 void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods)
 {
     if(action == GLFW_PRESS){
+        // w, s, a, d, f and g rotate or translate the selected object
+        bool moves = key == GLFW_KEY_W || key == GLFW_KEY_S || key == GLFW_KEY_A || key == GLFW_KEY_D || key == GLFW_KEY_F || key == GLFW_KEY_G;
+        if(moves)
+            Autosave.changed(OBJECT_SELECTED);
+
         if(Operation_mode == ROTATION_MODE){
             switch(key)
             {
@@ -171,6 +420,8 @@ void key_callback(GLFWwindow* window, int key, int scancode, int action, int mod
                     break;
             }
         }
+        if(moves)
+            Tracer.move(OBJECT_SELECTED,ObjectList[OBJECT_SELECTED].get_model_matrix());
 
         // Change Camara
         if(IF_TRACKBALL){
@@ -229,29 +480,16 @@ void key_callback(GLFWwindow* window, int key, int scancode, int action, int mod
         switch(key)
         {
             case  GLFW_KEY_1:
-                ObjectList.push_back(MeshObject("/home/kurisute/Desktop/CG/assignments/assignment-3/data/cube.off",V.size()));
+                ObjectList.push_back(MeshObject("/home/kurisute/Desktop/CG/assignments/assignment-3/data/cube.off"));
                 std::cout << "cube object loaded!" << std::endl;
-                V.insert(V.end(),ObjectList[ObjectList.size()-1].V.begin(),ObjectList[ObjectList.size()-1].V.end());
-                C.insert(C.end(),ObjectList[ObjectList.size()-1].C.begin(),ObjectList[ObjectList.size()-1].C.end());
-                N_f.insert(N_f.end(),ObjectList[ObjectList.size()-1].N_f.begin(),ObjectList[ObjectList.size()-1].N_f.end());
-                N_v.insert(N_v.end(),ObjectList[ObjectList.size()-1].N_v.begin(),ObjectList[ObjectList.size()-1].N_v.end());
-                std::cout << V.size() << std::endl;
                 OBJECT_SELECTED = ObjectList.size()-1;
                 break;
             case GLFW_KEY_2:
-                ObjectList.push_back(MeshObject("/home/kurisute/Desktop/CG/assignments/assignment-3/data/bumpy_cube.off",V.size()));
-                V.insert(V.end(),ObjectList[ObjectList.size()-1].V.begin(),ObjectList[ObjectList.size()-1].V.end());
-                C.insert(C.end(),ObjectList[ObjectList.size()-1].C.begin(),ObjectList[ObjectList.size()-1].C.end());
-                N_f.insert(N_f.end(),ObjectList[ObjectList.size()-1].N_f.begin(),ObjectList[ObjectList.size()-1].N_f.end());
-                N_v.insert(N_v.end(),ObjectList[ObjectList.size()-1].N_v.begin(),ObjectList[ObjectList.size()-1].N_v.end());
+                ObjectList.push_back(MeshObject("/home/kurisute/Desktop/CG/assignments/assignment-3/data/bumpy_cube.off"));
                 OBJECT_SELECTED = ObjectList.size()-1;
                 break;
             case  GLFW_KEY_3:
-                ObjectList.push_back(MeshObject("/home/kurisute/Desktop/CG/assignments/assignment-3/data/bunny.off",V.size()));
-                V.insert(V.end(),ObjectList[ObjectList.size()-1].V.begin(),ObjectList[ObjectList.size()-1].V.end());
-                C.insert(C.end(),ObjectList[ObjectList.size()-1].C.begin(),ObjectList[ObjectList.size()-1].C.end());
-                N_f.insert(N_f.end(),ObjectList[ObjectList.size()-1].N_f.begin(),ObjectList[ObjectList.size()-1].N_f.end());
-                N_v.insert(N_v.end(),ObjectList[ObjectList.size()-1].N_v.begin(),ObjectList[ObjectList.size()-1].N_v.end());
+                ObjectList.push_back(MeshObject("/home/kurisute/Desktop/CG/assignments/assignment-3/data/bunny.off"));
                 OBJECT_SELECTED = ObjectList.size()-1;
                 break;
 
@@ -266,9 +504,13 @@ void key_callback(GLFWwindow* window, int key, int scancode, int action, int mod
             // Scale
             case GLFW_KEY_Q:
                 ObjectList[OBJECT_SELECTED].ScaleVector += glm::vec3(0.05,0.05,0.05);
+                Autosave.changed(OBJECT_SELECTED);
+                Tracer.move(OBJECT_SELECTED,ObjectList[OBJECT_SELECTED].get_model_matrix());
                 break;
             case GLFW_KEY_E:
                 ObjectList[OBJECT_SELECTED].ScaleVector -= glm::vec3(0.05,0.05,0.05);
+                Autosave.changed(OBJECT_SELECTED);
+                Tracer.move(OBJECT_SELECTED,ObjectList[OBJECT_SELECTED].get_model_matrix());
                 break;
 
             // Change Persepctive Mode
@@ -294,54 +536,554 @@ void key_callback(GLFWwindow* window, int key, int scancode, int action, int mod
             // Change Rendering Mode to Selected Object
             case GLFW_KEY_Z:
                 ObjectList[OBJECT_SELECTED].Rmode = WIREFRAME;
+                Autosave.changed(OBJECT_SELECTED);
                 break;
             case GLFW_KEY_X:
                 ObjectList[OBJECT_SELECTED].Rmode = FLAT;
+                Autosave.changed(OBJECT_SELECTED);
                 break;
             case GLFW_KEY_C:
                 ObjectList[OBJECT_SELECTED].Rmode = PHONG;
+                Autosave.changed(OBJECT_SELECTED);
+                break;
+
+            // Feature edges only
+            case GLFW_KEY_B:
+                FEATURE_EDGES_ONLY = !FEATURE_EDGES_ONLY;
+                std::cout << "edges: " << (FEATURE_EDGES_ONLY ? "creases, borders and silhouettes" : "all") << std::endl;
+                break;
+
+            // Levels of detail
+            case GLFW_KEY_V:
+                LOD_ENABLED = !LOD_ENABLED;
+                std::cout << "levels of detail: " << (LOD_ENABLED ? "on" : "off") << std::endl;
+                break;
+
+            // Meshlet culling
+            case GLFW_KEY_J:
+                MESHLET_CULLING = !MESHLET_CULLING;
+                std::cout << "meshlet culling: " << (MESHLET_CULLING ? "on" : "off") << std::endl;
+                break;
+
+            // Occlusion culling
+            case GLFW_KEY_H:
+                OCCLUSION_CULLING = !OCCLUSION_CULLING;
+                std::cout << "occlusion culling: " << (OCCLUSION_CULLING ? "on" : "off") << std::endl;
+                break;
+
+            // Occlusion queries
+            case GLFW_KEY_Y:
+                OCCLUSION_QUERIES = !OCCLUSION_QUERIES;
+                std::cout << "occlusion queries: " << (OCCLUSION_QUERIES ? "on" : "off") << std::endl;
+                break;
+
+            // Shadow filtering
+            case GLFW_KEY_K:
+                SHADOW_PCF = (SHADOW_PCF + 1) % 4;
+                std::cout << "shadow PCF kernel: " << 2 * SHADOW_PCF + 1 << "x" << 2 * SHADOW_PCF + 1 << std::endl;
+                break;
+
+            // Load the many lights benchmark scene
+            case GLFW_KEY_L:
+                load_light_benchmark();
+                break;
+
+            // Save and open the scene file
+            case GLFW_KEY_F5:
+                save_scene_file(scene_file_path());
+                break;
+            case GLFW_KEY_F9:
+                open_scene_file(scene_file_path());
                 break;
             
             default:
                 break;
         }
     }
-    // Upload the change to the GPU
-    VBO.update(V);
 }
 
 
-int main(void)
+// GLFW key code of a script key name: a letter, a digit or one of the camera keys
+int script_key_code(const std::string& name)
 {
-    GLFWwindow* window;
+    if(name.size() == 1 && isalnum(name[0]))
+        return toupper(name[0]);
+    if(name == "up")
+        return GLFW_KEY_UP;
+    if(name == "down")
+        return GLFW_KEY_DOWN;
+    if(name == "left")
+        return GLFW_KEY_LEFT;
+    if(name == "right")
+        return GLFW_KEY_RIGHT;
+    if(name == "equal")
+        return GLFW_KEY_EQUAL;
+    if(name == "minus")
+        return GLFW_KEY_MINUS;
+    return -1;
+}
 
-    // Initialize the library
-    if (!glfwInit())
-        return -1;
 
-    // Activate supersampling
-    glfwWindowHint(GLFW_SAMPLES, 8);
+// Apply one command of a scene script, false if it cannot be done
+bool run_script_command(const ScriptCommand& command)
+{
+    const std::vector<std::string>& args = command.Args;
+    bool has_selection = OBJECT_SELECTED >= 0 && OBJECT_SELECTED < ObjectList.size();
+    glm::vec3 xyz(0,0,0);
+    if(args.size() == 3)
+        xyz = glm::vec3(atof(args[0].c_str()),atof(args[1].c_str()),atof(args[2].c_str()));
+
+    if(command.Name == "object"){
+        try{
+            ObjectList.push_back(MeshObject(args[0]));
+        }
+        catch(const char* error){
+            std::cerr << "line " << command.Line << ": " << args[0] << ": " << error << std::endl;
+            return false;
+        }
+        OBJECT_SELECTED = ObjectList.size()-1;
+    }
+    else if(command.Name == "select"){
+        int index = atoi(args[0].c_str());
+        if(index < 0 || index >= ObjectList.size()){
+            std::cerr << "line " << command.Line << ": no object " << index << std::endl;
+            return false;
+        }
+        OBJECT_SELECTED = index;
+    }
+    else if(command.Name == "lights")
+        add_random_lights(Lights,atoi(args[0].c_str()),atoi(args[1].c_str()),glm::vec3(-1.5f,-0.5f,-2.0f),glm::vec3(1.5f,1.0f,1.0f),0.2f,0.5f);
+    else if(command.Name == "light"){
+        ObjectList[0].TranslateVector = xyz;
+        Autosave.changed(0);
+        Tracer.move(0,ObjectList[0].get_model_matrix());
+    }
+    else if(command.Name == "projection"){
+        if(args[0] != "perspective" && args[0] != "orthographic"){
+            std::cerr << "line " << command.Line << ": unknown projection " << args[0] << std::endl;
+            return false;
+        }
+        IF_PERSPECTIVE = args[0] == "perspective";
+    }
+    else if(command.Name == "save"){
+        if(!save_scene_file(args[0])){
+            std::cerr << "line " << command.Line << ": cannot save " << args[0] << std::endl;
+            return false;
+        }
+    }
+    else if(command.Name == "open"){
+        if(!open_scene_file(args[0])){
+            std::cerr << "line " << command.Line << ": cannot open " << args[0] << std::endl;
+            return false;
+        }
+    }
+    else if(command.Name == "key"){
+        int key = script_key_code(args[1]);
+        if(key < 0){
+            std::cerr << "line " << command.Line << ": unknown key " << args[1] << std::endl;
+            return false;
+        }
+        key_callback(NULL, key, 0, GLFW_PRESS, 0);
+    }
+    else if(!has_selection){
+        std::cerr << "line " << command.Line << ": " << command.Name << " needs a selected object" << std::endl;
+        return false;
+    }
+    else if(command.Name == "mode"){
+        if(args[0] == "wireframe")
+            ObjectList[OBJECT_SELECTED].Rmode = WIREFRAME;
+        else if(args[0] == "flat")
+            ObjectList[OBJECT_SELECTED].Rmode = FLAT;
+        else if(args[0] == "phong")
+            ObjectList[OBJECT_SELECTED].Rmode = PHONG;
+        else{
+            std::cerr << "line " << command.Line << ": unknown mode " << args[0] << std::endl;
+            return false;
+        }
+    }
+    else if(command.Name == "translate")
+        ObjectList[OBJECT_SELECTED].TranslateVector = xyz;
+    else if(command.Name == "rotate")
+        ObjectList[OBJECT_SELECTED].RotateVector = xyz;
+    else if(command.Name == "scale")
+        ObjectList[OBJECT_SELECTED].ScaleVector = xyz;
+    if(command.Name == "mode" || command.Name == "translate" || command.Name == "rotate" || command.Name == "scale")
+        Autosave.changed(OBJECT_SELECTED);
+    if(command.Name == "translate" || command.Name == "rotate" || command.Name == "scale")
+        Tracer.move(OBJECT_SELECTED,ObjectList[OBJECT_SELECTED].get_model_matrix());
+    return true;
+}
 
-    // Ensure that we get at least a 3.2 context
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 2);
 
-    // On apple we have to load a core profile with forward compatibility
-#ifdef __APPLE__
-    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+// The light cube and its light, and the scene of a benchmark run.
+// False if the benchmark meshes cannot be loaded.
+bool init_scene()
+{
+    IF_PERSPECTIVE = true;
+    IF_TRACKBALL = false;
+
+    // Meshes are cached next to the executable with their levels of
+    // detail, their vertex cache optimized order and their hierarchy, see
+    // MeshAsset.h
+    set_mesh_cache_dir(ExecutableDir + "mesh_cache");
+    set_mesh_optimization(HEADLESS.OptimizeMeshes);
+    set_mesh_ao_bake(HEADLESS.BakeAo);
+    set_mesh_build_pool(&Workers);
+
+    //Add Lightsource
+    ObjectList.push_back(MeshObject("/home/kurisute/Desktop/CG/assignments/assignment-3/data/lightcube.off"));
+    OBJECT_SELECTED = ObjectList.size()-1;
+    ObjectList[OBJECT_SELECTED].UnitScale = glm::vec3(1,1,1);
+
+    // The light cube lights the whole scene, without attenuation
+    PointLight light;
+    light.Position = glm::vec3(0,0,0);
+    light.Color = glm::vec3(1.0f,1.0f,1.0f);
+    light.Radius = 0;
+    Lights.push_back(light);
+
+    // The benchmark scene, lit from above
+    if(BENCHMARK_RUN){
+        ObjectList[0].TranslateVector = glm::vec3(0,2,0);
+        try{
+            generate_bench_scene(ObjectList, BENCH);
+        }
+        catch(const char* error){
+            std::cerr << "Cannot load the benchmark meshes from " << BENCH.DataDir << ": " << error << std::endl;
+            return false;
+        }
+    }
+
+    // the scene of --scene, unless it is still to be saved
+    struct stat status;
+    if(!HEADLESS.ScenePath.empty() && stat(HEADLESS.ScenePath.c_str(),&status) == 0 && !open_scene_file(HEADLESS.ScenePath))
+        return false;
+
+    double interval = HEADLESS.AutosaveInterval >= 0 ? HEADLESS.AutosaveInterval : HEADLESS.Enabled ? 0 : 60;
+    Autosave.init("autosave.scn",interval);
+    Autosave.capture(ObjectList,OBJECT_SELECTED);
+    return true;
+}
+
+
+// Level of detail of each object from the pixels its bounding sphere
+// covers on screen: one mesh unit covers pixels_per_unit
+void select_levels_of_detail(int framebuffer_height)
+{
+    for(int i = 0;i < ObjectList.size();i++){
+        const Mesh& mesh = ObjectList[i].mesh();
+        if(!LOD_ENABLED || mesh.Lods.size() <= 1 || mesh.Radius <= 0){
+            ObjectList[i].Lod = 0;
+            continue;
+        }
+        glm::vec3 center;
+        float radius;
+        ObjectList[i].get_bounding_sphere(center,radius);
+        float screen_radius;
+        if(IF_PERSPECTIVE){
+            float distance = glm::length(center - CamaraPosition);
+            screen_radius = distance > radius ? radius / (distance * tan(glm::radians(35.0f))) * 0.5f * framebuffer_height : 1e9f;
+        }
+        else
+            screen_radius = radius * 0.5f * framebuffer_height;
+        ObjectList[i].Lod = mesh.select_lod(screen_radius / mesh.Radius,ObjectList[i].Lod);
+    }
+}
+
+
+// The unattenuated lights also give the ambient term
+glm::vec3 ambient_light()
+{
+    glm::vec3 ambient(0.0f,0.0f,0.0f);
+    for(int l = 0;l < Lights.size();l++){
+        if(Lights[l].Radius <= 0)
+            ambient += 0.1f * Lights[l].Color;
+    }
+    return ambient;
+}
+
+
+// Indices of a mesh from an offset in its element buffer (see Mesh.h)
+const unsigned int* element_indices(const Mesh& mesh, unsigned int first)
+{
+    if(first < mesh.F.size())
+        return mesh.F.data() + first;
+    first -= mesh.F.size();
+    if(first < mesh.LodIndices.size())
+        return mesh.LodIndices.data() + first;
+    return mesh.EdgeIndices.data() + first - mesh.LodIndices.size();
+}
+
+
+// A headless run rendered on the CPU, without any GL context: the script,
+// the camera path and the benchmark like the GL path, with the draws of
+// its render queue or traced by the ray tracer. Returns the exit code.
+int run_software_renderer(const SceneScript& script)
+{
+    Workers.init();
+    if(!init_scene())
+        return -1;
+    bool tracing = HEADLESS.Renderer == "raytrace";
+    SoftwareRenderer renderer;
+    std::string threads = std::to_string(Workers.size()) + (Workers.size() == 1 ? " thread" : " threads");
+    std::string renderer_name;
+    if(tracing){
+        // key_callback and the script commands report the objects they move
+        Tracer.init(HEADLESS.Width,HEADLESS.Height,&Workers);
+        Tracer.AoRays = HEADLESS.AoRays;
+        Tracer.MovesReported = true;
+        renderer_name = "ray tracer, " + std::to_string(HEADLESS.Samples) + " samples, "
+                      + std::to_string(HEADLESS.AoRays) + " ambient occlusion rays, " + threads;
+    }
+    else{
+        renderer.init(HEADLESS.Width,HEADLESS.Height,&Workers);
+        renderer_name = "software rasterizer, " + threads;
+    }
+    std::cout << "Renderer: " << renderer_name << std::endl;
+
+    int frame_count = HEADLESS.Frames >= 0 ? HEADLESS.Frames : script.Frames >= 0 ? script.Frames : 1;
+    std::vector<FrameTiming> timings;
+    if(!HEADLESS.OutputDir.empty())
+        mkdir(HEADLESS.OutputDir.c_str(), 0755);
+
+#ifdef ENABLE_PROFILER
+    PROFILER.init(!HEADLESS.TracePath.empty());
+#else
+    if(!HEADLESS.TracePath.empty())
+        std::cerr << "--trace needs a build with ENABLE_PROFILER" << std::endl;
 #endif
 
-    // Create a windowed mode window and its OpenGL context
-    window = glfwCreateWindow(640, 640, "Hello World", NULL, NULL);
-    if (!window)
+    // The axis, as the first 6 vertices of V
+    std::vector<glm::vec3> axis_vertices(6,glm::vec3(0,0,0));
+    for(int a = 0;a < 3;a++){
+        axis_vertices[2 * a][a] = 1e+6;
+        axis_vertices[2 * a + 1][a] = -1e+6;
+    }
+    static const unsigned int axis_indices[6] = {0,1,2,3,4,5};
+    const glm::vec3 axis_colors[3] = {glm::vec3(1,0,0),glm::vec3(0,1,0),glm::vec3(0,0,1)};
+
+    for(int frame = 0;frame < frame_count;frame++)
     {
-        glfwTerminate();
+        reset_render_stats();
+        for(int c = 0;c < script.Commands.size();c++){
+            if(script.Commands[c].Frame == frame && !run_script_command(script.Commands[c]))
+                return -1;
+        }
+        script.camera_at(frame, CamaraPosition);
+        if(BENCHMARK_RUN)
+            CamaraPosition = bench_camera(std::max(frame - BENCH.Warmup, 0), BENCH.Frames, BENCH.Orbit);
+        auto frame_start = std::chrono::high_resolution_clock::now();
+        PROFILE_FRAME_BEGIN();
+
+        // Hand the objects changed since the last autosave to its thread
+        {
+            PROFILE_SCOPE("autosave");
+            Autosave.update(ObjectList,OBJECT_SELECTED);
+        }
+
+        Lights[0].Position = glm::vec3(ObjectList[0].get_model_matrix() * glm::vec4(ObjectList[0].BaryCenter,1.0));
+        View = glm::lookAt(CamaraPosition,glm::vec3(0,0,0),CamaraUp);
+        float ratio = 1.0f*HEADLESS.Width/HEADLESS.Height;
+        if(IF_PERSPECTIVE)
+            Perspective = glm::perspective(glm::radians(70.0f),ratio,0.1f,100.0f);
+        else
+            Perspective = glm::ortho(-1.0f*ratio,1.0f*ratio,-1.0f,1.0f,0.1f,100.0f);
+
+        // The draws of the render queue. The light and the selected object
+        // are in their flat color, the edges over flat shaded faces in
+        // black. Every object but the light casts the shadows of its full mesh.
+        if(!tracing){
+            PROFILE_SCOPE("render queue");
+            select_levels_of_detail(HEADLESS.Height);
+            renderer.clear();
+            for(int a = 0;a < 3;a++){
+                SoftwareDraw axis = {GL_LINES,SOFTWARE_WIREFRAME,&axis_vertices,NULL,NULL,NULL,&axis_indices[2 * a],2,NULL,
+                                     UnitMatrix,axis_colors[a],SOFTWARE_PASS_IMAGE};
+                renderer.add(axis);
+            }
+            for(int i = 0;i < ObjectList.size();i++){
+                MeshObject& obj = ObjectList[i];
+                const Mesh& mesh = obj.mesh();
+                const MeshLod& lod = mesh.Lods[obj.Lod];
+                bool unlit = i == 0 || i == OBJECT_SELECTED;
+                glm::vec3 color = i == OBJECT_SELECTED ? glm::vec3(1.0f,1.0f,0.0f) : glm::vec3(1.0f,1.0f,1.0f);
+                unsigned int edge_offset = lod.EdgeFirst - mesh.F.size() - mesh.LodIndices.size();
+                SoftwareDraw draw = {GL_TRIANGLES,SOFTWARE_UNLIT,&mesh.V,&mesh.C,&mesh.N_v,&mesh.AO,element_indices(mesh,lod.First),lod.Count,
+                                     FEATURE_EDGES_ONLY ? mesh.EdgeFaces.data() + edge_offset : NULL,obj.get_model_matrix(),color,SOFTWARE_PASS_IMAGE};
+                bool faces = i == 0 || obj.Rmode != WIREFRAME;
+                if(faces){
+                    draw.Shading = unlit ? SOFTWARE_UNLIT : obj.Rmode == FLAT ? SOFTWARE_FLAT : SOFTWARE_PHONG;
+                    if(i > 0 && obj.Lod == 0)
+                        draw.Passes |= SOFTWARE_PASS_SHADOW;
+                    renderer.add(draw);
+                }
+                if(i > 0 && obj.Rmode != PHONG){
+                    SoftwareDraw edges = draw;
+                    edges.Primitive = GL_LINES;
+                    edges.Indices = element_indices(mesh,lod.EdgeFirst);
+                    edges.Count = lod.EdgeCount;
+                    edges.Passes = SOFTWARE_PASS_IMAGE;
+                    if(obj.Rmode == FLAT){
+                        edges.Shading = SOFTWARE_WIREFRAME;
+                        edges.Color = glm::vec3(0.0f,0.0f,0.0f);
+                    }
+                    else
+                        edges.Shading = unlit ? SOFTWARE_UNLIT : SOFTWARE_PHONG;
+                    renderer.add(edges);
+                }
+                if(i > 0 && !(draw.Passes & SOFTWARE_PASS_SHADOW)){
+                    SoftwareDraw caster = draw;
+                    caster.Indices = mesh.F.data();
+                    caster.Count = mesh.F.size();
+                    caster.Passes = SOFTWARE_PASS_SHADOW;
+                    renderer.add(caster);
+                }
+            }
+        }
+
+        SoftwareFrame uniforms = {View,Perspective,CamaraPosition,ambient_light(),glm::vec3(0.5f,0.5f,0.5f),&Lights,SHADOW_PCF};
+        if(tracing){
+            PROFILE_SCOPE("ray tracer");
+            Tracer.begin(uniforms,ObjectList);
+            for(int s = 0;s < HEADLESS.Samples;s++)
+                Tracer.trace_sample();
+        }
+        else{
+            PROFILE_SCOPE("software rasterizer");
+            renderer.render(uniforms);
+        }
+        PROFILE_FRAME_END();
+
+        // Everything is done once the image is there
+        FrameTiming timing;
+        timing.Frame = frame;
+        timing.CpuMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - frame_start).count();
+        timing.GpuMs = -1;
+        timing.FrameMs = timing.CpuMs;
+        timing.Work = render_stats();
+        timings.push_back(timing);
+
+        if(!HEADLESS.OutputDir.empty()){
+            char name[32];
+            snprintf(name, sizeof(name), "frame_%04d.%s", frame, HEADLESS.ImageFormat.c_str());
+            std::string path = HEADLESS.OutputDir + "/" + name;
+            const std::vector<unsigned char>& pixels = tracing ? Tracer.Pixels : renderer.Pixels;
+            bool written = HEADLESS.ImageFormat == "png" ? write_png(path, HEADLESS.Width, HEADLESS.Height, pixels)
+                                                         : write_ppm(path, HEADLESS.Width, HEADLESS.Height, pixels);
+            if(!written)
+                std::cerr << "Cannot write " << path << std::endl;
+        }
+    }
+
+    if(!HEADLESS.TimingsPath.empty()){
+        if(!write_timings_json(HEADLESS.TimingsPath, timings, HEADLESS.Width, HEADLESS.Height, renderer_name))
+            std::cerr << "Cannot write " << HEADLESS.TimingsPath << std::endl;
+    }
+    if(BENCHMARK_RUN){
+        std::vector<FrameTiming> measured(timings.begin() + std::min(BENCH.Warmup, int(timings.size())), timings.end());
+        write_bench_results(BENCH, measured, renderer_name);
+    }
+    if(tracing && !timings.empty()){
+        double seconds = 0;
+        for(int t = 0;t < timings.size();t++)
+            seconds += timings[t].FrameMs / 1000.0;
+        std::cout << "ray tracer: " << Tracer.ray_count() << " rays, " << Tracer.ray_count() / seconds / 1e6 << " Mrays/s" << std::endl;
+    }
+
+#ifdef ENABLE_PROFILER
+    PROFILER.free();
+    if(!HEADLESS.TracePath.empty() && !PROFILER.write_trace(HEADLESS.TracePath))
+        std::cerr << "Cannot write " << HEADLESS.TracePath << std::endl;
+#endif
+    Autosave.free(ObjectList,OBJECT_SELECTED);
+    Workers.free();
+    return 0;
+}
+
+
+int main(int argc, char* argv[])
+{
+    GLFWwindow* window = NULL;
+    GLFWwindow* shader_context = NULL;
+    ExecutableDir = executable_dir(argv[0]);
+
+#ifdef BENCHMARK_BUILD
+    // The bench executable is a headless run of a generated scene
+    if(!parse_bench_options(argc, argv, BENCH))
+        return -1;
+    if(BENCH.Bvh)
+        return run_bvh_bench(BENCH) ? 0 : -1;
+    if(!BENCH.ScenePath.empty())
+        return run_scene_bench(BENCH) ? 0 : -1;
+    BENCHMARK_RUN = true;
+    HEADLESS.Enabled = true;
+    HEADLESS.Width = BENCH.Width;
+    HEADLESS.Height = BENCH.Height;
+    HEADLESS.Frames = BENCH.Warmup + BENCH.Frames;
+    HEADLESS.TracePath = BENCH.TracePath;
+    LOD_ENABLED = BENCH.Lod;
+    HEADLESS.OptimizeMeshes = BENCH.OptimizeMeshes;
+    HEADLESS.BakeAo = BENCH.BakeAo;
+    HEADLESS.Renderer = BENCH.Renderer;
+    HEADLESS.AutosaveInterval = BENCH.Autosave;
+    FEATURE_EDGES_ONLY = BENCH.FeatureEdges;
+    MESHLET_CULLING = BENCH.Meshlets;
+    OCCLUSION_CULLING = BENCH.Occlusion;
+    OCCLUSION_QUERIES = BENCH.Queries;
+#else
+    if(!parse_headless_options(argc, argv, HEADLESS))
         return -1;
+#endif
+    SceneScript script;
+    if(!HEADLESS.ScriptPath.empty() && !script.load(HEADLESS.ScriptPath))
+        return -1;
+
+    // The software renderers need no GL context at all
+    if(HEADLESS.Enabled && HEADLESS.Renderer != "gl")
+        return run_software_renderer(script);
+
+    // Headless runs draw into a framebuffer object of a windowless context
+    if(HEADLESS.Enabled){
+        if(!Headless.init(HEADLESS.Width, HEADLESS.Height))
+            return -1;
     }
+    else{
+        // Initialize the library
+        if (!glfwInit())
+            return -1;
+
+        // Activate supersampling
+        glfwWindowHint(GLFW_SAMPLES, 8);
+
+        // Ensure that we get at least a 3.2 context
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 2);
+#ifdef DEBUG_GL
+        glfwWindowHint(GLFW_OPENGL_DEBUG_CONTEXT, GL_TRUE);
+#endif
+
+        // On apple we have to load a core profile with forward compatibility
+#ifdef __APPLE__
+        glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+        glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+#endif
+
+        // Create a windowed mode window and its OpenGL context
+        window = glfwCreateWindow(640, 640, "Hello World", NULL, NULL);
+        if (!window)
+        {
+            glfwTerminate();
+            return -1;
+        }
 
-    // Make the window's context current
-    glfwMakeContextCurrent(window);
+        // A hidden window sharing the objects of the first one, the shaders
+        // are recompiled on its context when their files change
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+        shader_context = glfwCreateWindow(1, 1, "Shader Compiler", NULL, window);
+
+        // Make the window's context current
+        glfwMakeContextCurrent(window);
+    }
 
     #ifndef __APPLE__
       glewExperimental = true;
@@ -355,19 +1097,30 @@ int main(void)
       fprintf(stdout, "Status: Using GLEW %s\n", glewGetString(GLEW_VERSION));
     #endif
 
-    int major, minor, rev;
-    major = glfwGetWindowAttrib(window, GLFW_CONTEXT_VERSION_MAJOR);
-    minor = glfwGetWindowAttrib(window, GLFW_CONTEXT_VERSION_MINOR);
-    rev = glfwGetWindowAttrib(window, GLFW_CONTEXT_REVISION);
-    printf("OpenGL version recieved: %d.%d.%d\n", major, minor, rev);
+    if(window){
+        int major, minor, rev;
+        major = glfwGetWindowAttrib(window, GLFW_CONTEXT_VERSION_MAJOR);
+        minor = glfwGetWindowAttrib(window, GLFW_CONTEXT_VERSION_MINOR);
+        rev = glfwGetWindowAttrib(window, GLFW_CONTEXT_REVISION);
+        printf("OpenGL version recieved: %d.%d.%d\n", major, minor, rev);
+    }
+    else
+        Headless.init_framebuffer();
     printf("Supported OpenGL is %s\n", (const char*)glGetString(GL_VERSION));
     printf("Supported GLSL is %s\n", (const char*)glGetString(GL_SHADING_LANGUAGE_VERSION));
 
+    // Debug builds report the OpenGL errors and warnings as they happen
+#ifdef DEBUG_GL
+    if(!enable_gl_debug_output())
+        std::cout << "KHR_debug is not supported, only glGetError is checked" << std::endl;
+#endif
+
     // Initialize the VAO
     // A Vertex Array Object (or VAO) is an object that describes how the vertex
     // attributes are stored in a Vertex Buffer Object (or VBO). This means that
     // the VAO is not the actual object storing the vertex data,
     // but the descriptor of the vertex data.
+    // This one only describes the axis, every mesh configures its own.
     VertexArrayObject VAO;
     VAO.init();
     VAO.bind();
@@ -382,6 +1135,18 @@ int main(void)
     V[3] = glm::vec3(0,-1e+6,0);
     V[4] = glm::vec3(0,0,1e+6);
     V[5] = glm::vec3(0,0,-1e+6);
+    for(int f = 0;f < 6;f++){
+        // two triangles on the face of the cube across axis f / 2
+        glm::vec3 n(0,0,0), u(0,0,0), w(0,0,0);
+        n[f/2] = f % 2 ? -1.0f : 1.0f;
+        u[(f/2+1)%3] = 1.0f;
+        w[(f/2+2)%3] = 1.0f;
+        glm::vec3 corners[6] = {n-u-w, n+u-w, n+u+w, n-u-w, n+u+w, n-u+w};
+        for(int k = 0;k < 6;k++){
+            V[6+6*f+k] = corners[k];
+            N_v[6+6*f+k] = n;
+        }
+    }
     VBO.update(V);
 
     CBO.init();
@@ -394,233 +1159,596 @@ int main(void)
     CBO.update(C);
 
     NBO.init();
-    N_f[0] = glm::vec3(1,0,0);
-    N_f[1] = glm::vec3(1,0,0);
-    N_f[2] = glm::vec3(0,1,0);
-    N_f[3] = glm::vec3(0,1,0);
-    N_f[4] = glm::vec3(0,0,1);
-    N_f[5] = glm::vec3(0,0,1);
-    NBO.update(N_f);
-
-    IF_PERSPECTIVE = true;
-    IF_TRACKBALL = false;
+    N_v[0] = glm::vec3(1,0,0);
+    N_v[1] = glm::vec3(1,0,0);
+    N_v[2] = glm::vec3(0,1,0);
+    N_v[3] = glm::vec3(0,1,0);
+    N_v[4] = glm::vec3(0,0,1);
+    N_v[5] = glm::vec3(0,0,1);
+    NBO.update(N_v);
+    label_gl(GL_VERTEX_ARRAY,VAO.id,"axis");
+    label_gl(GL_BUFFER,VBO.id,"axis positions");
+    label_gl(GL_BUFFER,CBO.id,"axis colors");
+    label_gl(GL_BUFFER,NBO.id,"axis normals");
+
+    // the mesh hierarchies are built on the workers too
+    Workers.init();
+    if(!init_scene()){
+        Headless.free();
+        return -1;
+    }
 
-    //Add Lightsource
-    ObjectList.push_back(MeshObject("/home/kurisute/Desktop/CG/assignments/assignment-3/data/lightcube.off",V.size()));
-    V.insert(V.end(),ObjectList[ObjectList.size()-1].V.begin(),ObjectList[ObjectList.size()-1].V.end());
-    C.insert(C.end(),ObjectList[ObjectList.size()-1].C.begin(),ObjectList[ObjectList.size()-1].C.end());
-    N_f.insert(N_f.end(),ObjectList[ObjectList.size()-1].N_f.begin(),ObjectList[ObjectList.size()-1].N_f.end());
-    N_v.insert(N_v.end(),ObjectList[ObjectList.size()-1].N_v.begin(),ObjectList[ObjectList.size()-1].N_v.end());
-    OBJECT_SELECTED = ObjectList.size()-1;
-    ObjectList[OBJECT_SELECTED].UnitScale = glm::vec3(1,1,1);
+    // Object data lives in a buffer texture on unit 0, the draw slots of
+    // the fallback path on unit 1, the clustered lights on units 2 to 4,
+    // the shadow map on unit 5
+    ObjectData.init();
+    label_gl(GL_BUFFER,ObjectData.id,"object data");
+    Drawer.init();
+    Clusters.init();
+    Shadow.init();
+    Queries.init();
+    int benchmark_frames = 0;
+    double benchmark_build_ms = 0;
 
     // Initialize the OpenGL Program
     // A program controls the OpenGL pipeline and it must contains
     // at least a vertex shader and a fragment shader to be valid
-    Program program;
-    const GLchar* vertex_shader =
-            "#version 150 core\n"
-                    "in vec3 position;"
-                    "in vec3 color;"
-                    "in vec3 normal;"
-                    "out vec3 f_position;"
-                    "out vec3 f_color;"
-                    "out vec3 f_normal;"
-                    "uniform mat4 model;"
-                    "uniform mat4 view;"
-                    "uniform mat4 perspective;"
-                    "void main()"
-                    "{"
-                    "    gl_Position = perspective * view * model * vec4(position, 1.0);"
-                    "    f_color = color;"
-                    "    f_normal = mat3(transpose(inverse(model))) * normal;"
-                    "    f_position = vec3(model * vec4(position, 1.0));"
-                    "}";
-    const GLchar* fragment_shader =
-            "#version 150 core\n"
-                    "in vec3 f_color;"
-                    "in vec3 f_normal;"
-                    "in vec3 f_position;"
-                    "out vec4 outColor;"
-                    "uniform vec3 lightPos;"
-                    "uniform vec3 lightcolor;"
-                    "uniform vec3 viewPos;"
-                    "uniform bool if_uni_color;"
-                    "uniform vec3 uni_color;"
-                    "void main()"
-                    "{"
-                    "    float ambientStrength = 0.1;"
-                    "    float specularStrength = 0.5;"
-                    "    vec3 norm = normalize(f_normal);"
-                    "    vec3 ambient = ambientStrength * lightcolor;"
-                    "    vec3 lightdir = normalize(lightPos - f_position);"
-                    "    float diff = max(dot(norm, lightdir), 0.0);"
-                    "    vec3 diffuse = diff * lightcolor;"
-                    "    vec3 viewdir = normalize(viewPos - f_position);"
-                    "    vec3 reflectdir = reflect(-lightdir, norm);"
-                    "    float spec = pow(max(dot(viewdir,reflectdir), 0.0), 30);"
-                    "    vec3 specular = specularStrength * spec * lightcolor;"
-                    "    vec3 result = (ambient + diffuse + specular) * f_color;"
-                    "    if(if_uni_color)"
-                    "       outColor = vec4(uni_color, 1.0);"
-                    "    else"
-                    "       outColor = vec4(result, 1.0);"
-                    "}";
-
-    // Compile the two shaders and upload the binary to the GPU
+    // The sources are read from the shaders folder next to the executable.
+    // They hold every shading mode, each variant is compiled with the
+    // #define lines of its features (see ShaderLibrary.h)
+    std::string shader_dir = ExecutableDir + "shaders/";
+    if(!Shaders.load(shader_dir + "scene.vert",shader_dir + "scene.frag","outColor")){
+        if(window)
+            glfwTerminate();
+        else
+            Headless.free();
+        return -1;
+    }
+
+    // Compile the shader variants and upload the binaries to the GPU
     // Note that we have to explicitly specify that the output "slot" called outColor
     // is the one that we want in the fragment buffer (and thus on screen)
-    program.init(vertex_shader,fragment_shader,"outColor");
-    program.bind();
+    // Linked binaries are cached next to the executable, later launches
+    // skip the compilation
+    // Without multi-draw indirect the object index comes from the draw slots
+    set_program_cache_dir(ExecutableDir + "shader_cache");
+    unsigned int instanced = Drawer.MultiDraw ? 0 : SHADER_INSTANCED;
+    UNLIT_SHADER = Shaders.variant(SHADER_UNLIT | instanced);
+    WIREFRAME_SHADER = Shaders.variant(SHADER_WIREFRAME | instanced);
+    FLAT_SHADER = Shaders.variant(SHADER_FLAT | instanced);
+    PHONG_SHADER = Shaders.variant(SHADER_PHONG | instanced);
+    PICKING_SHADER = Shaders.variant(SHADER_PICKING | instanced);
+    FEATURE_UNLIT_SHADER = Shaders.variant(SHADER_UNLIT | SHADER_FEATURE_EDGES | instanced);
+    FEATURE_WIREFRAME_SHADER = Shaders.variant(SHADER_WIREFRAME | SHADER_FEATURE_EDGES | instanced);
+    FEATURE_PHONG_SHADER = Shaders.variant(SHADER_PHONG | SHADER_FEATURE_EDGES | instanced);
+    set_sampler_units();
+
+    // Edited shaders are recompiled in the background, the current
+    // programs stay in use until all the new variants link. Headless runs
+    // keep the shaders they started with.
+    if(window){
+        ShaderWatcher.add(Shaders.VertexPath);
+        ShaderWatcher.add(Shaders.FragmentPath);
+    }
+    if(shader_context)
+        Shaders.start_worker(shader_context);
 
     // The vertex shader wants the position of the vertices as an input.
-    // The following line connects the VBO we defined above with the position "slot"
-    // in the vertex shader
-    program.bindVertexAttribArray("position",VBO);
-    program.bindVertexAttribArray("color",CBO);
-    program.bindVertexAttribArray("normal",NBO);
+    // The following lines connect the VBOs we defined above with the
+    // attribute locations every variant shares
+    VAO.bind();
+    bindVertexAttribArray(ATTRIB_POSITION,VBO);
+    bindVertexAttribArray(ATTRIB_COLOR,CBO);
+    bindVertexAttribArray(ATTRIB_NORMAL,NBO);
+    // no occlusion buffer, every vertex reads the current value
+    glVertexAttrib1f(ATTRIB_OCCLUSION,1.0f);
+    if(Drawer.MultiDraw)
+        bindVertexAttribIArray(ATTRIB_OBJECT_ID,Drawer.DrawIdBuffer,1);
 
     // Save the current time --- it will be used to dynamically change the triangle color
     auto t_start = std::chrono::high_resolution_clock::now();
 
-    // Register the keyboard callback
-    glfwSetKeyCallback(window, key_callback);
+    if(window){
+        // Register the keyboard callback
+        glfwSetKeyCallback(window, key_callback);
 
-    // Register the mouse callback
-    glfwSetMouseButtonCallback(window, mouse_button_callback);
+        // Register the mouse callback
+        glfwSetMouseButtonCallback(window, mouse_button_callback);
+
+        // Update viewport
+        glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
+    }
 
-    // Update viewport
-    glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
+    // A headless run renders the frames of its script (--frames wins), one without a script
+    int frame_count = HEADLESS.Frames >= 0 ? HEADLESS.Frames : script.Frames >= 0 ? script.Frames : 1;
+    std::vector<FrameTiming> timings;
+    std::vector<unsigned char> pixels;
+    bool timer_queries = GLEW_VERSION_3_3 || GLEW_ARB_timer_query;
+    GLuint frame_query = 0;
+    if(!window && timer_queries)
+        glGenQueries(1, &frame_query);
+    if(!window && !HEADLESS.OutputDir.empty())
+        mkdir(HEADLESS.OutputDir.c_str(), 0755);
+
+#ifdef ENABLE_PROFILER
+    PROFILER.init(!HEADLESS.TracePath.empty());
+#else
+    if(!HEADLESS.TracePath.empty())
+        std::cerr << "--trace needs a build with ENABLE_PROFILER" << std::endl;
+#endif
 
     // Loop until the user closes the window
-    while (!glfwWindowShouldClose(window))
+    for(int frame = 0;window ? !glfwWindowShouldClose(window) : frame < frame_count;frame++)
     {
-        // Bind your VAO (not necessary if you have only one)
-        VAO.bind();
+        // Scripted edits and camera path of this frame
+        auto frame_start = std::chrono::high_resolution_clock::now();
+        reset_render_stats();
+        if(!window){
+            for(int c = 0;c < script.Commands.size();c++){
+                if(script.Commands[c].Frame == frame && !run_script_command(script.Commands[c])){
+                    Headless.free();
+                    return -1;
+                }
+            }
+            script.camera_at(frame, CamaraPosition);
+            if(BENCHMARK_RUN)
+                CamaraPosition = bench_camera(std::max(frame - BENCH.Warmup, 0), BENCH.Frames, BENCH.Orbit);
+            frame_start = std::chrono::high_resolution_clock::now();
+            if(frame_query)
+                glBeginQuery(GL_TIME_ELAPSED, frame_query);
+        }
+        PROFILE_FRAME_BEGIN();
 
-        // Bind your program
-        program.bind();
+        // Pick up the shaders edited since the last frame
+        {
+            PROFILE_SCOPE("shader reload");
+            if(ShaderWatcher.poll())
+                Shaders.reload();
+            if(Shaders.update())
+                set_sampler_units();
+        }
+
+        // Hand the objects changed since the last autosave to its thread
+        {
+            PROFILE_SCOPE("autosave");
+            Autosave.update(ObjectList,OBJECT_SELECTED);
+        }
 
         // Clear the framebuffer
-        glClearColor(0.5f, 0.5f, 0.5f, 1.0f);
-        glClearStencil(-1);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+        {
+            PROFILE_SCOPE("clear");
+            glClearColor(0.5f, 0.5f, 0.5f, 1.0f);
+            glClearStencil(-1);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
 
-        glEnable(GL_DEPTH_TEST);
-        glEnable(GL_STENCIL_TEST);
-        glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
-        
-        VBO.update(V);
-        CBO.update(C);
-        NBO.update(N_f);
-        glm::vec3 light_pos = glm::vec3(ObjectList[0].get_model_matrix() * glm::vec4(ObjectList[0].BaryCenter,1.0));
-        glUniform3f(program.uniform("lightPos"),light_pos.x,light_pos.y,light_pos.z);
-        glUniform3f(program.uniform("lightcolor"),1.0f,1.0f,1.0f);
+            glEnable(GL_DEPTH_TEST);
+        }
+
+        // Upload the meshes loaded since the last frame
+        {
+            PROFILE_SCOPE("upload meshes");
+            for(int m = 0;m < mesh_count();m++){
+                if(!get_mesh(m).Uploaded)
+                    get_mesh(m).upload(Drawer.DrawIdBuffer,Drawer.MultiDraw);
+            }
+        }
+
+        Lights[0].Position = glm::vec3(ObjectList[0].get_model_matrix() * glm::vec4(ObjectList[0].BaryCenter,1.0));
 
         // View Matrix
         View = glm::lookAt(CamaraPosition,glm::vec3(0,0,0),CamaraUp);
-        glUniformMatrix4fv(program.uniform("view"),1,GL_FALSE,glm::value_ptr(View));
-        glUniform3f(program.uniform("viewPos"),CamaraPosition.x,CamaraPosition.y,CamaraPosition.z);
 
         // Perspective Matrix
         int width,height;
-        glfwGetWindowSize(window, &width, &height);
+        get_window_size(window, &width, &height);
         float ratio = 1.0f*width/height;
         if(IF_PERSPECTIVE)
             Perspective = glm::perspective(glm::radians(70.0f),ratio,0.1f,100.0f);
         else
             Perspective = glm::ortho(-1.0f*ratio,1.0f*ratio,-1.0f,1.0f,0.1f,100.0f);
-        glUniformMatrix4fv(program.uniform("perspective"),1,GL_FALSE,glm::value_ptr(Perspective));
 
-        // Axis Display
-        glUniformMatrix4fv(program.uniform("model"),1,GL_FALSE,glm::value_ptr(UnitMatrix));
-        glUniform1i(program.uniform("if_uni_color"),true);
-        glUniform3f(program.uniform("uni_color"),1.0f,0.0f,0.0f);
-        glDrawArrays(GL_LINES,0,2);
-        glUniform3f(program.uniform("uni_color"),0.0f,1.0f,0.0f);
-        glDrawArrays(GL_LINES,2,2);
-        glUniform3f(program.uniform("uni_color"),0.0f,0.0f,1.0f);
-        glDrawArrays(GL_LINES,4,2);
-        glUniform1i(program.uniform("if_uni_color"),false);
-
-        // Lightsource Display
-        glUniformMatrix4fv(program.uniform("model"),1,GL_FALSE,glm::value_ptr(ObjectList[0].get_model_matrix()));
-        glUniform1i(program.uniform("if_uni_color"),true);
-        if(OBJECT_SELECTED == 0)
-            glUniform3f(program.uniform("uni_color"),1.0f,1.0f,0.0f);
-        else
-            glUniform3f(program.uniform("uni_color"),1.0f,1.0f,1.0f);
-        for(int j = ObjectList[0].VBO_Pos;j < ObjectList[0].VBO_Pos + ObjectList[0].V.size();j+=3){
-            glStencilFunc(GL_ALWAYS, 0, -1);
-            glDrawArrays(GL_TRIANGLES, j, 3);
+        // Light lists of the clusters of this camera
+        {
+            PROFILE_SCOPE("light clusters");
+            auto build_start = std::chrono::high_resolution_clock::now();
+            Clusters.Near = 0.1f;
+            Clusters.Far = 100.0f;
+            Clusters.build(Lights,View,Perspective);
+            Clusters.upload(2);
+            benchmark_build_ms += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - build_start).count();
+            if(LIGHT_BENCHMARK && ++benchmark_frames == 100){
+                std::cout << "lights: " << Lights.size() << ", max per cluster: " << Clusters.MaxLightsPerCluster
+                          << ", cluster build: " << benchmark_build_ms / benchmark_frames << " ms" << std::endl;
+                benchmark_frames = 0;
+                benchmark_build_ms = 0;
+            }
         }
-        glUniform1i(program.uniform("if_uni_color"),false);
-        
-        // Object Display
-        for(int i = 1;i < ObjectList.size();i++){
-            glUniformMatrix4fv(program.uniform("model"),1,GL_FALSE,glm::value_ptr(ObjectList[i].get_model_matrix()));
-            if(ObjectList[i].Rmode == WIREFRAME){
-                if(OBJECT_SELECTED == i){
-                    glUniform1i(program.uniform("if_uni_color"),true);
-                    glUniform3f(program.uniform("uni_color"),1.0f,1.0f,0.0f);
+
+        glm::vec3 ambient = ambient_light();
+        int framebuffer_width,framebuffer_height;
+        get_framebuffer_size(window, &framebuffer_width, &framebuffer_height);
+
+        // Object Data: object i uses record i, the axis the next one, then
+        // the boxes of the occlusion queries
+        int axis_id = ObjectList.size();
+        {
+            PROFILE_SCOPE("render queue");
+            ObjectRecords.clear();
+            for(int i = 0;i < ObjectList.size();i++){
+                glm::vec4 color(0.0f,0.0f,0.0f,0.0f);
+                if(OBJECT_SELECTED == i)
+                    color = glm::vec4(1.0f,1.0f,0.0f,1.0f);
+                else if(i == 0)
+                    color = glm::vec4(1.0f,1.0f,1.0f,1.0f);
+                pack_object_record(ObjectRecords,ObjectList[i].get_model_matrix(),color);
+            }
+            pack_object_record(ObjectRecords,UnitMatrix,glm::vec4(0.0f,0.0f,0.0f,0.0f));
+
+            // Queue the objects, sorted by render state then front to back.
+            // The light and the selected object are drawn in their flat color,
+            // the edges over flat shaded faces in black.
+            unsigned int edge_unlit = FEATURE_EDGES_ONLY ? FEATURE_UNLIT_SHADER : UNLIT_SHADER;
+            unsigned int edge_phong = FEATURE_EDGES_ONLY ? FEATURE_PHONG_SHADER : PHONG_SHADER;
+            unsigned int edge_overlay = FEATURE_EDGES_ONLY ? FEATURE_WIREFRAME_SHADER : WIREFRAME_SHADER;
+            Queue.clear();
+            for(int i = 0;i < ObjectList.size();i++){
+                glm::vec3 center = glm::vec3(ObjectList[i].get_model_matrix() * glm::vec4(ObjectList[i].BaryCenter,1.0));
+                float depth = glm::length(center - CamaraPosition);
+                unsigned int mesh = ObjectList[i].MeshId;
+                bool unlit = i == 0 || i == OBJECT_SELECTED;
+                if(i == 0)
+                    Queue.push(make_sort_key(PASS_OPAQUE,UNLIT_SHADER,MODE_UNLIT,mesh,depth),i);
+                else if(ObjectList[i].Rmode == WIREFRAME)
+                    Queue.push(make_sort_key(PASS_EDGES,unlit ? edge_unlit : edge_phong,WIREFRAME,mesh,depth),i);
+                else if(ObjectList[i].Rmode == FLAT){
+                    Queue.push(make_sort_key(PASS_OPAQUE,unlit ? UNLIT_SHADER : FLAT_SHADER,FLAT,mesh,depth),i);
+                    Queue.push(make_sort_key(PASS_EDGES,edge_overlay,FLAT,mesh,depth),i);
                 }
-                for(int j = ObjectList[i].VBO_Pos;j < ObjectList[i].VBO_Pos + ObjectList[i].V.size();j+=3){
-                    glStencilFunc(GL_ALWAYS, i, -1);
-                    glDrawArrays(GL_LINE_LOOP, j, 3);
+                else if(ObjectList[i].Rmode == PHONG)
+                    Queue.push(make_sort_key(PASS_OPAQUE,unlit ? UNLIT_SHADER : PHONG_SHADER,PHONG,mesh,depth),i);
+            }
+            Queue.sort();
+
+            select_levels_of_detail(framebuffer_height);
+
+            // Occluders: the objects with faces largest on screen, at the
+            // coarsest level within a pixel of the occlusion buffer, the
+            // margin its rasterization keeps. Every object is then tested
+            // with its bounding sphere, the occluders too.
+            ObjectVisible.assign(ObjectList.size(),1);
+            if(OCCLUSION_CULLING){
+                PROFILE_SCOPE("occlusion culling");
+                Occlusion.begin(framebuffer_width,framebuffer_height,Perspective * View,&Workers);
+                ObjectSpheres.resize(ObjectList.size());
+                OccluderCandidates.clear();
+                for(int i = 0;i < ObjectList.size();i++){
+                    glm::vec3 center;
+                    float radius;
+                    ObjectList[i].get_bounding_sphere(center,radius);
+                    ObjectSpheres[i] = glm::vec4(center,radius);
+                    if(i != 0 && ObjectList[i].Rmode == WIREFRAME)
+                        continue;
+                    float screen_radius = radius * 0.5f * Occlusion.Height;
+                    if(IF_PERSPECTIVE){
+                        float distance = glm::length(center - CamaraPosition);
+                        screen_radius = distance > radius ? screen_radius / (distance * tan(glm::radians(35.0f))) : 1e9f;
+                    }
+                    OccluderCandidates.push_back(std::make_pair(screen_radius,i));
                 }
-                glUniform1i(program.uniform("if_uni_color"),false);
+                std::sort(OccluderCandidates.begin(),OccluderCandidates.end(),std::greater<std::pair<float,int> >());
+                unsigned int triangles = 0;
+                for(int o = 0;o < OccluderCandidates.size();o++){
+                    MeshObject& obj = ObjectList[OccluderCandidates[o].second];
+                    const Mesh& mesh = obj.mesh();
+                    int level = mesh.Radius > 0 ? mesh.select_lod(OccluderCandidates[o].first / mesh.Radius,mesh.Lods.size() - 1) : 0;
+                    const MeshLod& lod = mesh.Lods[level];
+                    triangles += lod.Count / 3;
+                    if(triangles > OCCLUDER_TRIANGLES)
+                        break;
+                    const std::vector<unsigned int>& indices = level == 0 ? mesh.F : mesh.LodIndices;
+                    unsigned int offset = level == 0 ? 0 : mesh.F.size();
+                    Occluder occluder = {obj.get_model_matrix(),&mesh.V,&indices,lod.First - offset,lod.Count};
+                    Occlusion.add_occluder(occluder);
+                }
+                Occlusion.rasterize();
+                Occlusion.test(ObjectSpheres,ObjectVisible);
             }
 
-            else if(ObjectList[i].Rmode == FLAT){
-                NBO.update(N_f);
-                // draw fragments
-                if(OBJECT_SELECTED == i){
-                    glUniform1i(program.uniform("if_uni_color"),true);
-                    glUniform3f(program.uniform("uni_color"),1.0f,1.0f,0.0f);
+            // Occlusion queries of the drawn objects with enough triangles
+            // at their level. A box cut by the near plane (0.1) would hide
+            // an object around the camera, those are drawn unconditionally.
+            // The boxes use the object records after the axis.
+            QueryObjects.assign(ObjectList.size(),0);
+            QueryTests.clear();
+            if(OCCLUSION_QUERIES){
+                Queries.resize(ObjectList.size());
+                Queries.update();
+                for(int i = 1;i < ObjectList.size();i++){
+                    MeshObject& obj = ObjectList[i];
+                    if(!ObjectVisible[i] || obj.Rmode == WIREFRAME || obj.mesh().Lods[obj.Lod].Count / 3 < QUERY_MIN_TRIANGLES){
+                        Queries.forget(i);
+                        continue;
+                    }
+                    glm::vec3 center;
+                    float radius;
+                    obj.get_bounding_sphere(center,radius);
+                    float view_depth = (View * glm::vec4(center,1.0f)).z;
+                    if(view_depth + radius * 1.733f > -0.1f){
+                        Queries.forget(i);
+                        continue;
+                    }
+                    QueryObjects[i] = 1;
+                    if(Queries.due(i)){
+                        QueryTests.push_back(i);
+                        glm::mat4 box = glm::scale(glm::translate(UnitMatrix,center),glm::vec3(radius));
+                        pack_object_record(ObjectRecords,box,glm::vec4(0.0f,0.0f,0.0f,0.0f));
+                    }
                 }
-                for(int j = ObjectList[i].VBO_Pos;j < ObjectList[i].VBO_Pos + ObjectList[i].V.size();j+=3){
-                    glStencilFunc(GL_ALWAYS, i, -1);
-                    glDrawArrays(GL_TRIANGLES, j, 3);
+            }
+
+            // Cut the queue where the render state or the mesh changes.
+            // Edges are lines over the mesh vertices, or over the feature
+            // edge vertices for the FEATURE_EDGES variants.
+            // A queried object is a batch of its own, between the
+            // conditional render calls.
+            Batches.clear();
+            BatchKeys.clear();
+            BatchMeshes.clear();
+            BatchQueries.clear();
+            for(int k = 0;k < Queue.Items.size();k++){
+                if(!ObjectVisible[Queue.Items[k].Object])
+                    continue;
+                uint64_t key = Queue.Items[k].Key;
+                bool edges = key_pass(key) == PASS_EDGES;
+                int query = QueryObjects[Queue.Items[k].Object] ? Queue.Items[k].Object : -1;
+                MeshObject& obj = ObjectList[Queue.Items[k].Object];
+                if(BatchKeys.empty() || key_batch(BatchKeys.back()) != key_batch(key) || BatchMeshes.back() != obj.MeshId ||
+                   query >= 0 || BatchQueries.back() >= 0){
+                    Batches.push_back(DrawBatch(edges ? GL_LINES : GL_TRIANGLES));
+                    BatchKeys.push_back(key);
+                    BatchMeshes.push_back(obj.MeshId);
+                    BatchQueries.push_back(query);
                 }
-                glUniform1i(program.uniform("if_uni_color"),false);
-                // pass a uniform color to draw wireframe
-                glUniform1i(program.uniform("if_uni_color"),true);
-                glUniform3f(program.uniform("uni_color"),0.0f,0.0f,0.0f);
-                for(int j = ObjectList[i].VBO_Pos;j < ObjectList[i].VBO_Pos + ObjectList[i].V.size();j+=3){
-                    glStencilFunc(GL_ALWAYS, i, -1);
-                    glDrawArrays(GL_LINE_LOOP, j, 3);
+                const MeshLod& lod = obj.mesh().Lods[obj.Lod];
+                if(!edges && MESHLET_CULLING && obj.Lod == 0){
+                    // the surviving meshlets, neighbours in F drawn as one range
+                    const Mesh& mesh = obj.mesh();
+                    MeshletView view;
+                    view.init(obj.get_model_matrix(),View,Perspective,IF_PERSPECTIVE);
+                    VisibleMeshlets.clear();
+                    cull_meshlets(mesh.Bounds,mesh.Meshlets.size(),view,VisibleMeshlets);
+                    for(int m = 0;m < VisibleMeshlets.size();){
+                        const Meshlet& run = mesh.Meshlets[VisibleMeshlets[m]];
+                        unsigned int count = run.Count;
+                        for(m++;m < VisibleMeshlets.size() && mesh.Meshlets[VisibleMeshlets[m]].First == run.First + count;m++)
+                            count += mesh.Meshlets[VisibleMeshlets[m]].Count;
+                        Batches.back().add(run.First,count,Queue.Items[k].Object);
+                    }
                 }
-                glUniform1i(program.uniform("if_uni_color"),false);
+                else if(!edges)
+                    Batches.back().add(lod.First,lod.Count,Queue.Items[k].Object);
+                else
+                    Batches.back().add(FEATURE_EDGES_ONLY ? lod.FeatureFirst : lod.EdgeFirst,lod.EdgeCount,Queue.Items[k].Object);
             }
+            ObjectData.update(ObjectRecords);
+            ObjectData.bind(0);
+            Drawer.begin(ObjectList.size() + 1 + QueryTests.size());
+            for(int b = 0;b < Batches.size();b++)
+                Drawer.append(Batches[b]);
+            Drawer.upload(1);
+        }
 
-            else if(ObjectList[i].Rmode == PHONG){
-                NBO.update(N_v);
-                if(OBJECT_SELECTED == i){
-                    glUniform1i(program.uniform("if_uni_color"),true);
-                    glUniform3f(program.uniform("uni_color"),1.0f,1.0f,0.0f);
+        // Shadows of the light cube: only the faces where a caster or the
+        // light moved are drawn again, with the position only variant
+        Shadow.set_light(Lights[0].Position);
+        bool shadow_dirty = false;
+        for(int i = 1;i < ObjectList.size();i++){
+            glm::vec3 center;
+            float radius;
+            ObjectList[i].get_bounding_sphere(center,radius);
+            Shadow.update_caster(i,ObjectList[i].get_model_matrix(),center,radius);
+        }
+        for(int f = 0;f < 6;f++)
+            shadow_dirty = shadow_dirty || Shadow.Dirty[f];
+        if(shadow_dirty){
+            PROFILE_SCOPE("shadow map");
+            Shadow.begin();
+            use_shader(PICKING_SHADER);
+            Program& depth_program = Shaders.program(PICKING_SHADER);
+            glUniformMatrix4fv(depth_program.uniform("view"),1,GL_FALSE,glm::value_ptr(UnitMatrix));
+            glEnable(GL_POLYGON_OFFSET_FILL);
+            glPolygonOffset(1.1f,4.0f);
+            for(int f = 0;f < 6;f++){
+                if(!Shadow.Dirty[f])
+                    continue;
+                Shadow.begin_face(f);
+                glUniformMatrix4fv(depth_program.uniform("perspective"),1,GL_FALSE,glm::value_ptr(Shadow.face_matrix(f)));
+                for(int i = 1;i < ObjectList.size();i++){
+                    glm::vec4 sphere = Shadow.CasterSpheres[i];
+                    if(!Shadow.face_sees(f,glm::vec3(sphere),sphere.w))
+                        continue;
+                    ObjectList[i].mesh().VAO.bind();
+                    Drawer.draw_object(GL_TRIANGLES,0,ObjectList[i].mesh().F.size(),i);
                 }
-                for(int j = ObjectList[i].VBO_Pos;j < ObjectList[i].VBO_Pos + ObjectList[i].V.size();j+=3){
-                    glStencilFunc(GL_ALWAYS, i, -1);
-                    glDrawArrays(GL_TRIANGLES, j, 3);
+            }
+            glDisable(GL_POLYGON_OFFSET_FILL);
+            Shadow.end();
+        }
+        Shadow.bind(5);
+        glm::vec2 shadow_depth = Shadow.depth_scale();
+
+        // Frame uniforms, the variants that do not use one ignore it
+        for(int v = 0;v < Shaders.Programs.size();v++){
+            Program& program = Shaders.program(v);
+            program.bind();
+            glUniform3f(program.uniform("ambient"),ambient.x,ambient.y,ambient.z);
+            glUniformMatrix4fv(program.uniform("view"),1,GL_FALSE,glm::value_ptr(View));
+            glUniform3f(program.uniform("viewPos"),CamaraPosition.x,CamaraPosition.y,CamaraPosition.z);
+            glUniformMatrix4fv(program.uniform("perspective"),1,GL_FALSE,glm::value_ptr(Perspective));
+            glUniform3i(program.uniform("cluster_grid"),Clusters.GridX,Clusters.GridY,Clusters.GridZ);
+            glUniform2f(program.uniform("cluster_tile"),float(framebuffer_width)/Clusters.GridX,float(framebuffer_height)/Clusters.GridY);
+            glUniform1f(program.uniform("cluster_scale"),Clusters.slice_scale());
+            glUniform1f(program.uniform("cluster_bias"),Clusters.slice_bias());
+            glUniform2f(program.uniform("shadow_depth"),shadow_depth.x,shadow_depth.y);
+            glUniform1f(program.uniform("shadow_texel"),2.0f/Shadow.Size);
+            glUniform1i(program.uniform("shadow_pcf"),SHADOW_PCF);
+        }
+
+
+        // Axis Display
+        {
+            PROFILE_SCOPE("axis");
+            VAO.bind();
+            use_shader(WIREFRAME_SHADER);
+            GLint uni_color = Shaders.program(WIREFRAME_SHADER).uniform("uni_color");
+            glUniform3f(uni_color,1.0f,0.0f,0.0f);
+            Drawer.draw_arrays_object(GL_LINES,0,2,axis_id);
+            glUniform3f(uni_color,0.0f,1.0f,0.0f);
+            Drawer.draw_arrays_object(GL_LINES,2,2,axis_id);
+            glUniform3f(uni_color,0.0f,0.0f,1.0f);
+            Drawer.draw_arrays_object(GL_LINES,4,2,axis_id);
+            glUniform3f(uni_color,0.0f,0.0f,0.0f);
+        }
+
+        // Lightsource and Object Display, one profiler scope per render state
+        for(int first = 0, b = 0;first < Batches.size();first = b){
+            PROFILE_SCOPE(pass_scope_name(BatchKeys[first]));
+            for(b = first;b < Batches.size() && key_state(BatchKeys[b]) == key_state(BatchKeys[first]);b++){
+                apply_render_state(b == 0,b == 0 ? 0 : BatchKeys[b-1],BatchKeys[b]);
+                if(b == 0 || BatchMeshes[b-1] != BatchMeshes[b])
+                    get_mesh(BatchMeshes[b]).VAO.bind();
+                if(BatchQueries[b] >= 0 && Queries.conditional(BatchQueries[b])){
+                    Queries.begin_conditional(BatchQueries[b]);
+                    Drawer.draw(Batches[b]);
+                    Queries.end_conditional();
                 }
-                glUniform1i(program.uniform("if_uni_color"),false);
+                else
+                    Drawer.draw(Batches[b]);
             }
         }
 
+        // Occlusion queries: the boxes against the depth of the scene,
+        // changing neither color nor depth
+        if(!QueryTests.empty()){
+            PROFILE_SCOPE("occlusion queries");
+            VAO.bind();
+            use_shader(PICKING_SHADER);
+            glColorMask(GL_FALSE,GL_FALSE,GL_FALSE,GL_FALSE);
+            glDepthMask(GL_FALSE);
+            for(int t = 0;t < QueryTests.size();t++){
+                Queries.begin(QueryTests[t]);
+                Drawer.draw_arrays_object(GL_TRIANGLES,6,36,axis_id + 1 + t);
+                Queries.end();
+            }
+            glDepthMask(GL_TRUE);
+            glColorMask(GL_TRUE,GL_TRUE,GL_TRUE,GL_TRUE);
+        }
+
+        // Object Picking: batched draws share one stencil reference, so a click
+        // redraws the scene once into depth and stencil with the object indices
+        if(PICK_PENDING){
+            PROFILE_SCOPE("picking");
+            glColorMask(GL_FALSE,GL_FALSE,GL_FALSE,GL_FALSE);
+            glClear(GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+            glEnable(GL_STENCIL_TEST);
+            glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
+            use_shader(PICKING_SHADER);
+            for(int i = 0;i < ObjectList.size();i++){
+                glStencilFunc(GL_ALWAYS, i, -1);
+                const MeshLod& full = ObjectList[i].mesh().Lods[0];
+                ObjectList[i].mesh().VAO.bind();
+                if(i > 0 && ObjectList[i].Rmode == WIREFRAME)
+                    Drawer.draw_object(GL_LINES,full.EdgeFirst,full.EdgeCount,i);
+                else
+                    Drawer.draw_object(GL_TRIANGLES,full.First,full.Count,i);
+            }
+            glReadPixels(PICK_X, PICK_Y, 1, 1, GL_STENCIL_INDEX, GL_UNSIGNED_INT, &OBJECT_SELECTED);
+            std::cout << "selected:" << OBJECT_SELECTED << std::endl;
+            glDisable(GL_STENCIL_TEST);
+            glColorMask(GL_TRUE,GL_TRUE,GL_TRUE,GL_TRUE);
+            PICK_PENDING = false;
+        }
+
         // Swap front and back buffers
-        glfwSwapBuffers(window);
+        if(window){
+            PROFILE_SCOPE("swap");
+            glfwSwapBuffers(window);
+        }
+        PROFILE_FRAME_END();
+
+        if(!window){
+            // The GPU time waits for the frame, the CPU time is the submission
+            FrameTiming timing;
+            timing.Frame = frame;
+            timing.CpuMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - frame_start).count();
+            timing.GpuMs = -1;
+            if(frame_query){
+                glEndQuery(GL_TIME_ELAPSED);
+                GLuint64 elapsed;
+                glGetQueryObjectui64v(frame_query, GL_QUERY_RESULT, &elapsed);
+                timing.GpuMs = elapsed / 1e6;
+            }
+            glFinish();
+            timing.FrameMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - frame_start).count();
+            timing.Work = render_stats();
+            timings.push_back(timing);
+
+            if(!HEADLESS.OutputDir.empty()){
+                char name[32];
+                snprintf(name, sizeof(name), "frame_%04d.%s", frame, HEADLESS.ImageFormat.c_str());
+                std::string path = HEADLESS.OutputDir + "/" + name;
+                Headless.read_pixels(pixels);
+                bool written = HEADLESS.ImageFormat == "png" ? write_png(path, Headless.Width, Headless.Height, pixels)
+                                                             : write_ppm(path, Headless.Width, Headless.Height, pixels);
+                if(!written)
+                    std::cerr << "Cannot write " << path << std::endl;
+            }
+            continue;
+        }
 
         // Poll for and process events
         glfwPollEvents();
     }
 
+    if(!HEADLESS.TimingsPath.empty()){
+        if(!write_timings_json(HEADLESS.TimingsPath, timings, Headless.Width, Headless.Height, (const char*)glGetString(GL_RENDERER)))
+            std::cerr << "Cannot write " << HEADLESS.TimingsPath << std::endl;
+    }
+    if(BENCHMARK_RUN){
+        std::vector<FrameTiming> measured(timings.begin() + std::min(BENCH.Warmup, int(timings.size())), timings.end());
+        write_bench_results(BENCH, measured, (const char*)glGetString(GL_RENDERER));
+    }
+    if(frame_query)
+        glDeleteQueries(1, &frame_query);
+
+#ifdef ENABLE_PROFILER
+    PROFILER.free();
+    if(!HEADLESS.TracePath.empty() && !PROFILER.write_trace(HEADLESS.TracePath))
+        std::cerr << "Cannot write " << HEADLESS.TracePath << std::endl;
+#endif
+
     // Deallocate opengl memory
-    program.free();
+    Shaders.free();
+    ShaderWatcher.free();
+    if(shader_context)
+        glfwDestroyWindow(shader_context);
     VAO.free();
     VBO.free();
     CBO.free();
+    NBO.free();
+    free_meshes();
+    ObjectData.free();
+    Drawer.free();
+    Clusters.free();
+    Shadow.free();
+    Autosave.free(ObjectList,OBJECT_SELECTED);
+    Workers.free();
+    Queries.free();
 
     // Deallocate glfw internals
-    glfwTerminate();
+    if(window)
+        glfwTerminate();
+    else
+        Headless.free();
     return 0;
 }